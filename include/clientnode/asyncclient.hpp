@@ -0,0 +1,392 @@
+// asyncclient.hpp
+
+/*
+ *   nuke-ms - Nuclear Messaging System
+ *   Copyright (C) 2012  Alexander Korsunsky
+ *
+ *   This program is free software: you can redistribute it and/or modify
+ *   it under the terms of the GNU General Public License as published by
+ *   the Free Software Foundation, version 3 of the License.
+ *
+ *   This program is distributed in the hope that it will be useful,
+ *   but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *   MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ *   GNU General Public License for more details.
+ *
+ *   You should have received a copy of the GNU General Public License
+ *   along with this program.  If not, see <http://www.gnu.org/licenses/>.
+*/
+
+/** @file clientnode/asyncclient.hpp
+* @brief Client connection with an asynchronous interface in Boost.Asio style.
+* @ingroup clientnode
+*
+* @author Alexander Korsunsky
+*/
+
+#ifndef ASYNCCLIENT_HPP
+#define ASYNCCLIENT_HPP
+
+#include <memory>
+#include <array>
+
+#include <boost/asio/async_result.hpp>
+#include <boost/asio/compose.hpp>
+#include <boost/asio/connect.hpp>
+#include <boost/asio/io_service.hpp>
+#include <boost/asio/read.hpp>
+#include <boost/asio/write.hpp>
+#include <boost/asio/ip/tcp.hpp>
+
+#include "bytes.hpp"
+#include "handleralloc.hpp"
+#include "msglayer.hpp"
+#include "neartypes.hpp"
+
+namespace nuke_ms
+{
+
+
+/** @addtogroup clientnode Communication Protocol
+ * @{
+*/
+
+
+namespace clientnode
+{
+
+/** Client connection with an asynchronous interface in Boost.Asio style.
+ *
+ * In contrast to ClientNode, this class has no thread and no signals of its
+ * own. All operations run on the io_service passed to the constructor and
+ * take a completion token as last argument, like the asynchronous operations
+ * of Boost.Asio. The token can be a callback, boost::asio::use_future or,
+ * if the compiler supports C++20 coroutines, boost::asio::use_awaitable:
+ *
+ * @code
+ * boost::asio::awaitable<void> session(AsyncClient& client)
+ * {
+ *     using boost::asio::use_awaitable;
+ *
+ *     co_await client.asyncConnect("localhost", "34443", use_awaitable);
+ *     co_await client.asyncSend(NearUserMessage{"Hello"}, use_awaitable);
+ *
+ *     std::shared_ptr<NearUserMessage> msg =
+ *         co_await client.asyncReceive(use_awaitable);
+ * }
+ * @endcode
+ *
+ * Like a socket, the object may only have one send operation and one
+ * receive operation pending at a time. ClientNode offers the same operations
+ * together with its signals, reconnects and other kinds of connections;
+ * AsyncClient is the lightweight alternative for a single TCP connection.
+ *
+ * The intermediate operations of sending and of receiving each recycle one
+ * HandlerMemory block of the connection, so reading the header and the
+ * body of a packet does not allocate memory for the handlers.
+*/
+class AsyncClient
+{
+public:
+    /** Type of the socket */
+    typedef boost::asio::ip::tcp::socket socket_type;
+
+    /** Type of the buffer for a segmentation header */
+    typedef std::array<byte_traits::byte_t, SegmentationLayerBase::header_length>
+        header_buffer_type;
+
+    /** Constructor.
+    * @param io_service The io_service to run all operations on
+    */
+    explicit AsyncClient(boost::asio::io_service& io_service);
+
+    /** Get the underlying socket */
+    socket_type& socket()
+    { return sock; }
+
+    /** Close the connection. Pending operations are aborted. */
+    void close();
+
+    /** Resolve a host and connect to it.
+    *
+    * @param host Host name or address of the server
+    * @param service Port or service name of the server
+    * @param token Completion token with the signature
+    * void(boost::system::error_code)
+    */
+    template <typename CompletionToken>
+    BOOST_ASIO_INITFN_RESULT_TYPE(CompletionToken,
+        void (boost::system::error_code))
+    asyncConnect(
+        const byte_traits::native_string& host,
+        const byte_traits::native_string& service,
+        CompletionToken&& token
+    );
+
+    /** Send a message to the server.
+    *
+    * @param msg The message to be sent
+    * @param token Completion token with the signature
+    * void(boost::system::error_code)
+    */
+    template <typename CompletionToken>
+    BOOST_ASIO_INITFN_RESULT_TYPE(CompletionToken,
+        void (boost::system::error_code))
+    asyncSend(NearUserMessage&& msg, CompletionToken&& token);
+
+    /** Receive the next user message from the server.
+    * Packets that are not user messages are skipped.
+    *
+    * @param token Completion token with the signature
+    * void(boost::system::error_code, std::shared_ptr<NearUserMessage>)
+    */
+    template <typename CompletionToken>
+    BOOST_ASIO_INITFN_RESULT_TYPE(CompletionToken,
+        void (boost::system::error_code, std::shared_ptr<NearUserMessage>))
+    asyncReceive(CompletionToken&& token);
+
+private:
+    struct ConnectOp;
+    struct SendOp;
+    struct ReceiveOp;
+
+    /** Resolver used for connecting */
+    boost::asio::ip::tcp::resolver resolver;
+
+    /** Socket connected to the server */
+    socket_type sock;
+
+    /** Buffer for the segmentation header of the next received packet */
+    header_buffer_type header_buffer;
+
+    /** Recycled memory for the handlers of the read operations */
+    std::shared_ptr<HandlerMemory> read_handler_memory;
+
+    /** Recycled memory for the handlers of the write operations */
+    std::shared_ptr<HandlerMemory> write_handler_memory;
+};
+
+
+/** Composed operation for AsyncClient::asyncConnect(). */
+struct AsyncClient::ConnectOp
+{
+    AsyncClient& client;
+    byte_traits::native_string host;
+    byte_traits::native_string service;
+
+    // start resolving
+    template <typename Self>
+    void operator() (Self& self)
+    {
+        client.resolver.async_resolve(host, service, std::move(self));
+    }
+
+    // resolved, now connect
+    template <typename Self>
+    void operator() (
+        Self& self,
+        const boost::system::error_code& error,
+        boost::asio::ip::tcp::resolver::results_type results
+    )
+    {
+        if (error)
+            return self.complete(error);
+
+        boost::asio::async_connect(client.sock, results, std::move(self));
+    }
+
+    // connected
+    template <typename Self>
+    void operator() (
+        Self& self,
+        const boost::system::error_code& error,
+        const boost::asio::ip::tcp::endpoint& /* endpoint */
+    )
+    {
+        self.complete(error);
+    }
+};
+
+/** Composed operation for AsyncClient::asyncSend(). */
+struct AsyncClient::SendOp
+{
+    AsyncClient& client;
+    std::unique_ptr<byte_traits::byte_sequence> data;
+
+    // start writing
+    template <typename Self>
+    void operator() (Self& self)
+    {
+        boost::asio::mutable_buffer buffer = boost::asio::buffer(*data);
+        boost::asio::async_write(client.sock, buffer,
+            makeAllocHandler(client.write_handler_memory, std::move(self)));
+    }
+
+    // written
+    template <typename Self>
+    void operator() (
+        Self& self,
+        const boost::system::error_code& error,
+        std::size_t /* bytes_transferred */
+    )
+    {
+        // free the buffer before the handler runs
+        data.reset();
+        self.complete(error);
+    }
+};
+
+/** Composed operation for AsyncClient::asyncReceive(). */
+struct AsyncClient::ReceiveOp
+{
+    AsyncClient& client;
+    std::shared_ptr<byte_traits::byte_sequence> body;
+
+    // start reading the header
+    template <typename Self>
+    void operator() (Self& self)
+    {
+        body.reset();
+        boost::asio::async_read(
+            client.sock, boost::asio::buffer(client.header_buffer),
+            makeAllocHandler(client.read_handler_memory, std::move(self))
+        );
+    }
+
+    // header or body read
+    template <typename Self>
+    void operator() (
+        Self& self,
+        const boost::system::error_code& error,
+        std::size_t /* bytes_transferred */
+    )
+    {
+        if (error)
+            return self.complete(error, std::shared_ptr<NearUserMessage>{});
+
+        if (!body)
+            return readBody(self);
+
+        // skip everything that is not a user message
+        if (body->empty() || (*body)[0] !=
+            static_cast<byte_traits::byte_t>(NearUserMessage::LAYER_ID))
+        {
+            return (*this)(self);
+        }
+
+        std::shared_ptr<NearUserMessage> msg;
+        try
+        {
+            msg = std::make_shared<NearUserMessage>(
+                SerializedData{body, body->begin(), body->size()}
+            );
+        }
+        catch (const MsgLayerError&)
+        {
+            return self.complete(
+                boost::asio::error::make_error_code(
+                    boost::asio::error::invalid_argument
+                ),
+                std::shared_ptr<NearUserMessage>{}
+            );
+        }
+
+        self.complete(boost::system::error_code{}, std::move(msg));
+    }
+
+    /** Decode the header and start reading the body */
+    template <typename Self>
+    void readBody(Self& self)
+    {
+        SegmentationLayerBase::HeaderType header;
+        try
+        {
+            header = SegmentationLayerBase::decodeHeader(
+                client.header_buffer.begin()
+            );
+
+            // larger packets make asyncReceive() fail
+            if (header.packetsize > SegmentationLayerBase::max_packetsize)
+                throw MsgLayerError("Oversized packet.");
+
+            if (header.packetsize < SegmentationLayerBase::header_length)
+                throw UndersizedPacketError{};
+        }
+        catch (const MsgLayerError&)
+        {
+            return self.complete(
+                boost::asio::error::make_error_code(
+                    boost::asio::error::invalid_argument
+                ),
+                std::shared_ptr<NearUserMessage>{}
+            );
+        }
+
+        body = std::make_shared<byte_traits::byte_sequence>(
+            header.packetsize - SegmentationLayerBase::header_length
+        );
+
+        boost::asio::mutable_buffer buffer = boost::asio::buffer(*body);
+        boost::asio::async_read(client.sock, buffer,
+            makeAllocHandler(client.read_handler_memory, std::move(self)));
+    }
+};
+
+
+template <typename CompletionToken>
+BOOST_ASIO_INITFN_RESULT_TYPE(CompletionToken,
+    void (boost::system::error_code))
+AsyncClient::asyncConnect(
+    const byte_traits::native_string& host,
+    const byte_traits::native_string& service,
+    CompletionToken&& token
+)
+{
+    return boost::asio::async_compose<
+        CompletionToken, void (boost::system::error_code)
+    >(
+        ConnectOp{*this, host, service}, token, sock
+    );
+}
+
+template <typename CompletionToken>
+BOOST_ASIO_INITFN_RESULT_TYPE(CompletionToken,
+    void (boost::system::error_code))
+AsyncClient::asyncSend(NearUserMessage&& msg, CompletionToken&& token)
+{
+    SegmentationLayer<NearUserMessage> segm_layer{std::move(msg)};
+
+    std::unique_ptr<byte_traits::byte_sequence> data{
+        new byte_traits::byte_sequence(segm_layer.size())
+    };
+    segm_layer.fillSerialized(data->begin());
+
+    return boost::asio::async_compose<
+        CompletionToken, void (boost::system::error_code)
+    >(
+        SendOp{*this, std::move(data)}, token, sock
+    );
+}
+
+template <typename CompletionToken>
+BOOST_ASIO_INITFN_RESULT_TYPE(CompletionToken,
+    void (boost::system::error_code, std::shared_ptr<NearUserMessage>))
+AsyncClient::asyncReceive(CompletionToken&& token)
+{
+    return boost::asio::async_compose<
+        CompletionToken,
+        void (boost::system::error_code, std::shared_ptr<NearUserMessage>)
+    >(
+        ReceiveOp{*this, std::shared_ptr<byte_traits::byte_sequence>{}},
+        token, sock
+    );
+}
+
+} // namespace clientnode
+
+/**@}*/ // addtogroup clientnode
+
+} // namespace nuke_ms
+
+
+#endif // ifndef ASYNCCLIENT_HPP
@@ -35,15 +35,21 @@
 #ifndef CLIENTNODE_HPP_
 #define CLIENTNODE_HPP_
 
+#include <atomic>
+#include <future>
+#include <vector>
+
 #include <boost/asio.hpp>
 
 #include <boost/thread/thread.hpp>
 #include <boost/signals2/signal.hpp>
 
 #include "bytes.hpp"
+#include "completion.hpp"
 #include "neartypes.hpp"
 #include "clientnode/sigtypes.hpp"
 #include "clientnode/logstreams.hpp"
+#include "clientnode/reconnect.hpp"
 #include "clientnode/statemachine.hpp"
 
 
@@ -64,6 +70,12 @@ namespace nuke_ms
  * to create multiple instances of it without the possibility of interference
  * between them.
  *
+ * All member functions of ClientNode may be called from any thread. They only
+ * queue a command for the internal I/O thread and return immediately, the
+ * outcome is reported via the signals. The functions asyncConnect(),
+ * asyncSend() and asyncReceive() take a Boost.Asio completion token instead,
+ * see the documentation of ClientNode.
+ *
  * @{
 */
 
@@ -85,7 +97,29 @@ namespace clientnode
  * register callbacks use the functions connectRcvMessage(),
  * connectConnectionStatusReport() and connectSendReport().
  * You can then post connection/disconnection requests
- * (connectTo(), disconnect()) and send messages (sendUserMessage()).
+ * (connectTo(), disconnect()) and send messages (sendUserMessage(),
+ * sendUserMessages()).
+ *
+ * Instead of the signals, the outcome of connecting, sending and receiving
+ * can be waited for with asyncConnect(), asyncSend() and asyncReceive().
+ * Like the asynchronous operations of Boost.Asio, they take a completion
+ * token: a callback, boost::asio::use_future or, with a C++20 compiler,
+ * boost::asio::use_awaitable. The handler is invoked on its associated
+ * executor, e.g. the one of the coroutine, or on the I/O thread if it has
+ * none:
+ *
+ * @code
+ * boost::asio::awaitable<void> session(ClientNode& client)
+ * {
+ *     using boost::asio::use_awaitable;
+ *
+ *     co_await client.asyncConnect({"localhost 34443"}, use_awaitable);
+ *     co_await client.asyncSend("Hello", use_awaitable);
+ *
+ *     std::shared_ptr<NearUserMessage> msg =
+ *         co_await client.asyncReceive(use_awaitable);
+ * }
+ * @endcode
  *
 */
 class ClientNode
@@ -137,6 +171,31 @@ public:
      */
     void connectTo(const ServerLocation& where);
 
+    /** Connect to a remote site and wait for the outcome.
+     *
+     * Works like connectTo(), the connection status reports are issued as
+     * well.
+     *
+     * @param where The string representation of the address of the remote
+     * site
+     * @param token Completion token with the signature
+     * void(boost::system::error_code). The error is
+     * boost::asio::error::invalid_argument if the address could not be
+     * parsed, boost::asio::error::already_started or
+     * boost::asio::error::already_connected if the ClientNode is busy, and
+     * boost::asio::error::operation_aborted if disconnect() was called
+     * before the connection was established.
+     */
+    template <typename CompletionToken>
+    BOOST_ASIO_INITFN_RESULT_TYPE(CompletionToken,
+        void (boost::system::error_code))
+    asyncConnect(const ServerLocation& where, CompletionToken&& token)
+    {
+        return boost::asio::async_initiate<
+            CompletionToken, void (boost::system::error_code)
+        >(InitConnect{*this}, token, where);
+    }
+
 
     /** Send message to connected remote site.
      *
@@ -163,12 +222,256 @@ public:
     }
 
 
+    /** Send message to connected remote site and get notified via a future.
+     *
+     * Works like sendUserMessage(), but instead of issuing a SendReport
+     * signal, the returned future becomes ready when the message was
+     * written to the connection.
+     *
+     * @param msg The message you want to send
+     * @param recipient Recipient of the message
+     * @return A future holding the message identifier of the sent message.
+     * If the message could not be sent, the future holds a SendError
+     * describing the reason.
+     */
+    std::future<NearUserMessage::msg_id_t> sendUserMessageAsync(
+        byte_traits::msg_string&& msg,
+        const UniqueUserID& recipient = UniqueUserID{}
+    );
+
+    std::future<NearUserMessage::msg_id_t> sendUserMessageAsync(
+        const byte_traits::msg_string& msg,
+        const UniqueUserID& recipient = UniqueUserID{}
+    )
+    {
+        return sendUserMessageAsync(
+            std::move(byte_traits::msg_string{msg}), recipient
+        );
+    }
+
+    /** Send a message to the connected remote site and wait until it was
+     * written to the connection.
+     *
+     * Works like sendUserMessage(), but no SendReport signal is issued.
+     *
+     * @param msg The message you want to send
+     * @param recipient Recipient of the message
+     * @param token Completion token with the signature
+     * void(boost::system::error_code, NearUserMessage::msg_id_t). The error
+     * is boost::asio::error::not_connected if the ClientNode is not
+     * connected and boost::asio::error::connection_aborted if the
+     * connection failed.
+     */
+    template <typename CompletionToken>
+    BOOST_ASIO_INITFN_RESULT_TYPE(CompletionToken,
+        void (boost::system::error_code, NearUserMessage::msg_id_t))
+    asyncSend(
+        byte_traits::msg_string msg,
+        const UniqueUserID& recipient,
+        CompletionToken&& token
+    )
+    {
+        return boost::asio::async_initiate<
+            CompletionToken,
+            void (boost::system::error_code, NearUserMessage::msg_id_t)
+        >(InitSend{*this}, token, std::move(msg), recipient);
+    }
+
+    /** @overload Send a message to all clients connected to the server. */
+    template <typename CompletionToken>
+    BOOST_ASIO_INITFN_RESULT_TYPE(CompletionToken,
+        void (boost::system::error_code, NearUserMessage::msg_id_t))
+    asyncSend(byte_traits::msg_string msg, CompletionToken&& token)
+    {
+        return asyncSend(std::move(msg), UniqueUserID{},
+            std::forward<CompletionToken>(token));
+    }
+
+    /** Wait for the next message from the remote site.
+     *
+     * The rcvMessage signal is issued for all messages as well. Once this
+     * function was called, received messages are kept until they are
+     * asked for with another call, so none is missed between two calls.
+     * Only one receive may be pending at a time.
+     *
+     * @param token Completion token with the signature
+     * void(boost::system::error_code, std::shared_ptr<NearUserMessage>).
+     * The error is boost::asio::error::not_connected if the ClientNode is
+     * not connected and no messages are kept, or if the connection is lost
+     * while waiting.
+     */
+    template <typename CompletionToken>
+    BOOST_ASIO_INITFN_RESULT_TYPE(CompletionToken,
+        void (boost::system::error_code, std::shared_ptr<NearUserMessage>))
+    asyncReceive(CompletionToken&& token)
+    {
+        return boost::asio::async_initiate<
+            CompletionToken,
+            void (boost::system::error_code, std::shared_ptr<NearUserMessage>)
+        >(InitReceive{*this}, token);
+    }
+
+    /** Send a batch of messages to the connected remote site.
+     *
+     * All messages are sent with a single write operation, which is much
+     * cheaper than calling sendUserMessage() for each of them. The recipient
+     * of each message is taken from the message itself, the message
+     * identifiers are assigned by this function.
+     * A separate SendReport is issued for each message.
+     *
+     * @param messages The messages you want to send
+     * @return the message identifier of the first message. The following
+     * messages have consecutive identifiers. An empty batch returns
+     * NearUserMessage::msg_id_none and issues no SendReport.
+     */
+    NearUserMessage::msg_id_t sendUserMessages(
+        std::vector<NearUserMessage>&& messages
+    );
+
+    /** Send a batch of messages and get notified via a future.
+     *
+     * Works like sendUserMessages(std::vector<NearUserMessage>&&), but
+     * instead of issuing a SendReport signal for each message, the returned
+     * future becomes ready when the whole batch was written to the
+     * connection.
+     *
+     * @param messages The messages you want to send
+     * @return A future holding the message identifiers of all messages, in
+     * the order of the batch. If the batch could not be sent, the future
+     * holds a SendError describing the reason; its report carries the
+     * identifier of the first message.
+     */
+    std::future<std::vector<NearUserMessage::msg_id_t>> sendUserMessagesAsync(
+        std::vector<NearUserMessage>&& messages
+    );
+
+    /** Send a range of messages to the connected remote site.
+     * The messages are copied, see
+     * sendUserMessages(std::vector<NearUserMessage>&&).
+     *
+     * @param first Iterator to the first message of the range
+     * @param last Iterator past the last message of the range
+     * @return the message identifier of the first message. The following
+     * messages have consecutive identifiers.
+     */
+    template <typename InputIterator>
+    NearUserMessage::msg_id_t sendUserMessages(
+        InputIterator first, InputIterator last
+    )
+    {
+        std::vector<NearUserMessage> messages;
+        for (; first != last; ++first)
+            messages.emplace_back(*first);
+
+        return sendUserMessages(std::move(messages));
+    }
+
+
     /** Disconnect from the remote site.
     */
     void disconnect();
 
+    /** Set the policy for automatic reconnects.
+     *
+     * If the policy is enabled and the connection to the server is lost,
+     * the ClientNode tries to reconnect and to resume the message stream
+     * after the last received message. While it tries, connection status
+     * reports with the reason
+     * ConnectionStatusReport::STCHR_RECONNECTING are issued.
+     *
+     * @param policy The new reconnect policy
+     */
+    void setReconnectPolicy(const ReconnectPolicy& policy);
+
 private:
 
+    /** Starts asyncConnect() */
+    struct InitConnect
+    {
+        ClientNode& node;
+
+        template <typename Handler>
+        void operator() (Handler&& handler, const ServerLocation& where) const
+        {
+            node.postConnect(where,
+                makeCompletion<void (boost::system::error_code)>(
+                    std::forward<Handler>(handler),
+                    node.statemachine.get_executor()
+                )
+            );
+        }
+    };
+
+    /** Starts asyncSend() */
+    struct InitSend
+    {
+        ClientNode& node;
+
+        template <typename Handler>
+        void operator() (
+            Handler&& handler,
+            byte_traits::msg_string msg,
+            const UniqueUserID& recipient
+        ) const
+        {
+            node.postSend(std::move(msg), recipient,
+                makeCompletion<
+                    void (boost::system::error_code, NearUserMessage::msg_id_t)
+                >(
+                    std::forward<Handler>(handler),
+                    node.statemachine.get_executor()
+                )
+            );
+        }
+    };
+
+    /** Starts asyncReceive() */
+    struct InitReceive
+    {
+        ClientNode& node;
+
+        template <typename Handler>
+        void operator() (Handler&& handler) const
+        {
+            node.postReceive(
+                makeCompletion<
+                    void (
+                        boost::system::error_code,
+                        std::shared_ptr<NearUserMessage>
+                    )
+                >(
+                    std::forward<Handler>(handler),
+                    node.statemachine.get_executor()
+                )
+            );
+        }
+    };
+
+    /** Queue a connection request.
+     * @param where The string representation of the address of the remote
+     * site
+     * @param completion Called with the outcome, may be empty
+    */
+    void postConnect(const ServerLocation& where, ConnectCompletion completion);
+
+    /** Queue a message for sending.
+     * @param msg The message
+     * @param recipient Recipient of the message
+     * @param completion Called with the outcome
+    */
+    void postSend(
+        byte_traits::msg_string&& msg,
+        const UniqueUserID& recipient,
+        std::function<
+            void (boost::system::error_code, NearUserMessage::msg_id_t)
+        > completion
+    );
+
+    /** Queue a request for the next received message.
+     * @param completion Called with the message
+    */
+    void postReceive(ReceiveCompletion completion);
+
     /** Retrieve new unique message identifier.
      * This identifier will be unique on this client
      * @return unique message identifier
@@ -181,20 +484,41 @@ private:
         return ++last_msg_id;
     }
 
+    /** Assign identifiers to a batch of messages and queue it for sending.
+     * @param messages The messages of the batch
+     * @param completion Called when the batch was sent, or empty to issue
+     * SendReport signals
+     * @return the message identifier of the first message, or
+     * NearUserMessage::msg_id_none if the batch is empty
+    */
+    NearUserMessage::msg_id_t postBatch(
+        std::vector<NearUserMessage>&& messages,
+        SendCompletion completion
+    );
+
+    /** Retrieve a block of consecutive unique message identifiers.
+     * @param count Number of identifiers
+     * @return the first identifier of the block
+    */
+    NearUserMessage::msg_id_t getNextMessageIds(std::size_t count)
+    {
+        return last_msg_id.fetch_add(
+            static_cast<NearUserMessage::msg_id_t>(count)) + 1;
+    }
+
     /** The Streams used for message output */
     LoggingStreams logstreams;
 
+    /** The function object that will be called, if an event occurs.
+     * Declared before the state machine, so it outlives the I/O thread.
+    */
+    ClientNodeSignals signals;
+
     /** Our state machine */
     ClientnodeMachine statemachine;
 
-    /** A mutex to gain access to the state machine */
-    boost::mutex machine_mutex;
-
-    /** The function object that will be called, if an event occurs.*/
-    ClientNodeSignals signals;
-
     /** Unique message identifier of the last message */
-    NearUserMessage::msg_id_t last_msg_id;
+    std::atomic<NearUserMessage::msg_id_t> last_msg_id;
 
     /** How long to wait for the thread to join */
     enum { threadwait_ms = 3000 };
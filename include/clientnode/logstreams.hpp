@@ -28,6 +28,14 @@
 #define LOGSTREAMS_HPP
 
 #include <iostream>
+#include <sstream>
+#include <string>
+#include <vector>
+#include <memory>
+
+#include <boost/thread/thread.hpp>
+#include <boost/thread/mutex.hpp>
+#include <boost/thread/condition_variable.hpp>
 
 namespace nuke_ms
 {
@@ -41,7 +49,104 @@ namespace nuke_ms
 namespace clientnode
 {
 
-/** Wrapper class for logging streams. */
+/** Severity of a log message */
+enum log_level_t {
+    LOGLEVEL_INFO, /**< Debugging and progress information */
+    LOGLEVEL_WARNING, /**< Something unexpected happened, but we go on */
+    LOGLEVEL_ERROR, /**< Something failed */
+    LOGLEVEL_NONE /**< Used as threshold: log nothing at all */
+};
+
+/** Lowest level that is compiled into the library.
+* Log statements below this level are removed by the compiler. Define this
+* macro to LOGLEVEL_WARNING or higher to strip the info messages completely.
+*/
+#ifndef NUKE_MS_MIN_LOG_LEVEL
+#   define NUKE_MS_MIN_LOG_LEVEL nuke_ms::clientnode::LOGLEVEL_INFO
+#endif
+
+/** Write a log message.
+*
+* If the level is below NUKE_MS_MIN_LOG_LEVEL the statement compiles to
+* nothing, if it is below the threshold of the LoggingStreams object it costs
+* a single comparison. The message is not formatted in either case.
+*
+* @param logstreams The LoggingStreams object to log to
+* @param level The level of the message, one of the log_level_t values
+* @param message The message, can be a chain of values separated by <<.
+* A newline is appended.
+*/
+#define NUKE_MS_LOG(logstreams, level, message) \
+    do { \
+        if ((level) >= NUKE_MS_MIN_LOG_LEVEL && (logstreams).enabled(level)) \
+        { \
+            std::ostringstream nuke_ms_log_buffer; \
+            nuke_ms_log_buffer<<message<<'\n'; \
+            (logstreams).write((level), nuke_ms_log_buffer.str()); \
+        } \
+    } while (false)
+
+
+/** Background thread that writes log messages.
+*
+* Messages are collected in a buffer and written to their streams by a
+* separate thread, so the thread that logs never waits for the I/O.
+* Messages are written in the order they were queued. All queued messages
+* are written and the streams are flushed before the destructor returns.
+*/
+class LogWriter
+{
+    /** A message waiting to be written */
+    struct Record
+    {
+        std::ostream* stream;
+        std::string text;
+    };
+
+    /** Protects queue and stop */
+    boost::mutex queue_mutex;
+
+    /** Signalled when messages are queued or the writer is stopped */
+    boost::condition_variable queue_cond;
+
+    /** Messages waiting to be written */
+    std::vector<Record> queue;
+
+    /** Set by the destructor to end the thread */
+    bool stop;
+
+    /** The thread writing the messages */
+    boost::thread writer_thread;
+
+    /** Thread function: write messages until stopped. */
+    void run();
+
+public:
+    /** Constructor. Starts the writer thread. */
+    LogWriter();
+
+    /** Destructor. Writes all queued messages and stops the thread. */
+    ~LogWriter();
+
+    LogWriter(const LogWriter&) = delete;
+    LogWriter& operator= (const LogWriter&) = delete;
+
+    /** Queue a message.
+    * This function can be called by any thread.
+    *
+    * @param stream The stream the message should be written to. Must stay
+    * alive as long as the LogWriter.
+    * @param text The complete message
+    */
+    void write(std::ostream& stream, std::string&& text);
+};
+
+
+/** Wrapper class for logging streams.
+*
+* Use NUKE_MS_LOG() to write to the streams, so that messages below the
+* threshold cost nothing. Messages are not flushed individually.
+*/
 struct LoggingStreams
 {
     /** Stream info messages will be written to */
@@ -53,10 +158,62 @@ struct LoggingStreams
     /** Stream error messages will be written to */
     std::ostream& errorstream;
 
-    /** Default constructor, initialize to std::clog and std::cerr */
+    /** Messages below this level are discarded */
+    log_level_t threshold;
+
+    /** If set, the messages are written by this background thread instead
+    * of the thread that logs. */
+    std::shared_ptr<LogWriter> writer;
+
+    /** Default constructor, initialize to std::clog and std::cerr.
+    * Info messages are discarded, output is written synchronously.
+    */
     LoggingStreams() :
-        infostream(std::clog), warnstream(std::cerr), errorstream(std::cerr)
+        infostream(std::clog), warnstream(std::cerr), errorstream(std::cerr),
+        threshold{LOGLEVEL_WARNING}
     {}
+
+    /** Constructor.
+    * @param infostream_ Stream for info messages
+    * @param warnstream_ Stream for warning messages
+    * @param errorstream_ Stream for error messages
+    * @param threshold_ Messages below this level are discarded
+    * @param writer_ If set, write the messages in the background
+    */
+    LoggingStreams(
+        std::ostream& infostream_,
+        std::ostream& warnstream_,
+        std::ostream& errorstream_,
+        log_level_t threshold_ = LOGLEVEL_INFO,
+        std::shared_ptr<LogWriter> writer_ = std::shared_ptr<LogWriter>{}
+    ) :
+        infostream(infostream_), warnstream(warnstream_),
+        errorstream(errorstream_), threshold{threshold_},
+        writer{std::move(writer_)}
+    {}
+
+    /** Check if messages of a level are written. */
+    bool enabled(log_level_t level) const
+    { return level >= threshold; }
+
+    /** Get the stream for a level. */
+    std::ostream& stream(log_level_t level) const
+    {
+        return level >= LOGLEVEL_ERROR ? errorstream :
+            level >= LOGLEVEL_WARNING ? warnstream : infostream;
+    }
+
+    /** Write a formatted message to the stream for its level.
+    * @param level The level of the message
+    * @param text The complete message, including the newline
+    */
+    void write(log_level_t level, std::string&& text) const
+    {
+        if (writer)
+            writer->write(stream(level), std::move(text));
+        else
+            stream(level)<<text;
+    }
 };
 
 } // namespace clientnode
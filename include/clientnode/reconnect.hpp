@@ -0,0 +1,120 @@
+// reconnect.hpp
+
+/*
+ *   nuke-ms - Nuclear Messaging System
+ *   Copyright (C) 2012  Alexander Korsunsky
+ *
+ *   This program is free software: you can redistribute it and/or modify
+ *   it under the terms of the GNU General Public License as published by
+ *   the Free Software Foundation, version 3 of the License.
+ *
+ *   This program is distributed in the hope that it will be useful,
+ *   but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *   MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ *   GNU General Public License for more details.
+ *
+ *   You should have received a copy of the GNU General Public License
+ *   along with this program.  If not, see <http://www.gnu.org/licenses/>.
+*/
+
+/** @file clientnode/reconnect.hpp
+* @brief Policy for automatic reconnects of the ClientNode.
+* @ingroup clientnode
+*
+* @author Alexander Korsunsky
+*/
+
+#ifndef RECONNECT_HPP
+#define RECONNECT_HPP
+
+#include <random>
+#include <algorithm>
+
+namespace nuke_ms
+{
+
+
+/** @addtogroup clientnode Communication Protocol
+ * @{
+*/
+
+
+namespace clientnode
+{
+
+/** Policy for automatic reconnects.
+ *
+ * When the connection to the server is lost and the policy is enabled, the
+ * ClientNode tries to reconnect to the same server. The delay before each
+ * attempt grows exponentially and is randomized ("full jitter"), so that
+ * clients that lost their connection at the same time do not all hammer the
+ * server at the same moment.
+ *
+ * After reconnecting, the ClientNode asks the server to resume the message
+ * stream after the last message it received.
+ *
+ * Automatic reconnects are disabled by default.
+*/
+struct ReconnectPolicy
+{
+    /** Reconnect automatically if the connection is lost */
+    bool enabled;
+
+    /** Upper bound of the delay before the first attempt in milliseconds */
+    unsigned initial_delay_ms;
+
+    /** Upper bound of the delay between two attempts in milliseconds */
+    unsigned max_delay_ms;
+
+    /** Give up after this many failed attempts. 0 means never give up. */
+    unsigned max_attempts;
+
+    /** Default constructor. Automatic reconnects are disabled. */
+    ReconnectPolicy(
+        bool enabled_ = false,
+        unsigned initial_delay_ms_ = 500,
+        unsigned max_delay_ms_ = 30000,
+        unsigned max_attempts_ = 0
+    )
+        : enabled{enabled_}, initial_delay_ms{initial_delay_ms_},
+            max_delay_ms{max_delay_ms_}, max_attempts{max_attempts_}
+    {}
+
+    /** Compute the delay before a reconnect attempt.
+     *
+     * The delay is drawn uniformly from [0, min(max_delay_ms,
+     * initial_delay_ms * 2^attempt)].
+     *
+     * @param attempt Number of the attempt, starting with 0
+     * @param rng Random number generator used for the jitter
+     * @return The delay in milliseconds
+    */
+    template <typename RandomNumberGenerator>
+    unsigned getDelay(unsigned attempt, RandomNumberGenerator& rng) const
+    {
+        // cap the exponent so the shift can't overflow
+        unsigned long long ceiling =
+            static_cast<unsigned long long>(initial_delay_ms) <<
+                std::min(attempt, 20u);
+
+        ceiling = std::min<unsigned long long>(ceiling, max_delay_ms);
+
+        return std::uniform_int_distribution<unsigned>{
+            0u, static_cast<unsigned>(ceiling)}(rng);
+    }
+
+    /** Check if another attempt should be made.
+     * @param attempt Number of the attempt, starting with 0
+    */
+    bool mayRetry(unsigned attempt) const
+    { return enabled && (max_attempts == 0 || attempt < max_attempts); }
+};
+
+} // namespace clientnode
+
+/**@}*/ // addtogroup clientnode
+
+} // namespace nuke_ms
+
+
+#endif // ifndef RECONNECT_HPP
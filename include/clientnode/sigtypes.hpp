@@ -33,6 +33,7 @@
 
 #include <boost/signals2/signal.hpp>
 #include <memory>
+#include <stdexcept>
 
 #include "bytes.hpp"
 #include "neartypes.hpp"
@@ -53,7 +54,12 @@ namespace clientnode
 /** Identification of the server location */
 struct ServerLocation
 {
-    byte_traits::native_string where; /**< String with hostname or ip address */
+    /** Host name or ip address and port, separated by a space,
+    * "unix:<path>" for a Unix domain socket on the same host,
+    * "shm:<path>" for a shared memory connection to a server on the same
+    * host, set up through the Unix domain socket at path, or
+    * "inproc:<name>" for a LoopbackListener in the same process. */
+    byte_traits::native_string where;
 };
 
 /** Status report of connection state changes
@@ -77,7 +83,8 @@ struct ConnectionStatusReport
         STCHR_CONNECT_FAILED, /**< Connection attempt failed */
         STCHR_SOCKET_CLOSED, /**< Connection to remote server lost */
         STCHR_USER_REQUESTED, /**< User requested state change */
-        STCHR_BUSY /**< An operation is currently being performed */
+        STCHR_BUSY, /**< An operation is currently being performed */
+        STCHR_RECONNECTING /**< Automatic reconnect after a lost connection */
     };
 
     connect_state_t newstate; /**< current connection state */
@@ -106,6 +113,24 @@ struct SendReport
 };
 
 
+/** Exception reported by the futures of sendUserMessageAsync() and
+ * sendUserMessagesAsync() if a message could not be sent.
+*/
+class SendError : public std::runtime_error
+{
+public:
+    /** The report describing the failure */
+    SendReport report;
+
+    /** Constructor.
+    * @param _report The report describing the failure
+    */
+    SendError(const SendReport& _report)
+        : std::runtime_error{_report.reason_str}, report(_report)
+    {}
+};
+
+
 // Signals issued by the Protocol
 
 /** Signal for incoming messages*/
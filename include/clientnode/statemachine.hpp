@@ -28,18 +28,23 @@
 #define STATEMACHINE_HPP
 
 #include <boost/thread/thread.hpp>
-#include <boost/thread/condition_variable.hpp>
 #include <boost/asio.hpp>
-#include <boost/statechart/state_machine.hpp>
-#include <boost/statechart/state.hpp>
-#include <boost/statechart/custom_reaction.hpp>
-#include <boost/mpl/list.hpp>
 #include <boost/ref.hpp>
+#include <random>
+#include <atomic>
+#include <deque>
+#include <functional>
+#include <vector>
 
 #include "msglayer.hpp"
+#include "handleralloc.hpp"
+#include "mpscqueue.hpp"
+#include "neartypes.hpp"
 #include "clientnode/logstreams.hpp"
 #include "clientnode/sigtypes.hpp"
+#include "clientnode/reconnect.hpp"
 #include "refcounter.hpp"
+#include "transport.hpp"
 
 namespace nuke_ms
 {
@@ -53,24 +58,69 @@ namespace nuke_ms
 namespace clientnode
 {
 
+/** Called with the outcome of sending a message or a batch, instead of
+* issuing SendReport signals. It is called once for a batch, the report
+* holds the identifier of the first message.
+* @ingroup proto_machine
+*/
+typedef std::function<void (const SendReport&)> SendCompletion;
+
+/** Called with the outcome of a connection request.
+* @ingroup proto_machine
+*/
+typedef std::function<void (boost::system::error_code)> ConnectCompletion;
+
+/** Called with the next received user message.
+* @ingroup proto_machine
+*/
+typedef std::function<
+    void (boost::system::error_code, std::shared_ptr<NearUserMessage>)
+> ReceiveCompletion;
+
+/** Kinds of connections to the server
+* @ingroup proto_machine
+*/
+enum connection_kind_t
+{
+    CONNECTION_TCP, /**< TCP connection to a host and port */
+    CONNECTION_LOCAL, /**< Unix domain socket */
+    CONNECTION_SHM, /**< Shared memory, set up through a Unix domain socket */
+    CONNECTION_INPROC /**< LoopbackListener in the same process */
+};
+
 // Event declarations
 
 /** Event representing a Connection Request.
 * @ingroup proto_machine
 */
-struct EvtConnectRequest : public boost::statechart::event<EvtConnectRequest>
+struct EvtConnectRequest
 {
 
-    byte_traits::native_string host; /**< Where to connect to. */
-    byte_traits::native_string service; /**< Which port to connect to. */
+    /** Kind of connection */
+    connection_kind_t kind;
+
+    /** Where to connect to. Empty for Unix domain sockets. */
+    byte_traits::native_string host;
+
+    /** Which port to connect to, the path of the Unix domain socket, or the
+    * name of the LoopbackListener. */
+    byte_traits::native_string service;
+
+    /** Called with the outcome of the request. May be empty. */
+    ConnectCompletion completion;
 
     /** Constructor.
     * @param _host Where to connect to.
 	* @param _service Which port to connect to.
+    * @param _kind Kind of connection
+    * @param _completion Called with the outcome of the request
 	*/
     EvtConnectRequest(const byte_traits::native_string& _host,
-        const byte_traits::native_string& _service)
-        : host {_host}, service{_service}
+        const byte_traits::native_string& _service,
+        connection_kind_t _kind = CONNECTION_TCP,
+        ConnectCompletion _completion = ConnectCompletion{})
+        : kind{_kind}, host {_host}, service{_service},
+        completion{std::move(_completion)}
     {}
 };
 
@@ -78,33 +128,40 @@ struct EvtConnectRequest : public boost::statechart::event<EvtConnectRequest>
 * @ingroup proto_machine
 *
 */
-struct EvtConnectReport : public boost::statechart::event<EvtConnectReport>
+struct EvtConnectReport
 {
     bool success; /**< true on success, false on failure */
     byte_traits::native_string message; /**< Message commenting the outcome. */
+    boost::system::error_code error; /**< Error that made the attempt fail */
 
     /** Constructor. Initializes members.
     * @param _success true on success, false on failure
     * @param _message Message commenting the outcome.
+    * @param _error Error that made the attempt fail
     */
-    EvtConnectReport(bool _success, const byte_traits::native_string& _message)
-        : success{_success}, message {_message}
+    EvtConnectReport(bool _success, const byte_traits::native_string& _message,
+        const boost::system::error_code& _error = boost::system::error_code{})
+        : success{_success}, message {_message}, error{_error}
     {}
 };
 
+/** Event telling that the delay before a reconnect attempt has passed.
+* @ingroup proto_machine
+*/
+struct EvtReconnect
+{};
+
 /** Event representing a Disconnection Request.
 * @ingroup proto_machine
 */
-struct EvtDisconnectRequest :
-    public boost::statechart::event<EvtDisconnectRequest>
+struct EvtDisconnectRequest
 {};
 
 
 /** Event representing a Disconnect.
 * @ingroup proto_machine
 */
-struct EvtDisconnected :
-    public boost::statechart::event<EvtDisconnected>
+struct EvtDisconnected
 {
     /** The reason of the disconnection event */
     byte_traits::native_string msg;
@@ -121,45 +178,140 @@ struct EvtDisconnected :
 * @ingroup proto_machine
 */
 template <typename MessageType>
-struct EvtSendMsg : public boost::statechart::event<EvtSendMsg<MessageType>>
+struct EvtSendMsg
 {
     /** The data of the message */
-    std::shared_ptr<MessageType> _data;
+    MessageType _data;
+
+    /** Called instead of issuing a SendReport signal. May be empty. */
+    SendCompletion _completion;
 
     /** Constructor.
     * @param _data The text of the message.
+    * @param completion Called when the message was sent
     */
-    EvtSendMsg(MessageType&& data)
-        : _data{std::make_shared<MessageType>(std::move(data))}
+    EvtSendMsg(
+        MessageType&& data,
+        SendCompletion completion = SendCompletion{}
+    )
+        : _data{std::move(data)}, _completion{std::move(completion)}
     {}
+};
 
-    EvtSendMsg(const EvtSendMsg&) = default;
+/** Event representing a batch of messages to be sent at once.
+* All messages of the batch are written to the socket with a single write
+* operation, but there is one SendReport for each message.
+* @ingroup proto_machine
+*/
+template <typename MessageType>
+struct EvtSendMsgBatch
+{
+    /** The messages of the batch */
+    std::vector<MessageType> _data;
+
+    /** Called once for the whole batch instead of issuing a SendReport
+    * signal for each message. May be empty. */
+    SendCompletion _completion;
+
+    /** Constructor.
+    * @param data The messages of the batch.
+    * @param completion Called when the batch was sent
+    */
+    EvtSendMsgBatch(
+        std::vector<MessageType>&& data,
+        SendCompletion completion = SendCompletion{}
+    )
+        : _data{std::move(data)}, _completion{std::move(completion)}
+    {}
 };
 
 /** Event representing a received message
+* The data may refer to the receive buffer of the machine, which is reused
+* for the following packets. Reactions copy out whatever they keep.
 * @ingroup proto_machine
 * @ingroup netdata
 */
 template <typename UpperLayer>
-struct EvtRcvdMessage :
-    public boost::statechart::event<EvtRcvdMessage<UpperLayer>>
+struct EvtRcvdMessage
 {
     /** The data of the message. */
-    std::shared_ptr<SegmentationLayer<UpperLayer>> _data;
+    SegmentationLayer<UpperLayer> _data;
 
     /** Constructor.
     * @param _data The data of the message.
     */
     EvtRcvdMessage(SegmentationLayer<UpperLayer>&& data)
-        :_data{std::make_shared<SegmentationLayer<UpperLayer>>(std::move(data))}
+        :_data{std::move(data)}
     {}
+};
+
+
+class ClientnodeMachine;
 
-    EvtRcvdMessage(const EvtRcvdMessage<UpperLayer>&) = default;
+/** Identifiers of the states of the ClientnodeMachine.
+* @ingroup proto_machine
+*/
+enum state_id_t
+{
+    STATE_TERMINATED, /**< Machine not running, all events are discarded */
+    STATE_WAITING, /**< See StateWaiting */
+    STATE_NEGOTIATING, /**< See StateNegotiating */
+    STATE_CONNECTED, /**< See StateConnected */
+    NUM_STATES
 };
 
 
-// Forward declaration of the Initial State
-struct StateWaiting;
+/** Command from the application to the state machine.
+* @ingroup proto_machine
+*
+* Commands are queued by application threads and executed by the I/O thread,
+* so that the state machine is only ever touched by one thread.
+*/
+struct MachineCommand : public MPSCQueueNode
+{
+    virtual ~MachineCommand() {}
+
+    /** Carry out the command. Called by the I/O thread. */
+    virtual void execute(ClientnodeMachine& cm) = 0;
+};
+
+/** Command that dispatches an event to the state machine.
+* @ingroup proto_machine
+*/
+template <typename Event>
+struct EventCommand : public MachineCommand
+{
+    /** The event that will be dispatched */
+    Event evt;
+
+    /** Constructor.
+    * @param _evt The event that will be dispatched
+    */
+    EventCommand(Event&& _evt)
+        : evt(std::move(_evt))
+    {}
+
+    void execute(ClientnodeMachine& cm);
+};
+
+/** Command that calls a function with the state machine as argument.
+* @ingroup proto_machine
+*/
+struct FunctionCommand : public MachineCommand
+{
+    /** The function that will be called */
+    std::function<void (ClientnodeMachine&)> function;
+
+    /** Constructor.
+    * @param _function The function that will be called
+    */
+    FunctionCommand(const std::function<void (ClientnodeMachine&)>& _function)
+        : function{_function}
+    {}
+
+    void execute(ClientnodeMachine& cm)
+    { function(cm); }
+};
 
 
 /** The Protoc State Machine.
@@ -168,33 +320,40 @@ struct StateWaiting;
 * Events can be dispatched to this machine, and the according actions will be
 * performed.
 *
-* Currently, this class is an "asynchronous_state_machine", which has it's own
-* thread. Refer to the documention of Boost.Statechart for details on how to
-* create and use this class, and how to dispatch events.
+* The machine owns an I/O thread that runs for the whole lifetime of the
+* machine. All events are processed by this thread: application threads
+* post commands with postCommand() and postEvent() to a lock-free queue,
+* which is drained by the I/O thread. No locking is needed to access the
+* machine.
+*
+* The machine is table-driven: for every event type there is a table holding
+* the reaction of each state (see the process_event() overloads). Reactions
+* return the next state. When the state changes, the entry action of the new
+* state is called. Nothing is allocated for a transition or a dispatch.
 */
 class ClientnodeMachine :
-    public boost::statechart::state_machine<
-        ClientnodeMachine,
-        StateWaiting
-    >,
     public ReferenceCounter<ClientnodeMachine>
-
 {
+    /** The state the machine is currently in */
+    state_id_t current_state;
+
+
     std::shared_ptr<boost::asio::io_service> io_service;
 
-    /** A thread object for all asynchronouy I/O operations. It will start in
-    not-a-thread state. */
+    /** Keeps the I/O thread running while there is nothing to do */
+    std::unique_ptr<boost::asio::io_service::work> io_work;
+
+    /** A thread object for all asynchronouy I/O operations. */
     boost::thread io_thread;
 
-    /**
-     * Condition that is true when all currently invoked handlers have returned
-    */
-    boost::condition_variable returned_condition;
+    /** Commands posted by the application, waiting for the I/O thread */
+    MPSCQueue<MachineCommand> command_queue;
 
-    /** Callback that will be called when all handlers have returned */
-    void on_returned()
-    { returned_condition.notify_all(); }
+    /** True if a drainCommands() call is already on its way */
+    std::atomic<bool> drain_scheduled;
 
+    /** Execute all queued commands. Only called by the I/O thread. */
+    void drainCommands();
 
 public:
     enum {thread_timeout = 3000u};
@@ -205,67 +364,305 @@ public:
     /** The Streams used for message output */
 	LoggingStreams logstreams;
 
-    /** Socket used for the connection */
+    /** Socket used to establish TCP connections. Handed over to the
+    * transport as soon as it is connected. */
     boost::asio::ip::tcp::socket socket;
 
+    /** Socket used to establish Unix domain socket connections. Handed over
+    * to the transport as soon as it is connected. */
+    boost::asio::local::stream_protocol::socket local_socket;
+
+    /** Connection to the server */
+    Transport transport;
+
     /** Resolver used for any resolve operations */
     boost::asio::ip::tcp::resolver resolver;
 
-    /** A reference to the mutex that is needed to access this machine */
-    boost::mutex& machine_mutex;
+    /** Size of the receive buffer. Large enough for the biggest packet. */
+    enum { rcvbuf_size = 0x10000 };
+
+    /** Receive buffer of the connection.
+    * All received data is read into this buffer and the packets are parsed
+    * out of it. Received packets refer to the buffer directly, the messages
+    * handed to the application copy their contents. The buffer is only
+    * reused if nobody else holds a reference to it anymore.
+    */
+    std::shared_ptr<byte_traits::byte_sequence> rcvbuf;
+
+    /** Number of bytes in the receive buffer that are not yet parsed */
+    std::size_t rcvbuf_fill;
+
+    /** Recycled memory for the handlers of the read operations.
+    * Only one read operation is pending at any time.
+    */
+    std::shared_ptr<HandlerMemory> read_handler_memory;
+
+    /** Recycled memory for the handlers of the write operations.
+    * Only one write operation is pending at any time.
+    */
+    std::shared_ptr<HandlerMemory> write_handler_memory;
+
+    /** A packet waiting to be written, and whom to tell about it */
+    struct QueuedWrite
+    {
+        /** What the packet holds */
+        enum kind_t
+        {
+            WRITE_MESSAGE, /**< A single message */
+            WRITE_BATCH, /**< A batch of messages back to back */
+            WRITE_RESUME_REQUEST /**< Nothing to report about */
+        };
+
+        kind_t kind;
+
+        /** The serialized packets */
+        std::shared_ptr<byte_traits::byte_sequence> data;
+
+        /** Identifier of the message, for WRITE_MESSAGE */
+        NearUserMessage::msg_id_t msg_id;
+
+        /** Identifiers of the messages, for WRITE_BATCH */
+        std::vector<NearUserMessage::msg_id_t> msg_ids;
+
+        /** Called with the outcome, may be empty */
+        SendCompletion completion;
+    };
+
+    /** Packets to write, the first one is being written. Only one write is
+    * pending at a time, so the packets are never interleaved on the
+    * connection. */
+    std::deque<QueuedWrite> write_queue;
+
+    /** Timer for delays between reconnect attempts */
+    boost::asio::deadline_timer reconnect_timer;
+
+    /** Policy for automatic reconnects */
+    ReconnectPolicy reconnect_policy;
+
+    /** Number of the current reconnect attempt */
+    unsigned reconnect_attempt;
+
+    /** Random number generator for reconnect delays */
+    std::minstd_rand reconnect_rng;
+
+    /** Kind of the last connection request */
+    connection_kind_t connection_kind;
+
+    /** Host of the last connection request */
+    byte_traits::native_string host;
+
+    /** Service of the last connection request */
+    byte_traits::native_string service;
+
+    /** True if a message was received in the current session */
+    bool have_received;
+
+    /** Identifier of the last received message */
+    NearUserMessage::msg_id_t last_rcvd_msg_id;
+
+    /** Sender of the last received message */
+    UniqueUserID last_rcvd_sender;
+
+    /** Called with the outcome of the pending connection request */
+    ConnectCompletion connect_completion;
+
+    /** Called with the next received message */
+    ReceiveCompletion receive_completion;
+
+    /** Received messages nobody has asked for yet */
+    std::deque<std::shared_ptr<NearUserMessage>> received_messages;
+
+    /** True once receiveMessage() was called. From then on, received
+    * messages are kept until they are asked for. */
+    bool keep_received;
 
 
     /** Constructor.
+    * Starts the I/O thread and initiates the machine on it.
+    *
+    * @throws std::exception if an error creating the thread occurs.
     */
-    ClientnodeMachine(ClientNodeSignals&  _signals,
-		LoggingStreams logstreams_, boost::mutex& _machine_mutex);
+    ClientnodeMachine(ClientNodeSignals&  _signals, LoggingStreams logstreams_);
 
 
-    /** Destructor. Stops all I/O operations and threads as cleanly as possible.
+    /** Destructor. Calls shutdown().
     */
     ~ClientnodeMachine();
 
-    /** Starts the I/O service object and thread to process I/O operations.
-    * @pre io_service object must have some work to do before calling this
-    * function.
+    /** Enter the initial state StateWaiting. */
+    void initiate();
+
+    /** Leave the current state. All following events are discarded. */
+    void terminate();
+
+    /** Get the state the machine is currently in. */
+    state_id_t state() const
+    { return current_state; }
+
+    /** Switch to another state and run its entry action.
+    * @param next The new state
+    */
+    void transit(state_id_t next);
+
+    /** @name Event processing
+    * Dispatch an event to the reaction of the current state. This is a
+    * lookup in a table of function pointers and a direct call, nothing is
+    * allocated. Only called by the I/O thread.
+    * @{
+    */
+    void process_event(EvtConnectRequest& evt);
+    void process_event(EvtConnectReport& evt);
+    void process_event(EvtReconnect& evt);
+    void process_event(EvtDisconnectRequest& evt);
+    void process_event(EvtDisconnected& evt);
+    void process_event(EvtSendMsg<NearUserMessage>& evt);
+    void process_event(EvtSendMsgBatch<NearUserMessage>& evt);
+    void process_event(EvtRcvdMessage<SerializedData>& evt);
+
+    /** Dispatch a temporary event */
+    template <typename Event>
+    void process_event(Event&& evt)
+    { process_event(evt); }
+    /**@}*/
+
+    /** Get the executor of the I/O thread. */
+    boost::asio::io_service::executor_type get_executor()
+    { return io_service->get_executor(); }
+
+    /** Stop the machine.
+    * Stops the I/O thread, lets all pending handlers return and terminates
+    * the machine. Afterwards, commands will not be executed anymore.
+    */
+    void shutdown();
+
+    /** Queue a command for execution by the I/O thread.
+    * This function can be called by any thread.
     *
-    * @throws std::exception if an error creating the thread occurs.
+    * @param cmd The command to be executed.
     */
-    void startIOOperations();
+    void postCommand(std::unique_ptr<MachineCommand> cmd);
 
-    /** Stops I/O Operations.
-    * This function stops the IO- Service Object and joins the thread if
-    * they are running.
+    /** Queue an event for processing by the I/O thread.
+    * This function can be called by any thread.
+    *
+    * @param evt The event to be processed.
+    */
+    template <typename Event>
+    void postEvent(Event&& evt)
+    {
+        postCommand(std::unique_ptr<MachineCommand>{
+            new EventCommand<typename std::decay<Event>::type>{std::move(evt)}
+        });
+    }
+
+    /** Cancel all I/O Operations.
+    * This function closes the connection and cancels all pending resolve and
+    * timer operations.
     */
     void stopIOOperations();
 
+    /** Queue a packet for writing to the connection.
+    * The write is started right away if no other write is pending.
+    */
+    void queueWrite(QueuedWrite&& write);
+
+    /** Start writing the first packet of the write queue. */
+    void startWrite();
+
+    /** Report all queued packets as not sent and empty the queue.
+    * Called when the connection is closed. The handler of a write that is
+    * still pending finds the queue changed and does nothing.
+    *
+    * @param reason_str Text describing the reason
+    */
+    void failWrites(const byte_traits::native_string& reason_str);
+
+    /** Call the completion of the pending connection request, if any.
+    * @param error The outcome of the request
+    */
+    void completeConnect(const boost::system::error_code& error);
+
+    /** Hand out the next received message, or wait for it.
+    * Messages that were received before are handed out first. If there are
+    * none and the machine is not connected or connecting, the completion
+    * is called with boost::asio::error::not_connected.
+    *
+    * @param completion Called with the message
+    */
+    void receiveMessage(ReceiveCompletion&& completion);
+
+    /** Hand a received message to the pending receive, or keep it.
+    * @param msg The message
+    */
+    void deliverMessage(const std::shared_ptr<NearUserMessage>& msg);
+
+    /** Call the completion of the pending receive with an error, if any.
+    * @param error The reason
+    */
+    void failReceive(const boost::system::error_code& error);
+
+    /** Start receiving on a freshly connected socket.
+    * Empties the receive buffer and starts the receive loop.
+    */
+    void startReceive();
+
+    /** Read more data into the free space of the receive buffer. */
+    void continueReceive();
+
+    /** Connect to the location of the last connection request.
+    * Unix domain sockets are connected directly, host names are resolved
+    * first.
+    */
+    void startConnect();
+
+    /** Start resolving the host and service of the last connection request.
+    * When resolving is done, a connection attempt is made.
+    */
+    void startResolve();
+
+    /** Schedule the next reconnect attempt.
+    * An EvtReconnect will be processed when the delay has passed.
+    *
+    * @return false if the reconnect policy does not allow another attempt
+    */
+    bool scheduleReconnect();
+
+    static void reconnectTimerHandler(
+        const boost::system::error_code& error,
+        ClientnodeMachine::CountedReference cm
+    );
 };
 
 
+template <typename Event>
+void EventCommand<Event>::execute(ClientnodeMachine& cm)
+{
+    cm.process_event(evt);
+}
+
+
 
 /** State indicating that the Protocol is Waiting to be connected.
 * @ingroup proto_machine
 *
+* The states are not instantiated. Each of them is a collection of static
+* reactions, which are entered into the reaction tables of the machine. A
+* reaction returns the state the machine shall be in afterwards.
+*
 * Reacting to:
 * EvtConnectRequest
 * EvtSendMsg
 */
-struct StateWaiting :
-    public boost::statechart::state<StateWaiting, ClientnodeMachine>
+struct StateWaiting
 {
-
-    /** State reactions. */
-    typedef boost::mpl::list<
-        boost::statechart::custom_reaction<EvtConnectRequest>,
-        boost::statechart::custom_reaction<EvtSendMsg<NearUserMessage>>
-    > reactions;
-
-    /** Constructor. To be used only by Boost.Statechart classes. */
-    StateWaiting(my_context ctx);
-
-    boost::statechart::result react(const EvtConnectRequest&);
-    boost::statechart::result react(const EvtSendMsg<NearUserMessage>&);
-
+    /** Entry action. Called by ClientnodeMachine::transit(). */
+    static void enter(ClientnodeMachine& cm);
+
+    static state_id_t react(ClientnodeMachine& cm, EvtConnectRequest&);
+    static state_id_t react(ClientnodeMachine& cm,
+        EvtSendMsg<NearUserMessage>&);
+    static state_id_t react(ClientnodeMachine& cm,
+        EvtSendMsgBatch<NearUserMessage>&);
 };
 
 
@@ -275,19 +672,10 @@ struct StateWaiting :
 * Reacting to:
 * EvtConnectReport
 */
-struct StateNegotiating :
-    public boost::statechart::state<StateNegotiating, ClientnodeMachine>
+struct StateNegotiating
 {
-     /** State reactions. */
-    typedef boost::mpl::list<
-        boost::statechart::custom_reaction<EvtConnectReport>,
-        boost::statechart::custom_reaction<EvtDisconnectRequest>,
-        boost::statechart::custom_reaction<EvtSendMsg<NearUserMessage>>, // FIXME Use a template version of this function!
-        boost::statechart::custom_reaction<EvtConnectRequest>
-    > reactions;
-
-    /** Constructor. To be used only by Boost.Statechart classes. */
-    StateNegotiating(my_context ctx);
+    /** Entry action. Called by ClientnodeMachine::transit(). */
+    static void enter(ClientnodeMachine& cm);
 
     static void resolveHandler(
         const boost::system::error_code& error,
@@ -303,54 +691,63 @@ struct StateNegotiating :
         boost::asio::ip::tcp::resolver::iterator endpoint_iterator
     );
 
+    static void localConnectHandler(
+        const boost::system::error_code& error,
+        ClientnodeMachine::CountedReference cm
+    );
+
+    /** Called when the server sent the shared memory of the connection */
+    static void shmHandshakeHandler(
+        const boost::system::error_code& error,
+        ClientnodeMachine::CountedReference cm
+    );
+
+    /** Connects to a LoopbackListener */
+    static void inprocConnectHandler(
+        const boost::system::error_code& error,
+        ClientnodeMachine::CountedReference cm
+    );
 
-    boost::statechart::result react(const EvtConnectReport& evt);
-    boost::statechart::result react(const EvtDisconnectRequest&);
-    boost::statechart::result react(const EvtSendMsg<NearUserMessage>&);
-    boost::statechart::result react(const EvtConnectRequest& evt);
+    static state_id_t react(ClientnodeMachine& cm, EvtConnectReport& evt);
+    static state_id_t react(ClientnodeMachine& cm, EvtDisconnectRequest&);
+    static state_id_t react(ClientnodeMachine& cm,
+        EvtSendMsg<NearUserMessage>&);
+    static state_id_t react(ClientnodeMachine& cm,
+        EvtSendMsgBatch<NearUserMessage>&);
+    static state_id_t react(ClientnodeMachine& cm, EvtConnectRequest& evt);
+    static state_id_t react(ClientnodeMachine& cm, EvtReconnect&);
 };
 
 
-struct StateConnected :
-    public boost::statechart::state<StateConnected, ClientnodeMachine>
+struct StateConnected
 {
-    /** State reactions. */
-    typedef boost::mpl::list<
-        boost::statechart::custom_reaction<EvtDisconnectRequest>,
-        boost::statechart::custom_reaction<EvtSendMsg<NearUserMessage>>,
-        boost::statechart::custom_reaction<EvtDisconnected>,
-        boost::statechart::custom_reaction<EvtRcvdMessage<SerializedData>>,
-        boost::statechart::custom_reaction<EvtConnectRequest>
-    > reactions;
-
-    /** Constructor. To be used only by Boost.Statechart classes. */
-    StateConnected(my_context ctx);
-
-    boost::statechart::result react(const EvtDisconnectRequest&);
-    boost::statechart::result react(const EvtSendMsg<NearUserMessage>&);
-    boost::statechart::result react(const EvtDisconnected& evt);
-    boost::statechart::result react(const EvtRcvdMessage<SerializedData>& evt);
-    boost::statechart::result react(const EvtConnectRequest& evt);
-
+    /** Entry action. Called by ClientnodeMachine::transit(). */
+    static void enter(ClientnodeMachine& cm);
+
+    static state_id_t react(ClientnodeMachine& cm, EvtDisconnectRequest&);
+    static state_id_t react(ClientnodeMachine& cm,
+        EvtSendMsg<NearUserMessage>&);
+    static state_id_t react(ClientnodeMachine& cm,
+        EvtSendMsgBatch<NearUserMessage>&);
+    static state_id_t react(ClientnodeMachine& cm, EvtDisconnected& evt);
+    static state_id_t react(ClientnodeMachine& cm,
+        EvtRcvdMessage<SerializedData>& evt);
+    static state_id_t react(ClientnodeMachine& cm, EvtConnectRequest& evt);
+
+    /** Called when the first packet of the write queue was written.
+    * @param data The packet, to find out if the queue was failed meanwhile
+    */
     static void writeHandler(
         const boost::system::error_code& error,
-        std::size_t bytes_transferred,
+        std::size_t /* bytes_transferred */,
         ClientnodeMachine::CountedReference cm,
         std::shared_ptr<byte_traits::byte_sequence> data
     );
 
-    static void receiveSegmentationHeaderHandler(
-        const boost::system::error_code& error,
-        std::size_t bytes_transferred,
-        ClientnodeMachine::CountedReference cm,
-        byte_traits::byte_t rcvbuf[SegmentationLayerBase::header_length]
-    );
-
-    static void receiveSegmentationBodyHandler(
+    static void receiveHandler(
         const boost::system::error_code& error,
         std::size_t bytes_transferred,
-        ClientnodeMachine::CountedReference cm,
-        std::shared_ptr<byte_traits::byte_sequence> rcvbuf
+        ClientnodeMachine::CountedReference cm
     );
 
 };
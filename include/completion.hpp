@@ -0,0 +1,163 @@
+// completion.hpp
+
+/*
+ *   nuke-ms - Nuclear Messaging System
+ *   Copyright (C) 2012  Alexander Korsunsky
+ *
+ *   This program is free software: you can redistribute it and/or modify
+ *   it under the terms of the GNU General Public License as published by
+ *   the Free Software Foundation, version 3 of the License.
+ *
+ *   This program is distributed in the hope that it will be useful,
+ *   but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *   MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ *   GNU General Public License for more details.
+ *
+ *   You should have received a copy of the GNU General Public License
+ *   along with this program.  If not, see <http://www.gnu.org/licenses/>.
+*/
+
+/** @file completion.hpp
+* @ingroup common
+* @brief Completion handlers that can be stored in a std::function
+*
+* Operations taking a Boost.Asio completion token get a handler that can
+* only be moved and has to be invoked on its associated executor. An
+* operation that finishes somewhere else, e.g. in the state machine of the
+* ClientNode, stores the handler as a std::function and calls it when the
+* outcome is known.
+*/
+
+#ifndef COMPLETION_HPP
+#define COMPLETION_HPP
+
+#include <functional>
+#include <memory>
+#include <type_traits>
+#include <utility>
+
+#include <boost/asio/associated_executor.hpp>
+#include <boost/asio/execution/outstanding_work.hpp>
+#include <boost/asio/post.hpp>
+#include <boost/asio/prefer.hpp>
+
+namespace nuke_ms
+{
+
+/** @addtogroup common
+ * @{
+*/
+
+template <typename Signature, typename Handler, typename Executor>
+class PostedCompletion;
+
+/** Copyable wrapper of a completion handler.
+*
+* Calling the wrapper posts the handler with the arguments to the executor
+* associated with the handler. Only the first call has an effect. Until the
+* handler was invoked, the executor is kept from running out of work.
+*
+* @tparam Handler Type of the wrapped handler
+* @tparam Executor Type of the executor used if the handler has none
+* @tparam Args Arguments of the handler
+*/
+template <typename Handler, typename Executor, typename... Args>
+class PostedCompletion<void (Args...), Handler, Executor>
+{
+    typedef typename boost::asio::associated_executor<
+        Handler, Executor
+    >::type handler_executor_type;
+
+    typedef typename std::decay<decltype(
+        boost::asio::prefer(
+            std::declval<handler_executor_type>(),
+            boost::asio::execution::outstanding_work.tracked
+        )
+    )>::type work_executor_type;
+
+    /** Shared by all copies of the wrapper */
+    struct State
+    {
+        Handler handler;
+
+        /** Executor of the handler, tracking outstanding work */
+        work_executor_type work;
+
+        /** True if the wrapper was called */
+        bool called;
+
+        State(Handler&& _handler, const work_executor_type& _work)
+            : handler(std::move(_handler)), work{_work}, called{false}
+        {}
+    };
+
+    /** Invokes the handler, posted to its executor */
+    struct Invoker
+    {
+        std::shared_ptr<State> state;
+
+        template <typename... BoundArgs>
+        void operator() (BoundArgs&... args)
+        {
+            Handler handler(std::move(state->handler));
+            handler(std::move(args)...);
+        }
+    };
+
+    std::shared_ptr<State> state;
+
+public:
+    /** Constructor.
+    * @param handler The handler to be wrapped
+    * @param executor Executor to invoke the handler on, if the handler has
+    * no associated executor
+    */
+    PostedCompletion(Handler&& handler, const Executor& executor)
+    {
+        work_executor_type work = boost::asio::prefer(
+            boost::asio::get_associated_executor(handler, executor),
+            boost::asio::execution::outstanding_work.tracked
+        );
+
+        state = std::make_shared<State>(std::move(handler), work);
+    }
+
+    /** Post the handler with the arguments to its executor. */
+    void operator() (Args... args)
+    {
+        if (state->called)
+            return;
+
+        state->called = true;
+        boost::asio::post(state->work,
+            std::bind(Invoker{state}, std::move(args)...));
+    }
+};
+
+/** Wrap a completion handler into a std::function.
+*
+* @tparam Signature Signature of the handler, e.g.
+* void(boost::system::error_code)
+* @param handler The handler to be wrapped
+* @param executor Executor to invoke the handler on, if the handler has no
+* associated executor
+* @return Function posting the handler, see PostedCompletion
+*/
+template <typename Signature, typename Handler, typename Executor>
+inline std::function<Signature> makeCompletion(
+    Handler&& handler,
+    const Executor& executor
+)
+{
+    typedef typename std::decay<Handler>::type handler_type;
+
+    return PostedCompletion<Signature, handler_type, Executor>{
+        handler_type(std::forward<Handler>(handler)), executor
+    };
+}
+
+/**@}*/ // addtogroup common
+
+} // namespace nuke_ms
+
+#endif // ifndef COMPLETION_HPP
@@ -0,0 +1,130 @@
+// datagram.hpp
+
+/*
+ *   nuke-ms - Nuclear Messaging System
+ *   Copyright (C) 2012  Alexander Korsunsky
+ *
+ *   This program is free software: you can redistribute it and/or modify
+ *   it under the terms of the GNU General Public License as published by
+ *   the Free Software Foundation, version 3 of the License.
+ *
+ *   This program is distributed in the hope that it will be useful,
+ *   but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *   MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ *   GNU General Public License for more details.
+ *
+ *   You should have received a copy of the GNU General Public License
+ *   along with this program.  If not, see <http://www.gnu.org/licenses/>.
+*/
+
+/** @file datagram.hpp
+* @ingroup common
+* @brief UDP socket that receives and sends datagrams in batches
+*
+* Only available on Linux, where NUKE_MS_UDP_TRANSPORT is defined.
+*/
+
+#ifndef DATAGRAM_HPP
+#define DATAGRAM_HPP
+
+#include <cstddef>
+#include <memory>
+
+#include <boost/asio/buffer.hpp>
+#include <boost/asio/ip/udp.hpp>
+
+namespace nuke_ms
+{
+
+/** @addtogroup common
+ * @{
+*/
+
+/** UDP socket that moves many datagrams per system call.
+*
+* receive() fetches all waiting datagrams, up to batch_size, with a single
+* recvmmsg() call. sendToAll() hands the same datagram to many receivers
+* with one sendmmsg() call per batch_size receivers. Neither ever blocks;
+* wait for the socket to become readable with async_wait() on getSocket().
+*/
+class DatagramSocket
+{
+public:
+    typedef boost::asio::ip::udp::endpoint endpoint_type;
+
+    enum {
+        /** Largest datagram that is received. Fits into a single Ethernet
+        * frame, so datagrams of this size are never fragmented. */
+        max_datagram_size = 1472,
+
+        /** Most datagrams moved by a single system call */
+        batch_size = 64
+    };
+
+    /** Constructor.
+    * @param _socket Open UDP socket, usually bound to a port
+    */
+    explicit DatagramSocket(boost::asio::ip::udp::socket&& _socket);
+
+    DatagramSocket(DatagramSocket&&);
+    DatagramSocket& operator= (DatagramSocket&&);
+
+    /** Destructor. Closes the socket. */
+    ~DatagramSocket();
+
+    /** Get the socket, e.g. to wait for it or to set options */
+    boost::asio::ip::udp::socket& getSocket()
+    { return socket; }
+
+    /** Receive the waiting datagrams, without blocking.
+    * @param error Set to boost::asio::error::would_block if no datagram was
+    * waiting
+    * @return Number of datagrams received, at most batch_size
+    */
+    std::size_t receive(boost::system::error_code& error);
+
+    /** Get a datagram of the last receive(). Valid until the next call.
+    * Datagrams longer than max_datagram_size are cut off, see truncated().
+    * @param i Index of the datagram
+    */
+    boost::asio::const_buffer datagram(std::size_t i) const;
+
+    /** Get the sender of a datagram of the last receive() */
+    const endpoint_type& sender(std::size_t i) const;
+
+    /** Check if a datagram of the last receive() was longer than
+    * max_datagram_size */
+    bool truncated(std::size_t i) const;
+
+    /** Send the same datagram to many receivers, without blocking.
+    * A receiver the datagram can not be sent to, e.g. because it is
+    * unreachable, is skipped. If the send buffer of the socket is full, the
+    * remaining receivers are skipped as well.
+    *
+    * @param datagram The bytes to send
+    * @param receivers The receivers
+    * @param count Number of receivers
+    * @param error Set to the last error
+    * @return Number of receivers the datagram was sent to
+    */
+    std::size_t sendToAll(
+        const boost::asio::const_buffer& datagram,
+        const endpoint_type* receivers,
+        std::size_t count,
+        boost::system::error_code& error
+    );
+
+private:
+    struct Batch;
+
+    boost::asio::ip::udp::socket socket;
+
+    /** Buffers and message headers for the system calls */
+    std::unique_ptr<Batch> batch;
+};
+
+/**@}*/ // addtogroup common
+
+} // namespace nuke_ms
+
+#endif // ifndef DATAGRAM_HPP
@@ -0,0 +1,240 @@
+// handleralloc.hpp
+
+/*
+ *   nuke-ms - Nuclear Messaging System
+ *   Copyright (C) 2012  Alexander Korsunsky
+ *
+ *   This program is free software: you can redistribute it and/or modify
+ *   it under the terms of the GNU General Public License as published by
+ *   the Free Software Foundation, version 3 of the License.
+ *
+ *   This program is distributed in the hope that it will be useful,
+ *   but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *   MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ *   GNU General Public License for more details.
+ *
+ *   You should have received a copy of the GNU General Public License
+ *   along with this program.  If not, see <http://www.gnu.org/licenses/>.
+*/
+
+/** @file handleralloc.hpp
+* @ingroup common
+* @brief Recyclable memory for asynchronous operation handlers
+*
+* Every asynchronous operation of Boost.Asio allocates a small block of memory
+* to store the handler until the operation completes. For a chain of
+* operations on one connection (read header, read body, read header, ...)
+* only one of these blocks is in use at any time, so the same block can be
+* reused for the whole lifetime of the connection.
+*/
+
+#ifndef HANDLERALLOC_HPP
+#define HANDLERALLOC_HPP
+
+#include <cstddef>
+#include <memory>
+#include <new>
+#include <type_traits>
+#include <utility>
+
+#include <boost/asio/associated_allocator.hpp>
+#include <boost/asio/associated_executor.hpp>
+
+namespace nuke_ms
+{
+
+/** @addtogroup common
+ * @{
+*/
+
+/** Memory block for one handler at a time.
+*
+* If the block is in use or too small, memory is taken from the free store
+* instead.
+*/
+class HandlerMemory
+{
+public:
+    /** Size of the block. Large enough for a composed read or write
+    * operation with a handler bound to a few smart pointers. */
+    enum { block_size = 512 };
+
+private:
+    /** Storage for the handler */
+    typename std::aligned_storage<block_size>::type storage;
+
+    /** True if the storage is currently handed out */
+    bool in_use;
+
+public:
+    /** Constructor. Creates an unused block. */
+    HandlerMemory()
+        : in_use{false}
+    {}
+
+    HandlerMemory(const HandlerMemory&) = delete;
+    HandlerMemory& operator= (const HandlerMemory&) = delete;
+
+    /** Get memory for a handler.
+    * @param size Number of bytes needed
+    * @return Pointer to the memory
+    */
+    void* allocate(std::size_t size)
+    {
+        if (!in_use && size <= sizeof(storage))
+        {
+            in_use = true;
+            return &storage;
+        }
+
+        return ::operator new(size);
+    }
+
+    /** Give back memory retrieved with allocate().
+    * @param pointer Pointer returned by allocate()
+    */
+    void deallocate(void* pointer)
+    {
+        if (pointer == &storage)
+            in_use = false;
+        else
+            ::operator delete(pointer);
+    }
+
+    /** Check if the block is currently handed out. */
+    bool inUse() const
+    { return in_use; }
+};
+
+
+/** Standard allocator that takes its memory from a HandlerMemory block.
+* @tparam T Type of the allocated objects
+*/
+template <typename T>
+class HandlerAllocator
+{
+    template <typename U> friend class HandlerAllocator;
+
+    /** Where the memory comes from */
+    HandlerMemory* memory;
+
+public:
+    typedef T value_type;
+
+    /** Constructor.
+    * @param _memory Where the memory comes from
+    */
+    explicit HandlerAllocator(HandlerMemory& _memory)
+        : memory{&_memory}
+    {}
+
+    /** Converting copy constructor. */
+    template <typename U>
+    HandlerAllocator(const HandlerAllocator<U>& other)
+        : memory{other.memory}
+    {}
+
+    T* allocate(std::size_t n)
+    { return static_cast<T*>(memory->allocate(sizeof(T) * n)); }
+
+    void deallocate(T* pointer, std::size_t /* n */)
+    { memory->deallocate(pointer); }
+
+    template <typename U>
+    bool operator== (const HandlerAllocator<U>& other) const
+    { return memory == other.memory; }
+
+    template <typename U>
+    bool operator!= (const HandlerAllocator<U>& other) const
+    { return memory != other.memory; }
+};
+
+
+/** Handler wrapper that makes Boost.Asio allocate from a HandlerMemory block.
+*
+* The wrapper shares ownership of the memory block, so the block stays alive
+* until the last operation using it is finished, even if the owner of the
+* block is gone before.
+*
+* @tparam Handler Type of the wrapped handler
+*/
+template <typename Handler>
+class AllocHandler
+{
+    /** Where the memory comes from */
+    std::shared_ptr<HandlerMemory> memory;
+
+    /** The wrapped handler */
+    Handler handler;
+
+public:
+    typedef HandlerAllocator<void> allocator_type;
+
+    /** Constructor.
+    * @param _memory Where the memory comes from
+    * @param _handler The handler to be wrapped
+    */
+    AllocHandler(std::shared_ptr<HandlerMemory> _memory, Handler _handler)
+        : memory{std::move(_memory)}, handler(std::move(_handler))
+    {}
+
+    /** Get the allocator for Boost.Asio. */
+    allocator_type get_allocator() const
+    { return allocator_type{*memory}; }
+
+    /** Get the wrapped handler. */
+    const Handler& wrapped() const
+    { return handler; }
+
+    /** Invoke the wrapped handler. */
+    template <typename... Args>
+    void operator() (Args&&... args)
+    { handler(std::forward<Args>(args)...); }
+};
+
+/** Wrap a handler so that its memory comes from a HandlerMemory block.
+*
+* @param memory Where the memory comes from
+* @param handler The handler to be wrapped
+* @return The wrapped handler
+*/
+template <typename Handler>
+inline AllocHandler<typename std::decay<Handler>::type> makeAllocHandler(
+    const std::shared_ptr<HandlerMemory>& memory,
+    Handler&& handler
+)
+{
+    return AllocHandler<typename std::decay<Handler>::type>{
+        memory, std::forward<Handler>(handler)
+    };
+}
+
+/**@}*/ // addtogroup common
+
+} // namespace nuke_ms
+
+
+namespace boost
+{
+namespace asio
+{
+
+/** Keep the executor of a handler wrapped in an AllocHandler. */
+template <typename Handler, typename Executor>
+struct associated_executor<nuke_ms::AllocHandler<Handler>, Executor>
+{
+    typedef typename associated_executor<Handler, Executor>::type type;
+
+    static type get(
+        const nuke_ms::AllocHandler<Handler>& h,
+        const Executor& ex = Executor()
+    )
+    {
+        return associated_executor<Handler, Executor>::get(h.wrapped(), ex);
+    }
+};
+
+} // namespace asio
+} // namespace boost
+
+#endif // ifndef HANDLERALLOC_HPP
@@ -0,0 +1,107 @@
+// hashring.hpp
+
+/*
+ *   nuke-ms - Nuclear Messaging System
+ *   Copyright (C) 2012  Alexander Korsunsky
+ *
+ *   This program is free software: you can redistribute it and/or modify
+ *   it under the terms of the GNU General Public License as published by
+ *   the Free Software Foundation, version 3 of the License.
+ *
+ *   This program is distributed in the hope that it will be useful,
+ *   but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *   MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ *   GNU General Public License for more details.
+ *
+ *   You should have received a copy of the GNU General Public License
+ *   along with this program.  If not, see <http://www.gnu.org/licenses/>.
+*/
+
+/** @file hashring.hpp
+* @ingroup common
+* @brief Consistent hashing of users onto servers
+*/
+
+#ifndef HASHRING_HPP
+#define HASHRING_HPP
+
+#include <cstdint>
+#include <map>
+#include <set>
+
+#include "neartypes.hpp"
+
+namespace nuke_ms
+{
+
+/** @addtogroup common
+ * @{
+*/
+
+/** Assigns every user a home server by consistent hashing.
+*
+* Each server is placed on a ring of hash values at many points. A user
+* belongs to the server of the first point at or after the hash of its
+* UniqueUserID. When a server is added, it takes over about 1/N of the
+* users, all from other servers; no other user changes its home. When a
+* server is removed, only its own users move.
+*
+* Servers are identified by UniqueUserID as well. All servers that build
+* a ring of the same servers assign every user the same home.
+*/
+class HashRing
+{
+public:
+    /** Points on the ring per server. More points spread the users more
+    * evenly. */
+    enum { default_replicas = 128 };
+
+    /** Constructor. Creates an empty ring.
+    * @param _replicas Points on the ring per server
+    */
+    explicit HashRing(unsigned _replicas = default_replicas)
+        : replicas{_replicas}
+    {}
+
+    /** Add a server. Adding a server twice has no effect. */
+    void addNode(const UniqueUserID& node);
+
+    /** Remove a server. Removing an unknown server has no effect. */
+    void removeNode(const UniqueUserID& node);
+
+    /** Check whether a server is on the ring */
+    bool contains(const UniqueUserID& node) const
+    { return nodes.count(node.id) != 0; }
+
+    /** Number of servers on the ring */
+    std::size_t size() const
+    { return nodes.size(); }
+
+    bool empty() const
+    { return nodes.empty(); }
+
+    /** Get the home server of a user.
+    * @param user The user
+    * @return The home server, or UniqueUserID::user_id_none if the ring is
+    * empty
+    */
+    UniqueUserID nodeFor(const UniqueUserID& user) const;
+
+private:
+    unsigned replicas;
+
+    /** The servers on the ring */
+    std::set<unsigned long long> nodes;
+
+    /** The points on the ring and the server of each */
+    std::map<std::uint64_t, unsigned long long> points;
+
+    /** Scatter a value over the whole ring */
+    static std::uint64_t hash(std::uint64_t x);
+};
+
+/**@}*/ // addtogroup common
+
+} // namespace nuke_ms
+
+#endif // ifndef HASHRING_HPP
@@ -0,0 +1,183 @@
+// loopback.hpp
+
+/*
+ *   nuke-ms - Nuclear Messaging System
+ *   Copyright (C) 2012  Alexander Korsunsky
+ *
+ *   This program is free software: you can redistribute it and/or modify
+ *   it under the terms of the GNU General Public License as published by
+ *   the Free Software Foundation, version 3 of the License.
+ *
+ *   This program is distributed in the hope that it will be useful,
+ *   but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *   MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ *   GNU General Public License for more details.
+ *
+ *   You should have received a copy of the GNU General Public License
+ *   along with this program.  If not, see <http://www.gnu.org/licenses/>.
+*/
+
+/** @file loopback.hpp
+* @ingroup common
+* @brief Transport between two parts of the same process
+*/
+
+#ifndef LOOPBACK_HPP
+#define LOOPBACK_HPP
+
+#include <functional>
+#include <memory>
+#include <string>
+#include <utility>
+
+#include "transport.hpp"
+
+namespace nuke_ms
+{
+
+/** @addtogroup common
+ * @{
+*/
+
+/** Transport within a process, without the kernel.
+*
+* The two ends of a connection share a buffer for each direction, protected
+* by a mutex. The ends may belong to different io_services run by different
+* threads; the handlers of an end are always run by its own io_service.
+*
+* A writer only has to wait when the buffer of its direction is full. When
+* one end is closed, the other end reads the rest of the buffered bytes and
+* then boost::asio::error::eof, and its writes fail with
+* boost::asio::error::broken_pipe.
+*
+* Waiting operations are held by the connection, not by the io_service, so
+* destroying the io_service does not free them. Close the ends first.
+*/
+class LoopbackTransport : public TransportImpl
+{
+public:
+    /** Bytes buffered in each direction before writers have to wait */
+    enum { buffer_size = 0x40000 };
+
+    /** Create a connected pair of ends.
+    * @param io_service1 The io_service running the handlers of the first end
+    * @param io_service2 The io_service running the handlers of the second end
+    * @return Both ends of the connection
+    */
+    static std::pair<std::unique_ptr<TransportImpl>, std::unique_ptr<TransportImpl>>
+    createPair(
+        boost::asio::io_service& io_service1,
+        boost::asio::io_service& io_service2
+    );
+
+    /** Destructor. Closes the connection. */
+    ~LoopbackTransport();
+
+    void asyncReadSome(
+        const boost::asio::mutable_buffer& buffer,
+        TransportOp* op
+    );
+
+    void asyncWriteSome(
+        const boost::asio::const_buffer& buffer,
+        TransportOp* op
+    );
+
+    void shutdown(boost::system::error_code& error);
+
+    void close(boost::system::error_code& error);
+
+    bool isOpen() const;
+
+private:
+    struct Shared;
+
+    /** State of the connection, shared by both ends */
+    std::shared_ptr<Shared> shared;
+
+    /** Which end this is, 0 or 1 */
+    int side;
+
+    /** The io_service running the handlers of this end */
+    boost::asio::io_service& io_service;
+
+    /** False after close() */
+    bool open;
+
+    LoopbackTransport(
+        std::shared_ptr<Shared> _shared,
+        int _side,
+        boost::asio::io_service& _io_service
+    );
+
+    /** Stop both directions, complete own pending operations with error */
+    void stop(const boost::system::error_code& error);
+};
+
+
+/** Accepts LoopbackTransport connections under a name.
+*
+* The name is registered for the whole process while the listener exists.
+* Clients connect with LoopbackListener::connect(), e.g. a ClientNode with
+* the location "inproc:<name>".
+*/
+class LoopbackListener
+{
+public:
+    /** Called for every new connection, by the io_service of the listener */
+    typedef std::function<void(Transport&&)> AcceptHandler;
+
+    /** Constructor. Registers the name.
+    * @param io_service The io_service running the server end of connections
+    * @param name Name clients connect to
+    * @param handler Called with the server end of every new connection
+    * @throws boost::system::system_error with
+    * boost::asio::error::address_in_use if the name is already registered
+    */
+    LoopbackListener(
+        boost::asio::io_service& io_service,
+        const std::string& name,
+        AcceptHandler handler
+    );
+
+    /** Destructor. Unregisters the name. Connections that have not been
+    * handed to the accept handler yet are closed. Destroy the listener from
+    * a handler of its io_service or while the io_service is not running, so
+    * the accept handler is not running at the same time. */
+    ~LoopbackListener();
+
+    LoopbackListener(const LoopbackListener&) = delete;
+    LoopbackListener& operator= (const LoopbackListener&) = delete;
+
+    /** Connect to a listener.
+    * The server end is handed to the accept handler of the listener later,
+    * the client end can be used right away.
+    *
+    * @param io_service The io_service running the handlers of the client end
+    * @param name Name of the listener
+    * @param error Set to boost::asio::error::connection_refused if no
+    * listener has that name
+    * @return The client end of the connection, or nullptr on error
+    */
+    static std::unique_ptr<TransportImpl> connect(
+        boost::asio::io_service& io_service,
+        const std::string& name,
+        boost::system::error_code& error
+    );
+
+private:
+    struct Registration;
+    struct Registry;
+
+    /** Get the listeners of the process */
+    static Registry& registry();
+
+    /** Entry in the registry, shared with connections not yet accepted */
+    std::shared_ptr<Registration> registration;
+};
+
+/**@}*/ // addtogroup common
+
+} // namespace nuke_ms
+
+#endif // ifndef LOOPBACK_HPP
@@ -0,0 +1,271 @@
+// metrics.hpp
+
+/*
+ *   nuke-ms - Nuclear Messaging System
+ *   Copyright (C) 2012  Alexander Korsunsky
+ *
+ *   This program is free software: you can redistribute it and/or modify
+ *   it under the terms of the GNU General Public License as published by
+ *   the Free Software Foundation, version 3 of the License.
+ *
+ *   This program is distributed in the hope that it will be useful,
+ *   but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *   MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ *   GNU General Public License for more details.
+ *
+ *   You should have received a copy of the GNU General Public License
+ *   along with this program.  If not, see <http://www.gnu.org/licenses/>.
+*/
+
+/** @file metrics.hpp
+* @ingroup common
+* @brief Counters, gauges and latency histograms for runtime statistics
+*
+*/
+
+#ifndef METRICS_HPP
+#define METRICS_HPP
+
+#include <atomic>
+#include <cstdint>
+#include <cstddef>
+#include <map>
+#include <memory>
+#include <mutex>
+#include <ostream>
+#include <string>
+
+namespace nuke_ms
+{
+
+/** @addtogroup common
+ * @{
+*/
+
+/** Monotonic counter that can be incremented by many threads at once.
+*
+* The value is split into several stripes on separate cache lines. Every
+* thread increments its own stripe, so threads don't compete for the same
+* cache line. Reading the counter sums up all stripes.
+*/
+class Counter
+{
+public:
+    /** Number of stripes */
+    enum { num_stripes = 8 };
+
+private:
+    struct alignas(64) Stripe
+    {
+        std::atomic<std::uint64_t> value;
+    };
+
+    Stripe stripes[num_stripes];
+
+    /** Get the stripe of the calling thread */
+    static std::size_t stripeIndex();
+
+public:
+    /** Constructor. Initializes the counter to zero. */
+    Counter()
+    {
+        for (Stripe& s : stripes)
+            s.value.store(0, std::memory_order_relaxed);
+    }
+
+    Counter(const Counter&) = delete;
+    Counter& operator= (const Counter&) = delete;
+
+    /** Increment the counter. */
+    void add(std::uint64_t n = 1)
+    {
+        stripes[stripeIndex()].value.fetch_add(n, std::memory_order_relaxed);
+    }
+
+    /** Get the current value. */
+    std::uint64_t value() const
+    {
+        std::uint64_t sum = 0;
+        for (const Stripe& s : stripes)
+            sum += s.value.load(std::memory_order_relaxed);
+        return sum;
+    }
+};
+
+
+/** A value that can go up and down, like the length of a queue. */
+class Gauge
+{
+    std::atomic<std::int64_t> val;
+
+public:
+    /** Constructor. Initializes the gauge to zero. */
+    Gauge()
+        : val{0}
+    {}
+
+    Gauge(const Gauge&) = delete;
+    Gauge& operator= (const Gauge&) = delete;
+
+    void add(std::int64_t n = 1)
+    { val.fetch_add(n, std::memory_order_relaxed); }
+
+    void sub(std::int64_t n = 1)
+    { val.fetch_sub(n, std::memory_order_relaxed); }
+
+    void set(std::int64_t n)
+    { val.store(n, std::memory_order_relaxed); }
+
+    std::int64_t value() const
+    { return val.load(std::memory_order_relaxed); }
+};
+
+
+/** Histogram of durations in nanoseconds.
+*
+* Values are sorted into logarithmic buckets with sub_buckets linear
+* subdivisions each, so every value is recorded with a relative error of at
+* most 1/sub_buckets. Recording a value is lock-free and does not allocate.
+*/
+class LatencyHistogram
+{
+public:
+    /** Linear subdivisions per power of two */
+    enum { sub_buckets = 8 };
+
+    /** Values from 2^max_exponent ns (about 18 minutes) on are recorded in
+    * the last bucket */
+    enum { max_exponent = 40 };
+
+    /** Total number of buckets */
+    enum { num_buckets = (max_exponent - 2) * sub_buckets };
+
+private:
+    std::atomic<std::uint64_t> buckets[num_buckets];
+    std::atomic<std::uint64_t> total_count;
+    std::atomic<std::uint64_t> total_sum;
+
+    /** Find the bucket for a value */
+    static std::size_t bucketIndex(std::uint64_t value);
+
+    /** Largest value that is sorted into a bucket */
+    static std::uint64_t bucketUpperBound(std::size_t index);
+
+public:
+    /** Constructor. Creates an empty histogram. */
+    LatencyHistogram();
+
+    LatencyHistogram(const LatencyHistogram&) = delete;
+    LatencyHistogram& operator= (const LatencyHistogram&) = delete;
+
+    /** Record a duration.
+    * @param ns The duration in nanoseconds
+    */
+    void record(std::uint64_t ns)
+    {
+        buckets[bucketIndex(ns)].fetch_add(1, std::memory_order_relaxed);
+        total_count.fetch_add(1, std::memory_order_relaxed);
+        total_sum.fetch_add(ns, std::memory_order_relaxed);
+    }
+
+    /** Number of recorded values */
+    std::uint64_t count() const
+    { return total_count.load(std::memory_order_relaxed); }
+
+    /** Sum of all recorded values */
+    std::uint64_t sum() const
+    { return total_sum.load(std::memory_order_relaxed); }
+
+    /** Get a percentile.
+    * @param quantile The quantile, between 0 and 1
+    * @return An upper bound for the quantile, or 0 if nothing was recorded
+    */
+    std::uint64_t percentile(double quantile) const;
+};
+
+
+/** Statistics of a single connection.
+*
+* A connection is only handled by one thread at a time, so the fields are
+* plain integers. Totals over all connections are computed by adding up the
+* statistics of the connections when they are read.
+*/
+struct ConnectionMetrics
+{
+    std::uint64_t messages_in; /**< Complete packets received */
+    std::uint64_t messages_out; /**< Complete packets sent */
+    std::uint64_t bytes_in; /**< Bytes received, including headers */
+    std::uint64_t bytes_out; /**< Bytes sent, including headers */
+    std::uint64_t dropped_frames; /**< Packets rejected as invalid */
+    std::uint64_t pending_writes; /**< Write operations not yet completed */
+
+    ConnectionMetrics()
+        : messages_in{0}, messages_out{0}, bytes_in{0}, bytes_out{0},
+        dropped_frames{0}, pending_writes{0}
+    {}
+
+    /** Add the statistics of another connection. */
+    ConnectionMetrics& operator+= (const ConnectionMetrics& other)
+    {
+        messages_in += other.messages_in;
+        messages_out += other.messages_out;
+        bytes_in += other.bytes_in;
+        bytes_out += other.bytes_out;
+        dropped_frames += other.dropped_frames;
+        pending_writes += other.pending_writes;
+        return *this;
+    }
+
+    /** Write the statistics in the format of MetricsRegistry::write().
+    * @param out Where the statistics are written to
+    * @param prefix Put in front of every metric name
+    * @param labels Put behind every metric name, e.g. {conn="3"}
+    */
+    void write(
+        std::ostream& out,
+        const std::string& prefix,
+        const std::string& labels = std::string{}
+    ) const;
+};
+
+
+/** Collection of named metrics.
+*
+* Metrics are created the first time they are requested and live as long as
+* the registry. Look them up once and keep the reference, the lookup takes a
+* lock.
+*/
+class MetricsRegistry
+{
+    mutable std::mutex registry_mutex;
+
+    std::map<std::string, std::unique_ptr<Counter>> counters;
+    std::map<std::string, std::unique_ptr<Gauge>> gauges;
+    std::map<std::string, std::unique_ptr<LatencyHistogram>> histograms;
+
+public:
+    MetricsRegistry() = default;
+    MetricsRegistry(const MetricsRegistry&) = delete;
+    MetricsRegistry& operator= (const MetricsRegistry&) = delete;
+
+    /** Get a counter, create it if it doesn't exist yet. */
+    Counter& counter(const std::string& name);
+
+    /** Get a gauge, create it if it doesn't exist yet. */
+    Gauge& gauge(const std::string& name);
+
+    /** Get a histogram, create it if it doesn't exist yet. */
+    LatencyHistogram& histogram(const std::string& name);
+
+    /** Write all metrics as text, one "name value" pair per line.
+    * For each histogram, the count, sum and the 50th, 90th, 99th and
+    * 99.9th percentile are written.
+    */
+    void write(std::ostream& out) const;
+};
+
+/**@}*/ // addtogroup common
+
+} // namespace nuke_ms
+
+#endif // ifndef METRICS_HPP
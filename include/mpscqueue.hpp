@@ -0,0 +1,164 @@
+// mpscqueue.hpp
+
+/*
+ *   nuke-ms - Nuclear Messaging System
+ *   Copyright (C) 2012  Alexander Korsunsky
+ *
+ *   This program is free software: you can redistribute it and/or modify
+ *   it under the terms of the GNU General Public License as published by
+ *   the Free Software Foundation, version 3 of the License.
+ *
+ *   This program is distributed in the hope that it will be useful,
+ *   but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *   MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ *   GNU General Public License for more details.
+ *
+ *   You should have received a copy of the GNU General Public License
+ *   along with this program.  If not, see <http://www.gnu.org/licenses/>.
+*/
+
+/** @file mpscqueue.hpp
+* @ingroup common
+* @brief Lock-free multiple producer, single consumer queue
+*
+*/
+
+#ifndef MPSCQUEUE_HPP
+#define MPSCQUEUE_HPP
+
+#include <atomic>
+#include <memory>
+
+namespace nuke_ms
+{
+
+/** @addtogroup common
+ * @{
+*/
+
+/** Base class for elements of a MPSCQueue.
+* Derive from this class to make objects of your class queueable.
+*/
+struct MPSCQueueNode
+{
+    /** Link to the next node in the queue */
+    std::atomic<MPSCQueueNode*> mpsc_next;
+
+    MPSCQueueNode() : mpsc_next{nullptr} {}
+
+    MPSCQueueNode(const MPSCQueueNode&) = delete;
+    MPSCQueueNode& operator= (const MPSCQueueNode&) = delete;
+};
+
+
+/** Intrusive lock-free multiple producer, single consumer queue.
+*
+* Any number of threads may push elements concurrently, but only one thread
+* at a time may pop elements. Pushing is wait-free, popping is lock-free.
+* The queue does not allocate any memory, the links are stored in the
+* elements which must derive from MPSCQueueNode.
+*
+* The algorithm is Dmitry Vyukov's intrusive MPSC node-based queue.
+*
+* @note pop() can return an empty pointer while another thread is in the
+* middle of a push(). The pushing thread must make sure the consumer will
+* look again after push() has returned.
+*
+* @tparam T Type of the elements. Must be derived from MPSCQueueNode.
+*/
+template <typename T>
+class MPSCQueue
+{
+    /** The node that was pushed last. Touched by producers. */
+    std::atomic<MPSCQueueNode*> head;
+
+    /** The next node to be popped. Only touched by the consumer. */
+    MPSCQueueNode* tail;
+
+    /** Placeholder node, so the queue is never really empty */
+    MPSCQueueNode stub;
+
+    /** Link a node to the head of the queue */
+    void pushNode(MPSCQueueNode* node)
+    {
+        node->mpsc_next.store(nullptr, std::memory_order_relaxed);
+        MPSCQueueNode* prev = head.exchange(node, std::memory_order_acq_rel);
+        prev->mpsc_next.store(node, std::memory_order_release);
+    }
+
+public:
+    /** Constructor. Creates an empty queue. */
+    MPSCQueue()
+        : head{&stub}, tail{&stub}
+    {}
+
+    /** Destructor. Destroys all elements that are still in the queue. */
+    ~MPSCQueue()
+    {
+        while (pop())
+        {}
+    }
+
+    MPSCQueue(const MPSCQueue&) = delete;
+    MPSCQueue& operator= (const MPSCQueue&) = delete;
+
+    /** Append an element to the queue.
+    * This function can be called by any thread at any time.
+    *
+    * @param element The element to be queued. The queue takes ownership.
+    */
+    void push(std::unique_ptr<T> element)
+    {
+        pushNode(element.release());
+    }
+
+    /** Remove the oldest element from the queue.
+    * Only one thread at a time may call this function.
+    *
+    * @return The element, or an empty pointer if the queue is empty.
+    */
+    std::unique_ptr<T> pop()
+    {
+        MPSCQueueNode* t = tail;
+        MPSCQueueNode* next = t->mpsc_next.load(std::memory_order_acquire);
+
+        // skip the placeholder
+        if (t == &stub)
+        {
+            if (!next)
+                return std::unique_ptr<T>{};
+
+            tail = t = next;
+            next = next->mpsc_next.load(std::memory_order_acquire);
+        }
+
+        if (next)
+        {
+            tail = next;
+            return std::unique_ptr<T>{static_cast<T*>(t)};
+        }
+
+        // a producer has swapped the head but not yet linked its node
+        if (t != head.load(std::memory_order_acquire))
+            return std::unique_ptr<T>{};
+
+        // t is the last element. Put the placeholder behind it, so it can be
+        // unlinked.
+        pushNode(&stub);
+
+        next = t->mpsc_next.load(std::memory_order_acquire);
+        if (next)
+        {
+            tail = next;
+            return std::unique_ptr<T>{static_cast<T*>(t)};
+        }
+
+        return std::unique_ptr<T>{};
+    }
+};
+
+/**@}*/ // addtogroup common
+
+} // namespace nuke_ms
+
+#endif // ifndef MPSCQUEUE_HPP
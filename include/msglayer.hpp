@@ -358,6 +358,10 @@ struct SegmentationLayerBase
     /** Header length */
     static constexpr std::size_t header_length = 4;
 
+    /** Size of the largest packet that is accepted, header included.
+    * A receiver drops the connection on a larger one. */
+    static constexpr byte_traits::uint2b_t max_packetsize = 0x8FFF;
+
     /** Type representing the header of a packet. */
     struct HeaderType {
         byte_traits::uint2b_t packetsize /**< Size of the packet */;
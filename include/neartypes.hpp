@@ -103,6 +103,10 @@ struct NearUserMessage : BasicMessageLayer<NearUserMessage>
     /** Type for a more or less unique message identifier */
     typedef byte_traits::uint4b_t msg_id_t;
 
+    /** Identifier that stands for no message. The identifiers a ClientNode
+    * assigns start at 1. */
+    static constexpr msg_id_t msg_id_none = 0;
+
     /**< Layer Identifier */
     static constexpr byte_traits::byte_t LAYER_ID = 0x41;
     static constexpr std::size_t header_length =
@@ -213,13 +217,221 @@ ByteOutputIterator NearUserMessage::fillSerialized(ByteOutputIterator it) const
 }
 
 
+/** Request to resume the message stream after a reconnect.
+ *
+ * A client that lost its connection sends this message right after
+ * reconnecting. It carries the identifier and sender of the last message the
+ * client received, so the server can replay only the messages that were
+ * distributed after that one instead of the whole history.
+*/
+struct NearResumeRequest : BasicMessageLayer<NearResumeRequest>
+{
+    /**< Layer Identifier */
+    static constexpr byte_traits::byte_t LAYER_ID = 0x42;
+    static constexpr std::size_t header_length =
+        1 + sizeof(NearUserMessage::msg_id_t) + UniqueUserID::id_length;
+
+    /** Construct a resume request
+     * @param last_msg_id Identifier of the last message that was received
+     * @param last_sender Sender of the last message that was received
+    */
+    NearResumeRequest(
+        NearUserMessage::msg_id_t last_msg_id = NearUserMessage::msg_id_t{},
+        const UniqueUserID& last_sender = UniqueUserID{}
+    )
+        : _last_msg_id{last_msg_id}, _last_sender{last_sender}
+    { }
+
+    /** Construct from serialized Data
+     *
+     * @param data Serialized Data layer
+     *
+     * @throw UndersizedPacketError when the datasize is less than the packet
+     * size
+     * @throw InvalidHeaderError if the first byte of the data does not contain
+     * the correct layer identifier.
+    */
+    NearResumeRequest(const SerializedData& data);
+
+    // implementing base class version
+    std::size_t size() const
+    { return header_length; }
+
+    // implementing base class version
+    template <typename ByteOutputIterator>
+    ByteOutputIterator fillSerialized(ByteOutputIterator it) const;
+
+    /** ID of the last message the client received */
+    NearUserMessage::msg_id_t _last_msg_id;
+
+    /** Sender of the last message the client received */
+    UniqueUserID _last_sender;
+};
+
+
+template <typename ByteOutputIterator>
+ByteOutputIterator NearResumeRequest::fillSerialized(ByteOutputIterator it) const
+{
+    // first byte is layer identifier
+    *it++ = static_cast<byte_traits::byte_t>(LAYER_ID);
+
+    // next four bytes are the message id
+    it = writebytes(it, to_netbo(_last_msg_id));
+
+    // and the sender of that message
+    return _last_sender.fillSerialized(it);
+}
+
+
+/** Greeting on a link between two servers.
+ *
+ * A server that connects to another server sends this message first, so
+ * it is treated as a node of the federation instead of a client. The other
+ * server answers with its own greeting.
+*/
+struct NodeHello : BasicMessageLayer<NodeHello>
+{
+    /**< Layer Identifier */
+    static constexpr byte_traits::byte_t LAYER_ID = 0x50;
+    static constexpr std::size_t header_length = 1 + UniqueUserID::id_length;
+
+    /** Construct a greeting
+     * @param node_id Identifier of the sending server
+    */
+    NodeHello(const UniqueUserID& node_id = UniqueUserID{})
+        : _node_id{node_id}
+    { }
+
+    /** Construct from serialized Data
+     *
+     * @param data Serialized Data layer
+     *
+     * @throw UndersizedPacketError when the datasize is less than the packet
+     * size
+     * @throw InvalidHeaderError if the first byte of the data does not contain
+     * the correct layer identifier.
+    */
+    NodeHello(const SerializedData& data);
+
+    // implementing base class version
+    std::size_t size() const
+    { return header_length; }
+
+    // implementing base class version
+    template <typename ByteOutputIterator>
+    ByteOutputIterator fillSerialized(ByteOutputIterator it) const;
+
+    /** Identifier of the sending server */
+    UniqueUserID _node_id;
+};
+
+
+template <typename ByteOutputIterator>
+ByteOutputIterator NodeHello::fillSerialized(ByteOutputIterator it) const
+{
+    // first byte is layer identifier
+    *it++ = static_cast<byte_traits::byte_t>(LAYER_ID);
+
+    return _node_id.fillSerialized(it);
+}
+
+
+/** A message relayed between the servers of a federation.
+ *
+ * The server a message was first received by assigns it an identifier,
+ * counting up from its start. Together with the identifier of that server,
+ * the origin, it lets every other server recognize copies of the message
+ * arriving over more than one link.
+*/
+struct RelayedMessage : BasicMessageLayer<RelayedMessage>
+{
+    /** Type of the identifier assigned by the origin */
+    typedef byte_traits::uint4b_t relay_id_t;
+
+    /**< Layer Identifier */
+    static constexpr byte_traits::byte_t LAYER_ID = 0x51;
+    static constexpr std::size_t header_length =
+        1 + UniqueUserID::id_length + sizeof(relay_id_t);
+
+    /** Wrap a message for relaying
+     * @param origin Identifier of the server the message was received by
+     * @param relay_id Identifier assigned to the message by the origin
+     * @param inner_layer The payload of the packet received from the client
+    */
+    RelayedMessage(
+        const UniqueUserID& origin,
+        relay_id_t relay_id,
+        SerializedData&& inner_layer
+    )
+        : _origin{origin}, _relay_id{relay_id},
+            _inner_layer{std::move(inner_layer)}
+    { }
+
+    /** Construct from serialized Data. The inner layer shares the memory
+     * of data.
+     *
+     * @param data Serialized Data layer
+     *
+     * @throw UndersizedPacketError when the datasize is less than the minimum
+     * packet header
+     * @throw InvalidHeaderError if the first byte of the data does not contain
+     * the correct layer identifier.
+    */
+    RelayedMessage(const SerializedData& data);
+
+    // implementing base class version
+    std::size_t size() const
+    { return header_length + _inner_layer.size(); }
+
+    // implementing base class version
+    template <typename ByteOutputIterator>
+    ByteOutputIterator fillSerialized(ByteOutputIterator it) const;
+
+    /** Server the message was first received by */
+    UniqueUserID _origin;
+
+    /** Identifier assigned by the origin */
+    relay_id_t _relay_id;
+
+    /** The payload of the packet received from the client */
+    SerializedData _inner_layer;
+};
+
+
+template <typename ByteOutputIterator>
+ByteOutputIterator RelayedMessage::fillSerialized(ByteOutputIterator it) const
+{
+    // first byte is layer identifier
+    *it++ = static_cast<byte_traits::byte_t>(LAYER_ID);
+
+    // the origin and the identifier it assigned
+    it = _origin.fillSerialized(it);
+    it = writebytes(it, to_netbo(_relay_id));
+
+    // the rest is the relayed payload
+    return _inner_layer.fillSerialized(it);
+}
+
+
 /**@}*/ // addtogroup common
 
 extern template class BasicMessageLayer<NearUserMessage>;
 extern template class SegmentationLayer<NearUserMessage>;
+extern template class BasicMessageLayer<NearResumeRequest>;
+extern template class SegmentationLayer<NearResumeRequest>;
+extern template class BasicMessageLayer<NodeHello>;
+extern template class SegmentationLayer<NodeHello>;
+extern template class BasicMessageLayer<RelayedMessage>;
+extern template class SegmentationLayer<RelayedMessage>;
 
 extern template byte_traits::byte_sequence::iterator
 NearUserMessage::fillSerialized(byte_traits::byte_sequence::iterator it) const;
+extern template byte_traits::byte_sequence::iterator
+NearResumeRequest::fillSerialized(byte_traits::byte_sequence::iterator it) const;
+extern template byte_traits::byte_sequence::iterator
+NodeHello::fillSerialized(byte_traits::byte_sequence::iterator it) const;
+extern template byte_traits::byte_sequence::iterator
+RelayedMessage::fillSerialized(byte_traits::byte_sequence::iterator it) const;
 
 
 } // namespace nuke_ms
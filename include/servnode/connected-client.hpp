@@ -22,11 +22,17 @@
 
 #include <memory>
 #include <array>
+#include <deque>
 #include <functional>
 
+#include <boost/asio/async_result.hpp>
 #include <boost/asio/ip/tcp.hpp>
 
+#include "completion.hpp"
 #include "neartypes.hpp"
+#include "handleralloc.hpp"
+#include "metrics.hpp"
+#include "transport.hpp"
 
 namespace nuke_ms
 {
@@ -52,6 +58,27 @@ typedef int connection_id_t;
 * Slots:
 *  - shutdown(): Shutdown connection and disconnect
 *  - sendPacket(): Send packet to client
+*
+* Instead of the callbacks, asyncSend() and asyncReceive() can be used to
+* wait for the outcome. They take a Boost.Asio completion token, e.g.
+* boost::asio::use_awaitable with a C++20 compiler:
+*
+* @code
+* boost::asio::awaitable<void> echo(std::shared_ptr<ConnectedClient> client)
+* {
+*     using boost::asio::use_awaitable;
+*
+*     while (true)
+*     {
+*         std::shared_ptr<SerializedData> data =
+*             co_await client->asyncReceive(use_awaitable);
+*         co_await client->asyncSend(
+*             SegmentationLayer<SerializedData>{std::move(*data)},
+*             use_awaitable
+*         );
+*     }
+* }
+* @endcode
 */
 class ConnectedClient
     : public std::enable_shared_from_this<ConnectedClient>
@@ -94,7 +121,7 @@ public:
 
     /** Destructor.
     *
-    * Disconnects the socket.
+    * Disconnects the transport.
     */
     ~ConnectedClient();
 
@@ -128,8 +155,38 @@ public:
         const Signals::Disconnected& disconnected_callback
     );
 
+    /** Create an instance of a ConnectedClient for any kind of connection.
+    *
+    * Same as the overload taking a socket, but the connection to the client
+    * can be of any kind that Transport supports.
+    *
+    * @param connection_id The connection identifier.
+    * @param transport The connection to the client.
+    * @param rcvd_callback Callback invoked when a new message is received.
+    * @param disconnected_callback Callback invoked when the client disconnects
+    */
+    static std::shared_ptr<ConnectedClient> makeInstance(
+        connection_id_t connection_id,
+        Transport&& transport,
+        const Signals::ReceivedMessage& rcvd_callback,
+        const Signals::Disconnected& disconnected_callback
+    );
+
+    /** Create an instance of a ConnectedClient without callbacks.
+    *
+    * Received messages are kept until they are asked for with
+    * asyncReceive().
+    *
+    * @param connection_id The connection identifier.
+    * @param transport The connection to the client.
+    */
+    static std::shared_ptr<ConnectedClient> makeInstance(
+        connection_id_t connection_id,
+        Transport&& transport
+    );
+
     /** Disconnect from client.
-    * Shut down the connected socket.
+    * Shut down the connection.
     *
     * @note No packets are sent by this function. If you need to send goodbye
     * spackets, do it before calling it.
@@ -156,13 +213,50 @@ public:
         sendPacket(data);
     }
 
+    /** Send packet to client and wait until it was written.
+    *
+    * Like sendPacket(), but the handler is invoked with the outcome.
+    *
+    * @param packet Packet to be sent.
+    * @param token Completion token with the signature
+    * void(boost::system::error_code)
+    */
+    template <typename InnerLayer, typename CompletionToken>
+    BOOST_ASIO_INITFN_RESULT_TYPE(CompletionToken,
+        void (boost::system::error_code))
+    asyncSend(const SegmentationLayer<InnerLayer>& packet,
+        CompletionToken&& token);
+
+    /** Wait for the next packet from the client.
+    *
+    * The ReceivedMessage callback is invoked for all packets as well. Once
+    * this function was called, received packets are kept until they are
+    * asked for with another call, so none is missed between two calls. Only
+    * one receive may be pending at a time.
+    *
+    * @param token Completion token with the signature
+    * void(boost::system::error_code, std::shared_ptr<SerializedData>). After
+    * the client disconnected and all kept packets were handed out, the
+    * error is the reason of the disconnect, e.g. boost::asio::error::eof.
+    */
+    template <typename CompletionToken>
+    BOOST_ASIO_INITFN_RESULT_TYPE(CompletionToken,
+        void (boost::system::error_code, std::shared_ptr<SerializedData>))
+    asyncReceive(CompletionToken&& token);
+
+    /** Get the statistics of this connection.
+    * Only call this function from the thread running the handlers.
+    */
+    const ConnectionMetrics& metrics() const
+    { return conn_metrics; }
+
 private:
     friend class SendHandler;
     friend class ReceiveHeaderHandler;
     friend class ReceiveBodyHandler;
 
-    /** Socket connected to the remote client */
-    boost::asio::ip::tcp::socket socket;
+    /** Connection to the remote client */
+    Transport transport;
 
     /** One array as the buffer for all packet headers.
      * This array will be reused by all asynchronous read operations waiting for
@@ -172,10 +266,42 @@ private:
         std::array<byte_traits::byte_t, SegmentationLayerBase::header_length>
     > header_buffer;
 
+    /** Recycled memory for the handlers of the read operations.
+     * Only one read operation is pending at any time.
+     */
+    std::shared_ptr<HandlerMemory> read_handler_memory;
+
+    /** Recycled memory for the handlers of the write operations */
+    std::shared_ptr<HandlerMemory> write_handler_memory;
+
+    /** Statistics of this connection */
+    ConnectionMetrics conn_metrics;
+
+    /** Called with the outcome of a write started by asyncSend() */
+    typedef std::function<void (boost::system::error_code)> SendCompletion;
+
+    /** Called with the next received packet */
+    typedef std::function<
+        void (boost::system::error_code, std::shared_ptr<SerializedData>)
+    > ReceiveCompletion;
+
+    /** Called with the next received packet, may be empty */
+    ReceiveCompletion receive_completion;
+
+    /** Received packets nobody has asked for yet */
+    std::deque<std::shared_ptr<SerializedData>> received_packets;
+
+    /** True once asyncReceive() was called. From then on, received packets
+    * are kept until they are asked for. */
+    bool keep_received;
+
+    /** Why the client disconnected, if it did */
+    boost::system::error_code disconnect_reason;
+
     // private constructor
     ConnectedClient(
         connection_id_t connection_id,
-        boost::asio::ip::tcp::socket&& socket,
+        Transport&& transport,
         const Signals::ReceivedMessage& rcvd_callback,
         const Signals::Disconnected& disconnected_callback
     );
@@ -189,8 +315,69 @@ private:
     */
     void startReceive();
 
-    /** Invoke asynchronous send operation on socket. */
-    void async_write(const std::shared_ptr<byte_traits::byte_sequence>& data);
+    /** Invoke asynchronous send operation on the transport.
+    * @param data The serialized packet
+    * @param completion Called with the outcome, may be empty
+    */
+    void async_write(
+        const std::shared_ptr<byte_traits::byte_sequence>& data,
+        const SendCompletion& completion = SendCompletion{}
+    );
+
+    /** Hand out the next received packet, or wait for it.
+    * @param completion Called with the packet
+    */
+    void receivePacket(ReceiveCompletion&& completion);
+
+    /** Hand a received packet to the pending receive, or keep it. */
+    void deliverPacket(const std::shared_ptr<SerializedData>& data);
+
+    /** Shut down the connection and tell everyone who is waiting.
+    * @param reason Why the client disconnected
+    */
+    void handleDisconnect(const boost::system::error_code& reason);
+
+    /** Starts asyncSend() */
+    struct InitSend
+    {
+        ConnectedClient& client;
+
+        template <typename Handler>
+        void operator() (
+            Handler&& handler,
+            const std::shared_ptr<byte_traits::byte_sequence>& data
+        ) const
+        {
+            client.async_write(data,
+                makeCompletion<void (boost::system::error_code)>(
+                    std::forward<Handler>(handler),
+                    client.transport.get_executor()
+                )
+            );
+        }
+    };
+
+    /** Starts asyncReceive() */
+    struct InitReceive
+    {
+        ConnectedClient& client;
+
+        template <typename Handler>
+        void operator() (Handler&& handler) const
+        {
+            client.receivePacket(
+                makeCompletion<
+                    void (
+                        boost::system::error_code,
+                        std::shared_ptr<SerializedData>
+                    )
+                >(
+                    std::forward<Handler>(handler),
+                    client.transport.get_executor()
+                )
+            );
+        }
+    };
 };
 
 template <typename InnerLayer>
@@ -203,6 +390,33 @@ void ConnectedClient::sendPacket(const SegmentationLayer<InnerLayer>& packet)
     this->async_write(data);
 }
 
+template <typename InnerLayer, typename CompletionToken>
+BOOST_ASIO_INITFN_RESULT_TYPE(CompletionToken,
+    void (boost::system::error_code))
+ConnectedClient::asyncSend(
+    const SegmentationLayer<InnerLayer>& packet,
+    CompletionToken&& token
+)
+{
+    auto data = std::make_shared<byte_traits::byte_sequence>(packet.size());
+    packet.fillSerialized(data->begin());
+
+    return boost::asio::async_initiate<
+        CompletionToken, void (boost::system::error_code)
+    >(InitSend{*this}, token, data);
+}
+
+template <typename CompletionToken>
+BOOST_ASIO_INITFN_RESULT_TYPE(CompletionToken,
+    void (boost::system::error_code, std::shared_ptr<SerializedData>))
+ConnectedClient::asyncReceive(CompletionToken&& token)
+{
+    return boost::asio::async_initiate<
+        CompletionToken,
+        void (boost::system::error_code, std::shared_ptr<SerializedData>)
+    >(InitReceive{*this}, token);
+}
+
 extern template
 void ConnectedClient::sendPacket(const SegmentationLayer<SerializedData>&);
 
@@ -0,0 +1,119 @@
+// shmtransport.hpp
+
+/*
+ *   nuke-ms - Nuclear Messaging System
+ *   Copyright (C) 2012  Alexander Korsunsky
+ *
+ *   This program is free software: you can redistribute it and/or modify
+ *   it under the terms of the GNU General Public License as published by
+ *   the Free Software Foundation, version 3 of the License.
+ *
+ *   This program is distributed in the hope that it will be useful,
+ *   but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *   MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ *   GNU General Public License for more details.
+ *
+ *   You should have received a copy of the GNU General Public License
+ *   along with this program.  If not, see <http://www.gnu.org/licenses/>.
+*/
+
+/** @file shmtransport.hpp
+* @ingroup common
+* @brief Transport over ring buffers in shared memory
+*
+* Only available on Linux, where NUKE_MS_SHM_TRANSPORT is defined.
+*/
+
+#ifndef SHMTRANSPORT_HPP
+#define SHMTRANSPORT_HPP
+
+#include <memory>
+
+#include <boost/asio/local/stream_protocol.hpp>
+
+#include "transport.hpp"
+
+namespace nuke_ms
+{
+
+/** @addtogroup common
+ * @{
+*/
+
+/** Transport for processes on the same host, over shared memory.
+*
+* The server creates a memory segment with a single-producer single-consumer
+* ring buffer for each direction and an eventfd object for each side of each
+* ring, and passes them to the client over a connected Unix domain socket.
+* After that, the socket is only used to notice when the other side goes
+* away.
+*
+* The bytes are copied into and out of the rings without system calls. A
+* side only writes an eventfd if the other side announced that it is going
+* to sleep, so a busy connection does not need system calls at all.
+*/
+class ShmTransport : public TransportImpl
+{
+public:
+    /** Size of each ring buffer in bytes. Must be a power of two. */
+    enum { ring_size = 0x100000 };
+
+    /** Set up a connection on the server side.
+    * Creates the shared memory and sends it to the client.
+    *
+    * @param socket Freshly accepted Unix domain socket
+    * @param error Set if the connection could not be set up
+    * @return The connection, or nullptr on error
+    */
+    static std::unique_ptr<TransportImpl> createServerSide(
+        boost::asio::local::stream_protocol::socket&& socket,
+        boost::system::error_code& error
+    );
+
+    /** Set up a connection on the client side.
+    * Takes over the shared memory sent by the server. Call this when the
+    * socket is readable.
+    *
+    * @param socket Unix domain socket connected to the server
+    * @param error Set if the connection could not be set up
+    * @return The connection, or nullptr on error
+    */
+    static std::unique_ptr<TransportImpl> createClientSide(
+        boost::asio::local::stream_protocol::socket&& socket,
+        boost::system::error_code& error
+    );
+
+    /** Destructor. Closes the connection. */
+    ~ShmTransport();
+
+    void asyncReadSome(
+        const boost::asio::mutable_buffer& buffer,
+        TransportOp* op
+    );
+
+    void asyncWriteSome(
+        const boost::asio::const_buffer& buffer,
+        TransportOp* op
+    );
+
+    void shutdown(boost::system::error_code& error);
+
+    void close(boost::system::error_code& error);
+
+    bool isOpen() const;
+
+private:
+    struct State;
+
+    /** Everything the pending wait operations need. Shared with their
+    * handlers, so it lives until the last handler has run. */
+    std::shared_ptr<State> state;
+
+    explicit ShmTransport(std::shared_ptr<State> _state);
+};
+
+/**@}*/ // addtogroup common
+
+} // namespace nuke_ms
+
+#endif // ifndef SHMTRANSPORT_HPP
@@ -0,0 +1,153 @@
+// tracing.hpp
+
+/*
+ *   nuke-ms - Nuclear Messaging System
+ *   Copyright (C) 2012  Alexander Korsunsky
+ *
+ *   This program is free software: you can redistribute it and/or modify
+ *   it under the terms of the GNU General Public License as published by
+ *   the Free Software Foundation, version 3 of the License.
+ *
+ *   This program is distributed in the hope that it will be useful,
+ *   but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *   MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ *   GNU General Public License for more details.
+ *
+ *   You should have received a copy of the GNU General Public License
+ *   along with this program.  If not, see <http://www.gnu.org/licenses/>.
+*/
+
+/** @file tracing.hpp
+* @ingroup common
+* @brief Recording of per-message spans in the Chrome trace event format
+*
+*/
+
+#ifndef TRACING_HPP
+#define TRACING_HPP
+
+#include <chrono>
+#include <cstdint>
+#include <fstream>
+#include <memory>
+#include <mutex>
+#include <string>
+#include <vector>
+
+namespace nuke_ms
+{
+
+/** @addtogroup common
+ * @{
+*/
+
+/** Recorder for the stages a message goes through.
+*
+* Each stage is recorded as a span with a start and end time. The spans are
+* written as Chrome trace events ("ph":"X"), which can be loaded into
+* chrome://tracing or Perfetto. Every span is put into the lane (thread id)
+* of the connection it belongs to and carries the id of the message in its
+* arguments, so the way of a single message through the server can be
+* followed.
+*
+* Tracing is disabled if the recorder is constructed without a file name.
+* In that case, enabled() is the only thing callers should touch.
+*/
+class TraceRecorder
+{
+public:
+    typedef std::chrono::steady_clock clock_type;
+
+    /** Number of spans that are buffered before they are written */
+    enum { buffer_size = 4096 };
+
+private:
+    /** A recorded span */
+    struct Span
+    {
+        const char* name;
+        std::int64_t lane;
+        clock_type::time_point start;
+        clock_type::time_point end;
+        std::uint64_t message_id;
+    };
+
+    /** Where the spans are written to. Empty if tracing is disabled. */
+    std::unique_ptr<std::ofstream> out;
+
+    /** Protects buffer, out and the message ids */
+    std::mutex buffer_mutex;
+
+    /** Spans not yet written */
+    std::vector<Span> buffer;
+
+    /** Time stamps in the file are relative to this time */
+    clock_type::time_point epoch;
+
+    /** Last message id handed out */
+    std::uint64_t last_message_id;
+
+    /** Message that is currently being handled */
+    std::uint64_t current_message;
+
+    /** True until the first span is written */
+    bool first_span;
+
+    /** Write the buffered spans. Call with buffer_mutex locked. */
+    void writeBuffer();
+
+public:
+    /** Constructor.
+    * @param filename File the trace is written to. If empty, tracing is
+    * disabled.
+    */
+    explicit TraceRecorder(const std::string& filename = std::string{});
+
+    /** Destructor. Writes the remaining spans and closes the file. */
+    ~TraceRecorder();
+
+    TraceRecorder(const TraceRecorder&) = delete;
+    TraceRecorder& operator= (const TraceRecorder&) = delete;
+
+    /** Check if spans are recorded. */
+    bool enabled() const
+    { return static_cast<bool>(out); }
+
+    /** Get a new id for a message. */
+    std::uint64_t nextMessageId();
+
+    /** Set the message that is currently being handled.
+    * Stages that don't know which message caused them can ask
+    * currentMessage(), e.g. writes started while a message is dispatched.
+    */
+    void setCurrentMessage(std::uint64_t message_id)
+    { current_message = message_id; }
+
+    /** Get the message that is currently being handled, or 0. */
+    std::uint64_t currentMessage() const
+    { return current_message; }
+
+    /** Record a span.
+    * @param name Name of the stage. Must be a string literal.
+    * @param lane Lane the span is shown in, usually a connection id
+    * @param start Start of the stage
+    * @param end End of the stage
+    * @param message_id The message the stage belongs to
+    */
+    void span(
+        const char* name,
+        std::int64_t lane,
+        clock_type::time_point start,
+        clock_type::time_point end,
+        std::uint64_t message_id
+    );
+
+    /** Write all buffered spans to the file. */
+    void flush();
+};
+
+/**@}*/ // addtogroup common
+
+} // namespace nuke_ms
+
+#endif // ifndef TRACING_HPP
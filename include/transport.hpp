@@ -0,0 +1,568 @@
+// transport.hpp
+
+/*
+ *   nuke-ms - Nuclear Messaging System
+ *   Copyright (C) 2012  Alexander Korsunsky
+ *
+ *   This program is free software: you can redistribute it and/or modify
+ *   it under the terms of the GNU General Public License as published by
+ *   the Free Software Foundation, version 3 of the License.
+ *
+ *   This program is distributed in the hope that it will be useful,
+ *   but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *   MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ *   GNU General Public License for more details.
+ *
+ *   You should have received a copy of the GNU General Public License
+ *   along with this program.  If not, see <http://www.gnu.org/licenses/>.
+*/
+
+/** @file transport.hpp
+* @ingroup common
+* @brief Byte stream connection, independent of the kind of connection
+*
+* The protocol code reads and writes SegmentationLayer frames from a Transport
+* and does not know whether the bytes travel over a TCP connection or some
+* other channel. New kinds of connections are added by deriving from
+* TransportImpl.
+*/
+
+#ifndef TRANSPORT_HPP
+#define TRANSPORT_HPP
+
+#include <cstddef>
+#include <functional>
+#include <memory>
+#include <new>
+#include <utility>
+
+#include <boost/asio/associated_allocator.hpp>
+#include <boost/asio/associated_executor.hpp>
+#include <boost/asio/async_result.hpp>
+#include <boost/asio/basic_stream_socket.hpp>
+#include <boost/asio/buffer.hpp>
+#include <boost/asio/dispatch.hpp>
+#include <boost/asio/error.hpp>
+#include <boost/asio/execution/context.hpp>
+#include <boost/asio/query.hpp>
+#include <boost/asio/io_service.hpp>
+#include <boost/asio/ip/tcp.hpp>
+
+#include "handleralloc.hpp"
+
+namespace nuke_ms
+{
+
+/** @addtogroup common
+ * @{
+*/
+
+/** A pending read or write operation of a Transport.
+*
+* Implementations of TransportImpl get a pointer to an operation and must
+* either complete or destroy it exactly once.
+*/
+class TransportOp
+{
+public:
+    /** Call the handler of the operation and free this object.
+    * Must be called by a thread running the io_service of the transport, and
+    * not from within the function that started the operation.
+    */
+    virtual void complete(
+        const boost::system::error_code& error,
+        std::size_t bytes_transferred
+    ) = 0;
+
+    /** Free this object without calling the handler. */
+    virtual void destroy() = 0;
+
+protected:
+    ~TransportOp() {}
+};
+
+
+/** Completion handler that completes a TransportOp.
+*
+* Pass it to the asynchronous operation that carries out the TransportOp. If
+* the handler is destroyed without being called, e.g. because the io_service
+* is destroyed, the TransportOp is destroyed as well.
+*/
+class TransportCompletion
+{
+    TransportOp* op;
+
+public:
+    /** Constructor.
+    * @param _op The operation to complete. This object takes ownership.
+    */
+    explicit TransportCompletion(TransportOp* _op)
+        : op{_op}
+    {}
+
+    TransportCompletion(TransportCompletion&& other)
+        : op{other.op}
+    { other.op = nullptr; }
+
+    TransportCompletion(const TransportCompletion&) = delete;
+    TransportCompletion& operator= (const TransportCompletion&) = delete;
+
+    ~TransportCompletion()
+    {
+        if (op)
+            op->destroy();
+    }
+
+    void operator() (
+        const boost::system::error_code& error,
+        std::size_t bytes_transferred
+    )
+    {
+        TransportOp* o = op;
+        op = nullptr;
+        o->complete(error, bytes_transferred);
+    }
+};
+
+
+/** Implementation of a kind of connection.
+*
+* Only one read operation is pending at any time. Several write operations
+* may be pending; they are carried out in the order they were started. Each
+* operation transfers at least one byte, unless an error occurs or the
+* buffer is empty.
+*/
+class TransportImpl
+{
+public:
+    /** Native handle of a socket */
+    typedef boost::asio::ip::tcp::socket::native_handle_type
+        native_handle_type;
+
+    virtual ~TransportImpl() {}
+
+    /** Start reading some bytes.
+    * @param buffer Where the bytes are stored
+    * @param op Operation to complete when done
+    */
+    virtual void asyncReadSome(
+        const boost::asio::mutable_buffer& buffer,
+        TransportOp* op
+    ) = 0;
+
+    /** Start writing some bytes.
+    * @param buffer The bytes to write
+    * @param op Operation to complete when done
+    */
+    virtual void asyncWriteSome(
+        const boost::asio::const_buffer& buffer,
+        TransportOp* op
+    ) = 0;
+
+    /** Shut down both directions. Pending operations fail. */
+    virtual void shutdown(boost::system::error_code& error) = 0;
+
+    /** Close the connection. Pending operations are aborted. */
+    virtual void close(boost::system::error_code& error) = 0;
+
+    /** Check if the connection is open. */
+    virtual bool isOpen() const = 0;
+
+    /** Give up the connection without closing it, e.g. to hand it to
+    * another process. Pending operations are aborted. Only connections
+    * backed by a single socket support this.
+    * @return The native handle of the socket, owned by the caller
+    */
+    virtual native_handle_type release(boost::system::error_code& error)
+    {
+        error = boost::asio::error::operation_not_supported;
+        return native_handle_type(-1);
+    }
+};
+
+
+/** Transport implementation for a connected stream socket, e.g. TCP.
+* @tparam Socket Type of the socket
+*/
+template <typename Socket>
+class SocketTransport : public TransportImpl
+{
+    /** The connected socket */
+    Socket socket;
+
+    /** Memory for the socket operations, one block for each direction */
+    std::shared_ptr<HandlerMemory> read_memory;
+    std::shared_ptr<HandlerMemory> write_memory;
+
+public:
+    /** Constructor.
+    * @param _socket The connected socket
+    */
+    explicit SocketTransport(Socket&& _socket)
+        : socket(std::move(_socket)),
+        read_memory{std::make_shared<HandlerMemory>()},
+        write_memory{std::make_shared<HandlerMemory>()}
+    {}
+
+    /** Get the socket, e.g. to set options */
+    Socket& getSocket()
+    { return socket; }
+
+    void asyncReadSome(
+        const boost::asio::mutable_buffer& buffer,
+        TransportOp* op
+    )
+    {
+        socket.async_read_some(
+            boost::asio::mutable_buffers_1{buffer},
+            makeAllocHandler(read_memory, TransportCompletion{op})
+        );
+    }
+
+    void asyncWriteSome(
+        const boost::asio::const_buffer& buffer,
+        TransportOp* op
+    )
+    {
+        socket.async_write_some(
+            boost::asio::const_buffers_1{buffer},
+            makeAllocHandler(write_memory, TransportCompletion{op})
+        );
+    }
+
+    void shutdown(boost::system::error_code& error)
+    { socket.shutdown(Socket::shutdown_both, error); }
+
+    void close(boost::system::error_code& error)
+    { socket.close(error); }
+
+    bool isOpen() const
+    { return socket.is_open(); }
+
+    native_handle_type release(boost::system::error_code& error)
+    { return socket.release(error); }
+};
+
+
+/** Byte stream connection, independent of the kind of connection.
+*
+* A Transport is a stream in the sense of Boost.Asio, so it can be used with
+* boost::asio::async_read() and boost::asio::async_write(). The kind of
+* connection is chosen by assigning a TransportImpl or a connected socket.
+* Operations on a transport without a connection fail with
+* boost::asio::error::bad_descriptor.
+*
+* Every read or write operation transfers bytes from or to the first
+* non-empty buffer of the buffer sequence only. The operations allocate
+* their memory with the allocator associated with the handler, so wrap
+* handlers with makeAllocHandler() on hot paths.
+*/
+class Transport
+{
+public:
+    typedef boost::asio::io_service::executor_type executor_type;
+
+private:
+    /** The io_service all handlers are run by */
+    boost::asio::io_service* io_service;
+
+    /** The connection, empty if not connected */
+    std::unique_ptr<TransportImpl> impl;
+
+    template <typename Handler>
+    class Op;
+
+    struct InitiateRead;
+    struct InitiateWrite;
+
+    /** Complete an operation with an error, when there is no connection */
+    void failOperation(TransportOp* op);
+
+    /** Get the first non-empty buffer of a sequence */
+    template <typename Buffer, typename BufferSequence>
+    static Buffer firstBuffer(const BufferSequence& buffers)
+    {
+        auto it = boost::asio::buffer_sequence_begin(buffers);
+        auto end = boost::asio::buffer_sequence_end(buffers);
+        for (; it != end; ++it)
+        {
+            Buffer buffer(*it);
+            if (buffer.size())
+                return buffer;
+        }
+
+        return Buffer{};
+    }
+
+public:
+    /** Constructor. Creates a transport without a connection.
+    * @param _io_service The io_service to run all handlers on
+    */
+    explicit Transport(boost::asio::io_service& _io_service)
+        : io_service{&_io_service}
+    {}
+
+    /** Constructor. Creates a transport with a connection.
+    * @param _io_service The io_service to run all handlers on. Must be the
+    * one the implementation uses.
+    * @param _impl The connection
+    */
+    Transport(
+        boost::asio::io_service& _io_service,
+        std::unique_ptr<TransportImpl> _impl
+    )
+        : io_service{&_io_service}, impl{std::move(_impl)}
+    {}
+
+    /** Constructor. Creates a transport for a connected socket.
+    * @param socket The connected socket. Must belong to an io_service.
+    */
+    template <typename Protocol, typename Executor>
+    explicit Transport(
+        boost::asio::basic_stream_socket<Protocol, Executor>&& socket
+    )
+        : io_service{&static_cast<boost::asio::io_service&>(
+            boost::asio::query(
+                socket.get_executor(), boost::asio::execution::context
+            )
+        )}
+    { assign(std::move(socket)); }
+
+    Transport(Transport&&) = default;
+    Transport& operator= (Transport&&) = default;
+
+    /** Destructor. Closes the connection. */
+    ~Transport();
+
+    /** Replace the connection. The old one is closed. */
+    void assign(std::unique_ptr<TransportImpl> _impl);
+
+    /** Replace the connection by a connected socket. The old one is closed. */
+    template <typename Protocol, typename Executor>
+    void assign(boost::asio::basic_stream_socket<Protocol, Executor>&& socket)
+    {
+        typedef boost::asio::basic_stream_socket<Protocol, Executor> socket_type;
+
+        assign(std::unique_ptr<TransportImpl>{
+            new SocketTransport<socket_type>{std::move(socket)}
+        });
+    }
+
+    /** Get the implementation of the connection, or nullptr. */
+    TransportImpl* getImpl()
+    { return impl.get(); }
+
+    /** Get the io_service all handlers are run by */
+    boost::asio::io_service& get_io_service()
+    { return *io_service; }
+
+    /** Get the executor all handlers are run by, if they have none. */
+    executor_type get_executor()
+    { return io_service->get_executor(); }
+
+    /** Check if there is an open connection. */
+    bool isOpen() const
+    { return impl && impl->isOpen(); }
+
+    /** Shut down both directions. Pending operations fail. */
+    void shutdown(boost::system::error_code& error);
+
+    /** Close the connection. Pending operations are aborted, the transport
+    * has no connection afterwards. */
+    void close(boost::system::error_code& error);
+
+    /** Give up the connection without closing it, see
+    * TransportImpl::release(). On success, the transport has no connection
+    * afterwards.
+    * @return The native handle of the socket, owned by the caller
+    */
+    TransportImpl::native_handle_type release(boost::system::error_code& error);
+
+    /** Read some bytes.
+    * @param buffers Where the bytes are stored
+    * @param handler Completion handler with the signature
+    * void(boost::system::error_code, std::size_t)
+    */
+    template <typename MutableBufferSequence, typename ReadHandler>
+    BOOST_ASIO_INITFN_RESULT_TYPE(ReadHandler,
+        void (boost::system::error_code, std::size_t))
+    async_read_some(const MutableBufferSequence& buffers, ReadHandler&& handler);
+
+    /** Write some bytes.
+    * @param buffers The bytes to write
+    * @param handler Completion handler with the signature
+    * void(boost::system::error_code, std::size_t)
+    */
+    template <typename ConstBufferSequence, typename WriteHandler>
+    BOOST_ASIO_INITFN_RESULT_TYPE(WriteHandler,
+        void (boost::system::error_code, std::size_t))
+    async_write_some(const ConstBufferSequence& buffers, WriteHandler&& handler);
+};
+
+
+/** Operation of a Transport with a handler of a certain type.
+*
+* The memory for the operation is taken from the allocator associated with
+* the handler and given back before the handler is called.
+*/
+template <typename Handler>
+class Transport::Op : public TransportOp
+{
+    typedef typename boost::asio::associated_allocator<Handler>::type
+        handler_allocator_type;
+
+    typedef typename std::allocator_traits<handler_allocator_type>::
+        template rebind_alloc<Op> allocator_type;
+
+    Handler handler;
+
+    /** Executor of the transport, used if the handler has none */
+    executor_type io_executor;
+
+    Op(Handler&& _handler, const executor_type& _io_executor)
+        : handler(std::move(_handler)), io_executor(_io_executor)
+    {}
+
+    /** Destroy the object and give back its memory
+    * @param alloc Allocator obtained before the handler was moved away
+    */
+    void free(allocator_type alloc)
+    {
+        this->~Op();
+        std::allocator_traits<allocator_type>::deallocate(alloc, this, 1);
+    }
+
+public:
+    /** Create an operation with memory from the handler's allocator */
+    static Op* create(Handler&& handler, const executor_type& io_executor)
+    {
+        allocator_type alloc(
+            boost::asio::get_associated_allocator(handler)
+        );
+
+        Op* op = std::allocator_traits<allocator_type>::allocate(alloc, 1);
+        try {
+            return new (op) Op{std::move(handler), io_executor};
+        }
+        catch (...)
+        {
+            std::allocator_traits<allocator_type>::deallocate(alloc, op, 1);
+            throw;
+        }
+    }
+
+    void complete(
+        const boost::system::error_code& error,
+        std::size_t bytes_transferred
+    )
+    {
+        allocator_type alloc(
+            boost::asio::get_associated_allocator(handler)
+        );
+        Handler h(std::move(handler));
+        auto executor = boost::asio::get_associated_executor(h, io_executor);
+
+        // give back the memory first, so the handler can use it again
+        free(alloc);
+
+        boost::asio::dispatch(executor,
+            std::bind(std::move(h), error, bytes_transferred)
+        );
+    }
+
+    void destroy()
+    {
+        allocator_type alloc(
+            boost::asio::get_associated_allocator(handler)
+        );
+        Handler h(std::move(handler));
+
+        // the handler may own the memory, so it has to go after the memory
+        // was given back
+        free(alloc);
+    }
+};
+
+/** Initiation of Transport::async_read_some() */
+struct Transport::InitiateRead
+{
+    Transport& transport;
+
+    template <typename ReadHandler>
+    void operator() (
+        ReadHandler&& handler,
+        const boost::asio::mutable_buffer& buffer
+    ) const
+    {
+        typedef Op<typename std::decay<ReadHandler>::type> op_type;
+        TransportOp* op = op_type::create(
+            std::move(handler), transport.get_executor()
+        );
+
+        if (transport.impl)
+            transport.impl->asyncReadSome(buffer, op);
+        else
+            transport.failOperation(op);
+    }
+};
+
+/** Initiation of Transport::async_write_some() */
+struct Transport::InitiateWrite
+{
+    Transport& transport;
+
+    template <typename WriteHandler>
+    void operator() (
+        WriteHandler&& handler,
+        const boost::asio::const_buffer& buffer
+    ) const
+    {
+        typedef Op<typename std::decay<WriteHandler>::type> op_type;
+        TransportOp* op = op_type::create(
+            std::move(handler), transport.get_executor()
+        );
+
+        if (transport.impl)
+            transport.impl->asyncWriteSome(buffer, op);
+        else
+            transport.failOperation(op);
+    }
+};
+
+template <typename MutableBufferSequence, typename ReadHandler>
+BOOST_ASIO_INITFN_RESULT_TYPE(ReadHandler,
+    void (boost::system::error_code, std::size_t))
+Transport::async_read_some(
+    const MutableBufferSequence& buffers,
+    ReadHandler&& handler
+)
+{
+    return boost::asio::async_initiate<
+        ReadHandler, void (boost::system::error_code, std::size_t)
+    >(
+        InitiateRead{*this}, handler,
+        firstBuffer<boost::asio::mutable_buffer>(buffers)
+    );
+}
+
+template <typename ConstBufferSequence, typename WriteHandler>
+BOOST_ASIO_INITFN_RESULT_TYPE(WriteHandler,
+    void (boost::system::error_code, std::size_t))
+Transport::async_write_some(
+    const ConstBufferSequence& buffers,
+    WriteHandler&& handler
+)
+{
+    return boost::asio::async_initiate<
+        WriteHandler, void (boost::system::error_code, std::size_t)
+    >(
+        InitiateWrite{*this}, handler,
+        firstBuffer<boost::asio::const_buffer>(buffers)
+    );
+}
+
+/**@}*/ // addtogroup common
+
+} // namespace nuke_ms
+
+#endif // ifndef TRANSPORT_HPP
@@ -0,0 +1,855 @@
+// bench.cpp
+
+/*
+ *   nuke-ms - Nuclear Messaging System
+ *   Copyright (C) 2012  Alexander Korsunsky
+ *
+ *   This program is free software: you can redistribute it and/or modify
+ *   it under the terms of the GNU General Public License as published by
+ *   the Free Software Foundation, either version 3 of the License.
+ *
+ *   This program is distributed in the hope that it will be useful,
+ *   but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *   MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ *   GNU General Public License for more details.
+ *
+ *   You should have received a copy of the GNU General Public License
+ *   along with this program.  If not, see <http://www.gnu.org/licenses/>.
+*/
+
+#include <cstdio>
+#include <cstdlib>
+#include <fstream>
+#include <functional>
+#include <sstream>
+#include <thread>
+#include <vector>
+
+#include <boost/asio/bind_executor.hpp>
+#include <boost/asio/ip/tcp.hpp>
+#include <boost/thread/thread.hpp>
+
+#ifdef __linux__
+#   include <unistd.h>
+#   include <sys/resource.h>
+#endif
+
+#include "bench.hpp"
+
+using namespace nuke_ms;
+using namespace nuke_ms::bench;
+
+
+std::string bench::makePayload(unsigned sender, std::size_t size)
+{
+    long long now = std::chrono::duration_cast<std::chrono::nanoseconds>(
+        clock_type::now().time_since_epoch()
+    ).count();
+
+    char header[48];
+    int len = std::snprintf(header, sizeof(header), "%u %lld ", sender, now);
+
+    std::string text(header, len);
+    if (text.size() < size)
+        text.resize(size, '.');
+
+    return text;
+}
+
+bool bench::parsePayload(
+    const std::string& text,
+    unsigned& sender,
+    clock_type::time_point& send_time
+)
+{
+    const char* begin = text.c_str();
+    char* end;
+
+    unsigned long s = std::strtoul(begin, &end, 10);
+    if (end == begin || *end != ' ')
+        return false;
+
+    begin = end + 1;
+    long long t = std::strtoll(begin, &end, 10);
+    if (end == begin || *end != ' ')
+        return false;
+
+    sender = static_cast<unsigned>(s);
+    send_time = clock_type::time_point{std::chrono::nanoseconds{t}};
+    return true;
+}
+
+
+long long bench::residentMemory(int pid)
+{
+#ifdef __linux__
+    std::string path = pid ?
+        "/proc/" + std::to_string(pid) + "/statm" : "/proc/self/statm";
+    std::ifstream statm_file(path.c_str());
+
+    // total program size, resident set size, both in pages
+    unsigned long long size, resident;
+    if (!(statm_file>>size>>resident))
+        return -1;
+
+    return static_cast<long long>(resident) * sysconf(_SC_PAGESIZE);
+#else
+    return -1;
+#endif
+}
+
+
+ProcessCpuSampler::ProcessCpuSampler(int _pid)
+    : pid{_pid}, start_seconds{-1.0}, start_time{clock_type::now()}
+{
+    if (pid)
+        start_seconds = cpuSeconds();
+}
+
+double ProcessCpuSampler::cpuSeconds() const
+{
+#ifdef __linux__
+    std::ifstream stat_file(("/proc/" + std::to_string(pid) + "/stat").c_str());
+    std::string stat;
+    if (!std::getline(stat_file, stat))
+        return -1.0;
+
+    // the command name may contain spaces, so skip everything up to its end
+    std::string::size_type pos = stat.rfind(')');
+    if (pos == std::string::npos)
+        return -1.0;
+
+    // after the command name: state (field 3) ... utime (14), stime (15)
+    std::istringstream fields(stat.substr(pos + 2));
+    std::string field;
+    for (int i = 3; i < 14; ++i)
+        fields>>field;
+
+    unsigned long long utime = 0, stime = 0;
+    if (!(fields>>utime>>stime))
+        return -1.0;
+
+    return static_cast<double>(utime + stime) / sysconf(_SC_CLK_TCK);
+#else
+    return -1.0;
+#endif
+}
+
+double ProcessCpuSampler::cpuTime() const
+{
+    if (!available())
+        return 0.0;
+
+    return cpuSeconds() - start_seconds;
+}
+
+double ProcessCpuSampler::utilization() const
+{
+    double elapsed = std::chrono::duration<double>(
+        clock_type::now() - start_time
+    ).count();
+
+    return elapsed > 0 ? cpuTime() / elapsed : 0.0;
+}
+
+
+BenchClient::BenchClient(
+    boost::asio::io_service& io_service,
+    const BenchConfig& _config,
+    BenchStats& _stats,
+    unsigned _index
+)
+    : config(_config), stats(_stats), index{_index}, strand{io_service},
+    client{io_service}, send_timer{io_service},
+    receive_memory{std::make_shared<HandlerMemory>()},
+    send_memory{std::make_shared<HandlerMemory>()},
+    rng{_index + 1}, send_interval{clock_type::duration::zero()},
+    next_msg_id{0}, connected{false}, sending{false}, send_pending{false}
+{}
+
+void BenchClient::start()
+{
+    client.asyncConnect(config.host, config.port,
+        boost::asio::bind_executor(strand,
+            [this](const boost::system::error_code& error)
+            {
+                if (error)
+                {
+                    stats.connect_failures.add();
+                    return;
+                }
+
+                connected = true;
+                stats.connected.add();
+                receive();
+            }
+        )
+    );
+}
+
+void BenchClient::receive()
+{
+    client.asyncReceive(makeAllocHandler(receive_memory,
+        boost::asio::bind_executor(strand,
+            [this](
+                const boost::system::error_code& error,
+                std::shared_ptr<NearUserMessage> msg
+            )
+            {
+                if (error)
+                {
+                    connected = false;
+                    return;
+                }
+
+                clock_type::time_point now = clock_type::now();
+
+                const std::string& text = msg->_stringwrap._message_string;
+                unsigned sender;
+                clock_type::time_point send_time;
+
+                if (parsePayload(text, sender, send_time))
+                {
+                    stats.received.add();
+                    stats.bytes_received.add(text.size());
+                    stats.latency.record(
+                        std::chrono::duration_cast<std::chrono::nanoseconds>(
+                            now - send_time
+                        ).count()
+                    );
+                }
+                else
+                    stats.foreign.add();
+
+                receive();
+            }
+        )
+    ));
+}
+
+void BenchClient::startSending(clock_type::duration interval)
+{
+    strand.post([this, interval]()
+    {
+        if (!connected)
+            return;
+
+        sending = true;
+        send_interval = interval;
+
+        if (send_interval == clock_type::duration::zero())
+            return send();
+
+        // spread the clients over the interval, so they don't all send at
+        // the same time
+        std::uniform_int_distribution<clock_type::rep> phase{
+            0, send_interval.count()
+        };
+        send_timer.expires_at(
+            clock_type::now() + clock_type::duration{phase(rng)}
+        );
+        scheduleSend();
+    });
+}
+
+void BenchClient::scheduleSend()
+{
+    send_timer.async_wait(boost::asio::bind_executor(strand,
+        [this](const boost::system::error_code& error)
+        {
+            if (error || !sending)
+                return;
+
+            // don't queue writes if the server can't keep up
+            if (send_pending)
+                stats.skipped.add();
+            else
+                send();
+
+            // fixed schedule, so late timers don't lower the rate
+            send_timer.expires_at(send_timer.expiry() + send_interval);
+            scheduleSend();
+        }
+    ));
+}
+
+void BenchClient::send()
+{
+    UniqueUserID recipient;
+    if (config.unicast_fraction > 0 &&
+        std::uniform_real_distribution<double>{}(rng) < config.unicast_fraction)
+    {
+        recipient = UniqueUserID{1ull + rng() % config.clients};
+    }
+
+    send_pending = true;
+    client.asyncSend(
+        NearUserMessage{
+            StringwrapLayer{makePayload(index, config.message_size)},
+            recipient, UniqueUserID{index + 1ull}, ++next_msg_id
+        },
+        makeAllocHandler(send_memory, boost::asio::bind_executor(strand,
+            [this](const boost::system::error_code& error)
+            {
+                send_pending = false;
+
+                if (error)
+                {
+                    stats.send_errors.add();
+                    return;
+                }
+
+                stats.sent.add();
+
+                // without a rate, send the next one right away
+                if (sending && send_interval == clock_type::duration::zero())
+                    send();
+            }
+        ))
+    );
+}
+
+void BenchClient::stopSending()
+{
+    strand.post([this]()
+    {
+        sending = false;
+        send_timer.cancel();
+    });
+}
+
+void BenchClient::close()
+{
+    strand.post([this]()
+    {
+        connected = false;
+        client.close();
+    });
+}
+
+
+/** Sleep for a number of seconds */
+static void sleepSeconds(double seconds)
+{
+    std::this_thread::sleep_for(std::chrono::duration<double>(seconds));
+}
+
+void BenchResult::write(std::ostream& out) const
+{
+    out<<"clients: "<<clients<<'\n'<<
+        "connected: "<<connected<<'\n'<<
+        "senders: "<<senders<<'\n'<<
+        "duration_s: "<<duration<<'\n'<<
+        "sent: "<<sent<<'\n'<<
+        "send_rate: "<<sent / duration<<'\n'<<
+        "skipped: "<<skipped<<'\n'<<
+        "send_errors: "<<send_errors<<'\n'<<
+        "received: "<<received<<'\n'<<
+        "delivery_rate: "<<received / duration<<'\n'<<
+        "delivery_ratio: "<<(expected ? double(received) / expected : 0.0)<<
+            '\n'<<
+        "throughput_MBps: "<<bytes_received / duration / 1e6<<'\n'<<
+        "foreign: "<<foreign<<'\n'<<
+        "latency_p50_us: "<<latency_p50<<'\n'<<
+        "latency_p90_us: "<<latency_p90<<'\n'<<
+        "latency_p99_us: "<<latency_p99<<'\n'<<
+        "latency_p999_us: "<<latency_p999<<'\n'<<
+        "latency_max_us: "<<latency_max<<'\n';
+
+    if (server_cpu_available)
+    {
+        out<<"server_cpu_s: "<<server_cpu_time<<'\n'<<
+            "server_cpu_utilization: "<<server_cpu_utilization<<'\n'<<
+            "server_cpu_us_per_delivery: "<<
+                (received ? server_cpu_time * 1e6 / received : 0.0)<<'\n';
+    }
+}
+
+
+bool bench::runLoadTest(
+    const BenchConfig& config,
+    BenchResult& result,
+    std::ostream& err
+)
+{
+    boost::asio::io_service io_service;
+    BenchStats stats;
+
+    std::vector<std::unique_ptr<BenchClient>> clients;
+    for (unsigned i = 0; i < config.clients; ++i)
+    {
+        clients.emplace_back(new BenchClient{io_service, config, stats, i});
+        clients.back()->start();
+    }
+
+    std::unique_ptr<boost::asio::io_service::work> work{
+        new boost::asio::io_service::work{io_service}
+    };
+
+    boost::thread_group threads;
+    for (unsigned t = 0; t < std::max(config.threads, 1u); ++t)
+        threads.create_thread([&io_service]() { io_service.run(); });
+
+    // wait until all clients are connected or gave up
+    clock_type::time_point connect_deadline =
+        clock_type::now() + std::chrono::seconds{30};
+    while (stats.connected.value() + stats.connect_failures.value() <
+            config.clients && clock_type::now() < connect_deadline)
+        sleepSeconds(0.01);
+
+    std::uint64_t num_connected = stats.connected.value();
+    if (num_connected == 0)
+    {
+        err<<"error: no client could connect to "<<config.host<<':'<<
+            config.port<<'\n';
+
+        io_service.stop();
+        threads.join_all();
+        return false;
+    }
+
+    if (num_connected < config.clients)
+        err<<"warning: only "<<num_connected<<" of "<<config.clients<<
+            " clients could connect\n";
+
+    // the first clients are the senders
+    unsigned num_senders = config.senders ?
+        std::min(config.senders, config.clients) : config.clients;
+
+    std::uint64_t active_senders = 0;
+    for (unsigned i = 0; i < num_senders; ++i)
+        if (clients[i]->isConnected())
+            ++active_senders;
+
+    // every sender sends at the same rate
+    clock_type::duration interval = clock_type::duration::zero();
+    if (config.rate > 0)
+        interval = std::chrono::duration_cast<clock_type::duration>(
+            std::chrono::duration<double>(active_senders / config.rate)
+        );
+
+    ProcessCpuSampler server_cpu{config.server_pid};
+
+    for (unsigned i = 0; i < num_senders; ++i)
+        clients[i]->startSending(interval);
+
+    sleepSeconds(config.duration);
+
+    for (unsigned i = 0; i < num_senders; ++i)
+        clients[i]->stopSending();
+
+    sleepSeconds(config.drain_time);
+
+    result.server_cpu_available = server_cpu.available();
+    result.server_cpu_time = server_cpu.cpuTime();
+    result.server_cpu_utilization = server_cpu.utilization();
+
+    for (std::unique_ptr<BenchClient>& c : clients)
+        c->close();
+
+    work.reset();
+    io_service.stop();
+    threads.join_all();
+
+    result.clients = config.clients;
+    result.connected = num_connected;
+    result.senders = active_senders;
+    result.duration = config.duration;
+    result.sent = stats.sent.value();
+    result.skipped = stats.skipped.value();
+    result.send_errors = stats.send_errors.value();
+    result.received = stats.received.value();
+    result.expected = result.sent * num_connected;
+    result.bytes_received = stats.bytes_received.value();
+    result.foreign = stats.foreign.value();
+
+    result.latency_p50 = stats.latency.percentile(0.5) / 1000.0;
+    result.latency_p90 = stats.latency.percentile(0.9) / 1000.0;
+    result.latency_p99 = stats.latency.percentile(0.99) / 1000.0;
+    result.latency_p999 = stats.latency.percentile(0.999) / 1000.0;
+    result.latency_max = stats.latency.percentile(1.0) / 1000.0;
+
+    return true;
+}
+
+bool bench::runFanoutSweep(
+    const BenchConfig& config,
+    const std::vector<unsigned>& peer_counts,
+    std::ostream& out,
+    std::ostream& err
+)
+{
+    out<<"peers,connected,sent,received,delivery_ratio,"
+        "latency_p50_us,latency_p99_us,latency_p999_us,latency_max_us,"
+        "server_cpu_s,server_cpu_us_per_delivery\n";
+
+    bool ok = true;
+    for (unsigned peers : peer_counts)
+    {
+        BenchConfig run_config = config;
+        run_config.clients = peers;
+        run_config.senders = 1;
+
+        BenchResult result;
+        if (!runLoadTest(run_config, result, err))
+        {
+            ok = false;
+            continue;
+        }
+
+        out<<peers<<','<<result.connected<<','<<result.sent<<','<<
+            result.received<<','<<
+            (result.expected ? double(result.received) / result.expected : 0)<<
+            ','<<result.latency_p50<<','<<result.latency_p99<<','<<
+            result.latency_p999<<','<<result.latency_max<<',';
+
+        if (result.server_cpu_available)
+            out<<result.server_cpu_time<<','<<(result.received ?
+                result.server_cpu_time * 1e6 / result.received : 0.0);
+        else
+            out<<',';
+
+        out<<std::endl;
+
+        // let the server clean up the connections of the last run
+        sleepSeconds(1.0);
+    }
+
+    return ok;
+}
+
+void ChurnResult::write(std::ostream& out) const
+{
+    out<<"connectors: "<<connectors<<'\n'<<
+        "duration_s: "<<duration<<'\n'<<
+        "cycles: "<<cycles<<'\n'<<
+        "cycle_rate: "<<cycles / duration<<'\n'<<
+        "connect_failures: "<<failures<<'\n'<<
+        "connect_p50_us: "<<connect_p50<<'\n'<<
+        "connect_p99_us: "<<connect_p99<<'\n'<<
+        "connect_max_us: "<<connect_max<<'\n';
+
+    if (server_cpu_available)
+    {
+        out<<"server_cpu_s: "<<server_cpu_time<<'\n'<<
+            "server_cpu_us_per_cycle: "<<
+                (cycles ? server_cpu_time * 1e6 / cycles : 0.0)<<'\n';
+    }
+
+    if (server_rss_before >= 0 && server_rss_after >= 0)
+    {
+        out<<"server_rss_before_kB: "<<server_rss_before / 1024<<'\n'<<
+            "server_rss_after_kB: "<<server_rss_after / 1024<<'\n';
+    }
+}
+
+void IdleResult::write(std::ostream& out) const
+{
+    out<<"connections: "<<connections<<'\n'<<
+        "connected: "<<connected<<'\n';
+
+    if (server_rss_before >= 0 && server_rss_after >= 0)
+    {
+        out<<"server_rss_before_kB: "<<server_rss_before / 1024<<'\n'<<
+            "server_rss_after_kB: "<<server_rss_after / 1024<<'\n'<<
+            "server_bytes_per_connection: "<<(connected ?
+                double(server_rss_after - server_rss_before) / connected : 0.0)<<
+            '\n';
+    }
+
+    if (own_rss_before >= 0 && own_rss_after >= 0)
+    {
+        out<<"client_bytes_per_connection: "<<(connected ?
+            double(own_rss_after - own_rss_before) / connected : 0.0)<<'\n';
+    }
+}
+
+
+/** Resolve the server address of a benchmark configuration */
+static bool resolveServer(
+    boost::asio::io_service& io_service,
+    const BenchConfig& config,
+    boost::asio::ip::tcp::endpoint& endpoint,
+    std::ostream& err
+)
+{
+    using boost::asio::ip::tcp;
+
+    boost::system::error_code error;
+    tcp::resolver::results_type results =
+        tcp::resolver{io_service}.resolve(config.host, config.port, error);
+
+    if (error || results.empty())
+    {
+        err<<"error: can't resolve "<<config.host<<':'<<config.port<<": "<<
+            error.message()<<'\n';
+        return false;
+    }
+
+    // prefer IPv4, so the loopback address can be varied in runIdleTest()
+    endpoint = results.begin()->endpoint();
+    for (const tcp::resolver::results_type::value_type& entry : results)
+        if (entry.endpoint().address().is_v4())
+        {
+            endpoint = entry.endpoint();
+            break;
+        }
+
+    return true;
+}
+
+
+namespace
+{
+
+/** Results of a churn test, shared by all connectors */
+struct ChurnStats
+{
+    Counter cycles; /**< Connections opened and reset */
+    Counter failures; /**< Failed connects */
+
+    /** Time from starting a connect until it is established */
+    LatencyHistogram connect_latency;
+};
+
+/** Opens a connection and resets it right away, until it is stopped. */
+class ChurnConnector
+{
+    boost::asio::ip::tcp::socket sock;
+    boost::asio::ip::tcp::endpoint server;
+    ChurnStats& stats;
+    const std::atomic<bool>& running;
+    clock_type::time_point connect_start;
+
+public:
+    ChurnConnector(
+        boost::asio::io_service& io_service,
+        const boost::asio::ip::tcp::endpoint& _server,
+        ChurnStats& _stats,
+        const std::atomic<bool>& _running
+    )
+        : sock{io_service}, server{_server}, stats(_stats), running(_running)
+    {}
+
+    void start()
+    {
+        if (!running.load(std::memory_order_relaxed))
+            return;
+
+        connect_start = clock_type::now();
+        sock.async_connect(server,
+            [this](const boost::system::error_code& error)
+            {
+                boost::system::error_code ignored;
+
+                if (error)
+                    stats.failures.add();
+                else
+                {
+                    stats.connect_latency.record(
+                        std::chrono::duration_cast<std::chrono::nanoseconds>(
+                            clock_type::now() - connect_start
+                        ).count()
+                    );
+                    stats.cycles.add();
+
+                    // reset the connection, so the port is free again
+                    sock.set_option(
+                        boost::asio::socket_base::linger{true, 0}, ignored
+                    );
+                }
+
+                sock.close(ignored);
+                start();
+            }
+        );
+    }
+};
+
+} // anonymous namespace
+
+bool bench::runChurnTest(
+    const BenchConfig& config,
+    ChurnResult& result,
+    std::ostream& err
+)
+{
+    boost::asio::io_service io_service;
+
+    boost::asio::ip::tcp::endpoint server;
+    if (!resolveServer(io_service, config, server, err))
+        return false;
+
+    ChurnStats stats;
+    std::atomic<bool> running{true};
+
+    result.server_rss_before = config.server_pid ?
+        residentMemory(config.server_pid) : -1;
+    ProcessCpuSampler server_cpu{config.server_pid};
+
+    std::vector<std::unique_ptr<ChurnConnector>> connectors;
+    for (unsigned i = 0; i < config.clients; ++i)
+    {
+        connectors.emplace_back(
+            new ChurnConnector{io_service, server, stats, running}
+        );
+        connectors.back()->start();
+    }
+
+    boost::thread_group threads;
+    for (unsigned t = 0; t < std::max(config.threads, 1u); ++t)
+        threads.create_thread([&io_service]() { io_service.run(); });
+
+    sleepSeconds(config.duration);
+
+    // connects still pending are abandoned
+    running = false;
+    io_service.stop();
+    threads.join_all();
+
+    result.server_cpu_available = server_cpu.available();
+    result.server_cpu_time = server_cpu.cpuTime();
+
+    // let the server tear down the last connections
+    sleepSeconds(config.drain_time);
+    result.server_rss_after = config.server_pid ?
+        residentMemory(config.server_pid) : -1;
+
+    result.connectors = config.clients;
+    result.duration = config.duration;
+    result.cycles = stats.cycles.value();
+    result.failures = stats.failures.value();
+    result.connect_p50 = stats.connect_latency.percentile(0.5) / 1000.0;
+    result.connect_p99 = stats.connect_latency.percentile(0.99) / 1000.0;
+    result.connect_max = stats.connect_latency.percentile(1.0) / 1000.0;
+
+    if (result.cycles == 0)
+    {
+        err<<"error: no connection to "<<config.host<<':'<<config.port<<
+            " could be established\n";
+        return false;
+    }
+
+    return true;
+}
+
+bool bench::runIdleTest(
+    const BenchConfig& config,
+    unsigned connections,
+    IdleResult& result,
+    std::ostream& err
+)
+{
+    using boost::asio::ip::tcp;
+
+    // each local address has about 28000 ephemeral ports on Linux
+    const unsigned connections_per_address = 20000;
+
+    // limits the SYNs in flight, so the listen queue of the server does not
+    // overflow
+    const unsigned max_pending = 256;
+
+    boost::asio::io_service io_service;
+
+    tcp::endpoint server;
+    if (!resolveServer(io_service, config, server, err))
+        return false;
+
+    bool vary_address = server.address().is_v4() &&
+        server.address().to_v4().is_loopback();
+
+    result.connections = connections;
+    result.connected = 0;
+    result.server_rss_before = config.server_pid ?
+        residentMemory(config.server_pid) : -1;
+    result.own_rss_before = residentMemory(0);
+
+    std::vector<tcp::socket> sockets;
+    sockets.reserve(connections);
+
+    unsigned next = 0;
+    std::uint64_t failures = 0;
+    boost::system::error_code first_error;
+
+    // every chain opens one connection after the other
+    std::function<void()> connectNext = [&]()
+    {
+        if (next >= connections)
+            return;
+
+        unsigned index = next++;
+        sockets.emplace_back(io_service);
+        tcp::socket& sock = sockets.back();
+
+        boost::system::error_code error;
+        sock.open(server.protocol(), error);
+        if (!error && vary_address)
+        {
+            boost::asio::ip::address_v4::uint_type local =
+                boost::asio::ip::address_v4::loopback().to_uint() +
+                    index / connections_per_address;
+
+            sock.bind(
+                tcp::endpoint{boost::asio::ip::address_v4{local}, 0}, error
+            );
+        }
+
+        if (error)
+        {
+            if (!failures++)
+                first_error = error;
+            return io_service.post(connectNext);
+        }
+
+        sock.async_connect(server,
+            [&](const boost::system::error_code& connect_error)
+            {
+                if (!connect_error)
+                    ++result.connected;
+                else if (!failures++)
+                    first_error = connect_error;
+
+                connectNext();
+            }
+        );
+    };
+
+    for (unsigned i = 0; i < max_pending; ++i)
+        connectNext();
+
+    io_service.run();
+
+    if (failures)
+        err<<"warning: "<<failures<<" of "<<connections<<
+            " connections failed, first error: "<<first_error.message()<<'\n';
+
+    // give the server time to accept the connections
+    sleepSeconds(config.drain_time);
+
+    result.server_rss_after = config.server_pid ?
+        residentMemory(config.server_pid) : -1;
+    result.own_rss_after = residentMemory(0);
+
+    sockets.clear();
+
+    if (result.connected == 0)
+    {
+        err<<"error: no connection to "<<config.host<<':'<<config.port<<
+            " could be established\n";
+        return false;
+    }
+
+    return true;
+}
+
+void bench::raiseFileLimit()
+{
+#ifdef __linux__
+    struct rlimit limit;
+    if (getrlimit(RLIMIT_NOFILE, &limit) == 0 && limit.rlim_cur < limit.rlim_max)
+    {
+        limit.rlim_cur = limit.rlim_max;
+        setrlimit(RLIMIT_NOFILE, &limit);
+    }
+#endif
+}
@@ -0,0 +1,384 @@
+// bench.hpp
+
+/*
+ *   nuke-ms - Nuclear Messaging System
+ *   Copyright (C) 2012  Alexander Korsunsky
+ *
+ *   This program is free software: you can redistribute it and/or modify
+ *   it under the terms of the GNU General Public License as published by
+ *   the Free Software Foundation, version 3 of the License.
+ *
+ *   This program is distributed in the hope that it will be useful,
+ *   but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *   MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ *   GNU General Public License for more details.
+ *
+ *   You should have received a copy of the GNU General Public License
+ *   along with this program.  If not, see <http://www.gnu.org/licenses/>.
+*/
+
+#ifndef BENCH_HPP
+#define BENCH_HPP
+
+#include <atomic>
+#include <chrono>
+#include <cstdint>
+#include <memory>
+#include <ostream>
+#include <random>
+#include <string>
+#include <vector>
+
+#include <boost/asio/io_service.hpp>
+#include <boost/asio/steady_timer.hpp>
+#include <boost/asio/strand.hpp>
+
+#include "clientnode/asyncclient.hpp"
+#include "handleralloc.hpp"
+#include "metrics.hpp"
+
+namespace nuke_ms
+{
+namespace bench
+{
+
+typedef std::chrono::steady_clock clock_type;
+
+/** Settings for a benchmark run */
+struct BenchConfig
+{
+    /** Server to connect to */
+    std::string host;
+
+    /** Port of the server */
+    std::string port;
+
+    /** Number of simulated clients */
+    unsigned clients;
+
+    /** Number of clients that send messages, the others only receive.
+    * 0 means all clients send. */
+    unsigned senders;
+
+    /** Length of the message text in bytes */
+    std::size_t message_size;
+
+    /** Messages per second sent by all clients together. 0 means as fast as
+    * possible. */
+    double rate;
+
+    /** Fraction of messages that are addressed to a single client */
+    double unicast_fraction;
+
+    /** Duration of the measurement in seconds */
+    double duration;
+
+    /** Time to wait for outstanding messages after the last one was sent */
+    double drain_time;
+
+    /** Number of threads running the clients */
+    unsigned threads;
+
+    /** Process id of the server, to measure its CPU usage. 0 for none. */
+    int server_pid;
+
+    /** Default settings */
+    BenchConfig()
+        : host{"127.0.0.1"}, port{"34443"}, clients{10}, senders{0},
+        message_size{64},
+        rate{1000.0}, unicast_fraction{0.0}, duration{10.0}, drain_time{1.0},
+        threads{1}, server_pid{0}
+    {}
+};
+
+
+/** Results of a benchmark run, shared by all clients */
+struct BenchStats
+{
+    Counter connected; /**< Clients that are connected */
+    Counter connect_failures; /**< Clients that failed to connect */
+    Counter sent; /**< Messages written completely */
+    Counter skipped; /**< Sends skipped because the last one was pending */
+    Counter send_errors; /**< Failed writes */
+    Counter received; /**< Messages received, counting every recipient */
+    Counter bytes_received; /**< Message text received */
+    Counter foreign; /**< Received messages not sent by this benchmark */
+
+    /** Time from sending a message until each recipient received it */
+    LatencyHistogram latency;
+};
+
+
+/** Summary of a benchmark run */
+struct BenchResult
+{
+    unsigned clients; /**< Clients that should connect */
+    std::uint64_t connected; /**< Clients that did connect */
+    std::uint64_t senders; /**< Clients that sent messages */
+    double duration; /**< Seconds messages were sent */
+    std::uint64_t sent; /**< Messages sent */
+    std::uint64_t skipped; /**< Sends skipped because of backpressure */
+    std::uint64_t send_errors; /**< Failed sends */
+    std::uint64_t received; /**< Messages received by all clients */
+    std::uint64_t expected; /**< Messages that should have been received */
+    std::uint64_t bytes_received; /**< Message text received */
+    std::uint64_t foreign; /**< Messages not sent by this benchmark */
+
+    /** Delivery latency percentiles in microseconds */
+    double latency_p50, latency_p90, latency_p99, latency_p999, latency_max;
+
+    bool server_cpu_available; /**< Was the CPU usage measured? */
+    double server_cpu_time; /**< CPU seconds used by the server */
+    double server_cpu_utilization; /**< 1.0 is one core fully busy */
+
+    /** Write as "key: value" lines */
+    void write(std::ostream& out) const;
+};
+
+
+/** Results of a connection churn test */
+struct ChurnResult
+{
+    unsigned connectors; /**< Clients connecting concurrently */
+    double duration; /**< Seconds the test ran */
+    std::uint64_t cycles; /**< Completed connect and close cycles */
+    std::uint64_t failures; /**< Failed connects */
+
+    /** Connect latency percentiles in microseconds */
+    double connect_p50, connect_p99, connect_max;
+
+    bool server_cpu_available; /**< Was the server measured? */
+    double server_cpu_time; /**< CPU seconds used by the server */
+    long long server_rss_before; /**< Server memory before the test */
+    long long server_rss_after; /**< Server memory after the test */
+
+    /** Write as "key: value" lines */
+    void write(std::ostream& out) const;
+};
+
+/** Results of an idle connection test */
+struct IdleResult
+{
+    unsigned connections; /**< Connections that should be opened */
+    std::uint64_t connected; /**< Connections that were opened */
+    long long server_rss_before; /**< Server memory without the connections */
+    long long server_rss_after; /**< Server memory with the connections */
+    long long own_rss_before; /**< Own memory without the connections */
+    long long own_rss_after; /**< Own memory with the connections */
+
+    /** Write as "key: value" lines */
+    void write(std::ostream& out) const;
+};
+
+
+/** Get the resident memory of a process in bytes.
+* @param pid The process, 0 for the calling process
+* @return The memory, or -1 if it can't be determined
+*/
+long long residentMemory(int pid);
+
+
+/** Measures the CPU time used by another process.
+* Only implemented on Linux, elsewhere available() returns false.
+*/
+class ProcessCpuSampler
+{
+    int pid;
+    double start_seconds;
+    clock_type::time_point start_time;
+
+    /** Read the CPU time of the process in seconds, or -1 on failure */
+    double cpuSeconds() const;
+
+public:
+    /** Constructor. Takes the first sample.
+    * @param _pid The process to measure, 0 for none
+    */
+    explicit ProcessCpuSampler(int _pid);
+
+    /** Check if the CPU time of the process can be measured */
+    bool available() const
+    { return start_seconds >= 0; }
+
+    /** CPU time used since construction in seconds */
+    double cpuTime() const;
+
+    /** CPU usage since construction, 1.0 being one core fully busy */
+    double utilization() const;
+};
+
+
+/** A simulated client.
+*
+* The client connects to the server and then receives messages until it is
+* closed. Every message it receives carries the time it was sent at, which
+* is used to measure the delivery latency.
+*
+* All handlers of one client run on its own strand, so the client can be
+* driven by several threads.
+*/
+class BenchClient
+{
+public:
+    /** Constructor.
+    * @param io_service The io_service all operations run on
+    * @param config Settings of the benchmark
+    * @param stats Where the results are collected
+    * @param index Number of the client, starting at 0
+    */
+    BenchClient(
+        boost::asio::io_service& io_service,
+        const BenchConfig& config,
+        BenchStats& stats,
+        unsigned index
+    );
+
+    /** Connect and start receiving. */
+    void start();
+
+    /** Start sending messages with the given interval.
+    * @param interval Time between two messages. If zero, a message is sent
+    * as soon as the previous one was written.
+    */
+    void startSending(clock_type::duration interval);
+
+    /** Stop sending messages. */
+    void stopSending();
+
+    /** Close the connection. */
+    void close();
+
+    /** Check if the client is connected. */
+    bool isConnected() const
+    { return connected; }
+
+private:
+    const BenchConfig& config;
+    BenchStats& stats;
+    const unsigned index;
+
+    boost::asio::io_service::strand strand;
+    clientnode::AsyncClient client;
+    boost::asio::steady_timer send_timer;
+
+    /** Recycled memory for the receive operations */
+    std::shared_ptr<HandlerMemory> receive_memory;
+
+    /** Recycled memory for the send operations */
+    std::shared_ptr<HandlerMemory> send_memory;
+
+    std::minstd_rand rng;
+    clock_type::duration send_interval;
+    NearUserMessage::msg_id_t next_msg_id;
+
+    std::atomic<bool> connected;
+    bool sending;
+    bool send_pending;
+
+    void receive();
+    void scheduleSend();
+    void send();
+};
+
+
+/** Format a message text that carries the sender and the current time.
+* @param sender Number of the sending client
+* @param size Length of the text. Padded if longer than needed.
+*/
+std::string makePayload(unsigned sender, std::size_t size);
+
+/** Read the sender and send time from a message text.
+* @return false if the text was not created by makePayload()
+*/
+bool parsePayload(
+    const std::string& text,
+    unsigned& sender,
+    clock_type::time_point& send_time
+);
+
+
+/** Run a load test.
+*
+* Connects the clients, lets them send for the configured duration and
+* waits for the outstanding messages.
+*
+* @param config Settings of the benchmark
+* @param result The results of the run
+* @param err Where errors are reported to
+* @return true on success, false if no client could connect
+*/
+bool runLoadTest(
+    const BenchConfig& config,
+    BenchResult& result,
+    std::ostream& err
+);
+
+/** Measure how the server scales with the number of receivers.
+*
+* For each number of peers, a load test is run in which a single client
+* sends messages at the configured rate and all peers receive them. One CSV
+* line with the delivery latency and the server CPU time per delivered
+* message is written for each run.
+*
+* @param config Settings of the benchmark. clients and senders are ignored.
+* @param peer_counts The numbers of peers to measure
+* @param out Where the results are written to
+* @param err Where errors are reported to
+* @return true if all runs succeeded
+*/
+bool runFanoutSweep(
+    const BenchConfig& config,
+    const std::vector<unsigned>& peer_counts,
+    std::ostream& out,
+    std::ostream& err
+);
+
+/** Measure how fast the server accepts and tears down connections.
+*
+* config.clients connectors connect to the server and close the connection
+* again as soon as it is established, for config.duration seconds. The
+* connections are reset instead of closed gracefully, so no ports are stuck
+* in TIME_WAIT.
+*
+* @param config Settings of the benchmark
+* @param result The results of the run
+* @param err Where errors are reported to
+* @return true on success
+*/
+bool runChurnTest(
+    const BenchConfig& config,
+    ChurnResult& result,
+    std::ostream& err
+);
+
+/** Measure the memory used per idle connection.
+*
+* Opens the given number of connections without sending anything, waits
+* config.drain_time seconds and measures the resident memory of the server
+* (given by config.server_pid) and of this process.
+*
+* If the server is on the loopback interface, the connections are spread
+* over several local addresses, so more connections than local ports can
+* be opened.
+*
+* @param config Settings of the benchmark
+* @param connections Number of connections to open
+* @param result The results of the run
+* @param err Where errors are reported to
+* @return true if at least one connection was opened
+*/
+bool runIdleTest(
+    const BenchConfig& config,
+    unsigned connections,
+    IdleResult& result,
+    std::ostream& err
+);
+
+/** Raise the limit of open files as far as allowed, so that many clients
+* can be connected. Does nothing where not supported. */
+void raiseFileLimit();
+
+} // namespace bench
+} // namespace nuke_ms
+
+#endif // ifndef BENCH_HPP
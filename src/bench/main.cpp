@@ -0,0 +1,200 @@
+// main.cpp
+
+/*
+ *   nuke-ms - Nuclear Messaging System
+ *   Copyright (C) 2012  Alexander Korsunsky
+ *
+ *   This program is free software: you can redistribute it and/or modify
+ *   it under the terms of the GNU General Public License as published by
+ *   the Free Software Foundation, either version 3 of the License.
+ *
+ *   This program is distributed in the hope that it will be useful,
+ *   but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *   MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ *   GNU General Public License for more details.
+ *
+ *   You should have received a copy of the GNU General Public License
+ *   along with this program.  If not, see <http://www.gnu.org/licenses/>.
+*/
+
+#include <cstdlib>
+#include <cstring>
+#include <iostream>
+#include <string>
+#include <vector>
+
+#include "bench.hpp"
+
+using namespace nuke_ms::bench;
+
+
+static void printUsage(const char* progname)
+{
+    BenchConfig defaults;
+
+    std::cout<<"Usage: "<<progname<<" [options]\n"
+        "Load generator for nuke-ms-serv. Simulates clients that send\n"
+        "messages to the server and measures how fast they are delivered.\n\n"
+        "Modes:\n"
+        "  load    clients send messages for the given duration (default)\n"
+        "  churn   clients connect and reset the connection again and again\n"
+        "          for the given duration\n"
+        "  idle    open idle connections and measure the memory used per\n"
+        "          connection, needs --server-pid for the server side\n\n"
+        "Options:\n"
+        "  --mode MODE        load, churn or idle\n"
+        "  --host HOST        server address ("<<defaults.host<<")\n"
+        "  --port PORT        server port ("<<defaults.port<<")\n"
+        "  --clients N        number of clients ("<<defaults.clients<<")\n"
+        "  --senders N        number of clients that send, 0 for all ("<<
+            defaults.senders<<")\n"
+        "  --size BYTES       message size ("<<defaults.message_size<<")\n"
+        "  --rate N           messages per second of all clients together,\n"
+        "                     0 for as fast as possible ("<<defaults.rate<<")\n"
+        "  --unicast F        fraction of messages with a recipient ("<<
+            defaults.unicast_fraction<<")\n"
+        "  --duration S       seconds to send messages ("<<
+            defaults.duration<<")\n"
+        "  --drain S          seconds to wait for late messages ("<<
+            defaults.drain_time<<")\n"
+        "  --threads N        threads running the clients ("<<
+            defaults.threads<<")\n"
+        "  --server-pid PID   measure the CPU usage of the server process\n"
+        "  --fanout N,N,...   measure the delivery from one sender to each\n"
+        "                     number of peers and write a CSV table\n"
+        "  --connections N,N,...\n"
+        "                     connection counts for the idle mode (10000)\n"
+        "  --help             show this message\n";
+}
+
+/** Parse a comma separated list of numbers */
+static std::vector<unsigned> parseList(const char* str)
+{
+    std::vector<unsigned> list;
+    char* end;
+
+    while (*str)
+    {
+        list.push_back(std::strtoul(str, &end, 10));
+        if (end == str)
+            break;
+        str = *end == ',' ? end + 1 : end;
+    }
+
+    return list;
+}
+
+int main(int argc, char* argv[])
+{
+    BenchConfig config;
+    std::vector<unsigned> fanout;
+    std::vector<unsigned> idle_connections{10000};
+    std::string mode = "load";
+
+    for (int i = 1; i < argc; ++i)
+    {
+        const char* opt = argv[i];
+
+        if (!std::strcmp(opt, "--help"))
+        {
+            printUsage(argv[0]);
+            return 0;
+        }
+
+        if (i + 1 >= argc)
+        {
+            std::cerr<<"Missing value for option "<<opt<<"\n";
+            return 2;
+        }
+        const char* value = argv[++i];
+
+        if (!std::strcmp(opt, "--mode"))
+            mode = value;
+        else if (!std::strcmp(opt, "--connections"))
+            idle_connections = parseList(value);
+        else if (!std::strcmp(opt, "--host"))
+            config.host = value;
+        else if (!std::strcmp(opt, "--port"))
+            config.port = value;
+        else if (!std::strcmp(opt, "--clients"))
+            config.clients = std::strtoul(value, nullptr, 10);
+        else if (!std::strcmp(opt, "--senders"))
+            config.senders = std::strtoul(value, nullptr, 10);
+        else if (!std::strcmp(opt, "--fanout"))
+            fanout = parseList(value);
+        else if (!std::strcmp(opt, "--size"))
+            config.message_size = std::strtoul(value, nullptr, 10);
+        else if (!std::strcmp(opt, "--rate"))
+            config.rate = std::strtod(value, nullptr);
+        else if (!std::strcmp(opt, "--unicast"))
+            config.unicast_fraction = std::strtod(value, nullptr);
+        else if (!std::strcmp(opt, "--duration"))
+            config.duration = std::strtod(value, nullptr);
+        else if (!std::strcmp(opt, "--drain"))
+            config.drain_time = std::strtod(value, nullptr);
+        else if (!std::strcmp(opt, "--threads"))
+            config.threads = std::strtoul(value, nullptr, 10);
+        else if (!std::strcmp(opt, "--server-pid"))
+            config.server_pid = std::atoi(value);
+        else
+        {
+            std::cerr<<"Unknown option "<<opt<<"\n";
+            printUsage(argv[0]);
+            return 2;
+        }
+    }
+
+    if (config.clients == 0 || config.duration <= 0)
+    {
+        std::cerr<<"At least one client and a positive duration are needed.\n";
+        return 2;
+    }
+
+    raiseFileLimit();
+
+    if (mode == "churn")
+    {
+        ChurnResult result;
+        if (!runChurnTest(config, result, std::cerr))
+            return 1;
+
+        result.write(std::cout);
+        return 0;
+    }
+
+    if (mode == "idle")
+    {
+        bool ok = true;
+        for (unsigned connections : idle_connections)
+        {
+            IdleResult result;
+            if (!runIdleTest(config, connections, result, std::cerr))
+            {
+                ok = false;
+                continue;
+            }
+
+            result.write(std::cout);
+            std::cout<<std::endl;
+        }
+
+        return ok ? 0 : 1;
+    }
+
+    if (mode != "load")
+    {
+        std::cerr<<"Unknown mode "<<mode<<"\n";
+        printUsage(argv[0]);
+        return 2;
+    }
+
+    if (!fanout.empty())
+        return runFanoutSweep(config, fanout, std::cout, std::cerr) ? 0 : 1;
+
+    BenchResult result;
+    if (!runLoadTest(config, result, std::cerr))
+        return 1;
+
+    result.write(std::cout);
+    return 0;
+}
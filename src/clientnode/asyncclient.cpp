@@ -0,0 +1,37 @@
+// asyncclient.cpp
+
+/*
+ *   nuke-ms - Nuclear Messaging System
+ *   Copyright (C) 2012  Alexander Korsunsky
+ *
+ *   This program is free software: you can redistribute it and/or modify
+ *   it under the terms of the GNU General Public License as published by
+ *   the Free Software Foundation, either version 3 of the License.
+ *
+ *   This program is distributed in the hope that it will be useful,
+ *   but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *   MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ *   GNU General Public License for more details.
+ *
+ *   You should have received a copy of the GNU General Public License
+ *   along with this program.  If not, see <http://www.gnu.org/licenses/>.
+*/
+
+#include "clientnode/asyncclient.hpp"
+
+using namespace nuke_ms;
+using namespace nuke_ms::clientnode;
+
+
+AsyncClient::AsyncClient(boost::asio::io_service& io_service)
+    : resolver{io_service}, sock{io_service},
+    read_handler_memory{std::make_shared<HandlerMemory>()},
+    write_handler_memory{std::make_shared<HandlerMemory>()}
+{ }
+
+void AsyncClient::close()
+{
+    boost::system::error_code dontcare;
+    resolver.cancel();
+    sock.close(dontcare);
+}
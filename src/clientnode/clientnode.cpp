@@ -31,6 +31,7 @@ using namespace clientnode;
 
 
 static bool parseDestinationString(
+    connection_kind_t& kind,
     byte_traits::native_string& host,
     byte_traits::native_string& service,
     const byte_traits::native_string& where
@@ -38,17 +39,14 @@ static bool parseDestinationString(
 
 
 ClientNode::ClientNode(LoggingStreams logstreams_)
-    : statemachine{signals, logstreams, machine_mutex},
-    last_msg_id{0},  logstreams{logstreams_}
-{
-    // initiate the event processor
-    statemachine.initiate();
-}
+    : logstreams{logstreams_}, statemachine{signals, logstreams},
+    last_msg_id{0}
+{ }
 
 ClientNode::~ClientNode()
 {
-    // stop the network machine
-    statemachine.terminate();
+    // stop the network machine while the signals are still alive
+    statemachine.shutdown();
 }
 
 boost::signals2::connection
@@ -62,16 +60,91 @@ ClientNode::connectRcvMessage(const SignalRcvMessage::slot_type& slot)
     return rcvMessageConnection;
 }
 
+/** Fulfill a promise with the outcome of sending.
+*
+* @param promise The promise
+* @param rprt The outcome
+*/
+static void fulfillSendPromise(
+    const std::shared_ptr<std::promise<NearUserMessage::msg_id_t>>& promise,
+    const SendReport& rprt
+)
+{
+    if (rprt.send_state)
+        promise->set_value(rprt.message_id);
+    else
+        promise->set_exception(std::make_exception_ptr(SendError{rprt}));
+}
+
+/** Fulfill a promise with the outcome of sending a batch.
+*
+* @param promise The promise
+* @param count Number of messages in the batch
+* @param rprt The outcome, holding the identifier of the first message
+*/
+static void fulfillBatchPromise(
+    const std::shared_ptr<
+        std::promise<std::vector<NearUserMessage::msg_id_t>>
+    >& promise,
+    std::size_t count,
+    const SendReport& rprt
+)
+{
+    if (!rprt.send_state)
+    {
+        promise->set_exception(std::make_exception_ptr(SendError{rprt}));
+        return;
+    }
+
+    // the identifiers of a batch are consecutive
+    std::vector<NearUserMessage::msg_id_t> msg_ids(count);
+    for (std::size_t i = 0; i < count; ++i)
+        msg_ids[i] = rprt.message_id + static_cast<NearUserMessage::msg_id_t>(i);
+
+    promise->set_value(std::move(msg_ids));
+}
+
+/** Call a completion handler of asyncSend() with the outcome of sending.
+*
+* @param completion The completion handler
+* @param rprt The outcome
+*/
+static void completeSend(
+    const std::function<
+        void (boost::system::error_code, NearUserMessage::msg_id_t)
+    >& completion,
+    const SendReport& rprt
+)
+{
+    boost::system::error_code error;
+
+    if (rprt.reason == SendReport::SR_SERVER_NOT_CONNECTED)
+        error = boost::asio::error::not_connected;
+    else if (!rprt.send_state)
+        error = boost::asio::error::connection_aborted;
+
+    completion(error, rprt.message_id);
+}
+
+
 void ClientNode::connectTo(const ServerLocation& where)
+{
+    postConnect(where, ConnectCompletion{});
+}
+
+void ClientNode::postConnect(
+    const ServerLocation& where,
+    ConnectCompletion completion
+)
 {
     // Get Host/Service pair from the destination string
+    connection_kind_t kind;
     byte_traits::native_string host, service;
-    if (parseDestinationString(host, service, where.where))
+    if (parseDestinationString(kind, host, service, where.where))
     {  // on success, pass on event
-
-        // lock the mutex to the machine, process event
-        boost::mutex::scoped_lock{machine_mutex};
-        statemachine.process_event(EvtConnectRequest{host, service});
+        statemachine.postEvent(
+            EvtConnectRequest{host, service, kind, std::move(completion)}
+        );
     }
     else // on failure, report back to application
     {
@@ -82,6 +155,9 @@ void ClientNode::connectTo(const ServerLocation& where)
         rprt->msg = "Invalid remote site identifier";
 
         signals.connectStatReport(rprt);
+
+        if (completion)
+            completion(boost::asio::error::invalid_argument);
     }
 }
 
@@ -91,24 +167,140 @@ NearUserMessage::msg_id_t ClientNode::sendUserMessage(
     byte_traits::msg_string&& msg,
     const UniqueUserID& recipient
 )
+{
+    NearUserMessage usermsg{std::move(msg), recipient};
+    NearUserMessage::msg_id_t msg_id = usermsg._msg_id = getNextMessageId();
+
+    statemachine.postEvent(EvtSendMsg<NearUserMessage>{std::move(usermsg)});
+
+    return msg_id;
+}
+
+
+
+std::future<NearUserMessage::msg_id_t> ClientNode::sendUserMessageAsync(
+    byte_traits::msg_string&& msg,
+    const UniqueUserID& recipient
+)
+{
+    NearUserMessage usermsg{std::move(msg), recipient};
+    usermsg._msg_id = getNextMessageId();
+
+    auto promise = std::make_shared<std::promise<NearUserMessage::msg_id_t>>();
+    std::future<NearUserMessage::msg_id_t> future = promise->get_future();
+
+    statemachine.postEvent(EvtSendMsg<NearUserMessage>{
+        std::move(usermsg),
+        std::bind(&fulfillSendPromise, promise, std::placeholders::_1)
+    });
+
+    return future;
+}
+
+
+
+void ClientNode::postSend(
+    byte_traits::msg_string&& msg,
+    const UniqueUserID& recipient,
+    std::function<
+        void (boost::system::error_code, NearUserMessage::msg_id_t)
+    > completion
+)
 {
     NearUserMessage usermsg{std::move(msg), recipient};
     usermsg._msg_id = getNextMessageId();
 
-    // lock the mutex to the machine
-    boost::mutex::scoped_lock{machine_mutex};
-    statemachine.process_event(EvtSendMsg<NearUserMessage>{std::move(usermsg)});
+    statemachine.postEvent(EvtSendMsg<NearUserMessage>{
+        std::move(usermsg),
+        std::bind(&completeSend, std::move(completion), std::placeholders::_1)
+    });
+}
+
+
+
+void ClientNode::postReceive(ReceiveCompletion completion)
+{
+    statemachine.postCommand(std::unique_ptr<MachineCommand>{
+        new FunctionCommand{
+            [completion](ClientnodeMachine& cm) mutable
+            { cm.receiveMessage(std::move(completion)); }
+        }
+    });
+}
+
+
+
+NearUserMessage::msg_id_t ClientNode::sendUserMessages(
+    std::vector<NearUserMessage>&& messages
+)
+{
+    return postBatch(std::move(messages), SendCompletion{});
+}
+
+
+
+std::future<std::vector<NearUserMessage::msg_id_t>>
+ClientNode::sendUserMessagesAsync(std::vector<NearUserMessage>&& messages)
+{
+    auto promise = std::make_shared<
+        std::promise<std::vector<NearUserMessage::msg_id_t>>
+    >();
+    std::future<std::vector<NearUserMessage::msg_id_t>> future =
+        promise->get_future();
+
+    std::size_t count = messages.size();
+    postBatch(std::move(messages),
+        std::bind(&fulfillBatchPromise, promise, count, std::placeholders::_1));
+
+    return future;
+}
+
+
 
-    return usermsg._msg_id;
+NearUserMessage::msg_id_t ClientNode::postBatch(
+    std::vector<NearUserMessage>&& messages,
+    SendCompletion completion
+)
+{
+    // An empty batch is done immediately. It takes no identifier, so it
+    // must not report one that the next message gets.
+    if (messages.empty())
+    {
+        if (completion)
+            completion(SendReport{NearUserMessage::msg_id_none, true,
+                SendReport::SR_SEND_OK, {}});
+        return NearUserMessage::msg_id_none;
+    }
+
+    NearUserMessage::msg_id_t first_id = getNextMessageIds(messages.size());
+
+    NearUserMessage::msg_id_t msg_id = first_id;
+    for (NearUserMessage& msg : messages)
+        msg._msg_id = msg_id++;
+
+    statemachine.postEvent(EvtSendMsgBatch<NearUserMessage>{
+        std::move(messages), std::move(completion)
+    });
+
+    return first_id;
 }
 
 
 
 void ClientNode::disconnect()
 {
-    // lock the mutex to the machine, dispatch disconnect request
-    boost::mutex::scoped_lock{machine_mutex};
-    statemachine.process_event(EvtDisconnectRequest{});
+    // dispatch disconnect request
+    statemachine.postEvent(EvtDisconnectRequest{});
+}
+
+
+void ClientNode::setReconnectPolicy(const ReconnectPolicy& policy)
+{
+    statemachine.postCommand(std::unique_ptr<MachineCommand>{
+        new FunctionCommand{
+            [policy](ClientnodeMachine& cm) { cm.reconnect_policy = policy; }
+        }
+    });
 }
 
 
@@ -118,7 +310,13 @@ void ClientNode::disconnect()
 * service.
 * If there is not exactly one column, the function returns false, indicating
 * failure.
+* A destination of the form "unix:<path>" names a Unix domain socket,
+* "shm:<path>" a shared memory connection set up through a Unix domain
+* socket. In that case, the host is empty and the service holds the path.
+* A destination of the form "inproc:<name>" names a LoopbackListener in the
+* same process; the service holds the name.
 *
+* @param kind A reference where the kind of connection will be stored.
 * @param host A reference to a string where the host will be stored.
 * Any content will be overwritten.
 * @param service A reference to a string where the service will be stored.
@@ -128,11 +326,61 @@ void ClientNode::disconnect()
 * @return true on success, false on failure.
 */
 static bool parseDestinationString(
+    connection_kind_t& kind,
     byte_traits::native_string& host,
     byte_traits::native_string& service,
     const byte_traits::native_string& where
 )
 {
+    static const byte_traits::native_string local_prefix{"unix:"};
+    static const byte_traits::native_string shm_prefix{"shm:"};
+    static const byte_traits::native_string inproc_prefix{"inproc:"};
+
+    std::size_t prefix_size = 0;
+    kind = CONNECTION_TCP;
+
+    if (where.compare(0, local_prefix.size(), local_prefix) == 0)
+    {
+        kind = CONNECTION_LOCAL;
+        prefix_size = local_prefix.size();
+    }
+#ifdef NUKE_MS_SHM_TRANSPORT
+    else if (where.compare(0, shm_prefix.size(), shm_prefix) == 0)
+    {
+        kind = CONNECTION_SHM;
+        prefix_size = shm_prefix.size();
+    }
+#endif
+
+    if (where.compare(0, inproc_prefix.size(), inproc_prefix) == 0)
+    {
+        kind = CONNECTION_INPROC;
+        host.clear();
+        service.assign(where, inproc_prefix.size(), byte_traits::native_string::npos);
+
+        return !service.empty();
+    }
+
+    if (kind != CONNECTION_TCP)
+    {
+        host.clear();
+        service.assign(where, prefix_size, byte_traits::native_string::npos);
+
+        if (service.empty())
+            return false;
+
+        // the path has to fit into a socket address
+        try {
+            boost::asio::local::stream_protocol::endpoint{service};
+        }
+        catch (const boost::system::system_error&)
+        {
+            return false;
+        }
+
+        return true;
+    }
+
     // get ourself a tokenizer
     typedef boost::tokenizer<
         boost::char_separator<byte_traits::native_string::value_type>,
@@ -0,0 +1,85 @@
+// logstreams.cpp
+
+/*
+ *   nuke-ms - Nuclear Messaging System
+ *   Copyright (C) 2012  Alexander Korsunsky
+ *
+ *   This program is free software: you can redistribute it and/or modify
+ *   it under the terms of the GNU General Public License as published by
+ *   the Free Software Foundation, either version 3 of the License.
+ *
+ *   This program is distributed in the hope that it will be useful,
+ *   but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *   MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ *   GNU General Public License for more details.
+ *
+ *   You should have received a copy of the GNU General Public License
+ *   along with this program.  If not, see <http://www.gnu.org/licenses/>.
+*/
+
+#include "clientnode/logstreams.hpp"
+
+using namespace nuke_ms;
+using namespace nuke_ms::clientnode;
+
+
+LogWriter::LogWriter()
+    : stop{false}, writer_thread{&LogWriter::run, this}
+{}
+
+LogWriter::~LogWriter()
+{
+    {
+        boost::lock_guard<boost::mutex> lock{queue_mutex};
+        stop = true;
+    }
+    queue_cond.notify_one();
+
+    writer_thread.join();
+}
+
+void LogWriter::write(std::ostream& stream, std::string&& text)
+{
+    {
+        boost::lock_guard<boost::mutex> lock{queue_mutex};
+        queue.push_back(Record{&stream, std::move(text)});
+    }
+    queue_cond.notify_one();
+}
+
+void LogWriter::run()
+{
+    // swapped with the queue, so the lock is not held while writing
+    std::vector<Record> records;
+
+    while (true)
+    {
+        bool stopping;
+        {
+            boost::unique_lock<boost::mutex> lock{queue_mutex};
+            while (queue.empty() && !stop)
+                queue_cond.wait(lock);
+
+            records.swap(queue);
+            stopping = stop;
+        }
+
+        std::ostream* last_stream = nullptr;
+        for (Record& rec : records)
+        {
+            if (last_stream && last_stream != rec.stream)
+                last_stream->flush();
+
+            *rec.stream<<rec.text;
+            last_stream = rec.stream;
+        }
+
+        if (last_stream)
+            last_stream->flush();
+
+        records.clear();
+
+        if (stopping)
+            break;
+    }
+}
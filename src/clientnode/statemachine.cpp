@@ -19,187 +19,790 @@
 
 #include "clientnode/statemachine.hpp"
 
+#ifdef NUKE_MS_SHM_TRANSPORT
+#include "shmtransport.hpp"
+#include "loopback.hpp"
+#endif
+
 using namespace nuke_ms;
 using namespace nuke_ms::clientnode;
 using namespace boost::asio::ip;
 
 
-ClientnodeMachine::ClientnodeMachine(ClientNodeSignals&  _signals,
-	LoggingStreams logstreams_, boost::mutex& _machine_mutex
+/** Report the outcome of sending a message to the application.
+* If there is a completion, it is called instead of issuing a signal.
+*
+* @param signals The signals of the machine
+* @param completion Called with the outcome, may be empty
+* @param msg_id Identifier of the message in question
+* @param send_state Was it sent or not
+* @param reason Reason for failure
+* @param reason_str Text describing the reason
+*/
+static void reportSend(
+    ClientNodeSignals& signals,
+    const SendCompletion& completion,
+    NearUserMessage::msg_id_t msg_id,
+    bool send_state,
+    SendReport::send_rprt_reason_t reason,
+    const byte_traits::native_string& reason_str = byte_traits::native_string{}
 )
-    : signals(_signals), io_service{new boost::asio::io_service},
-        socket{*io_service}, resolver{*io_service},
-        logstreams(logstreams_), machine_mutex(_machine_mutex),
-        ReferenceCounter{std::bind(&ClientnodeMachine::on_returned, this)}
-{}
+{
+    auto rprt = std::make_shared<SendReport>();
+    rprt->message_id = msg_id;
+    rprt->send_state = send_state;
+    rprt->reason = reason;
+    rprt->reason_str = reason_str;
 
-ClientnodeMachine::~ClientnodeMachine()
+    if (!completion)
+        signals.sendReport(rprt);
+    else
+        completion(*rprt);
+}
+
+/** Report the outcome of sending a batch of messages to the application.
+* If there is a completion, it is called once for the whole batch, otherwise
+* a signal is issued for each message.
+*
+* @param signals The signals of the machine
+* @param completion Called with the outcome, may be empty
+* @param first Iterator to the first message identifier of the batch
+* @param last Iterator past the last message identifier of the batch
+* @param send_state Was it sent or not
+* @param reason Reason for failure
+* @param reason_str Text describing the reason
+*/
+template <typename MsgIdIterator>
+static void reportSendBatch(
+    ClientNodeSignals& signals,
+    const SendCompletion& completion,
+    MsgIdIterator first, MsgIdIterator last,
+    bool send_state,
+    SendReport::send_rprt_reason_t reason,
+    const byte_traits::native_string& reason_str = byte_traits::native_string{}
+)
 {
-    stopIOOperations();
+    if (first == last)
+        return;
 
-    catchThread(io_thread, thread_timeout);
+    if (completion)
+    {
+        reportSend(signals, completion, *first, send_state, reason, reason_str);
+        return;
+    }
+
+    for (; first != last; ++first)
+        reportSend(signals, completion, *first, send_state, reason, reason_str);
+}
+
+/** Report a whole batch of messages as not sent.
+*
+* @param signals The signals of the machine
+* @param evt The event carrying the batch
+* @param reason_str Text describing the reason
+*/
+static void reportBatchNotConnected(
+    ClientNodeSignals& signals,
+    const EvtSendMsgBatch<NearUserMessage>& evt,
+    const byte_traits::native_string& reason_str
+)
+{
+    std::vector<NearUserMessage::msg_id_t> msg_ids;
+    msg_ids.reserve(evt._data.size());
+    for (const NearUserMessage& msg : evt._data)
+        msg_ids.push_back(msg._msg_id);
+
+    reportSendBatch(signals, evt._completion, msg_ids.begin(), msg_ids.end(),
+        false, SendReport::SR_SERVER_NOT_CONNECTED, reason_str);
+}
 
-    // wait for all handlers to retuirn
-    if (getRefCount() > 0)
+/** Report the outcome of writing a queued packet to the application.
+*
+* @param signals The signals of the machine
+* @param write The packet in question
+* @param send_state Was it sent or not
+* @param reason Reason for failure
+* @param reason_str Text describing the reason
+*/
+static void reportWrite(
+    ClientNodeSignals& signals,
+    const ClientnodeMachine::QueuedWrite& write,
+    bool send_state,
+    SendReport::send_rprt_reason_t reason,
+    const byte_traits::native_string& reason_str = byte_traits::native_string{}
+)
+{
+    switch (write.kind)
     {
-        boost::mutex::scoped_lock lk{reference_mutex};
-        returned_condition.wait(lk);
+        case ClientnodeMachine::QueuedWrite::WRITE_MESSAGE:
+            reportSend(signals, write.completion, write.msg_id, send_state,
+                reason, reason_str);
+            break;
+
+        case ClientnodeMachine::QueuedWrite::WRITE_BATCH:
+            reportSendBatch(signals, write.completion, write.msg_ids.begin(),
+                write.msg_ids.end(), send_state, reason, reason_str);
+            break;
+
+        case ClientnodeMachine::QueuedWrite::WRITE_RESUME_REQUEST:
+            break;
     }
 }
 
-void ClientnodeMachine::startIOOperations()
+
+ClientnodeMachine::ClientnodeMachine(ClientNodeSignals&  _signals,
+	LoggingStreams logstreams_
+)
+    : current_state{STATE_TERMINATED},
+        io_service{new boost::asio::io_service},
+        io_work{new boost::asio::io_service::work{*io_service}},
+        drain_scheduled{false}, signals(_signals), logstreams(logstreams_),
+        socket{*io_service}, local_socket{*io_service},
+        transport{*io_service}, resolver{*io_service},
+        rcvbuf_fill{0},
+        read_handler_memory{std::make_shared<HandlerMemory>()},
+        write_handler_memory{std::make_shared<HandlerMemory>()},
+        reconnect_timer{*io_service}, reconnect_attempt{0},
+        reconnect_rng{std::random_device{}()},
+        connection_kind{CONNECTION_TCP}, have_received{false},
+        last_rcvd_msg_id{0}, keep_received{false}
 {
-    // Before starting a new thread, the old thread must be joined.
-    catchThread(io_thread, thread_timeout);
+    // enter the initial state before anyone else can touch the machine
+    initiate();
 
     // help std::bind find the right overload
     std::size_t (boost::asio::io_service::*r)() = &boost::asio::io_service::run;
 
-    // start a new thread that processes all asynchronous operations
+    // start a thread that processes all asynchronous operations and commands
     io_thread = boost::thread(std::bind(r, io_service.get()));
 }
 
+ClientnodeMachine::~ClientnodeMachine()
+{
+    shutdown();
+}
+
+void ClientnodeMachine::shutdown()
+{
+    // nothing to do if we are shut down already
+    if (!io_work)
+        return;
+
+    // stop the I/O thread
+    io_work.reset();
+    io_service->stop();
+    catchThread(io_thread, thread_timeout);
+
+    // From now on, this thread owns the machine. Events dispatched to a
+    // terminated machine are discarded.
+    terminate();
+
+    // cancel everything that is still pending and let the handlers return
+    stopIOOperations();
+    completeConnect(boost::asio::error::operation_aborted);
+    failReceive(boost::asio::error::operation_aborted);
+    io_service->reset();
+    while (getRefCount() > 0 && io_service->run_one())
+    {}
+
+    // throw away all commands that were not executed
+    while (command_queue.pop())
+    {}
+}
+
+void ClientnodeMachine::postCommand(std::unique_ptr<MachineCommand> cmd)
+{
+    command_queue.push(std::move(cmd));
+
+    // make sure the I/O thread comes around to drain the queue
+    if (!drain_scheduled.exchange(true))
+        io_service->post(std::bind(&ClientnodeMachine::drainCommands, this));
+}
+
+void ClientnodeMachine::drainCommands()
+{
+    // Reset the flag before looking into the queue. A command that is pushed
+    // after we find the queue empty will schedule another call.
+    drain_scheduled.store(false);
+
+    while (std::unique_ptr<MachineCommand> cmd = command_queue.pop())
+        cmd->execute(*this);
+}
+
+/** Reaction of a state to an event.
+* @return The state the machine shall be in after the reaction
+*/
+template <typename Event>
+using Reaction = state_id_t (*)(ClientnodeMachine&, Event&);
+
+/** Reaction of a state that does not care about an event. */
+template <typename Event, state_id_t State>
+static state_id_t discardEvent(ClientnodeMachine&, Event&)
+{
+    return State;
+}
+
+/** Call the reaction of the current state and carry out the transition.
+*
+* @param cm The machine
+* @param reactions Reaction of every state to this type of event
+* @param evt The event
+*/
+template <typename Event>
+static void dispatch(
+    ClientnodeMachine& cm,
+    const Reaction<Event> (&reactions)[NUM_STATES],
+    Event& evt
+)
+{
+    state_id_t next = reactions[cm.state()](cm, evt);
+
+    if (next != cm.state())
+        cm.transit(next);
+}
+
+void ClientnodeMachine::initiate()
+{
+    transit(STATE_WAITING);
+}
+
+void ClientnodeMachine::terminate()
+{
+    current_state = STATE_TERMINATED;
+}
+
+void ClientnodeMachine::transit(state_id_t next)
+{
+    static void (* const entry_actions[NUM_STATES])(ClientnodeMachine&) = {
+        nullptr,
+        &StateWaiting::enter,
+        &StateNegotiating::enter,
+        &StateConnected::enter
+    };
+
+    current_state = next;
+
+    if (entry_actions[next])
+        entry_actions[next](*this);
+}
+
+void ClientnodeMachine::process_event(EvtConnectRequest& evt)
+{
+    static const Reaction<EvtConnectRequest> reactions[NUM_STATES] = {
+        &discardEvent<EvtConnectRequest, STATE_TERMINATED>,
+        &StateWaiting::react,
+        &StateNegotiating::react,
+        &StateConnected::react
+    };
+
+    dispatch(*this, reactions, evt);
+}
+
+void ClientnodeMachine::process_event(EvtConnectReport& evt)
+{
+    static const Reaction<EvtConnectReport> reactions[NUM_STATES] = {
+        &discardEvent<EvtConnectReport, STATE_TERMINATED>,
+        &discardEvent<EvtConnectReport, STATE_WAITING>,
+        &StateNegotiating::react,
+        &discardEvent<EvtConnectReport, STATE_CONNECTED>
+    };
+
+    dispatch(*this, reactions, evt);
+}
+
+void ClientnodeMachine::process_event(EvtReconnect& evt)
+{
+    static const Reaction<EvtReconnect> reactions[NUM_STATES] = {
+        &discardEvent<EvtReconnect, STATE_TERMINATED>,
+        &discardEvent<EvtReconnect, STATE_WAITING>,
+        &StateNegotiating::react,
+        &discardEvent<EvtReconnect, STATE_CONNECTED>
+    };
+
+    dispatch(*this, reactions, evt);
+}
+
+void ClientnodeMachine::process_event(EvtDisconnectRequest& evt)
+{
+    static const Reaction<EvtDisconnectRequest> reactions[NUM_STATES] = {
+        &discardEvent<EvtDisconnectRequest, STATE_TERMINATED>,
+        &discardEvent<EvtDisconnectRequest, STATE_WAITING>,
+        &StateNegotiating::react,
+        &StateConnected::react
+    };
+
+    dispatch(*this, reactions, evt);
+}
+
+void ClientnodeMachine::process_event(EvtDisconnected& evt)
+{
+    static const Reaction<EvtDisconnected> reactions[NUM_STATES] = {
+        &discardEvent<EvtDisconnected, STATE_TERMINATED>,
+        &discardEvent<EvtDisconnected, STATE_WAITING>,
+        &discardEvent<EvtDisconnected, STATE_NEGOTIATING>,
+        &StateConnected::react
+    };
+
+    dispatch(*this, reactions, evt);
+}
+
+void ClientnodeMachine::process_event(EvtSendMsg<NearUserMessage>& evt)
+{
+    typedef EvtSendMsg<NearUserMessage> Event;
+    static const Reaction<Event> reactions[NUM_STATES] = {
+        &discardEvent<Event, STATE_TERMINATED>,
+        &StateWaiting::react,
+        &StateNegotiating::react,
+        &StateConnected::react
+    };
+
+    dispatch(*this, reactions, evt);
+}
+
+void ClientnodeMachine::process_event(EvtSendMsgBatch<NearUserMessage>& evt)
+{
+    typedef EvtSendMsgBatch<NearUserMessage> Event;
+    static const Reaction<Event> reactions[NUM_STATES] = {
+        &discardEvent<Event, STATE_TERMINATED>,
+        &StateWaiting::react,
+        &StateNegotiating::react,
+        &StateConnected::react
+    };
+
+    dispatch(*this, reactions, evt);
+}
+
+void ClientnodeMachine::process_event(EvtRcvdMessage<SerializedData>& evt)
+{
+    typedef EvtRcvdMessage<SerializedData> Event;
+    static const Reaction<Event> reactions[NUM_STATES] = {
+        &discardEvent<Event, STATE_TERMINATED>,
+        &discardEvent<Event, STATE_WAITING>,
+        &discardEvent<Event, STATE_NEGOTIATING>,
+        &StateConnected::react
+    };
+
+    dispatch(*this, reactions, evt);
+}
+
 void ClientnodeMachine::stopIOOperations()
 {
     boost::system::error_code dontcare;
 
-    // cancel all operations and close the socket
+    // cancel all operations and close the connection
+    transport.close(dontcare);
     socket.close(dontcare);
+    local_socket.close(dontcare);
+    resolver.cancel();
+    reconnect_timer.cancel(dontcare);
 
-    // stop the service object if it's running
-    io_service->stop();
+    failWrites("Connection closed.");
+}
 
-    // reset the io_service object so it can continue its work afterwards
-    io_service->reset();
+void ClientnodeMachine::queueWrite(QueuedWrite&& write)
+{
+    write_queue.push_back(std::move(write));
+
+    // otherwise the handler of the pending write starts it
+    if (write_queue.size() == 1)
+        startWrite();
 }
 
+void ClientnodeMachine::startWrite()
+{
+    async_write(
+        transport,
+        boost::asio::buffer(*write_queue.front().data),
+        makeAllocHandler(
+            write_handler_memory,
+            std::bind(
+                &StateConnected::writeHandler,
+                std::placeholders::_1,
+                std::placeholders::_2,
+                ClientnodeMachine::CountedReference{*this},
+                write_queue.front().data
+            )
+        )
+    );
+}
 
-StateWaiting::StateWaiting(my_context ctx)
-    : my_base(ctx)
+void ClientnodeMachine::failWrites(const byte_traits::native_string& reason_str)
 {
-    outermost_context().logstreams.infostream<<"Entering StateWaiting"<<
-		std::endl;
+    // the reports must not see the queue half emptied
+    std::deque<QueuedWrite> failed;
+    failed.swap(write_queue);
 
-    // when we are waiting, we don't need the io_service object
-    outermost_context().stopIOOperations();
+    for (const QueuedWrite& write : failed)
+        reportWrite(signals, write, false, SendReport::SR_CONNECTION_ERROR,
+            reason_str);
 }
 
-boost::statechart::result StateWaiting::react(const EvtConnectRequest& evt)
+void ClientnodeMachine::completeConnect(const boost::system::error_code& error)
 {
-    // create a query
-    auto query = std::make_shared<tcp::resolver::query>(evt.host, evt.service);
+    ConnectCompletion completion;
+    completion.swap(connect_completion);
+
+    if (completion)
+        completion(error);
+}
+
+void ClientnodeMachine::receiveMessage(ReceiveCompletion&& completion)
+{
+    keep_received = true;
+
+    // like a socket, only one receive may be pending
+    if (receive_completion)
+    {
+        completion(boost::asio::error::already_started,
+            std::shared_ptr<NearUserMessage>{});
+        return;
+    }
 
+    if (!received_messages.empty())
+    {
+        std::shared_ptr<NearUserMessage> msg{
+            std::move(received_messages.front())
+        };
+        received_messages.pop_front();
+
+        completion(boost::system::error_code{}, std::move(msg));
+        return;
+    }
+
+    if (current_state != STATE_CONNECTED && current_state != STATE_NEGOTIATING)
+    {
+        completion(boost::asio::error::not_connected,
+            std::shared_ptr<NearUserMessage>{});
+        return;
+    }
+
+    receive_completion = std::move(completion);
+}
+
+void ClientnodeMachine::deliverMessage(
+    const std::shared_ptr<NearUserMessage>& msg)
+{
+    if (receive_completion)
+    {
+        ReceiveCompletion completion;
+        completion.swap(receive_completion);
+
+        completion(boost::system::error_code{}, msg);
+    }
+    else if (keep_received)
+        received_messages.push_back(msg);
+}
+
+void ClientnodeMachine::failReceive(const boost::system::error_code& error)
+{
+    ReceiveCompletion completion;
+    completion.swap(receive_completion);
+
+    if (completion)
+        completion(error, std::shared_ptr<NearUserMessage>{});
+}
+
+void ClientnodeMachine::startReceive()
+{
+    // reuse the buffer of the last connection, if nobody holds on to it
+    if (!rcvbuf || rcvbuf.use_count() > 1)
+        rcvbuf = std::make_shared<byte_traits::byte_sequence>(rcvbuf_size);
+
+    rcvbuf_fill = 0;
+
+    continueReceive();
+}
+
+void ClientnodeMachine::continueReceive()
+{
+    transport.async_read_some(
+        boost::asio::buffer(
+            &(*rcvbuf)[rcvbuf_fill], rcvbuf->size() - rcvbuf_fill
+        ),
+        makeAllocHandler(
+            read_handler_memory,
+            std::bind(
+                &StateConnected::receiveHandler,
+                std::placeholders::_1,
+                std::placeholders::_2,
+                ClientnodeMachine::CountedReference(*this)
+            )
+        )
+    );
+}
+
+void ClientnodeMachine::startConnect()
+{
+    if (connection_kind == CONNECTION_TCP)
+    {
+        startResolve();
+        return;
+    }
+
+    if (connection_kind == CONNECTION_INPROC)
+    {
+        NUKE_MS_LOG(logstreams, LOGLEVEL_INFO,
+            "Connecting to in-process listener "<<service);
+
+        // connecting does not have to wait for anything, but the outcome is
+        // reported from a handler like for the other kinds. Going through
+        // the timer lets stopIOOperations() cancel it.
+        reconnect_timer.expires_from_now(boost::posix_time::millisec(0));
+        reconnect_timer.async_wait(
+            std::bind(
+                &StateNegotiating::inprocConnectHandler,
+                std::placeholders::_1,
+                ClientnodeMachine::CountedReference(*this)
+            )
+        );
+        return;
+    }
+
+    NUKE_MS_LOG(logstreams, LOGLEVEL_INFO,
+        "Connecting to Unix domain socket "<<service);
+
+    local_socket.async_connect(
+        boost::asio::local::stream_protocol::endpoint{service},
+        std::bind(
+            &StateNegotiating::localConnectHandler,
+            std::placeholders::_1,
+            ClientnodeMachine::CountedReference(*this)
+        )
+    );
+}
+
+void ClientnodeMachine::startResolve()
+{
+    // create a query
+    auto query = std::make_shared<tcp::resolver::query>(host, service);
 
     // dispatch an asynchronous resolve request
-    outermost_context().resolver.async_resolve(
+    resolver.async_resolve(
         *query,
         std::bind(
             &StateNegotiating::resolveHandler,
             std::placeholders::_1,
             std::placeholders::_2,
-            ClientnodeMachine::CountedReference(outermost_context()),
+            ClientnodeMachine::CountedReference(*this),
             query
         )
     );
+}
+
+bool ClientnodeMachine::scheduleReconnect()
+{
+    if (!reconnect_policy.mayRetry(reconnect_attempt))
+        return false;
+
+    unsigned delay = reconnect_policy.getDelay(reconnect_attempt++, reconnect_rng);
+
+    NUKE_MS_LOG(logstreams, LOGLEVEL_INFO,
+        "Reconnect attempt "<<reconnect_attempt<<" in "<<delay<<" ms");
+
+    reconnect_timer.expires_from_now(boost::posix_time::millisec(delay));
+    reconnect_timer.async_wait(
+        std::bind(
+            &ClientnodeMachine::reconnectTimerHandler,
+            std::placeholders::_1,
+            ClientnodeMachine::CountedReference(*this)
+        )
+    );
 
-    return transit< StateNegotiating >();
+    return true;
 }
 
-boost::statechart::result StateWaiting::react(const EvtSendMsg<NearUserMessage>& evt)
+void ClientnodeMachine::reconnectTimerHandler(
+    const boost::system::error_code& error,
+    ClientnodeMachine::CountedReference cm
+)
 {
-    auto rprt = std::make_shared<SendReport>();
-    rprt->send_state = false;
-    rprt->reason = SendReport::SR_SERVER_NOT_CONNECTED;
-    rprt->reason_str = "Not Connected.";
+    // if the timer was cancelled, the state machine might not be alive,
+    // so we STFU and return
+    if (error)
+        return;
+
+    cm.ref().process_event(EvtReconnect{});
+}
+
+
+void StateWaiting::enter(ClientnodeMachine& cm)
+{
+    NUKE_MS_LOG(cm.logstreams, LOGLEVEL_INFO, "Entering StateWaiting");
 
-    context<ClientnodeMachine>().signals.sendReport(rprt);
+    // when we are waiting, no I/O operations should be running
+    cm.stopIOOperations();
 
-    return discard_event();
+    // no reconnect attempts are running anymore
+    cm.reconnect_attempt = 0;
+
+    // nothing will be received anymore
+    cm.failReceive(boost::asio::error::not_connected);
 }
 
+state_id_t StateWaiting::react(ClientnodeMachine& cm, EvtConnectRequest& evt)
+{
+    // remember where we connect to, in case we have to reconnect later
+    cm.connection_kind = evt.kind;
+    cm.host = evt.host;
+    cm.service = evt.service;
+
+    // this is a new session, so there is nothing to resume
+    cm.have_received = false;
 
+    cm.connect_completion = std::move(evt.completion);
 
-StateNegotiating::StateNegotiating(my_context ctx)
-    : my_base(ctx)
+    cm.startConnect();
+
+    return STATE_NEGOTIATING;
+}
+
+state_id_t StateWaiting::react(
+    ClientnodeMachine& cm, EvtSendMsg<NearUserMessage>& evt)
 {
-    outermost_context().logstreams.infostream<<"Entering StateNegotiating"<<
-		std::endl;
+    reportSend(cm.signals, evt._completion, evt._data._msg_id, false,
+        SendReport::SR_SERVER_NOT_CONNECTED, "Not Connected.");
+
+    return STATE_WAITING;
+}
+
+state_id_t StateWaiting::react(
+    ClientnodeMachine& cm, EvtSendMsgBatch<NearUserMessage>& evt)
+{
+    reportBatchNotConnected(cm.signals, evt, "Not Connected.");
+
+    return STATE_WAITING;
+}
 
-    try {
-        outermost_context().startIOOperations();
-    }
-    catch(const std::exception& e)
-    {
-        byte_traits::native_string errmsg{e.what()};
-        errmsg = "Internal error:" + errmsg;
 
-        post_event(EvtConnectReport{false, errmsg});
-    }
-    catch(...)
-    {
-        post_event(EvtConnectReport{false, "Unknown internal Error"});
-    }
 
+void StateNegotiating::enter(ClientnodeMachine& cm)
+{
+    NUKE_MS_LOG(cm.logstreams, LOGLEVEL_INFO, "Entering StateNegotiating");
 }
 
-boost::statechart::result StateNegotiating::react(const EvtSendMsg<NearUserMessage>& evt)
+state_id_t StateNegotiating::react(
+    ClientnodeMachine& cm, EvtSendMsg<NearUserMessage>& evt)
 {
-    auto rprt = std::make_shared<SendReport>();
-    rprt->send_state = false;
-    rprt->reason = SendReport::SR_SERVER_NOT_CONNECTED;
-    rprt->reason_str = "Not yet Connected.";
+    reportSend(cm.signals, evt._completion, evt._data._msg_id, false,
+        SendReport::SR_SERVER_NOT_CONNECTED, "Not yet Connected.");
+
+    return STATE_NEGOTIATING;
+}
 
-    context<ClientnodeMachine>().signals.sendReport(rprt);
+state_id_t StateNegotiating::react(
+    ClientnodeMachine& cm, EvtSendMsgBatch<NearUserMessage>& evt)
+{
+    reportBatchNotConnected(cm.signals, evt, "Not yet Connected.");
 
-    return discard_event();
+    return STATE_NEGOTIATING;
 }
 
-boost::statechart::result StateNegotiating::react(const EvtConnectReport& evt)
+state_id_t StateNegotiating::react(ClientnodeMachine& cm, EvtConnectReport& evt)
 {
     auto rprt = std::make_shared<ConnectionStatusReport>();
 
+    // a reconnect attempt is running, if at least one was scheduled
+    bool reconnecting = cm.reconnect_attempt > 0;
+
     // change state according to the outcome of a connection attempt
     if ( evt.success )
     {
         rprt->newstate = ConnectionStatusReport::CNST_CONNECTED;
-        rprt->statechange_reason = ConnectionStatusReport::STCHR_USER_REQUESTED;
+        rprt->statechange_reason = reconnecting ?
+            ConnectionStatusReport::STCHR_RECONNECTING :
+            ConnectionStatusReport::STCHR_USER_REQUESTED;
         rprt->msg = evt.message;
-        context<ClientnodeMachine>().signals.connectStatReport(rprt);
+        cm.signals.connectStatReport(rprt);
 
-        return transit<StateConnected>();
+        // ask the server to continue after the last message we have seen
+        if (reconnecting && cm.have_received)
+        {
+            SegmentationLayer<NearResumeRequest> segm_layer{
+                NearResumeRequest{cm.last_rcvd_msg_id, cm.last_rcvd_sender}
+            };
+
+            auto data = std::make_shared<byte_traits::byte_sequence>(
+                segm_layer.size()
+            );
+            segm_layer.fillSerialized(data->begin());
+
+            // nothing else was queued on the new connection yet, so the
+            // request goes first
+            cm.queueWrite(ClientnodeMachine::QueuedWrite{
+                ClientnodeMachine::QueuedWrite::WRITE_RESUME_REQUEST,
+                std::move(data), 0, {}, {}
+            });
+        }
+
+        cm.reconnect_attempt = 0;
+
+        cm.completeConnect(boost::system::error_code{});
+
+        return STATE_CONNECTED;
+    }
+    else if (reconnecting && cm.scheduleReconnect())
+    {
+        // keep trying
+        rprt->newstate = ConnectionStatusReport::CNST_CONNECTING;
+        rprt->statechange_reason = ConnectionStatusReport::STCHR_RECONNECTING;
+        rprt->msg = evt.message;
+        cm.signals.connectStatReport(rprt);
+
+        return STATE_NEGOTIATING;
     }
     else
     {
         rprt->newstate = ConnectionStatusReport::CNST_DISCONNECTED;
         rprt->statechange_reason = ConnectionStatusReport::STCHR_CONNECT_FAILED;
         rprt->msg = evt.message;
-        context<ClientnodeMachine>().signals.connectStatReport(rprt);
+        cm.signals.connectStatReport(rprt);
+
+        cm.completeConnect(evt.error ? evt.error :
+            boost::system::error_code{boost::asio::error::not_connected});
 
-        return transit<StateWaiting>();
+        return STATE_WAITING;
     }
 }
 
-boost::statechart::result StateNegotiating::react(const EvtDisconnectRequest&)
+state_id_t StateNegotiating::react(ClientnodeMachine& cm, EvtDisconnectRequest&)
 {
     auto rprt = std::make_shared<ConnectionStatusReport>();
 
     rprt->newstate = ConnectionStatusReport::CNST_DISCONNECTED;
     rprt->statechange_reason = ConnectionStatusReport::STCHR_USER_REQUESTED;
-    context<ClientnodeMachine>().signals.connectStatReport(rprt);
+    cm.signals.connectStatReport(rprt);
+
+    cm.completeConnect(boost::asio::error::operation_aborted);
 
-    return transit<StateWaiting>();
+    return STATE_WAITING;
 }
 
-boost::statechart::result StateNegotiating::react(const EvtConnectRequest&)
+state_id_t StateNegotiating::react(ClientnodeMachine& cm, EvtConnectRequest& evt)
 {
     auto rprt = std::make_shared<ConnectionStatusReport>();
 
     rprt->newstate = ConnectionStatusReport::CNST_CONNECTING;
     rprt->statechange_reason = ConnectionStatusReport::STCHR_BUSY;
     rprt->msg = "Currently trying to connect";
-    context<ClientnodeMachine>().signals.connectStatReport(rprt);
+    cm.signals.connectStatReport(rprt);
+
+    if (evt.completion)
+        evt.completion(boost::asio::error::already_started);
+
+    return STATE_NEGOTIATING;
+}
 
-    return discard_event();
+state_id_t StateNegotiating::react(ClientnodeMachine& cm, EvtReconnect&)
+{
+    // get rid of whatever is left from the last attempt
+    boost::system::error_code dontcare;
+    cm.transport.close(dontcare);
+    cm.socket.close(dontcare);
+    cm.local_socket.close(dontcare);
+
+    cm.startConnect();
+
+    return STATE_NEGOTIATING;
 }
 
 
@@ -211,7 +814,7 @@ void StateNegotiating::resolveHandler(
     std::shared_ptr<tcp::resolver::query> /* query */
 )
 {
-    cm.ref().logstreams.infostream<<"resolveHandler invoked."<<std::endl;
+    NUKE_MS_LOG(cm.ref().logstreams, LOGLEVEL_INFO, "resolveHandler invoked.");
 
 
     // if there was an error, report it
@@ -231,22 +834,24 @@ void StateNegotiating::resolveHandler(
         else
             errmsg = "No hosts found.";
 
-        boost::mutex::scoped_lock lk(cm.ref().machine_mutex);
-        cm.ref().process_event(EvtConnectReport(false, errmsg));
+        cm.ref().process_event(EvtConnectReport(false, errmsg,
+            error ? error : boost::system::error_code{
+                boost::asio::error::host_not_found
+            }));
 
         return;
     }
 
-    cm.ref().logstreams.infostream<<"Resolving finished. "
-		"The following records were found:\n";
+    NUKE_MS_LOG(cm.ref().logstreams, LOGLEVEL_INFO,
+        "Resolving finished. The following records were found:");
 
 	// display all records for debugging purposes
     tcp::resolver::iterator disp_it = endpoint_iterator;
     while (disp_it != tcp::resolver::iterator{})
     {
-        cm.ref().logstreams.infostream<<"\tHost: "<<
+        NUKE_MS_LOG(cm.ref().logstreams, LOGLEVEL_INFO, "\tHost: "<<
             disp_it->endpoint().address().to_string()<<", Port: "<<
-            disp_it->endpoint().port()<<'\n';
+            disp_it->endpoint().port());
         ++disp_it;
     }
 
@@ -270,30 +875,17 @@ void StateNegotiating::connectHandler(
 	tcp::resolver::iterator endpoint_iterator
 )
 {
-    cm.ref().logstreams.infostream<<"connectHandler invoked. (host "<<
-		endpoint_iterator->endpoint().address().to_string()<<")"<<std::endl;
+    NUKE_MS_LOG(cm.ref().logstreams, LOGLEVEL_INFO, "connectHandler invoked. "
+        "(host "<<endpoint_iterator->endpoint().address().to_string()<<")");
 
 	if(!error) // if there was no error, create a positive reply
     {
+        // from now on, the connection is used through the transport
+        cm.ref().transport.assign(std::move(cm.ref().socket));
 
-        // create a receive buffer
-        byte_traits::byte_t* rcvbuf =
-            new byte_traits::byte_t[SegmentationLayerBase::header_length];
-
-        // start an asynchronous read to receive the header of the first packet
-        async_read(
-            cm.ref().socket,
-            boost::asio::buffer(rcvbuf, SegmentationLayerBase::header_length),
-            std::bind(
-                &StateConnected::receiveSegmentationHeaderHandler,
-                std::placeholders::_1,
-                std::placeholders::_2,
-                cm,
-                rcvbuf
-            )
-        );
+        // start receiving packets
+        cm.ref().startReceive();
 
-        boost::mutex::scoped_lock lk{cm.ref().machine_mutex};
         cm.ref().process_event(EvtConnectReport{true, "Connection succeeded."});
     }
 	// if there was an error, but we still have records,
@@ -321,40 +913,150 @@ void StateNegotiating::connectHandler(
 
         byte_traits::native_string errmsg{error.message()};
 
-        boost::mutex::scoped_lock lk{cm.ref().machine_mutex};
-        cm.ref().process_event(EvtConnectReport(false, errmsg));
+        cm.ref().process_event(EvtConnectReport(false, errmsg, error));
     }
 
 }
 
+void StateNegotiating::localConnectHandler(
+    const boost::system::error_code& error,
+    ClientnodeMachine::CountedReference cm
+)
+{
+    NUKE_MS_LOG(cm.ref().logstreams, LOGLEVEL_INFO,
+        "localConnectHandler invoked.");
 
+    if (!error && cm.ref().connection_kind == CONNECTION_SHM)
+    {
+        // the server sends the shared memory right after accepting
+        cm.ref().local_socket.async_wait(
+            boost::asio::local::stream_protocol::socket::wait_read,
+            std::bind(
+                &StateNegotiating::shmHandshakeHandler,
+                std::placeholders::_1,
+                cm
+            )
+        );
+    }
+    else if (!error)
+    {
+        cm.ref().transport.assign(std::move(cm.ref().local_socket));
+
+        cm.ref().startReceive();
 
+        cm.ref().process_event(EvtConnectReport{true, "Connection succeeded."});
+    }
+    else
+    {
+        // if the operation was aborted, the state machine might not be alive,
+        // so we STFU and return
+        if (error == boost::asio::error::operation_aborted)
+            return;
 
+        cm.ref().process_event(EvtConnectReport(false, error.message(), error));
+    }
+}
 
-StateConnected::StateConnected(my_context ctx)
-    : my_base(ctx)
+void StateNegotiating::shmHandshakeHandler(
+    const boost::system::error_code& error,
+    ClientnodeMachine::CountedReference cm
+)
 {
-    outermost_context().logstreams.infostream<<"Entering StateConnected"<<
-		std::endl;
+    // if the operation was aborted, the state machine might not be alive,
+    // so we STFU and return
+    if (error == boost::asio::error::operation_aborted)
+        return;
+
+    boost::system::error_code setup_error = error;
+    std::unique_ptr<TransportImpl> shm;
+
+#ifdef NUKE_MS_SHM_TRANSPORT
+    if (!setup_error)
+        shm = ShmTransport::createClientSide(
+            std::move(cm.ref().local_socket), setup_error
+        );
+#else
+    setup_error = boost::asio::error::operation_not_supported;
+#endif
+
+    if (!shm)
+    {
+        cm.ref().process_event(
+            EvtConnectReport(false, setup_error.message(), setup_error)
+        );
+        return;
+    }
+
+    cm.ref().transport.assign(std::move(shm));
+
+    cm.ref().startReceive();
+
+    cm.ref().process_event(EvtConnectReport{true, "Connection succeeded."});
 }
 
+void StateNegotiating::inprocConnectHandler(
+    const boost::system::error_code& error,
+    ClientnodeMachine::CountedReference cm
+)
+{
+    // if the operation was aborted, the state machine might not be alive,
+    // so we STFU and return
+    if (error == boost::asio::error::operation_aborted)
+        return;
+
+    boost::system::error_code connect_error = error;
+    std::unique_ptr<TransportImpl> loopback;
+
+    if (!connect_error)
+        loopback = LoopbackListener::connect(
+            cm.ref().transport.get_io_service(), cm.ref().service,
+            connect_error
+        );
+
+    if (!loopback)
+    {
+        cm.ref().process_event(
+            EvtConnectReport(false, connect_error.message(), connect_error)
+        );
+        return;
+    }
+
+    cm.ref().transport.assign(std::move(loopback));
+
+    cm.ref().startReceive();
 
-boost::statechart::result StateConnected::react(const EvtDisconnectRequest&)
+    cm.ref().process_event(EvtConnectReport{true, "Connection succeeded."});
+}
+
+
+
+
+
+void StateConnected::enter(ClientnodeMachine& cm)
+{
+    NUKE_MS_LOG(cm.logstreams, LOGLEVEL_INFO, "Entering StateConnected");
+}
+
+
+state_id_t StateConnected::react(ClientnodeMachine& cm, EvtDisconnectRequest&)
 {
     auto rprt = std::make_shared<ConnectionStatusReport>();
 
     rprt->newstate = ConnectionStatusReport::CNST_DISCONNECTED;
     rprt->statechange_reason = ConnectionStatusReport::STCHR_USER_REQUESTED;
-    context<ClientnodeMachine>().signals.connectStatReport(rprt);
+    cm.signals.connectStatReport(rprt);
 
-    return transit<StateWaiting>();
+    return STATE_WAITING;
 }
 
 
-boost::statechart::result StateConnected::react(const EvtSendMsg<NearUserMessage>& evt)
+state_id_t StateConnected::react(
+    ClientnodeMachine& cm, EvtSendMsg<NearUserMessage>& evt)
 {
+    NearUserMessage::msg_id_t msg_id = evt._data._msg_id;
+
     // create segmentation layer from the data to be sent
-    SegmentationLayer<NearUserMessage> segm_layer{std::move(*evt._data)};
+    SegmentationLayer<NearUserMessage> segm_layer{std::move(evt._data)};
 
     // create buffer, fill it with the serialized message
     auto data = std::make_shared<byte_traits::byte_sequence>(
@@ -363,40 +1065,89 @@ boost::statechart::result StateConnected::react(const EvtSendMsg<NearUserMessage
 
     segm_layer.fillSerialized(data->begin());
 
-    async_write(
-        context<ClientnodeMachine>().socket,
-        boost::asio::buffer(*data),
-        std::bind(
-            &StateConnected::writeHandler,
-            std::placeholders::_1,
-            std::placeholders::_2,
-            ClientnodeMachine::CountedReference{outermost_context()},
-            data
-        )
-    );
+    cm.queueWrite(ClientnodeMachine::QueuedWrite{
+        ClientnodeMachine::QueuedWrite::WRITE_MESSAGE,
+        std::move(data), msg_id, {}, std::move(evt._completion)
+    });
+
+    return STATE_CONNECTED;
+}
+
+
+state_id_t StateConnected::react(
+    ClientnodeMachine& cm, EvtSendMsgBatch<NearUserMessage>& evt)
+{
+    std::vector<NearUserMessage>& batch = evt._data;
+
+    if (batch.empty())
+        return STATE_CONNECTED;
+
+    std::vector<NearUserMessage::msg_id_t> msg_ids;
+    msg_ids.reserve(batch.size());
+
+    // the segmentation header is the same size for all messages
+    std::size_t total_size = 0;
+    for (const NearUserMessage& msg : batch)
+        total_size += msg.size() + SegmentationLayerBase::header_length;
 
-    return discard_event();
+    // serialize all messages back to back into a single buffer
+    auto data = std::make_shared<byte_traits::byte_sequence>(total_size);
+    byte_traits::byte_sequence::iterator it = data->begin();
+
+    for (NearUserMessage& msg : batch)
+    {
+        msg_ids.push_back(msg._msg_id);
+        it = SegmentationLayer<NearUserMessage>{std::move(msg)}
+            .fillSerialized(it);
+    }
+
+    cm.queueWrite(ClientnodeMachine::QueuedWrite{
+        ClientnodeMachine::QueuedWrite::WRITE_BATCH,
+        std::move(data), 0, std::move(msg_ids), std::move(evt._completion)
+    });
+
+    return STATE_CONNECTED;
 }
 
 
-boost::statechart::result StateConnected::react(const EvtDisconnected& evt)
+state_id_t StateConnected::react(ClientnodeMachine& cm, EvtDisconnected& evt)
 {
     auto rprt = std::make_shared<ConnectionStatusReport>();
 
+    // if the policy says so, try to get the connection back
+    if (cm.reconnect_policy.enabled)
+    {
+        boost::system::error_code dontcare;
+        cm.transport.close(dontcare);
+        cm.failWrites(evt.msg);
+
+        cm.reconnect_attempt = 0;
+        if (cm.scheduleReconnect())
+        {
+            rprt->newstate = ConnectionStatusReport::CNST_CONNECTING;
+            rprt->statechange_reason =
+                ConnectionStatusReport::STCHR_RECONNECTING;
+            rprt->msg = evt.msg;
+            cm.signals.connectStatReport(rprt);
+
+            return STATE_NEGOTIATING;
+        }
+    }
+
     rprt->newstate = ConnectionStatusReport::CNST_DISCONNECTED;
     rprt->statechange_reason = ConnectionStatusReport::STCHR_SOCKET_CLOSED;
     rprt->msg = evt.msg;
-    context<ClientnodeMachine>().signals.connectStatReport(rprt);
+    cm.signals.connectStatReport(rprt);
 
-    return transit<StateWaiting>();
+    return STATE_WAITING;
 }
 
 
-boost::statechart::result
-StateConnected::react(const EvtRcvdMessage<SerializedData>& evt)
+state_id_t StateConnected::react(
+    ClientnodeMachine& cm, EvtRcvdMessage<SerializedData>& evt)
 {
     // whatever it is, we need a SerializedData object from it
-    SerializedData data{std::move(evt._data->_inner_layer)};
+    SerializedData data{std::move(evt._data._inner_layer)};
 
 
     try {
@@ -405,189 +1156,188 @@ StateConnected::react(const EvtRcvdMessage<SerializedData>& evt)
         if (*data.begin() ==
             static_cast<byte_traits::byte_t>(NearUserMessage::LAYER_ID))
         {
+            // the message copies its text, so it does not keep the receive
+            // buffer alive
             auto usermsg = std::make_shared<NearUserMessage>(data);
-            context<ClientnodeMachine>().signals.rcvMessage(usermsg);
+
+            // remember the message, in case we have to resume the stream
+            cm.have_received = true;
+            cm.last_rcvd_msg_id = usermsg->_msg_id;
+            cm.last_rcvd_sender = usermsg->_sender;
+
+            cm.signals.rcvMessage(usermsg);
+            cm.deliverMessage(usermsg);
         }
         else
 		{
-            outermost_context().logstreams.warnstream<<
-				"Received packet with unknown layer identifier! Discarding."<<
-				std::endl;
+            NUKE_MS_LOG(cm.logstreams, LOGLEVEL_WARNING,
+				"Received packet with unknown layer identifier! Discarding.");
 		}
     }
     catch(const MsgLayerError& e)
     {
-        outermost_context().logstreams.errorstream<<
-			"Reiceived packet but failed to create Message object: "<<e.what()<<
-			std::endl;
+        NUKE_MS_LOG(cm.logstreams, LOGLEVEL_ERROR,
+			"Reiceived packet but failed to create Message object: "<<e.what());
     }
 
-    return discard_event();
+    return STATE_CONNECTED;
 }
 
 
-boost::statechart::result StateConnected::react(const EvtConnectRequest&)
+state_id_t StateConnected::react(ClientnodeMachine& cm, EvtConnectRequest& evt)
 {
     auto rprt = std::make_shared<ConnectionStatusReport>();
 
     rprt->newstate = ConnectionStatusReport::CNST_CONNECTED;
     rprt->statechange_reason = ConnectionStatusReport::STCHR_BUSY;
     rprt->msg = "Allready connected";
-    context<ClientnodeMachine>().signals.connectStatReport(rprt);
+    cm.signals.connectStatReport(rprt);
+
+    if (evt.completion)
+        evt.completion(boost::asio::error::already_connected);
 
-    return discard_event();
+    return STATE_CONNECTED;
 }
 
 
 
 void StateConnected::writeHandler(
     const boost::system::error_code& error,
-    std::size_t bytes_transferred,
+    std::size_t /* bytes_transferred */,
     ClientnodeMachine::CountedReference cm,
     std::shared_ptr<byte_traits::byte_sequence> data
 )
 {
-    cm.ref().logstreams.infostream<<"Sending message finished"<<std::endl;
+    ClientnodeMachine& machine = cm.ref();
 
+    // the connection was closed and the queue failed meanwhile
+    if (machine.write_queue.empty() || machine.write_queue.front().data != data)
+        return;
 
-    if (!error)
+    if (error)
     {
-        auto rprt = std::make_shared<SendReport>();
-        rprt->send_state = true;
-        rprt->reason = SendReport::SR_SEND_OK;
+        byte_traits::native_string errmsg(error.message());
 
-        cm.ref().signals.sendReport(rprt);
+        if (machine.write_queue.front().kind ==
+            ClientnodeMachine::QueuedWrite::WRITE_RESUME_REQUEST)
+            NUKE_MS_LOG(machine.logstreams, LOGLEVEL_WARNING,
+                "Sending resume request failed: "<<errmsg);
+
+        machine.failWrites(errmsg);
+        machine.process_event(EvtDisconnected(errmsg));
+        return;
     }
-    else
-    {
-        byte_traits::native_string errmsg(error.message());
 
-        auto rprt = std::make_shared<SendReport>();
-        rprt->send_state = false;
-        rprt->reason = SendReport::SR_CONNECTION_ERROR;
-        rprt->reason_str = errmsg;
+    NUKE_MS_LOG(machine.logstreams, LOGLEVEL_INFO, "Sending packet finished");
 
-        cm.ref().signals.sendReport(rprt);
+    ClientnodeMachine::QueuedWrite written{std::move(machine.write_queue.front())};
+    machine.write_queue.pop_front();
 
-        boost::mutex::scoped_lock lk{cm.ref().machine_mutex};
-        cm.ref().process_event(EvtDisconnected(errmsg));
+    if (!machine.write_queue.empty())
+        machine.startWrite();
 
-    }
+    reportWrite(machine.signals, written, true, SendReport::SR_SEND_OK);
 }
 
 
-void StateConnected::receiveSegmentationHeaderHandler(
+void StateConnected::receiveHandler(
     const boost::system::error_code& error,
     std::size_t bytes_transferred,
-    ClientnodeMachine::CountedReference cm,
-    byte_traits::byte_t rcvbuf[SegmentationLayerBase::header_length]
+    ClientnodeMachine::CountedReference cm
 )
 {
-    cm.ref().logstreams.infostream<<"Reveive (header) handler invoked"<<std::endl;
-
     // if there was an error,
     // tear down the connection by posting a disconnection event
-    if (error || bytes_transferred != SegmentationLayerBase::header_length)
+    if (error)
     {
 		// if the operation was aborted, the state machine might not be alive,
 		// so we STFU and return
 		if (error == boost::asio::error::operation_aborted)
 			return;
 
-        byte_traits::native_string errmsg{error.message()};
-
-        boost::mutex::scoped_lock lk{cm.ref().machine_mutex};
-        cm.ref().process_event(EvtDisconnected{errmsg});
+        cm.ref().process_event(EvtDisconnected{error.message()});
+        return;
     }
-    else // if no error occured, try to decode the header
+
+    ClientnodeMachine& machine = cm.ref();
+    machine.rcvbuf_fill += bytes_transferred;
+
+    // parse all complete packets in the buffer
+    std::size_t pos = 0;
+    while (machine.rcvbuf_fill - pos >= SegmentationLayerBase::header_length)
     {
+        byte_traits::byte_sequence::const_iterator packet_begin =
+            machine.rcvbuf->begin() + pos;
+
+        SegmentationLayerBase::HeaderType header_data;
+
         try {
             // decode and verify the header of the message
-            SegmentationLayerBase::HeaderType header_data
-                = SegmentationLayerBase::decodeHeader(rcvbuf);
-
-/// @todo Magic number, set to something proper or make configurable
-constexpr byte_traits::uint2b_t MAX_PACKETSIZE = 0x8FFF;
+            header_data = SegmentationLayerBase::decodeHeader(packet_begin);
 
-            if (header_data.packetsize > MAX_PACKETSIZE)
+            if (header_data.packetsize > SegmentationLayerBase::max_packetsize)
                 throw MsgLayerError("Oversized packet.");
 
-            auto body_buf = std::make_shared<byte_traits::byte_sequence>(
-                header_data.packetsize-SegmentationLayerBase::header_length);
-
-            // start an asynchronous receive for the body
-            async_read(
-                cm.ref().socket,
-                boost::asio::buffer(*body_buf),
-                std::bind(
-                    &StateConnected::receiveSegmentationBodyHandler,
-                    std::placeholders::_1 /* boost::asio::placeholders::error */,
-                    std::placeholders::_2 /* boost::asio::placeholders::bytes_transferred */ ,
-                    cm,
-                    body_buf
-                )
-            );
+            if (header_data.packetsize < SegmentationLayerBase::header_length)
+                throw UndersizedPacketError{};
         }
         // on failure, report back to application
         catch (const std::exception& e)
         {
-            boost::mutex::scoped_lock lk{cm.ref().machine_mutex};
-            cm.ref().process_event(EvtDisconnected{e.what()});
-        }
-        catch(...)
-        {
-            boost::mutex::scoped_lock lk{cm.ref().machine_mutex};
-            cm.ref().process_event(EvtDisconnected{"Unknown Error"});
+            machine.process_event(EvtDisconnected{e.what()});
+            return;
         }
+
+        // wait for the rest of the packet
+        if (machine.rcvbuf_fill - pos < header_data.packetsize)
+            break;
+
+        // The packet refers to the receive buffer, nothing is copied. The
+        // reaction copies out what it keeps.
+        SegmentationLayer<SerializedData> segmlayer{SerializedData{
+            machine.rcvbuf,
+            packet_begin + SegmentationLayerBase::header_length,
+            header_data.packetsize - SegmentationLayerBase::header_length
+        }};
+
+        machine.process_event(
+            EvtRcvdMessage<SerializedData>{std::move(segmlayer)}
+        );
+
+        pos += header_data.packetsize;
+
+        // stop if the reaction ended the connection
+        if (machine.state() != STATE_CONNECTED)
+            return;
     }
 
-    delete[] rcvbuf;
-}
+    // Move the incomplete rest to the front. The reactions do not keep the
+    // packets, but should somebody still reference the buffer, we need a new
+    // one.
+    std::size_t rest = machine.rcvbuf_fill - pos;
 
-void StateConnected::receiveSegmentationBodyHandler(
-    const boost::system::error_code& error,
-    std::size_t bytes_transferred,
-    ClientnodeMachine::CountedReference cm,
-    std::shared_ptr<byte_traits::byte_sequence> rcvbuf
-)
-{
-    // if there was an error,
-    // tear down the connection by posting a disconnection event
-    if (error)
+    if (machine.rcvbuf.use_count() == 1)
     {
-        boost::mutex::scoped_lock lk{cm.ref().machine_mutex};
-        cm.ref().process_event(EvtDisconnected{error.message()});
+        std::copy(
+            machine.rcvbuf->begin() + pos,
+            machine.rcvbuf->begin() + machine.rcvbuf_fill,
+            machine.rcvbuf->begin()
+        );
     }
-    else // if no error occured, report the received message to the application
+    else
     {
-        SegmentationLayer<SerializedData> segmlayer{
-            {rcvbuf, rcvbuf->begin(), rcvbuf->size()}
-        };
-
-        {
-            boost::mutex::scoped_lock lk(cm.ref().machine_mutex);
-            cm.ref().process_event(
-                EvtRcvdMessage<SerializedData>{std::move(segmlayer)}
-            );
-        }
-        // start a new receive for the next message
-
-        // create a receive buffer
-        byte_traits::byte_t* rcvbuf =
-            new byte_traits::byte_t[SegmentationLayerBase::header_length];
-
-        // start an asynchronous read to receive the header of the first packet
-        async_read(
-            cm.ref().socket,
-            boost::asio::buffer(rcvbuf, SegmentationLayerBase::header_length),
-            std::bind(
-                &StateConnected::receiveSegmentationHeaderHandler,
-                std::placeholders::_1,
-                std::placeholders::_2,
-                cm,
-                rcvbuf
-            )
+        auto newbuf = std::make_shared<byte_traits::byte_sequence>(
+            ClientnodeMachine::rcvbuf_size
+        );
+        std::copy(
+            machine.rcvbuf->begin() + pos,
+            machine.rcvbuf->begin() + machine.rcvbuf_fill,
+            newbuf->begin()
         );
+        machine.rcvbuf = std::move(newbuf);
     }
-}
 
+    machine.rcvbuf_fill = rest;
+
+    machine.continueReceive();
+}
@@ -0,0 +1,184 @@
+// datagram.cpp
+
+/*
+ *   nuke-ms - Nuclear Messaging System
+ *   Copyright (C) 2012  Alexander Korsunsky
+ *
+ *   This program is free software: you can redistribute it and/or modify
+ *   it under the terms of the GNU General Public License as published by
+ *   the Free Software Foundation, version 3 of the License.
+ *
+ *   This program is distributed in the hope that it will be useful,
+ *   but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *   MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ *   GNU General Public License for more details.
+ *
+ *   You should have received a copy of the GNU General Public License
+ *   along with this program.  If not, see <http://www.gnu.org/licenses/>.
+*/
+
+#include <algorithm>
+#include <cstring>
+
+#include <errno.h>
+#include <sys/socket.h>
+
+#include <boost/asio/error.hpp>
+
+#include "datagram.hpp"
+
+using namespace nuke_ms;
+
+
+namespace
+{
+
+boost::system::error_code lastError()
+{
+    if (errno == EAGAIN || errno == EWOULDBLOCK)
+        return boost::asio::error::would_block;
+
+    return boost::system::error_code{
+        errno, boost::asio::error::get_system_category()
+    };
+}
+
+} // anonymous namespace
+
+
+struct DatagramSocket::Batch
+{
+    // receiving
+    unsigned char buffers[batch_size][max_datagram_size];
+    iovec receive_iov[batch_size];
+    sockaddr_storage addresses[batch_size];
+    mmsghdr received[batch_size];
+    endpoint_type senders[batch_size];
+
+    // sending
+    mmsghdr sent[batch_size];
+};
+
+
+DatagramSocket::DatagramSocket(boost::asio::ip::udp::socket&& _socket)
+    : socket(std::move(_socket)), batch{new Batch}
+{}
+
+DatagramSocket::DatagramSocket(DatagramSocket&&) = default;
+DatagramSocket& DatagramSocket::operator= (DatagramSocket&&) = default;
+
+DatagramSocket::~DatagramSocket()
+{}
+
+std::size_t DatagramSocket::receive(boost::system::error_code& error)
+{
+    for (std::size_t i = 0; i < batch_size; ++i)
+    {
+        batch->receive_iov[i].iov_base = batch->buffers[i];
+        batch->receive_iov[i].iov_len = max_datagram_size;
+
+        msghdr& hdr = batch->received[i].msg_hdr;
+        std::memset(&hdr, 0, sizeof(hdr));
+        hdr.msg_name = &batch->addresses[i];
+        hdr.msg_namelen = sizeof(batch->addresses[i]);
+        hdr.msg_iov = &batch->receive_iov[i];
+        hdr.msg_iovlen = 1;
+    }
+
+    int n = ::recvmmsg(socket.native_handle(), batch->received, batch_size,
+        MSG_DONTWAIT, nullptr);
+
+    if (n < 0)
+    {
+        error = lastError();
+        return 0;
+    }
+
+    for (int i = 0; i < n; ++i)
+    {
+        endpoint_type& sender = batch->senders[i];
+        std::size_t length = batch->received[i].msg_hdr.msg_namelen;
+
+        if (length > sender.capacity())
+            length = 0;
+
+        std::memcpy(sender.data(), &batch->addresses[i], length);
+        sender.resize(length);
+    }
+
+    error = boost::system::error_code{};
+    return n;
+}
+
+boost::asio::const_buffer DatagramSocket::datagram(std::size_t i) const
+{
+    return boost::asio::buffer(batch->buffers[i], batch->received[i].msg_len);
+}
+
+const DatagramSocket::endpoint_type& DatagramSocket::sender(std::size_t i) const
+{
+    return batch->senders[i];
+}
+
+bool DatagramSocket::truncated(std::size_t i) const
+{
+    return batch->received[i].msg_hdr.msg_flags & MSG_TRUNC;
+}
+
+std::size_t DatagramSocket::sendToAll(
+    const boost::asio::const_buffer& datagram,
+    const endpoint_type* receivers,
+    std::size_t count,
+    boost::system::error_code& error
+)
+{
+    iovec iov;
+    iov.iov_base = const_cast<void*>(datagram.data());
+    iov.iov_len = datagram.size();
+
+    error = boost::system::error_code{};
+    std::size_t sent = 0;
+
+    std::size_t next = 0;
+    while (next < count)
+    {
+        std::size_t n = std::min(count - next, std::size_t(batch_size));
+
+        for (std::size_t i = 0; i < n; ++i)
+        {
+            const endpoint_type& receiver = receivers[next + i];
+
+            msghdr& hdr = batch->sent[i].msg_hdr;
+            std::memset(&hdr, 0, sizeof(hdr));
+            hdr.msg_name = const_cast<sockaddr*>(
+                reinterpret_cast<const sockaddr*>(receiver.data())
+            );
+            hdr.msg_namelen = receiver.size();
+            hdr.msg_iov = &iov;
+            hdr.msg_iovlen = 1;
+        }
+
+        int result = ::sendmmsg(socket.native_handle(), batch->sent, n,
+            MSG_DONTWAIT);
+
+        if (result < 0)
+        {
+            error = lastError();
+
+            // the send buffer is full, nothing else will go out now
+            if (error == boost::asio::error::would_block)
+                break;
+
+            // skip the receiver the datagram could not be sent to
+            ++next;
+        }
+        else
+        {
+            // the next call reports the error of the receiver after these
+            sent += result;
+            next += result;
+        }
+    }
+
+    return sent;
+}
@@ -0,0 +1,69 @@
+// hashring.cpp
+
+/*
+ *   nuke-ms - Nuclear Messaging System
+ *   Copyright (C) 2012  Alexander Korsunsky
+ *
+ *   This program is free software: you can redistribute it and/or modify
+ *   it under the terms of the GNU General Public License as published by
+ *   the Free Software Foundation, version 3 of the License.
+ *
+ *   This program is distributed in the hope that it will be useful,
+ *   but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *   MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ *   GNU General Public License for more details.
+ *
+ *   You should have received a copy of the GNU General Public License
+ *   along with this program.  If not, see <http://www.gnu.org/licenses/>.
+*/
+
+#include "hashring.hpp"
+
+using namespace nuke_ms;
+
+
+std::uint64_t HashRing::hash(std::uint64_t x)
+{
+    // the finalizer of SplitMix64: every input bit affects every output bit
+    x += 0x9E3779B97F4A7C15ull;
+    x = (x ^ (x >> 30)) * 0xBF58476D1CE4E5B9ull;
+    x = (x ^ (x >> 27)) * 0x94D049BB133111EBull;
+    return x ^ (x >> 31);
+}
+
+void HashRing::addNode(const UniqueUserID& node)
+{
+    if (!nodes.insert(node.id).second)
+        return;
+
+    std::uint64_t base = hash(node.id);
+    for (unsigned i = 0; i < replicas; ++i)
+        points.insert({hash(base + i), node.id});
+}
+
+void HashRing::removeNode(const UniqueUserID& node)
+{
+    if (!nodes.erase(node.id))
+        return;
+
+    for (auto it = points.begin(); it != points.end(); )
+    {
+        if (it->second == node.id)
+            it = points.erase(it);
+        else
+            ++it;
+    }
+}
+
+UniqueUserID HashRing::nodeFor(const UniqueUserID& user) const
+{
+    if (points.empty())
+        return UniqueUserID::user_id_none;
+
+    // the first point at or after the user, wrapping around
+    auto it = points.lower_bound(hash(user.id));
+    if (it == points.end())
+        it = points.begin();
+
+    return UniqueUserID{it->second};
+}
@@ -0,0 +1,426 @@
+// loopback.cpp
+
+/*
+ *   nuke-ms - Nuclear Messaging System
+ *   Copyright (C) 2012  Alexander Korsunsky
+ *
+ *   This program is free software: you can redistribute it and/or modify
+ *   it under the terms of the GNU General Public License as published by
+ *   the Free Software Foundation, version 3 of the License.
+ *
+ *   This program is distributed in the hope that it will be useful,
+ *   but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *   MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ *   GNU General Public License for more details.
+ *
+ *   You should have received a copy of the GNU General Public License
+ *   along with this program.  If not, see <http://www.gnu.org/licenses/>.
+*/
+
+#include <algorithm>
+#include <deque>
+#include <map>
+#include <mutex>
+#include <vector>
+
+#include <boost/asio/error.hpp>
+#include <boost/asio/post.hpp>
+#include <boost/system/system_error.hpp>
+
+#include "loopback.hpp"
+
+using namespace nuke_ms;
+
+
+namespace
+{
+
+/** A write waiting for space in the buffer. Writes are completed when all
+* of their bytes are buffered, so overlapping writes do not interleave. */
+struct PendingWrite
+{
+    /** The bytes not yet buffered */
+    boost::asio::const_buffer rest;
+    std::size_t size;
+    TransportOp* op;
+};
+
+/** Bytes flowing to one end of a connection */
+struct Direction
+{
+    /** The buffered bytes start at begin */
+    std::vector<unsigned char> bytes;
+    std::size_t begin = 0;
+
+    /** The writing end will not write anymore */
+    bool closed = false;
+
+    /** The reading end will not read anymore */
+    bool reader_gone = false;
+
+    /** Pending read of the reading end, or nullptr */
+    TransportOp* read_op = nullptr;
+    boost::asio::mutable_buffer read_buffer;
+
+    /** Writes of the writing end waiting for space */
+    std::deque<PendingWrite> writes;
+
+    std::size_t available() const
+    { return bytes.size() - begin; }
+
+    /** Buffer as many bytes as fit
+    * @return The number of bytes buffered
+    */
+    std::size_t append(const boost::asio::const_buffer& buffer)
+    {
+        std::size_t n = std::min(
+            buffer.size(),
+            std::size_t(LoopbackTransport::buffer_size) - available()
+        );
+
+        // move the bytes to the front instead of growing
+        if (begin == bytes.size())
+        {
+            bytes.clear();
+            begin = 0;
+        }
+        else if (begin && bytes.size() + n > bytes.capacity())
+        {
+            bytes.erase(bytes.begin(), bytes.begin() + begin);
+            begin = 0;
+        }
+
+        const unsigned char* data =
+            static_cast<const unsigned char*>(buffer.data());
+        bytes.insert(bytes.end(), data, data + n);
+
+        return n;
+    }
+};
+
+/** Complete an operation by the io_service of its end */
+void post(
+    boost::asio::io_service& io_service,
+    TransportOp* op,
+    const boost::system::error_code& error,
+    std::size_t bytes_transferred
+)
+{
+    boost::asio::post(io_service,
+        std::bind(TransportCompletion{op}, error, bytes_transferred)
+    );
+}
+
+/** Keep the io_service running while an operation waits, like a socket
+* operation would */
+void wait(boost::asio::io_service& io_service)
+{
+    io_service.get_executor().on_work_started();
+}
+
+/** Complete an operation that waited */
+void finish(
+    boost::asio::io_service& io_service,
+    TransportOp* op,
+    const boost::system::error_code& error,
+    std::size_t bytes_transferred
+)
+{
+    post(io_service, op, error, bytes_transferred);
+    io_service.get_executor().on_work_finished();
+}
+
+} // anonymous namespace
+
+
+struct LoopbackTransport::Shared
+{
+    std::mutex mutex;
+
+    /** direction[i] holds the bytes read by end i */
+    Direction direction[2];
+
+    /** io_service[i] runs the handlers of end i */
+    boost::asio::io_service* io_service[2];
+
+    /** Move bytes to the reading end, and waiting writes into the buffer.
+    * Called with the mutex locked.
+    * @param reader The end reading the direction
+    */
+    void transfer(int reader)
+    {
+        Direction& d = direction[reader];
+
+        while (d.read_op)
+        {
+            if (d.available())
+            {
+                std::size_t n = boost::asio::buffer_copy(
+                    d.read_buffer,
+                    boost::asio::buffer(&d.bytes[d.begin], d.available())
+                );
+                d.begin += n;
+
+                finish(*io_service[reader], d.read_op, {}, n);
+                d.read_op = nullptr;
+            }
+            else if (d.closed)
+            {
+                finish(*io_service[reader], d.read_op,
+                    boost::asio::error::eof, 0);
+                d.read_op = nullptr;
+            }
+            else
+                break;
+
+            // the space that was freed can take waiting writes
+            while (!d.writes.empty() &&
+                d.available() < std::size_t(buffer_size))
+            {
+                PendingWrite& write = d.writes.front();
+                write.rest += d.append(write.rest);
+
+                if (write.rest.size())
+                    break;
+
+                finish(*io_service[1 - reader], write.op, {}, write.size);
+                d.writes.pop_front();
+            }
+        }
+    }
+};
+
+
+LoopbackTransport::LoopbackTransport(
+    std::shared_ptr<Shared> _shared,
+    int _side,
+    boost::asio::io_service& _io_service
+)
+    : shared{std::move(_shared)}, side{_side}, io_service(_io_service),
+    open{true}
+{}
+
+std::pair<std::unique_ptr<TransportImpl>, std::unique_ptr<TransportImpl>>
+LoopbackTransport::createPair(
+    boost::asio::io_service& io_service1,
+    boost::asio::io_service& io_service2
+)
+{
+    auto shared = std::make_shared<Shared>();
+    shared->io_service[0] = &io_service1;
+    shared->io_service[1] = &io_service2;
+
+    return {
+        std::unique_ptr<TransportImpl>{
+            new LoopbackTransport{shared, 0, io_service1}
+        },
+        std::unique_ptr<TransportImpl>{
+            new LoopbackTransport{shared, 1, io_service2}
+        }
+    };
+}
+
+LoopbackTransport::~LoopbackTransport()
+{
+    if (open)
+        stop(boost::asio::error::operation_aborted);
+}
+
+void LoopbackTransport::asyncReadSome(
+    const boost::asio::mutable_buffer& buffer,
+    TransportOp* op
+)
+{
+    std::lock_guard<std::mutex> lock{shared->mutex};
+    Direction& d = shared->direction[side];
+
+    if (d.reader_gone)
+        post(io_service, op, boost::asio::error::eof, 0);
+    else if (!buffer.size())
+        post(io_service, op, {}, 0);
+    else
+    {
+        d.read_op = op;
+        d.read_buffer = buffer;
+        wait(io_service);
+        shared->transfer(side);
+    }
+}
+
+void LoopbackTransport::asyncWriteSome(
+    const boost::asio::const_buffer& buffer,
+    TransportOp* op
+)
+{
+    std::lock_guard<std::mutex> lock{shared->mutex};
+    Direction& d = shared->direction[1 - side];
+
+    if (d.closed || d.reader_gone)
+        post(io_service, op, boost::asio::error::broken_pipe, 0);
+    else if (!buffer.size())
+        post(io_service, op, {}, 0);
+    else
+    {
+        boost::asio::const_buffer rest = buffer;
+        if (d.writes.empty())
+            rest += d.append(buffer);
+
+        if (rest.size())
+        {
+            d.writes.push_back(PendingWrite{rest, buffer.size(), op});
+            wait(io_service);
+        }
+        else
+            post(io_service, op, {}, buffer.size());
+
+        shared->transfer(1 - side);
+    }
+}
+
+void LoopbackTransport::stop(const boost::system::error_code& error)
+{
+    std::lock_guard<std::mutex> lock{shared->mutex};
+    Direction& in = shared->direction[side];
+    Direction& out = shared->direction[1 - side];
+    boost::asio::io_service& peer_io_service = *shared->io_service[1 - side];
+
+    // nobody reads the incoming bytes anymore
+    if (in.read_op)
+    {
+        finish(io_service, in.read_op, error, 0);
+        in.read_op = nullptr;
+    }
+
+    in.reader_gone = true;
+    in.bytes.clear();
+    in.begin = 0;
+
+    for (const PendingWrite& write : in.writes)
+        finish(peer_io_service, write.op, boost::asio::error::broken_pipe, 0);
+    in.writes.clear();
+
+    // the peer reads what was written so far, then the end of the stream
+    out.closed = true;
+
+    for (const PendingWrite& write : out.writes)
+        finish(io_service, write.op, error, 0);
+    out.writes.clear();
+
+    shared->transfer(1 - side);
+}
+
+void LoopbackTransport::shutdown(boost::system::error_code& error)
+{
+    stop(boost::asio::error::shut_down);
+    error = boost::system::error_code{};
+}
+
+void LoopbackTransport::close(boost::system::error_code& error)
+{
+    if (open)
+        stop(boost::asio::error::operation_aborted);
+
+    open = false;
+    error = boost::system::error_code{};
+}
+
+bool LoopbackTransport::isOpen() const
+{
+    return open;
+}
+
+
+
+struct LoopbackListener::Registration
+{
+    boost::asio::io_service& io_service;
+    AcceptHandler handler;
+
+    /** False after the listener was destroyed. Guarded by the registry. */
+    bool listening;
+};
+
+struct LoopbackListener::Registry
+{
+    std::mutex mutex;
+    std::map<std::string, std::shared_ptr<Registration>> listeners;
+};
+
+LoopbackListener::Registry& LoopbackListener::registry()
+{
+    static Registry the_registry;
+    return the_registry;
+}
+
+LoopbackListener::LoopbackListener(
+    boost::asio::io_service& io_service,
+    const std::string& name,
+    AcceptHandler handler
+)
+    : registration{
+        new Registration{io_service, std::move(handler), true}
+    }
+{
+    Registry& r = registry();
+    std::lock_guard<std::mutex> lock{r.mutex};
+
+    if (!r.listeners.insert({name, registration}).second)
+        throw boost::system::system_error{
+            boost::asio::error::address_in_use, "LoopbackListener " + name
+        };
+}
+
+LoopbackListener::~LoopbackListener()
+{
+    Registry& r = registry();
+    std::lock_guard<std::mutex> lock{r.mutex};
+
+    registration->listening = false;
+
+    for (auto it = r.listeners.begin(); it != r.listeners.end(); ++it)
+    {
+        if (it->second == registration)
+        {
+            r.listeners.erase(it);
+            break;
+        }
+    }
+}
+
+std::unique_ptr<TransportImpl> LoopbackListener::connect(
+    boost::asio::io_service& io_service,
+    const std::string& name,
+    boost::system::error_code& error
+)
+{
+    Registry& r = registry();
+    std::lock_guard<std::mutex> lock{r.mutex};
+
+    auto it = r.listeners.find(name);
+    if (it == r.listeners.end())
+    {
+        error = boost::asio::error::connection_refused;
+        return nullptr;
+    }
+
+    std::shared_ptr<Registration> reg = it->second;
+    auto ends = LoopbackTransport::createPair(io_service, reg->io_service);
+
+    // the server end is accepted by the io_service of the listener. If the
+    // listener is gone by then, the server end is closed.
+    boost::asio::post(reg->io_service,
+        [reg, server_end = std::move(ends.second)]() mutable
+        {
+            {
+                std::lock_guard<std::mutex> lock{registry().mutex};
+                if (!reg->listening)
+                    return;
+            }
+
+            reg->handler(Transport{reg->io_service, std::move(server_end)});
+        }
+    );
+
+    error = boost::system::error_code{};
+    return std::move(ends.first);
+}
@@ -0,0 +1,171 @@
+// metrics.cpp
+
+/*
+ *   nuke-ms - Nuclear Messaging System
+ *   Copyright (C) 2012  Alexander Korsunsky
+ *
+ *   This program is free software: you can redistribute it and/or modify
+ *   it under the terms of the GNU General Public License as published by
+ *   the Free Software Foundation, version 3 of the License.
+ *
+ *   This program is distributed in the hope that it will be useful,
+ *   but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *   MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ *   GNU General Public License for more details.
+ *
+ *   You should have received a copy of the GNU General Public License
+ *   along with this program.  If not, see <http://www.gnu.org/licenses/>.
+*/
+
+#include <cmath>
+
+#include "metrics.hpp"
+
+using namespace nuke_ms;
+
+
+std::size_t Counter::stripeIndex()
+{
+    // hand out the stripes to the threads round robin
+    static std::atomic<std::size_t> next_index{0};
+    thread_local std::size_t index =
+        next_index.fetch_add(1, std::memory_order_relaxed) % num_stripes;
+
+    return index;
+}
+
+
+LatencyHistogram::LatencyHistogram()
+    : total_count{0}, total_sum{0}
+{
+    for (std::atomic<std::uint64_t>& b : buckets)
+        b.store(0, std::memory_order_relaxed);
+}
+
+std::size_t LatencyHistogram::bucketIndex(std::uint64_t value)
+{
+    // small values get a bucket each
+    if (value < sub_buckets)
+        return static_cast<std::size_t>(value);
+
+#ifdef __GNUC__
+    unsigned msb = 63 - __builtin_clzll(value);
+#else
+    unsigned msb = 0;
+    while (value >> (msb + 1))
+        ++msb;
+#endif
+    if (msb >= max_exponent)
+        return num_buckets - 1;
+
+    // the three bits after the most significant one select the sub bucket
+    unsigned shift = msb - 3;
+    return (shift + 1) * sub_buckets +
+        static_cast<std::size_t>((value >> shift) & (sub_buckets - 1));
+}
+
+std::uint64_t LatencyHistogram::bucketUpperBound(std::size_t index)
+{
+    if (index < sub_buckets)
+        return index;
+
+    unsigned shift = index / sub_buckets - 1;
+    std::uint64_t lower =
+        (std::uint64_t{sub_buckets} + index % sub_buckets) << shift;
+
+    return lower + (std::uint64_t{1} << shift) - 1;
+}
+
+std::uint64_t LatencyHistogram::percentile(double quantile) const
+{
+    std::uint64_t n = count();
+    if (n == 0)
+        return 0;
+
+    std::uint64_t rank = static_cast<std::uint64_t>(std::ceil(quantile * n));
+    if (rank == 0)
+        rank = 1;
+
+    std::uint64_t seen = 0;
+    for (std::size_t i = 0; i < num_buckets; ++i)
+    {
+        seen += buckets[i].load(std::memory_order_relaxed);
+        if (seen >= rank)
+            return bucketUpperBound(i);
+    }
+
+    // a record() was only half done while we were counting
+    return bucketUpperBound(num_buckets - 1);
+}
+
+
+void ConnectionMetrics::write(
+    std::ostream& out,
+    const std::string& prefix,
+    const std::string& labels
+) const
+{
+    out<<prefix<<"messages_in"<<labels<<' '<<messages_in<<'\n'<<
+        prefix<<"messages_out"<<labels<<' '<<messages_out<<'\n'<<
+        prefix<<"bytes_in"<<labels<<' '<<bytes_in<<'\n'<<
+        prefix<<"bytes_out"<<labels<<' '<<bytes_out<<'\n'<<
+        prefix<<"dropped_frames"<<labels<<' '<<dropped_frames<<'\n'<<
+        prefix<<"pending_writes"<<labels<<' '<<pending_writes<<'\n';
+}
+
+
+Counter& MetricsRegistry::counter(const std::string& name)
+{
+    std::lock_guard<std::mutex> lock{registry_mutex};
+
+    std::unique_ptr<Counter>& c = counters[name];
+    if (!c)
+        c.reset(new Counter);
+
+    return *c;
+}
+
+Gauge& MetricsRegistry::gauge(const std::string& name)
+{
+    std::lock_guard<std::mutex> lock{registry_mutex};
+
+    std::unique_ptr<Gauge>& g = gauges[name];
+    if (!g)
+        g.reset(new Gauge);
+
+    return *g;
+}
+
+LatencyHistogram& MetricsRegistry::histogram(const std::string& name)
+{
+    std::lock_guard<std::mutex> lock{registry_mutex};
+
+    std::unique_ptr<LatencyHistogram>& h = histograms[name];
+    if (!h)
+        h.reset(new LatencyHistogram);
+
+    return *h;
+}
+
+void MetricsRegistry::write(std::ostream& out) const
+{
+    std::lock_guard<std::mutex> lock{registry_mutex};
+
+    for (const auto& c : counters)
+        out<<c.first<<' '<<c.second->value()<<'\n';
+
+    for (const auto& g : gauges)
+        out<<g.first<<' '<<g.second->value()<<'\n';
+
+    for (const auto& h : histograms)
+    {
+        const LatencyHistogram& hist = *h.second;
+
+        out<<h.first<<"_count "<<hist.count()<<'\n'<<
+            h.first<<"_sum "<<hist.sum()<<'\n'<<
+            h.first<<"{quantile=\"0.5\"} "<<hist.percentile(0.5)<<'\n'<<
+            h.first<<"{quantile=\"0.9\"} "<<hist.percentile(0.9)<<'\n'<<
+            h.first<<"{quantile=\"0.99\"} "<<hist.percentile(0.99)<<'\n'<<
+            h.first<<"{quantile=\"0.999\"} "<<hist.percentile(0.999)<<'\n';
+    }
+}
@@ -50,7 +50,7 @@ SerializedData& SerializedData::operator= (const SerializedData& other)
     if (&other == this) return *this;
 
     // create and copy memory block
-    auto data = std::make_shared<byte_traits::byte_sequence>(_datasize);
+    auto data = std::make_shared<byte_traits::byte_sequence>(other._datasize);
     std::copy(other._begin_it, other._begin_it+other._datasize, data->begin());
 
     // assign ownership and iterator
@@ -28,10 +28,22 @@ namespace nuke_ms {
 // explicit class template instantions
 template class BasicMessageLayer<NearUserMessage>;
 template class SegmentationLayer<NearUserMessage>;
+template class BasicMessageLayer<NearResumeRequest>;
+template class SegmentationLayer<NearResumeRequest>;
+template class BasicMessageLayer<NodeHello>;
+template class SegmentationLayer<NodeHello>;
+template class BasicMessageLayer<RelayedMessage>;
+template class SegmentationLayer<RelayedMessage>;
 
 // template function specializations
 template byte_traits::byte_sequence::iterator
 NearUserMessage::fillSerialized(byte_traits::byte_sequence::iterator it) const;
+template byte_traits::byte_sequence::iterator
+NearResumeRequest::fillSerialized(byte_traits::byte_sequence::iterator it) const;
+template byte_traits::byte_sequence::iterator
+NodeHello::fillSerialized(byte_traits::byte_sequence::iterator it) const;
+template byte_traits::byte_sequence::iterator
+RelayedMessage::fillSerialized(byte_traits::byte_sequence::iterator it) const;
 
 } // namespace nuke_ms
 
@@ -66,3 +78,64 @@ NearUserMessage::NearUserMessage(const SerializedData& data)
     };
 }
 
+
+NearResumeRequest::NearResumeRequest(const SerializedData& data)
+{
+    auto in_it = data.begin();
+
+    // bail out, if data is too small
+    if (data.size() < header_length)
+        throw UndersizedPacketError();
+
+    // if first byte isn't the correct layer identifier that's a wrong packet
+    if (*in_it++ != LAYER_ID) throw InvalidHeaderError();
+
+    // get msg id
+    in_it = readbytes<NearUserMessage::msg_id_t>(&_last_msg_id, in_it);
+    _last_msg_id = to_hostbo(_last_msg_id);
+
+    // sender of the last message
+    _last_sender = UniqueUserID(in_it);
+}
+
+
+NodeHello::NodeHello(const SerializedData& data)
+{
+    auto in_it = data.begin();
+
+    // bail out, if data is too small
+    if (data.size() < header_length)
+        throw UndersizedPacketError();
+
+    // if first byte isn't the correct layer identifier that's a wrong packet
+    if (*in_it++ != LAYER_ID) throw InvalidHeaderError();
+
+    _node_id = UniqueUserID(in_it);
+}
+
+
+RelayedMessage::RelayedMessage(const SerializedData& data)
+    : _inner_layer{data.getOwnership(), data.begin(), 0}
+{
+    auto in_it = data.begin();
+
+    // bail out, if data is too small
+    if (data.size() < header_length)
+        throw UndersizedPacketError();
+
+    // if first byte isn't the correct layer identifier that's a wrong packet
+    if (*in_it++ != LAYER_ID) throw InvalidHeaderError();
+
+    // origin
+    _origin = UniqueUserID(in_it);
+    in_it += UniqueUserID::id_length;
+
+    // identifier assigned by the origin
+    in_it = readbytes<relay_id_t>(&_relay_id, in_it);
+    _relay_id = to_hostbo(_relay_id);
+
+    // the rest is the relayed payload
+    _inner_layer = SerializedData{
+        data.getOwnership(), in_it, data.size() - header_length
+    };
+}
@@ -0,0 +1,736 @@
+// shmtransport.cpp
+
+/*
+ *   nuke-ms - Nuclear Messaging System
+ *   Copyright (C) 2012  Alexander Korsunsky
+ *
+ *   This program is free software: you can redistribute it and/or modify
+ *   it under the terms of the GNU General Public License as published by
+ *   the Free Software Foundation, version 3 of the License.
+ *
+ *   This program is distributed in the hope that it will be useful,
+ *   but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *   MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ *   GNU General Public License for more details.
+ *
+ *   You should have received a copy of the GNU General Public License
+ *   along with this program.  If not, see <http://www.gnu.org/licenses/>.
+*/
+
+#include <algorithm>
+#include <atomic>
+#include <cstdint>
+#include <cstring>
+#include <deque>
+
+#include <errno.h>
+#include <sys/eventfd.h>
+#include <sys/mman.h>
+#include <sys/socket.h>
+#include <sys/stat.h>
+#include <unistd.h>
+
+#include <boost/asio/error.hpp>
+#include <boost/asio/post.hpp>
+#include <boost/asio/posix/stream_descriptor.hpp>
+
+#include "shmtransport.hpp"
+
+using namespace nuke_ms;
+
+static_assert(ATOMIC_LLONG_LOCK_FREE == 2 && ATOMIC_INT_LOCK_FREE == 2,
+    "The ring buffers need lock-free atomics to be shared between processes");
+
+namespace
+{
+
+typedef boost::asio::local::stream_protocol::socket socket_type;
+
+/** Control block of a ring buffer in the shared memory.
+* Each side only ever writes its own index. The indices count all bytes
+* transferred so far and are never wrapped.
+*/
+struct RingHeader
+{
+    /** Bytes consumed so far, written by the consumer */
+    alignas(64) std::atomic<std::uint64_t> head;
+
+    /** Bytes produced so far, written by the producer */
+    alignas(64) std::atomic<std::uint64_t> tail;
+
+    /** Set by the consumer before it sleeps on its eventfd */
+    alignas(64) std::atomic<std::uint32_t> consumer_waiting;
+
+    /** Set by the producer before it sleeps on its eventfd */
+    alignas(64) std::atomic<std::uint32_t> producer_waiting;
+};
+
+const std::size_t ring_size = ShmTransport::ring_size;
+const std::size_t ring_block = sizeof(RingHeader) + ring_size;
+const std::size_t segment_size = 2 * ring_block;
+
+static_assert((ring_size & (ring_size - 1)) == 0,
+    "The ring size must be a power of two");
+
+/** Message the server sends along with the file descriptors */
+struct Handshake
+{
+    std::uint32_t magic;
+    std::uint32_t version;
+    std::uint64_t ring_size;
+};
+
+const std::uint32_t handshake_magic = 0x6e6d7368;
+const std::uint32_t handshake_version = 1;
+
+/** Order of the file descriptors sent to the client.
+* Ring 0 carries the bytes from the client to the server, ring 1 the bytes
+* from the server to the client. The consumer of a ring sleeps on its DATA
+* eventfd, the producer on its SPACE eventfd.
+*/
+enum { FD_MEMORY, FD_DATA0, FD_SPACE0, FD_DATA1, FD_SPACE1, FD_COUNT };
+
+
+/** Closes file descriptors, unless they were taken */
+struct FdGuard
+{
+    int fds[FD_COUNT];
+
+    FdGuard()
+    { std::fill(fds, fds + FD_COUNT, -1); }
+
+    ~FdGuard()
+    {
+        for (int fd : fds)
+            if (fd >= 0)
+                ::close(fd);
+    }
+
+    int take(int index)
+    {
+        int fd = fds[index];
+        fds[index] = -1;
+        return fd;
+    }
+};
+
+
+/** One side of a ring buffer in the shared memory */
+class Ring
+{
+    RingHeader* header;
+    unsigned char* data;
+
+public:
+    explicit Ring(void* block)
+        : header{static_cast<RingHeader*>(block)},
+        data{static_cast<unsigned char*>(block) + sizeof(RingHeader)}
+    {}
+
+    RingHeader& control()
+    { return *header; }
+
+    /** Number of bytes that can be consumed */
+    std::uint64_t available() const
+    {
+        return header->tail.load(std::memory_order_acquire) -
+            header->head.load(std::memory_order_acquire);
+    }
+
+    /** Check that the other side did not mess up its index */
+    bool valid() const
+    { return available() <= ring_size; }
+
+    /** Consume as many bytes as there are, up to the size of the buffer */
+    std::size_t read(const boost::asio::mutable_buffer& buffer)
+    {
+        std::uint64_t head = header->head.load(std::memory_order_relaxed);
+        std::uint64_t tail = header->tail.load(std::memory_order_acquire);
+
+        std::size_t n = std::min<std::uint64_t>(tail - head, buffer.size());
+        std::size_t offset = head & (ring_size - 1);
+        std::size_t first = std::min(n, ring_size - offset);
+
+        unsigned char* out = static_cast<unsigned char*>(buffer.data());
+        std::memcpy(out, data + offset, first);
+        std::memcpy(out + first, data, n - first);
+
+        header->head.store(head + n, std::memory_order_release);
+        return n;
+    }
+
+    /** Produce as many bytes as fit, up to the size of the buffer */
+    std::size_t write(const boost::asio::const_buffer& buffer)
+    {
+        std::uint64_t tail = header->tail.load(std::memory_order_relaxed);
+        std::uint64_t head = header->head.load(std::memory_order_acquire);
+
+        std::size_t n = std::min<std::uint64_t>(
+            ring_size - (tail - head), buffer.size()
+        );
+        std::size_t offset = tail & (ring_size - 1);
+        std::size_t first = std::min(n, ring_size - offset);
+
+        const unsigned char* in =
+            static_cast<const unsigned char*>(buffer.data());
+        std::memcpy(data + offset, in, first);
+        std::memcpy(data, in + first, n - first);
+
+        header->tail.store(tail + n, std::memory_order_release);
+        return n;
+    }
+};
+
+
+/** Wake the other side, if it announced that it sleeps on the eventfd */
+void wake(std::atomic<std::uint32_t>& waiting, int fd)
+{
+    // pairs with the fence in ShmTransport::State::sleep()
+    std::atomic_thread_fence(std::memory_order_seq_cst);
+
+    if (waiting.load(std::memory_order_relaxed) && waiting.exchange(0))
+    {
+        std::uint64_t one = 1;
+        ssize_t dontcare = ::write(fd, &one, sizeof(one));
+        (void) dontcare;
+    }
+}
+
+/** Reset an eventfd after waking up */
+void drain(int fd)
+{
+    std::uint64_t value;
+    ssize_t dontcare = ::read(fd, &value, sizeof(value));
+    (void) dontcare;
+}
+
+boost::system::error_code lastError()
+{
+    return boost::system::error_code{
+        errno, boost::asio::error::get_system_category()
+    };
+}
+
+boost::system::error_code protocolError()
+{
+    return boost::system::errc::make_error_code(
+        boost::system::errc::protocol_error
+    );
+}
+
+} // anonymous namespace
+
+
+struct ShmTransport::State : public std::enable_shared_from_this<State>
+{
+    boost::asio::io_service& io_service;
+
+    /** Socket to the other side, only used to notice when it goes away */
+    socket_type socket;
+
+    /** The mapped memory segment */
+    void* segment;
+
+    /** Ring we consume from and ring we produce into */
+    Ring rx, tx;
+
+    /** Readable when there is data in rx */
+    boost::asio::posix::stream_descriptor rx_data_event;
+
+    /** Readable when there is space in tx */
+    boost::asio::posix::stream_descriptor tx_space_event;
+
+    /** Eventfd to wake the producer of rx */
+    int rx_space_fd;
+
+    /** Eventfd to wake the consumer of tx */
+    int tx_data_fd;
+
+    /** Memory for the wait operations */
+    std::shared_ptr<HandlerMemory> read_memory, write_memory, peer_memory;
+
+    TransportOp* read_op;
+    boost::asio::mutable_buffer read_buffer;
+
+    /** A write operation waiting for its turn */
+    struct PendingWrite
+    {
+        TransportOp* op;
+        boost::asio::const_buffer buffer;
+    };
+
+    /** Write operations in the order they were started. The first one is
+    * written completely before the next one starts, so the bytes of two
+    * writes never interleave. */
+    std::deque<PendingWrite> writes;
+
+    /** Bytes of the first write already in the ring */
+    std::size_t written;
+
+    /** True while the writes are carried out or waiting for space */
+    bool writing;
+
+    /** The other side has gone away */
+    bool peer_closed;
+
+    /** This side has closed the connection */
+    bool closed;
+
+    State(socket_type&& _socket, void* _segment, bool server_side, FdGuard& fds)
+        : io_service(static_cast<boost::asio::io_service&>(
+            boost::asio::query(
+                _socket.get_executor(), boost::asio::execution::context
+            )
+        )),
+        socket(std::move(_socket)), segment{_segment},
+        rx{static_cast<unsigned char*>(segment) + (server_side ? 0 : ring_block)},
+        tx{static_cast<unsigned char*>(segment) + (server_side ? ring_block : 0)},
+        rx_data_event{io_service, fds.take(server_side ? FD_DATA0 : FD_DATA1)},
+        tx_space_event{io_service, fds.take(server_side ? FD_SPACE1 : FD_SPACE0)},
+        rx_space_fd{fds.take(server_side ? FD_SPACE0 : FD_SPACE1)},
+        tx_data_fd{fds.take(server_side ? FD_DATA1 : FD_DATA0)},
+        read_memory{std::make_shared<HandlerMemory>()},
+        write_memory{std::make_shared<HandlerMemory>()},
+        peer_memory{std::make_shared<HandlerMemory>()},
+        read_op{nullptr}, written{0}, writing{false},
+        peer_closed{false}, closed{false}
+    {}
+
+    ~State()
+    {
+        ::close(rx_space_fd);
+        ::close(tx_data_fd);
+        ::munmap(segment, segment_size);
+    }
+
+    /** Complete an operation.
+    * @param initiating True if called from within the initiating function,
+    * then the completion is posted.
+    */
+    void finish(
+        TransportOp*& op,
+        const boost::system::error_code& error,
+        std::size_t bytes_transferred,
+        bool initiating
+    )
+    {
+        TransportCompletion completion{op};
+        op = nullptr;
+
+        if (initiating)
+            boost::asio::post(io_service,
+                std::bind(std::move(completion), error, bytes_transferred)
+            );
+        else
+            completion(error, bytes_transferred);
+    }
+
+    /** Announce that we are going to sleep.
+    * @return false if the condition changed in between and we must not sleep
+    */
+    template <typename Condition>
+    static bool sleep(std::atomic<std::uint32_t>& waiting, Condition still_true)
+    {
+        waiting.store(1);
+
+        // pairs with the fence in wake()
+        std::atomic_thread_fence(std::memory_order_seq_cst);
+
+        if (still_true())
+            return true;
+
+        waiting.store(0);
+        return false;
+    }
+
+    void startRead(bool initiating)
+    {
+        for (;;)
+        {
+            if (!rx.valid())
+            {
+                finish(read_op, protocolError(), 0, initiating);
+                return;
+            }
+
+            std::size_t n = rx.read(read_buffer);
+            if (n)
+            {
+                wake(rx.control().producer_waiting, rx_space_fd);
+                finish(read_op, boost::system::error_code{}, n, initiating);
+                return;
+            }
+
+            if (peer_closed)
+            {
+                finish(read_op, boost::asio::error::eof, 0, initiating);
+                return;
+            }
+
+            if (sleep(rx.control().consumer_waiting,
+                    [this]() { return rx.available() == 0; }))
+                break;
+        }
+
+        rx_data_event.async_wait(
+            boost::asio::posix::stream_descriptor::wait_read,
+            makeAllocHandler(read_memory,
+                std::bind(&State::readWaitHandler, shared_from_this(),
+                    std::placeholders::_1)
+            )
+        );
+    }
+
+    void readWaitHandler(const boost::system::error_code& error)
+    {
+        if (closed)
+            finish(read_op, boost::asio::error::operation_aborted, 0, false);
+        // the wait is cancelled when the other side goes away
+        else if (error && error != boost::asio::error::operation_aborted)
+            finish(read_op, error, 0, false);
+        else
+        {
+            drain(rx_data_event.native_handle());
+            startRead(false);
+        }
+    }
+
+    /** Take the first write from the queue and complete it */
+    void finishWrite(
+        const boost::system::error_code& error,
+        std::size_t bytes_transferred,
+        bool initiating
+    )
+    {
+        TransportOp* op = writes.front().op;
+        writes.pop_front();
+        written = 0;
+
+        finish(op, error, bytes_transferred, initiating);
+    }
+
+    /** Fail all pending writes */
+    void failWrites(const boost::system::error_code& error, bool initiating)
+    {
+        while (!writes.empty())
+            finishWrite(error, 0, initiating);
+
+        writing = false;
+    }
+
+    void startWrite(bool initiating)
+    {
+        writing = true;
+
+        while (!writes.empty())
+        {
+            if (peer_closed)
+            {
+                failWrites(boost::asio::error::broken_pipe, initiating);
+                return;
+            }
+
+            if (!tx.valid())
+            {
+                failWrites(protocolError(), initiating);
+                return;
+            }
+
+            const boost::asio::const_buffer& buffer = writes.front().buffer;
+
+            std::size_t n = tx.write(buffer + written);
+            if (n)
+            {
+                wake(tx.control().consumer_waiting, tx_data_fd);
+                written += n;
+            }
+
+            if (written == buffer.size())
+            {
+                finishWrite(boost::system::error_code{}, buffer.size(),
+                    initiating);
+                continue;
+            }
+
+            // the ring is full
+            if (sleep(tx.control().producer_waiting,
+                    [this]() { return tx.available() == ring_size; }))
+            {
+                waitForSpace();
+                return;
+            }
+        }
+
+        writing = false;
+    }
+
+    void waitForSpace()
+    {
+        tx_space_event.async_wait(
+            boost::asio::posix::stream_descriptor::wait_read,
+            makeAllocHandler(write_memory,
+                std::bind(&State::writeWaitHandler, shared_from_this(),
+                    std::placeholders::_1)
+            )
+        );
+    }
+
+    void writeWaitHandler(const boost::system::error_code& error)
+    {
+        if (closed)
+            failWrites(boost::asio::error::operation_aborted, false);
+        else if (error && error != boost::asio::error::operation_aborted)
+            failWrites(error, false);
+        else
+        {
+            drain(tx_space_event.native_handle());
+            startWrite(false);
+        }
+    }
+
+    /** Wait until the other side closes its socket */
+    void watchPeer()
+    {
+        socket.async_wait(socket_type::wait_read,
+            makeAllocHandler(peer_memory,
+                std::bind(&State::peerHandler, shared_from_this(),
+                    std::placeholders::_1)
+            )
+        );
+    }
+
+    void peerHandler(const boost::system::error_code& error)
+    {
+        if (closed || error == boost::asio::error::operation_aborted)
+            return;
+
+        // the other side never writes to the socket, so it is readable only
+        // when it was closed. Let the pending operations find out.
+        peer_closed = true;
+
+        boost::system::error_code dontcare;
+        rx_data_event.cancel(dontcare);
+        tx_space_event.cancel(dontcare);
+    }
+};
+
+
+ShmTransport::ShmTransport(std::shared_ptr<State> _state)
+    : state{std::move(_state)}
+{
+    state->watchPeer();
+}
+
+ShmTransport::~ShmTransport()
+{
+    boost::system::error_code dontcare;
+    close(dontcare);
+}
+
+std::unique_ptr<TransportImpl> ShmTransport::createServerSide(
+    socket_type&& socket,
+    boost::system::error_code& error
+)
+{
+    FdGuard fds;
+
+    fds.fds[FD_MEMORY] = ::memfd_create("nuke-ms-shm", MFD_CLOEXEC);
+    if (fds.fds[FD_MEMORY] < 0 ||
+        ::ftruncate(fds.fds[FD_MEMORY], segment_size) < 0)
+    {
+        error = lastError();
+        return nullptr;
+    }
+
+    for (int i = FD_DATA0; i < FD_COUNT; ++i)
+    {
+        fds.fds[i] = ::eventfd(0, EFD_NONBLOCK | EFD_CLOEXEC);
+        if (fds.fds[i] < 0)
+        {
+            error = lastError();
+            return nullptr;
+        }
+    }
+
+    void* segment = ::mmap(nullptr, segment_size, PROT_READ | PROT_WRITE,
+        MAP_SHARED, fds.fds[FD_MEMORY], 0);
+    if (segment == MAP_FAILED)
+    {
+        error = lastError();
+        return nullptr;
+    }
+
+    new (segment) RingHeader();
+    new (static_cast<unsigned char*>(segment) + ring_block) RingHeader();
+
+    // send the handshake and all file descriptors in one message
+    Handshake handshake{handshake_magic, handshake_version, ring_size};
+    iovec iov{&handshake, sizeof(handshake)};
+
+    union
+    {
+        char buf[CMSG_SPACE(sizeof(int) * FD_COUNT)];
+        cmsghdr align;
+    } control;
+    std::memset(&control, 0, sizeof(control));
+
+    msghdr msg{};
+    msg.msg_iov = &iov;
+    msg.msg_iovlen = 1;
+    msg.msg_control = control.buf;
+    msg.msg_controllen = sizeof(control.buf);
+
+    cmsghdr* cmsg = CMSG_FIRSTHDR(&msg);
+    cmsg->cmsg_level = SOL_SOCKET;
+    cmsg->cmsg_type = SCM_RIGHTS;
+    cmsg->cmsg_len = CMSG_LEN(sizeof(int) * FD_COUNT);
+    std::memcpy(CMSG_DATA(cmsg), fds.fds, sizeof(int) * FD_COUNT);
+
+    ssize_t sent = ::sendmsg(socket.native_handle(), &msg, MSG_NOSIGNAL);
+    if (sent != sizeof(handshake))
+    {
+        error = sent < 0 ? lastError() : protocolError();
+        ::munmap(segment, segment_size);
+        return nullptr;
+    }
+
+    error = boost::system::error_code{};
+    return std::unique_ptr<TransportImpl>{new ShmTransport{
+        std::make_shared<State>(std::move(socket), segment, true, fds)
+    }};
+}
+
+std::unique_ptr<TransportImpl> ShmTransport::createClientSide(
+    socket_type&& socket,
+    boost::system::error_code& error
+)
+{
+    Handshake handshake;
+    iovec iov{&handshake, sizeof(handshake)};
+
+    union
+    {
+        char buf[CMSG_SPACE(sizeof(int) * FD_COUNT)];
+        cmsghdr align;
+    } control;
+
+    msghdr msg{};
+    msg.msg_iov = &iov;
+    msg.msg_iovlen = 1;
+    msg.msg_control = control.buf;
+    msg.msg_controllen = sizeof(control.buf);
+
+    ssize_t received = ::recvmsg(socket.native_handle(), &msg,
+        MSG_DONTWAIT | MSG_CMSG_CLOEXEC);
+    if (received <= 0)
+    {
+        error = received < 0 ? lastError() :
+            boost::system::error_code{boost::asio::error::eof};
+        return nullptr;
+    }
+
+    // take ownership of every file descriptor we got
+    FdGuard fds;
+    int fd_count = 0;
+    for (cmsghdr* cmsg = CMSG_FIRSTHDR(&msg); cmsg;
+        cmsg = CMSG_NXTHDR(&msg, cmsg))
+    {
+        if (cmsg->cmsg_level != SOL_SOCKET || cmsg->cmsg_type != SCM_RIGHTS)
+            continue;
+
+        int n = (cmsg->cmsg_len - CMSG_LEN(0)) / sizeof(int);
+        for (int i = 0; i < n; ++i, ++fd_count)
+        {
+            int fd;
+            std::memcpy(&fd, CMSG_DATA(cmsg) + i * sizeof(int), sizeof(int));
+
+            if (fd_count < FD_COUNT)
+                fds.fds[fd_count] = fd;
+            else
+                ::close(fd);
+        }
+    }
+
+    struct stat st;
+    if (received != sizeof(handshake) || fd_count != FD_COUNT ||
+        (msg.msg_flags & MSG_CTRUNC) ||
+        handshake.magic != handshake_magic ||
+        handshake.version != handshake_version ||
+        handshake.ring_size != ring_size ||
+        ::fstat(fds.fds[FD_MEMORY], &st) < 0 ||
+        std::size_t(st.st_size) < segment_size)
+    {
+        error = protocolError();
+        return nullptr;
+    }
+
+    void* segment = ::mmap(nullptr, segment_size, PROT_READ | PROT_WRITE,
+        MAP_SHARED, fds.fds[FD_MEMORY], 0);
+    if (segment == MAP_FAILED)
+    {
+        error = lastError();
+        return nullptr;
+    }
+
+    error = boost::system::error_code{};
+    return std::unique_ptr<TransportImpl>{new ShmTransport{
+        std::make_shared<State>(std::move(socket), segment, false, fds)
+    }};
+}
+
+void ShmTransport::asyncReadSome(
+    const boost::asio::mutable_buffer& buffer,
+    TransportOp* op
+)
+{
+    state->read_op = op;
+    state->read_buffer = buffer;
+
+    if (buffer.size() == 0)
+        state->finish(state->read_op, boost::system::error_code{}, 0, true);
+    else
+        state->startRead(true);
+}
+
+void ShmTransport::asyncWriteSome(
+    const boost::asio::const_buffer& buffer,
+    TransportOp* op
+)
+{
+    if (buffer.size() == 0)
+    {
+        state->finish(op, boost::system::error_code{}, 0, true);
+        return;
+    }
+
+    state->writes.push_back(State::PendingWrite{op, buffer});
+
+    // otherwise, the write is carried out after the ones before it
+    if (!state->writing)
+        state->startWrite(true);
+}
+
+void ShmTransport::shutdown(boost::system::error_code& error)
+{
+    // the other side notices the closed socket, and so do we
+    state->socket.shutdown(socket_type::shutdown_both, error);
+}
+
+void ShmTransport::close(boost::system::error_code& error)
+{
+    if (state->closed)
+        return;
+
+    state->closed = true;
+
+    // the wait handlers abort the pending operations
+    boost::system::error_code dontcare;
+    state->rx_data_event.cancel(dontcare);
+    state->tx_space_event.cancel(dontcare);
+    state->socket.close(error);
+}
+
+bool ShmTransport::isOpen() const
+{
+    return !state->closed;
+}
@@ -0,0 +1,113 @@
+// tracing.cpp
+
+/*
+ *   nuke-ms - Nuclear Messaging System
+ *   Copyright (C) 2012  Alexander Korsunsky
+ *
+ *   This program is free software: you can redistribute it and/or modify
+ *   it under the terms of the GNU General Public License as published by
+ *   the Free Software Foundation, version 3 of the License.
+ *
+ *   This program is distributed in the hope that it will be useful,
+ *   but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *   MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ *   GNU General Public License for more details.
+ *
+ *   You should have received a copy of the GNU General Public License
+ *   along with this program.  If not, see <http://www.gnu.org/licenses/>.
+*/
+
+#include "tracing.hpp"
+
+using namespace nuke_ms;
+
+
+/** Convert a time point into microseconds relative to the epoch */
+static double toMicroseconds(
+    TraceRecorder::clock_type::time_point t,
+    TraceRecorder::clock_type::time_point epoch
+)
+{
+    return std::chrono::duration<double, std::micro>(t - epoch).count();
+}
+
+
+TraceRecorder::TraceRecorder(const std::string& filename)
+    : epoch{clock_type::now()}, last_message_id{0}, current_message{0},
+    first_span{true}
+{
+    if (filename.empty())
+        return;
+
+    out.reset(new std::ofstream(filename.c_str()));
+    out->setf(std::ios::fixed);
+    out->precision(3);
+
+    // JSON array format. The closing bracket is optional, so the file can
+    // be loaded even if the process did not exit cleanly.
+    *out<<"[\n";
+
+    buffer.reserve(buffer_size);
+}
+
+TraceRecorder::~TraceRecorder()
+{
+    if (!out)
+        return;
+
+    std::lock_guard<std::mutex> lock{buffer_mutex};
+    writeBuffer();
+    *out<<"\n]\n";
+}
+
+std::uint64_t TraceRecorder::nextMessageId()
+{
+    std::lock_guard<std::mutex> lock{buffer_mutex};
+    return ++last_message_id;
+}
+
+void TraceRecorder::span(
+    const char* name,
+    std::int64_t lane,
+    clock_type::time_point start,
+    clock_type::time_point end,
+    std::uint64_t message_id
+)
+{
+    if (!out)
+        return;
+
+    std::lock_guard<std::mutex> lock{buffer_mutex};
+
+    buffer.push_back(Span{name, lane, start, end, message_id});
+    if (buffer.size() >= buffer_size)
+        writeBuffer();
+}
+
+void TraceRecorder::flush()
+{
+    if (!out)
+        return;
+
+    std::lock_guard<std::mutex> lock{buffer_mutex};
+    writeBuffer();
+}
+
+void TraceRecorder::writeBuffer()
+{
+    for (const Span& s : buffer)
+    {
+        if (!first_span)
+            *out<<",\n";
+        first_span = false;
+
+        *out<<"{\"name\":\""<<s.name<<"\",\"cat\":\"msg\",\"ph\":\"X\""
+            ",\"ts\":"<<toMicroseconds(s.start, epoch)<<
+            ",\"dur\":"<<toMicroseconds(s.end, s.start)<<
+            ",\"pid\":1,\"tid\":"<<s.lane<<
+            ",\"args\":{\"msg\":"<<s.message_id<<"}}";
+    }
+
+    buffer.clear();
+    out->flush();
+}
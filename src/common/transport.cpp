@@ -0,0 +1,84 @@
+// transport.cpp
+
+/*
+ *   nuke-ms - Nuclear Messaging System
+ *   Copyright (C) 2012  Alexander Korsunsky
+ *
+ *   This program is free software: you can redistribute it and/or modify
+ *   it under the terms of the GNU General Public License as published by
+ *   the Free Software Foundation, version 3 of the License.
+ *
+ *   This program is distributed in the hope that it will be useful,
+ *   but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *   MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ *   GNU General Public License for more details.
+ *
+ *   You should have received a copy of the GNU General Public License
+ *   along with this program.  If not, see <http://www.gnu.org/licenses/>.
+*/
+
+#include <boost/asio/error.hpp>
+#include <boost/asio/post.hpp>
+
+#include "transport.hpp"
+
+using namespace nuke_ms;
+
+
+Transport::~Transport()
+{
+    boost::system::error_code dontcare;
+    close(dontcare);
+}
+
+void Transport::assign(std::unique_ptr<TransportImpl> _impl)
+{
+    boost::system::error_code dontcare;
+    close(dontcare);
+
+    impl = std::move(_impl);
+}
+
+void Transport::shutdown(boost::system::error_code& error)
+{
+    if (impl)
+        impl->shutdown(error);
+    else
+        error = boost::asio::error::bad_descriptor;
+}
+
+void Transport::close(boost::system::error_code& error)
+{
+    if (!impl)
+        return;
+
+    impl->close(error);
+    impl.reset();
+}
+
+TransportImpl::native_handle_type Transport::release(
+    boost::system::error_code& error
+)
+{
+    if (!impl)
+    {
+        error = boost::asio::error::bad_descriptor;
+        return TransportImpl::native_handle_type(-1);
+    }
+
+    TransportImpl::native_handle_type handle = impl->release(error);
+    if (!error)
+        impl.reset();
+
+    return handle;
+}
+
+void Transport::failOperation(TransportOp* op)
+{
+    // never complete from within the initiating function
+    boost::asio::post(*io_service, std::bind(
+        TransportCompletion{op},
+        boost::system::error_code{boost::asio::error::bad_descriptor},
+        std::size_t{0}
+    ));
+}
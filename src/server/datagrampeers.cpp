@@ -0,0 +1,375 @@
+// datagrampeers.cpp
+
+/*
+ *   nuke-ms - Nuclear Messaging System
+ *   Copyright (C) 2012  Alexander Korsunsky
+ *
+ *   This program is free software: you can redistribute it and/or modify
+ *   it under the terms of the GNU General Public License as published by
+ *   the Free Software Foundation, version 3 of the License.
+ *
+ *   This program is distributed in the hope that it will be useful,
+ *   but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *   MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ *   GNU General Public License for more details.
+ *
+ *   You should have received a copy of the GNU General Public License
+ *   along with this program.  If not, see <http://www.gnu.org/licenses/>.
+*/
+
+#include <algorithm>
+#include <random>
+
+#include <boost/bind.hpp>
+
+#include "datagrampeers.hpp"
+
+using namespace nuke_ms;
+using namespace server;
+using boost::asio::ip::udp;
+
+
+/** Most batches received before other handlers get their turn */
+static const int max_batches_per_wakeup = 16;
+
+constexpr unsigned DatagramPeers::peer_timeout;
+constexpr unsigned DatagramPeers::cookie_lifetime;
+constexpr byte_traits::byte_t DatagramPeers::cookie_layer_id;
+constexpr std::size_t DatagramPeers::cookie_length;
+constexpr std::size_t DatagramPeers::cookie_packet_length;
+
+
+static std::uint64_t rotl(std::uint64_t x, int b)
+{
+    return (x << b) | (x >> (64 - b));
+}
+
+static void sipRound(std::uint64_t v[4])
+{
+    v[0] += v[1]; v[1] = rotl(v[1], 13); v[1] ^= v[0]; v[0] = rotl(v[0], 32);
+    v[2] += v[3]; v[3] = rotl(v[3], 16); v[3] ^= v[2];
+    v[0] += v[3]; v[3] = rotl(v[3], 21); v[3] ^= v[0];
+    v[2] += v[1]; v[1] = rotl(v[1], 17); v[1] ^= v[2]; v[2] = rotl(v[2], 32);
+}
+
+/** SipHash-2-4 of a byte string, a keyed hash that can not be guessed
+* without the key */
+static std::uint64_t sipHash(
+    const std::uint64_t key[2],
+    const byte_traits::byte_t* data,
+    std::size_t size
+)
+{
+    std::uint64_t v[4] = {
+        key[0] ^ 0x736f6d6570736575ull, key[1] ^ 0x646f72616e646f6dull,
+        key[0] ^ 0x6c7967656e657261ull, key[1] ^ 0x7465646279746573ull
+    };
+
+    std::uint64_t last = std::uint64_t{size} << 56;
+    std::size_t whole = size - size % 8;
+
+    for (std::size_t i = 0; i <= whole; i += 8)
+    {
+        std::uint64_t m = 0;
+        for (std::size_t j = 0; j < 8 && i + j < size; ++j)
+            m |= std::uint64_t{data[i + j]} << (8 * j);
+
+        // the last word holds the rest and the length
+        if (i == whole)
+            m |= last;
+
+        v[3] ^= m;
+        sipRound(v);
+        sipRound(v);
+        v[0] ^= m;
+    }
+
+    v[2] ^= 0xff;
+    for (int i = 0; i < 4; ++i)
+        sipRound(v);
+
+    return v[0] ^ v[1] ^ v[2] ^ v[3];
+}
+
+
+DatagramPeers::DatagramPeers(
+    boost::asio::io_service& io_service,
+    unsigned short port,
+    receive_callback_t _receive_callback,
+    ServerLog& _log,
+    MetricsRegistry& registry
+)
+    : socket(udp::socket(io_service, udp::endpoint(udp::v4(), port))),
+    receive_callback(std::move(_receive_callback)),
+    log(_log),
+    start_time(clock_type::now()),
+    expiry_timer(io_service),
+    datagrams_in(registry.counter("datagrams_in")),
+    datagrams_out(registry.counter("datagrams_out")),
+    datagrams_invalid(registry.counter("datagrams_invalid")),
+    datagrams_dropped(registry.counter("datagrams_dropped")),
+    datagrams_too_large(registry.counter("datagrams_too_large")),
+    datagrams_unverified(registry.counter("datagrams_unverified")),
+    datagram_cookies(registry.counter("datagram_cookies")),
+    datagram_peers(registry.gauge("datagram_peers"))
+{
+    std::random_device random;
+    for (std::uint64_t& k : cookie_key)
+        k = (std::uint64_t{random()} << 32) | random();
+
+    startReceive();
+    startExpiryTimer();
+}
+
+void DatagramPeers::sendMessage(const SegmentationLayer<SerializedData>& msg)
+{
+    if (receivers.empty())
+        return;
+
+    if (msg.size() > DatagramSocket::max_datagram_size)
+    {
+        datagrams_too_large.add();
+        return;
+    }
+
+    send_buffer.resize(msg.size());
+    msg.fillSerialized(send_buffer.begin());
+
+    boost::system::error_code error;
+    std::size_t sent = socket.sendToAll(
+        boost::asio::buffer(send_buffer), receivers.data(), receivers.size(),
+        error
+    );
+
+    datagrams_out.add(sent);
+    datagrams_dropped.add(receivers.size() - sent);
+
+    if (error && error != boost::asio::error::would_block)
+        log.write(ServerLog::LEVEL_WARNING, "datagram_send_failed", 0,
+            error.message());
+}
+
+void DatagramPeers::close()
+{
+    boost::system::error_code dontcare;
+    socket.getSocket().close(dontcare);
+    expiry_timer.cancel(dontcare);
+
+    last_seen.clear();
+    receivers.clear();
+    datagram_peers.set(0);
+}
+
+DatagramPeers::endpoint_type DatagramPeers::localEndpoint()
+{
+    return socket.getSocket().local_endpoint();
+}
+
+void DatagramPeers::startReceive()
+{
+    socket.getSocket().async_wait(
+        udp::socket::wait_read,
+        boost::bind(
+            &DatagramPeers::receiveHandler,
+            this,
+            boost::asio::placeholders::error
+        )
+    );
+}
+
+void DatagramPeers::receiveHandler(const boost::system::error_code& error)
+{
+    if (error)
+    {
+        if (error != boost::asio::error::operation_aborted)
+            log.write(ServerLog::LEVEL_ERROR, "datagram_receive_failed", 0,
+                error.message());
+        return;
+    }
+
+    for (int b = 0; b < max_batches_per_wakeup; ++b)
+    {
+        boost::system::error_code receive_error;
+        std::size_t n = socket.receive(receive_error);
+
+        for (std::size_t i = 0; i < n; ++i)
+        {
+            if (socket.truncated(i))
+                datagrams_invalid.add();
+            else
+                handleDatagram(socket.datagram(i), socket.sender(i));
+        }
+
+        if (receive_error || n < DatagramSocket::batch_size)
+            break;
+    }
+
+    startReceive();
+}
+
+void DatagramPeers::handleDatagram(
+    const boost::asio::const_buffer& datagram,
+    const endpoint_type& sender
+)
+{
+    const byte_traits::byte_t* data =
+        static_cast<const byte_traits::byte_t*>(datagram.data());
+
+    // the header has to describe exactly this datagram
+    try {
+        if (datagram.size() < SegmentationLayerBase::header_length ||
+            SegmentationLayerBase::decodeHeader(data).packetsize !=
+                datagram.size())
+        {
+            datagrams_invalid.add();
+            return;
+        }
+    }
+    catch (const InvalidHeaderError&)
+    {
+        datagrams_invalid.add();
+        return;
+    }
+
+    auto seen = last_seen.find(sender);
+    if (seen == last_seen.end())
+    {
+        // only a client that got a cookie at its address becomes known
+        if (datagram.size() != cookie_packet_length ||
+            data[SegmentationLayerBase::header_length] != cookie_layer_id ||
+            !handleCookie(data, sender))
+            datagrams_unverified.add();
+
+        return;
+    }
+
+    datagrams_in.add();
+    seen->second = clock_type::now();
+
+    // a packet without payload only says that the client is still there
+    if (datagram.size() == SegmentationLayerBase::header_length)
+        return;
+
+    auto body = std::make_shared<byte_traits::byte_sequence>(
+        data + SegmentationLayerBase::header_length, data + datagram.size()
+    );
+
+    receive_callback(std::make_shared<SegmentationLayer<SerializedData>>(
+        SerializedData{body, body->begin(), body->size()}
+    ));
+}
+
+std::uint64_t DatagramPeers::makeCookie(
+    const endpoint_type& client,
+    std::uint64_t epoch
+) const
+{
+    // the epoch, the port and the address
+    byte_traits::byte_t input[8 + 2 + 16];
+    byte_traits::byte_t* it = writebytes(input, to_netbo(epoch));
+    it = writebytes(it, to_netbo(
+        static_cast<byte_traits::uint2b_t>(client.port())
+    ));
+
+    if (client.address().is_v4())
+    {
+        boost::asio::ip::address_v4::bytes_type address =
+            client.address().to_v4().to_bytes();
+        it = std::copy(address.begin(), address.end(), it);
+    }
+    else
+    {
+        boost::asio::ip::address_v6::bytes_type address =
+            client.address().to_v6().to_bytes();
+        it = std::copy(address.begin(), address.end(), it);
+    }
+
+    std::uint64_t cookie = sipHash(cookie_key, input, it - input);
+
+    // zero asks for a cookie, so it is never one
+    return cookie ? cookie : 1;
+}
+
+bool DatagramPeers::handleCookie(
+    const byte_traits::byte_t* packet,
+    const endpoint_type& sender
+)
+{
+    const byte_traits::byte_t* cookie_bytes =
+        packet + SegmentationLayerBase::header_length + 1;
+
+    std::uint64_t cookie;
+    readbytes(&cookie, cookie_bytes);
+    cookie = to_hostbo(cookie);
+
+    std::uint64_t epoch = (clock_type::now() - start_time) /
+        std::chrono::seconds{cookie_lifetime};
+
+    if (cookie == 0)
+    {
+        // the answer is no longer than the request, so the server can not
+        // be used to multiply the traffic to a forged address
+        byte_traits::byte_t answer[cookie_packet_length];
+        std::copy(packet, packet + cookie_packet_length, answer);
+        writebytes(answer + SegmentationLayerBase::header_length + 1,
+            to_netbo(makeCookie(sender, epoch)));
+
+        boost::system::error_code error;
+        datagram_cookies.add(socket.sendToAll(
+            boost::asio::buffer(answer), &sender, 1, error
+        ));
+
+        return false;
+    }
+
+    if (cookie != makeCookie(sender, epoch) &&
+        (epoch == 0 || cookie != makeCookie(sender, epoch - 1)))
+        return false;
+
+    last_seen.insert({sender, clock_type::now()});
+    receivers.push_back(sender);
+    datagram_peers.set(receivers.size());
+
+    return true;
+}
+
+void DatagramPeers::startExpiryTimer()
+{
+    expiry_timer.expires_from_now(boost::posix_time::seconds(peer_timeout / 3));
+    expiry_timer.async_wait(
+        boost::bind(
+            &DatagramPeers::expiryTimerHandler,
+            this,
+            boost::asio::placeholders::error
+        )
+    );
+}
+
+void DatagramPeers::expiryTimerHandler(const boost::system::error_code& error)
+{
+    if (error)
+        return;
+
+    clock_type::time_point deadline =
+        clock_type::now() - std::chrono::seconds{peer_timeout};
+
+    std::size_t before = last_seen.size();
+    for (auto it = last_seen.begin(); it != last_seen.end(); )
+    {
+        if (it->second < deadline)
+            it = last_seen.erase(it);
+        else
+            ++it;
+    }
+
+    if (last_seen.size() != before)
+    {
+        receivers.clear();
+        for (const auto& peer : last_seen)
+            receivers.push_back(peer.first);
+
+        datagram_peers.set(receivers.size());
+    }
+
+    startExpiryTimer();
+}
@@ -0,0 +1,194 @@
+// datagrampeers.hpp
+
+/*
+ *   nuke-ms - Nuclear Messaging System
+ *   Copyright (C) 2012  Alexander Korsunsky
+ *
+ *   This program is free software: you can redistribute it and/or modify
+ *   it under the terms of the GNU General Public License as published by
+ *   the Free Software Foundation, version 3 of the License.
+ *
+ *   This program is distributed in the hope that it will be useful,
+ *   but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *   MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ *   GNU General Public License for more details.
+ *
+ *   You should have received a copy of the GNU General Public License
+ *   along with this program.  If not, see <http://www.gnu.org/licenses/>.
+*/
+
+#ifndef DATAGRAMPEERS_HPP
+#define DATAGRAMPEERS_HPP
+
+#include <chrono>
+#include <cstdint>
+#include <functional>
+#include <map>
+#include <memory>
+#include <vector>
+
+#include <boost/asio.hpp>
+
+#include "msglayer.hpp"
+#include "metrics.hpp"
+#include "datagram.hpp"
+#include "serverlog.hpp"
+
+namespace nuke_ms
+{
+namespace server
+{
+
+/** Clients that exchange packets with the server as UDP datagrams.
+*
+* Every datagram holds exactly one packet, in the same format as on a TCP
+* connection; the SegmentationLayer header must match the size of the
+* datagram. There are no connections, but the sender address of a datagram
+* can be forged. So a client proves that it receives at its address before
+* it is known:
+*
+* 1. The client sends a cookie packet (cookie_layer_id and cookie_length
+*    bytes) with a cookie of zeros.
+* 2. The server answers with a cookie packet of the same length, holding a
+*    cookie computed from the client's address and a secret. Nothing is
+*    stored for the client.
+* 3. The client sends that cookie packet back, and is known from then on.
+*    A cookie is valid for one to two times cookie_lifetime seconds.
+*
+* Datagrams of unknown clients are dropped, and nothing but the cookie is
+* ever sent to them. A known client is forgotten after it was silent for
+* peer_timeout seconds. A packet without payload only keeps it known.
+*
+* Packets are not resent or ordered. Packets that do not fit into a
+* datagram are not sent to these clients at all.
+*/
+class DatagramPeers
+{
+public:
+    /** Called for every valid packet with payload */
+    typedef std::function<
+        void (std::shared_ptr<SegmentationLayer<SerializedData>>)
+    > receive_callback_t;
+
+    typedef DatagramSocket::endpoint_type endpoint_type;
+
+    /** Seconds of silence after which a client is forgotten */
+    constexpr static unsigned peer_timeout = 30;
+
+    /** Seconds after which a new secret for the cookies is used */
+    constexpr static unsigned cookie_lifetime = 60;
+
+    /** First byte of the payload of a cookie packet */
+    constexpr static byte_traits::byte_t cookie_layer_id = 0x60;
+
+    /** Length of a cookie */
+    constexpr static std::size_t cookie_length = 8;
+
+    /** Length of a cookie packet, with header */
+    constexpr static std::size_t cookie_packet_length =
+        SegmentationLayerBase::header_length + 1 + cookie_length;
+
+    /** Constructor. Starts receiving.
+    * @param io_service The io_service running the handlers
+    * @param port UDP port to receive on
+    * @param _receive_callback Called for every received packet
+    * @param _log Log for errors
+    * @param registry Registry for the statistics
+    */
+    DatagramPeers(
+        boost::asio::io_service& io_service,
+        unsigned short port,
+        receive_callback_t _receive_callback,
+        ServerLog& _log,
+        MetricsRegistry& registry
+    );
+
+    /** Send a packet to all known clients.
+    * If the send buffer of the socket is full, the packet is dropped for the
+    * remaining clients.
+    */
+    void sendMessage(const SegmentationLayer<SerializedData>& msg);
+
+    /** Give up the port and forget all clients. Packets are neither received
+    * nor sent anymore. */
+    void close();
+
+    /** Get the address the clients send to, e.g. when the system chose the
+    * port. */
+    endpoint_type localEndpoint();
+
+private:
+    typedef std::chrono::steady_clock clock_type;
+
+    DatagramSocket socket;
+
+    receive_callback_t receive_callback;
+
+    ServerLog& log;
+
+    /** When each client was last heard from */
+    std::map<endpoint_type, clock_type::time_point> last_seen;
+
+    /** The clients of last_seen, in the form sendToAll() takes them */
+    std::vector<endpoint_type> receivers;
+
+    /** The packet being sent */
+    byte_traits::byte_sequence send_buffer;
+
+    /** Secret key of the cookies, chosen at random */
+    std::uint64_t cookie_key[2];
+
+    /** The cookies change every cookie_lifetime seconds from here on */
+    clock_type::time_point start_time;
+
+    /** Timer for forgetting silent clients */
+    boost::asio::deadline_timer expiry_timer;
+
+    Counter& datagrams_in;
+    Counter& datagrams_out;
+    Counter& datagrams_invalid;
+    Counter& datagrams_dropped;
+    Counter& datagrams_too_large;
+    Counter& datagrams_unverified;
+    Counter& datagram_cookies;
+    Gauge& datagram_peers;
+
+    /** Wait for datagrams */
+    void startReceive();
+
+    /** Receive the waiting datagrams */
+    void receiveHandler(const boost::system::error_code& error);
+
+    /** Check and dispatch a received datagram */
+    void handleDatagram(
+        const boost::asio::const_buffer& datagram,
+        const endpoint_type& sender
+    );
+
+    /** Compute the cookie of a client.
+    * @param epoch Number of cookie_lifetime periods since start_time
+    */
+    std::uint64_t makeCookie(
+        const endpoint_type& client,
+        std::uint64_t epoch
+    ) const;
+
+    /** Answer a cookie packet of a client that is not known yet.
+    * A zero cookie is answered with a fresh one, a valid cookie makes the
+    * client known.
+    * @return true if the client is known now
+    */
+    bool handleCookie(const byte_traits::byte_t* packet,
+        const endpoint_type& sender);
+
+    /** Schedule the next check for silent clients */
+    void startExpiryTimer();
+
+    /** Forget the clients that were silent for too long */
+    void expiryTimerHandler(const boost::system::error_code& error);
+};
+
+} // namespace server
+} // namespace nuke_ms
+
+#endif // ifndef DATAGRAMPEERS_HPP
@@ -18,20 +18,234 @@
 */
 
 #include <iostream>
+#include <fstream>
+#include <cstdio>
+#include <random>
 #include <boost/asio.hpp>
 #include <boost/bind.hpp>
+#include <sys/socket.h>
+#include <sys/stat.h>
+#include <unistd.h>
 
+#include "neartypes.hpp"
 #include "dispatcher.hpp"
 
+#ifdef NUKE_MS_SHM_TRANSPORT
+#include "shmtransport.hpp"
+#endif
+
 using namespace nuke_ms;
 using namespace server;
 using boost::asio::ip::tcp;
 
-DispatchingServer::DispatchingServer()
-    : acceptor(io_service, tcp::endpoint(tcp::v4(), listening_port)),
+/** Let an acceptor listen on a Unix domain socket.
+* A socket file of a server that was not shut down cleanly is in the way and
+* is replaced. Whether that is the case is found out by connecting to it:
+* only if the connection is refused, nobody listens on it any more.
+* Anything else is never deleted.
+*
+* @throws boost::system::system_error with address_in_use if another server
+* still listens on the path, or if the connection failed for another reason.
+*/
+static void listenLocal(
+    boost::asio::local::stream_protocol::acceptor& acceptor,
+    const std::string& path
+)
+{
+    using boost::asio::local::stream_protocol;
+
+    struct stat st;
+    if (::lstat(path.c_str(), &st) == 0 && S_ISSOCK(st.st_mode))
+    {
+        stream_protocol::socket probe{acceptor.get_executor()};
+        boost::system::error_code error;
+        probe.connect(stream_protocol::endpoint(path), error);
+
+        if (error != boost::asio::error::connection_refused)
+            throw boost::system::system_error{
+                boost::asio::error::address_in_use, path};
+
+        ::unlink(path.c_str());
+    }
+
+    acceptor.open();
+    acceptor.bind(stream_protocol::endpoint(path));
+    acceptor.listen();
+}
+
+/** Serialize a message into a packet, so it can be sent like a received one
+*/
+template <typename MessageLayer>
+static SegmentationLayer<SerializedData> makePacket(const MessageLayer& msg)
+{
+    auto bytes = std::make_shared<byte_traits::byte_sequence>(msg.size());
+    msg.fillSerialized(bytes->begin());
+
+    return SegmentationLayer<SerializedData>{
+        SerializedData{bytes, bytes->begin(), bytes->size()}
+    };
+}
+
+DispatchingServer::DispatchingServer(const ServerSettings& settings)
+    : log(std::cout),
+    tracer(settings.trace_file),
+    messages_distributed(metrics.counter("messages_distributed")),
+    messages_delivered(metrics.counter("messages_delivered")),
+    relayed_in(metrics.counter("relayed_in")),
+    relayed_out(metrics.counter("relayed_out")),
+    relay_duplicates(metrics.counter("relay_duplicates")),
+    connections_accepted(metrics.counter("connections_accepted")),
+    metrics_file(settings.metrics_file), last_accepted(0),
+    acceptor(io_service),
+    local_path(settings.local_path), local_acceptor(io_service),
+    shm_path(settings.shm_path), shm_acceptor(io_service),
+    handoff_path(settings.handoff_path), handoff_acceptor(io_service),
+    handing_off(false),
+    stop_signals(io_service, SIGINT, SIGTERM),
+    federated(false), full_mesh(false), last_relay_id(0),
+    relay_filter(relay_filter_capacity),
+    relayed_unicast(metrics.counter("relayed_unicast")),
+    next_sequence(0),
+    metrics_timer(io_service),
     current_conn_id(0)
 {
+    stop_signals.async_wait(
+        boost::bind(
+            &DispatchingServer::stopHandler,
+            this,
+            boost::asio::placeholders::error,
+            boost::asio::placeholders::signal_number
+        )
+    );
+
+#ifdef NUKE_MS_SOCKET_HANDOFF
+    std::vector<HandoffRecord> records;
+    if (!handoff_path.empty())
+        records = takeOver();
+
+    for (const HandoffRecord& record : records)
+    {
+        if (record.kind == HandoffRecord::KIND_ACCEPTOR)
+            acceptor.assign(tcp::v4(), record.fd);
+        else if (record.kind == HandoffRecord::KIND_LOCAL_ACCEPTOR &&
+            !local_path.empty())
+            local_acceptor.assign(
+                boost::asio::local::stream_protocol(), record.fd
+            );
+        else if (record.kind == HandoffRecord::KIND_LOCAL_ACCEPTOR)
+            ::close(record.fd);
+    }
+#endif
+
+    if (!acceptor.is_open())
+    {
+        tcp::endpoint endpoint(tcp::v4(), settings.port);
+        acceptor.open(endpoint.protocol());
+        acceptor.set_option(tcp::acceptor::reuse_address(true));
+
+        if (settings.reuse_port)
+        {
+#ifdef NUKE_MS_WORKER_PROCESSES
+            acceptor.set_option(
+                boost::asio::detail::socket_option::boolean<
+                    SOL_SOCKET, SO_REUSEPORT
+                >(true)
+            );
+#else
+            log.write(ServerLog::LEVEL_ERROR, "reuse_port_not_supported");
+#endif
+        }
+
+        acceptor.bind(endpoint);
+        acceptor.listen();
+    }
+
     startAccept();
+
+    if (!local_path.empty())
+    {
+        if (!local_acceptor.is_open())
+            listenLocal(local_acceptor, local_path);
+        startLocalAccept(local_acceptor);
+    }
+
+    if (!shm_path.empty())
+    {
+#ifdef NUKE_MS_SHM_TRANSPORT
+        listenLocal(shm_acceptor, shm_path);
+        startLocalAccept(shm_acceptor);
+#else
+        log.write(ServerLog::LEVEL_ERROR, "shm_not_supported", 0, shm_path);
+#endif
+    }
+
+    if (settings.udp_port)
+    {
+#ifdef NUKE_MS_UDP_TRANSPORT
+        datagram_port = settings.udp_port;
+        datagram_peers.reset(new DatagramPeers(
+            io_service,
+            settings.udp_port,
+            boost::bind(&DispatchingServer::datagramHandler, this, _1),
+            log,
+            metrics
+        ));
+#else
+        log.write(ServerLog::LEVEL_ERROR, "udp_not_supported", 0,
+            std::string{}, settings.udp_port);
+#endif
+    }
+
+    if (!handoff_path.empty())
+    {
+#ifdef NUKE_MS_SOCKET_HANDOFF
+        for (const HandoffRecord& record : records)
+            if (record.kind == HandoffRecord::KIND_PEER)
+                adoptPeer(record);
+
+        listenLocal(handoff_acceptor, handoff_path);
+        startHandoffAccept();
+#else
+        log.write(ServerLog::LEVEL_ERROR, "handoff_not_supported", 0,
+            handoff_path);
+#endif
+    }
+
+    if (!metrics_file.empty())
+        startMetricsTimer();
+}
+
+DispatchingServer::~DispatchingServer()
+{
+    // Close the remaining connections and run their handlers, so that none
+    // of the handlers is destroyed with the io_service after its peer.
+    // Links are not connected again.
+    boost::system::error_code dontcare;
+    for (const std::unique_ptr<boost::asio::deadline_timer>& timer :
+        link_timers)
+        timer->cancel(dontcare);
+
+    for (node_links_type::value_type& link : node_links)
+    {
+        link.second.endpoint_index = -1;
+        link.second.peer->shutdownConnection();
+    }
+
+    for (const peers_list_type::value_type& peer : peers_list)
+        peer.second->shutdownConnection();
+
+    io_service.restart();
+    while ((!peers_list.empty() || !node_links.empty()) && io_service.poll())
+    {}
+
+    if (local_acceptor.is_open())
+        ::unlink(local_path.c_str());
+
+    if (shm_acceptor.is_open())
+        ::unlink(shm_path.c_str());
+
+    if (handoff_acceptor.is_open())
+        ::unlink(handoff_path.c_str());
 }
 
 void DispatchingServer::run()
@@ -39,8 +253,48 @@ void DispatchingServer::run()
     io_service.run();
 }
 
+void DispatchingServer::joinBus(std::unique_ptr<FanoutBus> _bus)
+{
+    bus = std::move(_bus);
+    bus->start(boost::bind(&DispatchingServer::busHandler, this, _1));
+}
+
+void DispatchingServer::joinFederation(
+    const UniqueUserID& _node_id,
+    const std::vector<tcp::endpoint>& links,
+    bool _full_mesh
+)
+{
+    federated = true;
+    full_mesh = _full_mesh;
+    node_id = _node_id;
+    link_endpoints = links;
+
+    // the other servers still remember the identifiers of a server that
+    // was restarted, e.g. by a handoff, so they must not be used again
+    std::random_device random;
+    last_relay_id = random();
+
+    ring.addNode(node_id);
+
+    log.write(ServerLog::LEVEL_INFO, "federation_joined", 0,
+        std::to_string(node_id.id), links.size());
+
+    for (std::size_t i = 0; i < link_endpoints.size(); ++i)
+    {
+        link_timers.emplace_back(new boost::asio::deadline_timer(io_service));
+        startLinkConnect(i);
+    }
+}
+
 void DispatchingServer::handleServerEvent(const BasicServerEvent& evt)
 {
+    if (node_links.count(evt.connection_id))
+    {
+        handleLinkEvent(evt);
+        return;
+    }
+
     // ignore everything that is not in the list
     if (! peers_list.count(evt.connection_id) )
         return;
@@ -52,10 +306,23 @@ void DispatchingServer::handleServerEvent(const BasicServerEvent& evt)
             const ReceivedMessageEvent& rcvd_msg_evt =
                 static_cast<const ReceivedMessageEvent&>(evt);
 
-            std::cout<<"Received a message from "<<rcvd_msg_evt.connection_id<<
-                std::endl;
+            log.write(ServerLog::LEVEL_DEBUG, "message_received",
+                rcvd_msg_evt.connection_id);
 
-            distributeMessage(rcvd_msg_evt.connection_id, rcvd_msg_evt.parm);
+            const SerializedData& data = rcvd_msg_evt.parm->_inner_layer;
+
+            // resume requests are for us, everything else is distributed
+            if (data.size() > 0 && *data.begin() == NearResumeRequest::LAYER_ID)
+                resumeStream(rcvd_msg_evt.connection_id, data);
+            else if (data.size() > 0 && *data.begin() == NodeHello::LAYER_ID)
+                adoptLink(rcvd_msg_evt.connection_id, data);
+            else
+            {
+                if (federated)
+                    learnUser(rcvd_msg_evt.connection_id, data);
+
+                distributeMessage(rcvd_msg_evt.connection_id, rcvd_msg_evt.parm);
+            }
 
             break;
         }
@@ -66,10 +333,12 @@ void DispatchingServer::handleServerEvent(const BasicServerEvent& evt)
             const ConnectionErrorEvent& error_evt =
                 static_cast<const ConnectionErrorEvent&>(evt);
 
-            std::cout<<"An error with the connection("<<
-                error_evt.connection_id<<") occured: "<<
-                byte_traits::native_string(error_evt.parm.begin(), error_evt.parm.end())<<
-                ". Closing this connection."<<std::endl;
+            log.write(ServerLog::LEVEL_WARNING, "connection_error",
+                error_evt.connection_id,
+                byte_traits::native_string(
+                    error_evt.parm.begin(), error_evt.parm.end()
+                )
+            );
 
             peers_list[error_evt.connection_id]->shutdownConnection();
 
@@ -78,8 +347,21 @@ void DispatchingServer::handleServerEvent(const BasicServerEvent& evt)
 
         case BasicServerEvent::ID_CAN_DELETE:
         {
-            // delete the peer object if it existed
+#ifdef NUKE_MS_SOCKET_HANDOFF
+            if (handoff_peers.count(evt.connection_id))
+                peerHandedOff(evt.connection_id);
+#endif
+
+            // keep the statistics, then delete the peer object
+            closed_connections += peers_list[evt.connection_id]->metrics();
             peers_list.erase(evt.connection_id);
+            history_starts.erase(evt.connection_id);
+            forgetUser(evt.connection_id);
+
+#ifdef NUKE_MS_SOCKET_HANDOFF
+            if (handing_off)
+                continueHandoff();
+#endif
             break;
         }
 
@@ -87,7 +369,8 @@ void DispatchingServer::handleServerEvent(const BasicServerEvent& evt)
         {
 //             bool unknown_server_event = false;
 //             assert(unknown_server_event);
-            std::cout<<"Unknown server event\n";
+            log.write(ServerLog::LEVEL_ERROR, "unknown_event",
+                evt.connection_id, std::string{}, evt.event_kind);
             break;
         }
     }
@@ -116,58 +399,1029 @@ void DispatchingServer::acceptHandler(
     socket_ptr peer_socket
 )
 {
+    // the acceptor belongs to the successor now, and so does the client
+    if (handing_off)
+    {
+#ifdef NUKE_MS_SOCKET_HANDOFF
+        if (!e)
+            handoff_records.push_back(HandoffRecord{
+                HandoffRecord::KIND_PEER, peer_socket->release(), {}, {}
+            });
+#endif
+        return;
+    }
+
     if (e)
     {
-        std::cout<<"Accepting new clients failed due to an error: "<<
-            e.message()<<'\n';
+        log.write(ServerLog::LEVEL_ERROR, "accept_failed", 0, e.message());
 
         io_service.stop();
     }
     else
     {
-        std::cout<<"New client connected!\n";
+        addPeer(Transport{std::move(*peer_socket)});
 
-        RemotePeer::connection_id_t connection_id = getNextConnectionId();
+        startAccept();
+    }
 
-        // create new peer object
-        RemotePeer::ptr_t remote_peer(
-            new RemotePeer(
-                peer_socket,
-                connection_id,
-                boost::bind(
-                    &DispatchingServer::handleServerEvent,
-                    this,
-                    _1
-                )
-            )
-        );
+}
 
-        // put peer object into the map
-        peers_list[connection_id] = remote_peer;
+void DispatchingServer::startLocalAccept(
+    boost::asio::local::stream_protocol::acceptor& acceptor
+)
+{
+    local_socket_ptr socket(
+        new boost::asio::local::stream_protocol::socket(io_service)
+    );
 
-        startAccept();
+    acceptor.async_accept(
+        *socket,
+        boost::bind(
+            &DispatchingServer::localAcceptHandler,
+            this,
+            boost::asio::placeholders::error,
+            socket,
+            &acceptor
+        )
+    );
+}
+
+void DispatchingServer::localAcceptHandler(
+    const boost::system::error_code& e,
+    local_socket_ptr peer_socket,
+    boost::asio::local::stream_protocol::acceptor* acceptor
+)
+{
+    // clients over shared memory have to connect to the successor again
+    if (handing_off)
+    {
+#ifdef NUKE_MS_SOCKET_HANDOFF
+        if (!e && acceptor == &local_acceptor)
+            handoff_records.push_back(HandoffRecord{
+                HandoffRecord::KIND_PEER, peer_socket->release(), {}, {}
+            });
+#endif
+        return;
+    }
+
+    if (e)
+    {
+        // TCP connections are still accepted
+        log.write(ServerLog::LEVEL_ERROR, "local_accept_failed", 0,
+            e.message());
+        return;
+    }
+
+#ifdef NUKE_MS_SHM_TRANSPORT
+    if (acceptor == &shm_acceptor)
+    {
+        boost::system::error_code error;
+        std::unique_ptr<TransportImpl> shm =
+            ShmTransport::createServerSide(std::move(*peer_socket), error);
+
+        if (shm)
+            addPeer(Transport{io_service, std::move(shm)});
+        else
+            log.write(ServerLog::LEVEL_WARNING, "shm_setup_failed", 0,
+                error.message());
     }
+    else
+#endif
+        addPeer(Transport{std::move(*peer_socket)});
 
+    startLocalAccept(*acceptor);
 }
 
+void DispatchingServer::addPeer(
+    Transport&& transport,
+    const RemotePeer::PendingBytes& pending
+)
+{
+    RemotePeer::connection_id_t connection_id = getNextConnectionId();
+
+    connections_accepted.add();
 
-void DispatchingServer::distributeMessage(
-    RemotePeer::connection_id_t originating_id,
-    std::shared_ptr<SegmentationLayer<SerializedData>> data
+    // everything distributed from now on is sent to the client anyway
+    history_starts[connection_id] = next_sequence;
+
+    log.write(ServerLog::LEVEL_INFO, "client_connected", connection_id);
+
+    // create new peer object
+    RemotePeer::ptr_t remote_peer(
+        new RemotePeer(
+            std::move(transport),
+            connection_id,
+            boost::bind(
+                &DispatchingServer::handleServerEvent,
+                this,
+                _1
+            ),
+            metrics,
+            tracer,
+            pending
+        )
+    );
+
+    // put peer object into the map
+    peers_list[connection_id] = remote_peer;
+}
+
+
+#ifdef NUKE_MS_SOCKET_HANDOFF
+
+std::vector<HandoffRecord> DispatchingServer::takeOver()
+{
+    boost::asio::local::stream_protocol::socket predecessor(io_service);
+
+    boost::system::error_code error;
+    predecessor.connect(
+        boost::asio::local::stream_protocol::endpoint(handoff_path), error
+    );
+
+    // nobody there to take over from
+    if (error)
+        return std::vector<HandoffRecord>{};
+
+    std::vector<HandoffRecord> records =
+        receiveHandoff(predecessor.native_handle());
+
+    log.write(ServerLog::LEVEL_INFO, "handoff_received", 0, handoff_path,
+        records.size());
+
+    return records;
+}
+
+void DispatchingServer::adoptPeer(const HandoffRecord& record)
+{
+    RemotePeer::PendingBytes pending{record.inbound, record.outbound};
+
+    sockaddr_storage address;
+    socklen_t address_length = sizeof(address);
+    if (::getsockname(record.fd,
+        reinterpret_cast<sockaddr*>(&address), &address_length) < 0)
+    {
+        ::close(record.fd);
+        return;
+    }
+
+    if (address.ss_family == AF_UNIX)
+        addPeer(
+            Transport{boost::asio::local::stream_protocol::socket(
+                io_service, boost::asio::local::stream_protocol(), record.fd
+            )},
+            pending
+        );
+    else
+        addPeer(
+            Transport{tcp::socket(
+                io_service,
+                address.ss_family == AF_INET6 ? tcp::v6() : tcp::v4(),
+                record.fd
+            )},
+            pending
+        );
+}
+
+void DispatchingServer::startHandoffAccept()
+{
+    successor.reset(new boost::asio::local::stream_protocol::socket(io_service));
+
+    handoff_acceptor.async_accept(
+        *successor,
+        boost::bind(
+            &DispatchingServer::handoffAcceptHandler,
+            this,
+            boost::asio::placeholders::error
+        )
+    );
+}
+
+void DispatchingServer::handoffAcceptHandler(
+    const boost::system::error_code& e
 )
 {
-    peers_list_type::iterator it = peers_list.begin();
+    if (e)
+    {
+        if (e != boost::asio::error::operation_aborted)
+            log.write(ServerLog::LEVEL_ERROR, "handoff_accept_failed", 0,
+                e.message());
+        return;
+    }
 
-    for(; it != peers_list.end(); ++it )
+    boost::asio::async_read(
+        *successor,
+        boost::asio::buffer(successor_hello),
+        boost::bind(
+            &DispatchingServer::handoffHelloHandler,
+            this,
+            boost::asio::placeholders::error
+        )
+    );
+}
+
+void DispatchingServer::handoffHelloHandler(
+    const boost::system::error_code& e
+)
+{
+    // e.g. a successor of another version, the server keeps running
+    if (e || !checkHandoffHello(successor_hello))
     {
-        it->second->sendMessage(*data);
+        log.write(ServerLog::LEVEL_WARNING, "handoff_refused");
+
+        startHandoffAccept();
+        return;
     }
+
+    startHandoff();
 }
 
-RemotePeer::connection_id_t DispatchingServer::getNextConnectionId()
+void DispatchingServer::startHandoff()
 {
-    return ++current_conn_id;
+    log.write(ServerLog::LEVEL_INFO, "handoff_started", 0, std::string{},
+        peers_list.size());
+
+    handing_off = true;
+
+    boost::system::error_code error;
+
+    // the successor listens for its own successor on the same path
+    handoff_acceptor.close(error);
+
+    int fd = acceptor.release(error);
+    if (!error)
+        handoff_records.push_back(
+            HandoffRecord{HandoffRecord::KIND_ACCEPTOR, fd, {}, {}}
+        );
+
+    if (local_acceptor.is_open())
+    {
+        fd = local_acceptor.release(error);
+        if (!error)
+            handoff_records.push_back(
+                HandoffRecord{HandoffRecord::KIND_LOCAL_ACCEPTOR, fd, {}, {}}
+            );
+    }
+
+    // the successor sets these up again
+    shm_acceptor.close(error);
+#ifdef NUKE_MS_UDP_TRANSPORT
+    if (datagram_peers)
+        datagram_peers->close();
+#endif
+
+    for (const peers_list_type::value_type& peer : peers_list)
+    {
+        fd = peer.second->release(error);
+
+        if (!error)
+            handoff_peers[peer.first] = fd;
+        else
+            peer.second->shutdownConnection();
+    }
+
+    // the other servers link to the successor again
+    for (const node_links_type::value_type& link : node_links)
+        link.second.peer->shutdownConnection();
+
+    for (const std::unique_ptr<boost::asio::deadline_timer>& timer :
+        link_timers)
+        timer->cancel(error);
+
+    // after connections accepted just before the acceptors were released
+    io_service.post(boost::bind(&DispatchingServer::continueHandoff, this));
+}
+
+void DispatchingServer::peerHandedOff(RemotePeer::connection_id_t connection_id)
+{
+    RemotePeer::PendingBytes pending =
+        peers_list[connection_id]->pendingBytes();
+
+    handoff_records.push_back(HandoffRecord{
+        HandoffRecord::KIND_PEER,
+        handoff_peers[connection_id],
+        std::move(pending.inbound),
+        std::move(pending.outbound)
+    });
+
+    handoff_peers.erase(connection_id);
+}
+
+void DispatchingServer::continueHandoff()
+{
+    // the handlers of the peers may still add bytes in flight, and after a
+    // failed handoff the server just keeps running
+    if (!handing_off || !handoff_peers.empty())
+        return;
+
+    if (successor)
+    {
+        try {
+            successor->native_non_blocking(false);
+            sendHandoff(successor->native_handle(), handoff_records);
+
+            log.write(ServerLog::LEVEL_INFO, "handoff_finished", 0,
+                handoff_path, handoff_records.size());
+        }
+        catch (const boost::system::system_error& e)
+        {
+            log.write(ServerLog::LEVEL_ERROR, "handoff_failed", 0, e.what());
+
+            successor.reset();
+            abortHandoff();
+            return;
+        }
+
+        successor.reset();
+
+        // the successor has its own copies of the sockets now
+        for (const HandoffRecord& record : handoff_records)
+            ::close(record.fd);
+        handoff_records.clear();
+    }
+
+    // handlers of closed connections must not outlive their peers
+    if (peers_list.empty() && node_links.empty())
+        io_service.stop();
+}
+
+void DispatchingServer::abortHandoff()
+{
+    handing_off = false;
+
+    for (const HandoffRecord& record : handoff_records)
+    {
+        switch (record.kind)
+        {
+            case HandoffRecord::KIND_ACCEPTOR:
+                acceptor.assign(tcp::v4(), record.fd);
+                startAccept();
+                break;
+
+            case HandoffRecord::KIND_LOCAL_ACCEPTOR:
+                local_acceptor.assign(
+                    boost::asio::local::stream_protocol(), record.fd
+                );
+                startLocalAccept(local_acceptor);
+                break;
+
+            default:
+                adoptPeer(record);
+                break;
+        }
+    }
+
+    log.write(ServerLog::LEVEL_WARNING, "handoff_aborted", 0, std::string{},
+        handoff_records.size());
+    handoff_records.clear();
+
+    if (!shm_path.empty())
+    {
+#ifdef NUKE_MS_SHM_TRANSPORT
+        listenLocal(shm_acceptor, shm_path);
+        startLocalAccept(shm_acceptor);
+#endif
+    }
+
+#ifdef NUKE_MS_UDP_TRANSPORT
+    // the handlers of the closed socket have returned long ago
+    if (datagram_peers)
+        datagram_peers.reset(new DatagramPeers(
+            io_service,
+            datagram_port,
+            boost::bind(&DispatchingServer::datagramHandler, this, _1),
+            log,
+            metrics
+        ));
+#endif
+
+    // links that are still going down are connected again when they are
+    // gone, the others right now
+    for (std::size_t i = 0; i < link_endpoints.size(); ++i)
+    {
+        bool linked = false;
+        for (const node_links_type::value_type& link : node_links)
+            linked = linked || link.second.endpoint_index == int(i);
+
+        if (!linked)
+            startLinkConnect(i);
+    }
+
+    listenLocal(handoff_acceptor, handoff_path);
+    startHandoffAccept();
+}
+
+#endif // ifdef NUKE_MS_SOCKET_HANDOFF
+
+void DispatchingServer::startLinkConnect(int endpoint_index)
+{
+    socket_ptr socket(new tcp::socket(io_service));
+
+    socket->async_connect(
+        link_endpoints[endpoint_index],
+        boost::bind(
+            &DispatchingServer::linkConnectHandler,
+            this,
+            boost::asio::placeholders::error,
+            socket,
+            endpoint_index
+        )
+    );
 }
 
+void DispatchingServer::linkConnectHandler(
+    const boost::system::error_code& e,
+    socket_ptr link_socket,
+    int endpoint_index
+)
+{
+    if (handing_off)
+        return;
 
+    if (!e)
+    {
+        addLink(Transport{std::move(*link_socket)}, endpoint_index);
+        return;
+    }
 
+    log.write(ServerLog::LEVEL_WARNING, "link_connect_failed", 0,
+        e.message(), endpoint_index);
+
+    scheduleLinkConnect(endpoint_index);
+}
+
+void DispatchingServer::scheduleLinkConnect(int endpoint_index)
+{
+    boost::asio::deadline_timer& timer = *link_timers[endpoint_index];
+    timer.expires_from_now(boost::posix_time::seconds(link_retry_interval));
+    timer.async_wait(
+        boost::bind(
+            &DispatchingServer::linkTimerHandler,
+            this,
+            boost::asio::placeholders::error,
+            endpoint_index
+        )
+    );
+}
+
+void DispatchingServer::linkTimerHandler(
+    const boost::system::error_code& e,
+    int endpoint_index
+)
+{
+    if (!e && !handing_off)
+        startLinkConnect(endpoint_index);
+}
+
+void DispatchingServer::addLink(Transport&& transport, int endpoint_index)
+{
+    RemotePeer::connection_id_t connection_id = getNextConnectionId();
+
+    RemotePeer::ptr_t remote_peer(
+        new RemotePeer(
+            std::move(transport),
+            connection_id,
+            boost::bind(
+                &DispatchingServer::handleServerEvent,
+                this,
+                _1
+            ),
+            metrics,
+            tracer
+        )
+    );
+
+    node_links[connection_id] =
+        NodeLink{remote_peer, UniqueUserID::user_id_none, endpoint_index};
+    metrics.gauge("node_links").set(node_links.size());
+
+    remote_peer->sendMessage(makePacket(NodeHello{node_id}));
+}
+
+void DispatchingServer::adoptLink(
+    RemotePeer::connection_id_t connection_id,
+    const SerializedData& hello
+)
+{
+    if (!federated)
+    {
+        log.write(ServerLog::LEVEL_WARNING, "not_federated", connection_id);
+        peers_list[connection_id]->shutdownConnection();
+        return;
+    }
+
+    RemotePeer::ptr_t remote_peer = peers_list[connection_id];
+    peers_list.erase(connection_id);
+    forgetUser(connection_id);
+
+    node_links[connection_id] =
+        NodeLink{remote_peer, UniqueUserID::user_id_none, -1};
+    metrics.gauge("node_links").set(node_links.size());
+
+    // answer with the own greeting
+    remote_peer->sendMessage(makePacket(NodeHello{node_id}));
+
+    linkGreeted(connection_id, hello);
+}
+
+void DispatchingServer::linkGreeted(
+    RemotePeer::connection_id_t connection_id,
+    const SerializedData& hello
+)
+{
+    NodeLink& link = node_links[connection_id];
+
+    try {
+        link.node_id = NodeHello{hello}._node_id;
+    }
+    catch (const MsgLayerError& e)
+    {
+        log.write(ServerLog::LEVEL_WARNING, "invalid_link_packet",
+            connection_id, e.what());
+        return;
+    }
+
+    // a server listed among its own links
+    if (link.node_id == node_id)
+    {
+        log.write(ServerLog::LEVEL_WARNING, "link_to_self", connection_id);
+        link.endpoint_index = -1;
+        link.peer->shutdownConnection();
+        return;
+    }
+
+    log.write(ServerLog::LEVEL_INFO, "node_linked", connection_id,
+        std::to_string(link.node_id.id));
+
+    updateRing(link.node_id);
+}
+
+void DispatchingServer::handleLinkEvent(const BasicServerEvent& evt)
+{
+    NodeLink& link = node_links[evt.connection_id];
+
+    switch (evt.event_kind)
+    {
+        case BasicServerEvent::ID_MSG_RECEIVED:
+        {
+            const ReceivedMessageEvent& rcvd_msg_evt =
+                static_cast<const ReceivedMessageEvent&>(evt);
+            const SerializedData& data = rcvd_msg_evt.parm->_inner_layer;
+
+            if (data.size() > 0 && *data.begin() == RelayedMessage::LAYER_ID)
+                receiveRelayed(evt.connection_id, rcvd_msg_evt.parm);
+            else
+                linkGreeted(evt.connection_id, data);
+
+            break;
+        }
+
+        case BasicServerEvent::ID_CONNECTION_ERROR:
+        {
+            const ConnectionErrorEvent& error_evt =
+                static_cast<const ConnectionErrorEvent&>(evt);
+
+            log.write(ServerLog::LEVEL_WARNING, "link_error",
+                error_evt.connection_id,
+                byte_traits::native_string(
+                    error_evt.parm.begin(), error_evt.parm.end()
+                )
+            );
+
+            link.peer->shutdownConnection();
+            break;
+        }
+
+        case BasicServerEvent::ID_CAN_DELETE:
+        {
+            int endpoint_index = link.endpoint_index;
+            UniqueUserID linked_node = link.node_id;
+
+            node_links.erase(evt.connection_id);
+            metrics.gauge("node_links").set(node_links.size());
+
+            if (!(linked_node == UniqueUserID::user_id_none))
+                updateRing(linked_node);
+
+            // links this server connected are connected again, unless the
+            // successor does that
+            if (endpoint_index >= 0 && !handing_off)
+                scheduleLinkConnect(endpoint_index);
+
+#ifdef NUKE_MS_SOCKET_HANDOFF
+            if (handing_off)
+                continueHandoff();
+#endif
+            break;
+        }
+
+        default:
+            log.write(ServerLog::LEVEL_ERROR, "unknown_event",
+                evt.connection_id, std::string{}, evt.event_kind);
+            break;
+    }
+}
+
+void DispatchingServer::receiveRelayed(
+    RemotePeer::connection_id_t link_id,
+    std::shared_ptr<SegmentationLayer<SerializedData>> packet
+)
+{
+    std::unique_ptr<RelayedMessage> relayed;
+    try {
+        relayed.reset(new RelayedMessage{packet->_inner_layer});
+    }
+    catch (const MsgLayerError& e)
+    {
+        log.write(ServerLog::LEVEL_WARNING, "invalid_link_packet", link_id,
+            e.what());
+        return;
+    }
+
+    // every server passes a message on only the first time it arrives
+    if (relayed->_origin == node_id ||
+        !relay_filter.insert(relayed->_origin, relayed->_relay_id))
+    {
+        relay_duplicates.add();
+        return;
+    }
+
+    relayed_in.add();
+
+    routeRelayed(*packet, relayed->_inner_layer, link_id);
+
+    auto data = std::make_shared<SegmentationLayer<SerializedData>>(
+        std::move(relayed->_inner_layer)
+    );
+
+    if (bus)
+        bus->publish(*data);
+
+    deliverMessage(std::move(data));
+}
+
+void DispatchingServer::relayNewMessage(
+    const SegmentationLayer<SerializedData>& data
+)
+{
+    if (node_links.empty())
+        return;
+
+    if (data.size() + RelayedMessage::header_length > max_relayed_packetsize)
+    {
+        metrics.counter("relay_too_large").add();
+        return;
+    }
+
+    const SerializedData& inner = data._inner_layer;
+    RelayedMessage relayed{
+        node_id,
+        ++last_relay_id,
+        SerializedData{inner.getOwnership(), inner.begin(), inner.size()}
+    };
+
+    routeRelayed(makePacket(relayed), inner, 0);
+}
+
+void DispatchingServer::routeRelayed(
+    const SegmentationLayer<SerializedData>& packet,
+    const SerializedData& inner,
+    RemotePeer::connection_id_t from_link
+)
+{
+    RemotePeer::connection_id_t home_link = 0;
+    route_t route = routeMessage(inner, home_link);
+
+    if (route == ROUTE_NONE)
+        return;
+
+    // the home server already sent it everywhere if it came from there
+    if (route == ROUTE_LINK && home_link != from_link)
+    {
+        node_links[home_link].peer->sendMessage(packet);
+        relayed_out.add();
+        relayed_unicast.add();
+        return;
+    }
+
+    relayMessage(packet, from_link);
+}
+
+void DispatchingServer::relayMessage(
+    const SegmentationLayer<SerializedData>& packet,
+    RemotePeer::connection_id_t except_link
+)
+{
+    for (const node_links_type::value_type& link : node_links)
+    {
+        if (link.first == except_link)
+            continue;
+
+        link.second.peer->sendMessage(packet);
+        relayed_out.add();
+    }
+}
+
+void DispatchingServer::learnUser(
+    RemotePeer::connection_id_t connection_id,
+    const SerializedData& data
+)
+{
+    // only the sender is needed, the message itself is not parsed
+    if (data.size() < NearUserMessage::header_length ||
+        *data.begin() != NearUserMessage::LAYER_ID)
+        return;
+
+    UniqueUserID sender{
+        data.begin() + 1 + sizeof(NearUserMessage::msg_id_t) +
+            UniqueUserID::id_length
+    };
+
+    auto known = peer_users.insert({connection_id, sender});
+    if (!known.second)
+    {
+        if (known.first->second == sender)
+            return;
+
+        forgetUser(connection_id);
+        peer_users[connection_id] = sender;
+    }
+
+    ++local_users[sender.id];
+}
+
+void DispatchingServer::forgetUser(RemotePeer::connection_id_t connection_id)
+{
+    auto known = peer_users.find(connection_id);
+    if (known == peer_users.end())
+        return;
+
+    auto local = local_users.find(known->second.id);
+    if (!--local->second)
+        local_users.erase(local);
+
+    peer_users.erase(known);
+}
+
+void DispatchingServer::updateRing(const UniqueUserID& linked_node)
+{
+    if (linked_node == node_id)
+        return;
+
+    // two servers may be connected by more than one link
+    bool linked = false;
+    for (const node_links_type::value_type& link : node_links)
+        linked |= link.second.node_id == linked_node;
+
+    if (linked == ring.contains(linked_node))
+        return;
+
+    if (linked)
+        ring.addNode(linked_node);
+    else
+        ring.removeNode(linked_node);
+
+    log.write(ServerLog::LEVEL_INFO, "ring_changed", 0,
+        std::to_string(linked_node.id), ring.size());
+}
+
+DispatchingServer::route_t DispatchingServer::routeMessage(
+    const SerializedData& inner,
+    RemotePeer::connection_id_t& link
+) const
+{
+    // messages for everybody go everywhere
+    if (inner.size() < NearUserMessage::header_length ||
+        *inner.begin() != NearUserMessage::LAYER_ID)
+        return ROUTE_ALL;
+
+    UniqueUserID recipient{inner.begin() + 1 + sizeof(NearUserMessage::msg_id_t)};
+    if (recipient == UniqueUserID::user_id_none)
+        return ROUTE_ALL;
+
+    if (local_users.count(recipient.id))
+        return ROUTE_NONE;
+
+    // the ring lacks the servers that are not linked with this one, so
+    // their users would be routed to the wrong server
+    if (!full_mesh)
+        return ROUTE_ALL;
+
+    // a user that is not at its home may be connected anywhere
+    UniqueUserID home = ring.nodeFor(recipient);
+    if (home == node_id)
+        return ROUTE_ALL;
+
+    for (const node_links_type::value_type& candidate : node_links)
+    {
+        if (candidate.second.node_id == home)
+        {
+            link = candidate.first;
+            return ROUTE_LINK;
+        }
+    }
+
+    return ROUTE_ALL;
+}
+
+void DispatchingServer::busHandler(
+    std::shared_ptr<SegmentationLayer<SerializedData>> data
+)
+{
+    // only the worker with the links relays, the others have none
+    relayNewMessage(*data);
+
+    deliverMessage(std::move(data));
+}
+
+void DispatchingServer::datagramHandler(
+    std::shared_ptr<SegmentationLayer<SerializedData>> data
+)
+{
+    log.write(ServerLog::LEVEL_DEBUG, "datagram_received");
+
+    // without a stream, there is nothing to resume
+    const SerializedData& inner = data->_inner_layer;
+    if (*inner.begin() == NearResumeRequest::LAYER_ID)
+        return;
+
+    distributeMessage(0, data);
+}
+
+void DispatchingServer::distributeMessage(
+    RemotePeer::connection_id_t originating_id,
+    std::shared_ptr<SegmentationLayer<SerializedData>> data
+)
+{
+    if (bus)
+        bus->publish(*data);
+
+    relayNewMessage(*data);
+
+    deliverMessage(std::move(data));
+}
+
+void DispatchingServer::deliverMessage(
+    std::shared_ptr<SegmentationLayer<SerializedData>> data
+)
+{
+    peers_list_type::iterator it = peers_list.begin();
+
+    for(; it != peers_list.end(); ++it )
+    {
+        it->second->sendMessage(*data);
+    }
+
+#ifdef NUKE_MS_UDP_TRANSPORT
+    if (datagram_peers)
+        datagram_peers->sendMessage(*data);
+#endif
+
+    messages_distributed.add();
+    messages_delivered.add(peers_list.size());
+
+    // remember the message for clients that will resume later, with the
+    // fields a resume request compares
+    HistoryEntry entry{next_sequence++, false, 0, UniqueUserID{}, data};
+
+    const SerializedData& inner = data->_inner_layer;
+    if (inner.size() >= NearUserMessage::header_length &&
+        *inner.begin() == NearUserMessage::LAYER_ID)
+    {
+        entry.user_message = true;
+        readbytes(&entry.msg_id, inner.begin() + 1);
+        entry.msg_id = to_hostbo(entry.msg_id);
+        entry.sender = UniqueUserID{
+            inner.begin() + 1 + sizeof(NearUserMessage::msg_id_t) +
+                UniqueUserID::id_length
+        };
+    }
+
+    history.push_back(std::move(entry));
+    if (history.size() > history_length)
+        history.pop_front();
+}
+
+void DispatchingServer::resumeStream(
+    RemotePeer::connection_id_t connection_id,
+    const SerializedData& request
+)
+{
+    NearResumeRequest resume_request;
+    try {
+        resume_request = NearResumeRequest{request};
+    }
+    catch (const MsgLayerError& e)
+    {
+        metrics.counter("invalid_resume_requests").add();
+        log.write(ServerLog::LEVEL_WARNING, "invalid_resume_request",
+            connection_id, e.what());
+        return;
+    }
+
+    // search backwards for the last message the client has seen
+    history_type::iterator resume_it = history.end();
+    bool found = false;
+    while (!found && resume_it != history.begin())
+    {
+        --resume_it;
+
+        found = resume_it->user_message &&
+            resume_it->msg_id == resume_request._last_msg_id &&
+            resume_it->sender == resume_request._last_sender;
+    }
+
+    // the client missed messages the history does not have anymore
+    if (!found)
+    {
+        metrics.counter("resume_gaps").add();
+        log.write(ServerLog::LEVEL_WARNING, "resume_gap", connection_id);
+        return;
+    }
+
+    // the client got the messages after it connected without resuming
+    std::uint64_t start = history_starts[connection_id];
+
+    std::size_t replayed = 0;
+    RemotePeer::ptr_t& peer = peers_list[connection_id];
+    for (++resume_it; resume_it != history.end() && resume_it->sequence < start;
+        ++resume_it, ++replayed)
+        peer->sendMessage(*resume_it->data);
+
+    log.write(ServerLog::LEVEL_INFO, "stream_resumed", connection_id,
+        std::string{}, replayed);
+}
+
+RemotePeer::connection_id_t DispatchingServer::getNextConnectionId()
+{
+    return ++current_conn_id;
+}
+
+
+
+
+void DispatchingServer::startMetricsTimer()
+{
+    metrics_timer.expires_from_now(boost::posix_time::seconds(metrics_interval));
+    metrics_timer.async_wait(
+        boost::bind(
+            &DispatchingServer::metricsTimerHandler,
+            this,
+            boost::asio::placeholders::error
+        )
+    );
+}
+
+void DispatchingServer::metricsTimerHandler(const boost::system::error_code& e)
+{
+    if (e)
+        return;
+
+    // write to a temporary file first, so readers never see half a file
+    std::string tmp_file = metrics_file + ".tmp";
+    {
+        std::ofstream out(tmp_file.c_str());
+        writeMetrics(out);
+    }
+
+    if (std::rename(tmp_file.c_str(), metrics_file.c_str()))
+        log.write(ServerLog::LEVEL_WARNING, "metrics_write_failed", 0,
+            metrics_file);
+
+    startMetricsTimer();
+}
+
+void DispatchingServer::writeMetrics(std::ostream& out)
+{
+    std::uint64_t accepted = connections_accepted.value();
+    metrics.gauge("accept_rate").set((accepted - last_accepted) / metrics_interval);
+    metrics.gauge("connections").set(peers_list.size());
+    last_accepted = accepted;
+
+    metrics.write(out);
+
+    ConnectionMetrics totals = closed_connections;
+    for (const peers_list_type::value_type& peer : peers_list)
+        totals += peer.second->metrics();
+    totals.write(out, "total_");
+
+    for (const peers_list_type::value_type& peer : peers_list)
+    {
+        peer.second->metrics().write(
+            out, "peer_", "{conn=\"" + std::to_string(peer.first) + "\"}"
+        );
+    }
+}
+
+void DispatchingServer::stopHandler(
+    const boost::system::error_code& e,
+    int signal_number
+)
+{
+    if (e)
+        return;
+
+    log.write(ServerLog::LEVEL_INFO, "stopping", 0, std::string{},
+        signal_number);
+
+    io_service.stop();
+}
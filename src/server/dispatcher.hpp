@@ -21,17 +21,88 @@
 #ifndef DISPATCHER_HPP
 #define DISPATCHER_HPP
 
+#include <cstdint>
 #include <map>
+#include <deque>
+#include <string>
+#include <vector>
+#include <ostream>
 #include <boost/asio.hpp>
 #include <boost/shared_ptr.hpp>
 
 #include "remotepeer.hpp"
+#include "serverlog.hpp"
+#include "metrics.hpp"
+#include "tracing.hpp"
+#include "fanoutbus.hpp"
+#include "relayfilter.hpp"
+#include "hashring.hpp"
+
+#ifdef NUKE_MS_UDP_TRANSPORT
+#include "datagrampeers.hpp"
+#endif
+
+#ifdef NUKE_MS_SOCKET_HANDOFF
+#include "handoff.hpp"
+#endif
 
 namespace nuke_ms
 {
 namespace server
 {
 
+/** Settings of a DispatchingServer.
+* The defaults give a server that only accepts TCP connections on port 34443.
+*/
+struct ServerSettings
+{
+    /** The statistics of the server are written to this file periodically.
+    * If empty, no file is written. */
+    std::string metrics_file;
+
+    /** If not empty, the stages of every message are traced and written to
+    * this file in the Chrome trace event format. */
+    std::string trace_file;
+
+    /** If not empty, the server also accepts connections on a Unix domain
+    * socket with this path. A stale socket file left behind by a previous
+    * server is replaced, but if a server still listens on the path, a
+    * boost::system::system_error with address_in_use is thrown. */
+    std::string local_path;
+
+    /** If not empty, the server accepts connections over shared memory, set
+    * up through a Unix domain socket with this path. Only supported if
+    * NUKE_MS_SHM_TRANSPORT is defined. */
+    std::string shm_path;
+
+    /** If not zero, the server also exchanges packets as UDP datagrams on
+    * this port, see DatagramPeers. Only supported if NUKE_MS_UDP_TRANSPORT
+    * is defined. */
+    unsigned short udp_port = 0;
+
+    /** If true, the TCP port is bound with SO_REUSEPORT, so several worker
+    * processes can accept on it and the kernel spreads the connections
+    * among them. Only supported if NUKE_MS_WORKER_PROCESSES is defined. */
+    bool reuse_port = false;
+
+    /** TCP port to accept clients and other servers on, 0 to let the system
+    * choose one */
+    unsigned short port = listening_port;
+
+    /** If not empty, the sockets of the server listening on the Unix domain
+    * socket with this path are taken over, so its clients keep their
+    * connections. The server then listens on the path itself: when a
+    * successor connects, it hands over its acceptors and client
+    * connections, including the bytes in flight on them, and stops.
+    * Connections over shared memory and UDP and links to other servers are
+    * not handed over; they are set up again by the successor. Only
+    * supported if NUKE_MS_SOCKET_HANDOFF is defined. */
+    std::string handoff_path;
+
+    /** The port clients expect the server on */
+    constexpr static unsigned short listening_port = 34443;
+};
+
 /** Main server class.
 *
 * This class represents the main class of the server.
@@ -43,7 +114,18 @@ class DispatchingServer
 
 public:
 
-    DispatchingServer();
+    /** Constructor.
+    * @param settings Where the server accepts connections, and what it
+    * records
+    * @throws boost::system::system_error if the server can not listen
+    */
+    explicit DispatchingServer(
+        const ServerSettings& settings = ServerSettings{}
+    );
+
+    /** Destructor. Closes the connections and removes the Unix domain
+    * socket files. */
+    ~DispatchingServer();
 
     /** Start the server.
     * This function makes the server begin his work. It will block until the
@@ -54,18 +136,265 @@ public:
 
     void handleServerEvent(const BasicServerEvent& evt);
 
+    /** Get the io_service running the server, e.g. to set up a bus. */
+    boost::asio::io_service& getIOService()
+    { return io_service; }
+
+    /** Get the log of the server */
+    ServerLog& getLog()
+    { return log; }
+
+    /** Get the statistics of the server */
+    MetricsRegistry& getMetrics()
+    { return metrics; }
+
+    /** Get the address the server accepts clients and other servers on,
+    * e.g. to find the port chosen by the system if it was 0 */
+    boost::asio::ip::tcp::endpoint localEndpoint() const
+    { return acceptor.local_endpoint(); }
+
+    /** Exchange the distributed messages with other worker processes.
+    * Every message received from a client is also published on the bus,
+    * and every message received from the bus is handed to the clients.
+    * Call this before run().
+    */
+    void joinBus(std::unique_ptr<FanoutBus> _bus);
+
+    /** Relay messages to and from other servers.
+    * The servers form a mesh: every message received from a client is
+    * relayed over all links, and every server passes a message on over its
+    * other links the first time it sees it. Other servers may connect to
+    * this one as well; they greet with a NodeHello. Call this before run().
+    *
+    * In a full mesh, a message for a single user is not relayed over all
+    * links, but only to the home server of the user, which is found by
+    * consistent hashing over this server and the servers it is linked
+    * with. Users connected to another server than their home, e.g. after a
+    * server was added, keep their connection; messages for them go over all
+    * links again. In other meshes the servers know only a part of the ring,
+    * so every message goes over all links.
+    *
+    * @param _node_id Identifier of this server, unique in the federation
+    * @param links Servers to connect to. Lost links are connected again.
+    * @param _full_mesh Whether every server of the federation is linked with
+    * every other one
+    */
+    void joinFederation(
+        const UniqueUserID& _node_id,
+        const std::vector<boost::asio::ip::tcp::endpoint>& links,
+        bool _full_mesh = false
+    );
+
 private:
     typedef boost::shared_ptr<boost::asio::ip::tcp::socket> socket_ptr;
+    typedef boost::shared_ptr<boost::asio::local::stream_protocol::socket>
+        local_socket_ptr;
     typedef std::map<RemotePeer::connection_id_t, RemotePeer::ptr_t>
         peers_list_type;
 
+    /** A message in the history, with what a resume request names it by */
+    struct HistoryEntry
+    {
+        /** Number of the message, counting all distributed messages */
+        std::uint64_t sequence;
+
+        /** Whether the message is a NearUserMessage; if not, it has no
+        * identifier and sender */
+        bool user_message;
+
+        NearUserMessage::msg_id_t msg_id;
+        UniqueUserID sender;
+
+        std::shared_ptr<SegmentationLayer<SerializedData>> data;
+    };
+
+    typedef std::deque<HistoryEntry> history_type;
+
+    /** A link to another server of the federation */
+    struct NodeLink
+    {
+        RemotePeer::ptr_t peer;
+
+        /** The other server, user_id_none until its greeting arrived */
+        UniqueUserID node_id;
+
+        /** Index into link_endpoints if this server connected the link,
+        * -1 if the other server did */
+        int endpoint_index;
+    };
+
+    typedef std::map<RemotePeer::connection_id_t, NodeLink> node_links_type;
+
+    /** Where a relayed message goes next */
+    enum route_t
+    {
+        ROUTE_ALL, /**< Over all links */
+        ROUTE_LINK, /**< Over the link to the home server of the recipient */
+        ROUTE_NONE /**< Nowhere, the recipient is connected to this server */
+    };
+
+    /** Log for all server events. Constructed first, so it outlives all
+    * handlers. */
+    ServerLog log;
+
+    /** Statistics of the server. Connections keep references to it, so it
+    * has to outlive them. */
+    MetricsRegistry metrics;
+
+    /** Recorder for the stages of every message, if tracing is enabled */
+    TraceRecorder tracer;
+
+    /** Messages received for distribution */
+    Counter& messages_distributed;
+
+    /** Copies of messages handed to the peers */
+    Counter& messages_delivered;
+
+    /** Messages received from other servers for the first time */
+    Counter& relayed_in;
+
+    /** Copies of messages sent to other servers */
+    Counter& relayed_out;
+
+    /** Messages received from other servers that were seen before */
+    Counter& relay_duplicates;
+
+    /** Connections accepted from clients and other servers */
+    Counter& connections_accepted;
+
+    /** Statistics of the connections that are already closed */
+    ConnectionMetrics closed_connections;
+
+    /** Where the statistics are written to */
+    std::string metrics_file;
+
+    /** Number of accepted connections when metrics were last written */
+    std::uint64_t last_accepted;
+
     boost::asio::io_service io_service;
     boost::asio::ip::tcp::acceptor acceptor;
 
+    /** Path of the Unix domain socket, empty if there is none */
+    std::string local_path;
+
+    /** Acceptor for the Unix domain socket, closed if there is none */
+    boost::asio::local::stream_protocol::acceptor local_acceptor;
+
+    /** Path of the socket for shared memory connections, empty if none */
+    std::string shm_path;
+
+    /** Acceptor for shared memory connections, closed if there is none */
+    boost::asio::local::stream_protocol::acceptor shm_acceptor;
+
+#ifdef NUKE_MS_UDP_TRANSPORT
+    /** Clients using UDP datagrams, empty if UDP is not used */
+    std::unique_ptr<DatagramPeers> datagram_peers;
+
+    /** Port of datagram_peers, to open it again after a failed handoff */
+    unsigned short datagram_port;
+#endif
+
+    /** Path of the socket a successor connects to, empty if there is none */
+    std::string handoff_path;
+
+    /** Acceptor for a successor, closed if there is none */
+    boost::asio::local::stream_protocol::acceptor handoff_acceptor;
+
+    /** True while the sockets are handed to a successor */
+    bool handing_off;
+
+#ifdef NUKE_MS_SOCKET_HANDOFF
+    /** The successor, during a handoff */
+    local_socket_ptr successor;
+
+    /** Greeting of the successor */
+    byte_traits::byte_t successor_hello[handoff_hello_length];
+
+    /** The sockets for the successor */
+    std::vector<HandoffRecord> handoff_records;
+
+    /** Released client sockets, until the handlers of their peers returned */
+    std::map<RemotePeer::connection_id_t, int> handoff_peers;
+#endif
+
+    /** Connection to the other worker processes, if any */
+    std::unique_ptr<FanoutBus> bus;
+
+    /** Stops the server on SIGINT and SIGTERM */
+    boost::asio::signal_set stop_signals;
+
     /** A list with connected peers. */
     peers_list_type peers_list;
 
-    constexpr static unsigned short listening_port = 34443;
+    /** True after joinFederation() */
+    bool federated;
+
+    /** True if every server of the federation is linked with every other
+    * one, so messages for single users can go to their home server only */
+    bool full_mesh;
+
+    /** Identifier of this server in the federation */
+    UniqueUserID node_id;
+
+    /** Identifier of the last message this server relayed first */
+    RelayedMessage::relay_id_t last_relay_id;
+
+    /** The servers this server connects to */
+    std::vector<boost::asio::ip::tcp::endpoint> link_endpoints;
+
+    /** Timers for connecting each of link_endpoints again */
+    std::vector<std::unique_ptr<boost::asio::deadline_timer>> link_timers;
+
+    /** The links to other servers */
+    node_links_type node_links;
+
+    /** Messages relayed recently, to drop further copies */
+    RelayFilter relay_filter;
+
+    /** This server and the servers it is linked with, for finding the home
+    * servers of users */
+    HashRing ring;
+
+    /** The user of each client, known from the messages the client sent */
+    std::map<RemotePeer::connection_id_t, UniqueUserID> peer_users;
+
+    /** Number of clients of each user connected to this server */
+    std::map<unsigned long long, unsigned> local_users;
+
+    /** Messages for a single user relayed only to its home server */
+    Counter& relayed_unicast;
+
+    /** The most recently distributed messages, oldest first.
+    * Used to resume the message stream of reconnecting clients.
+    */
+    history_type history;
+
+    /** Sequence number of the next distributed message */
+    std::uint64_t next_sequence;
+
+    /** Sequence number of the first message each client got as it was
+    * distributed. Older messages are the ones a resume request replays. */
+    std::map<RemotePeer::connection_id_t, std::uint64_t> history_starts;
+
+    /** Timer for writing the metrics file */
+    boost::asio::deadline_timer metrics_timer;
+
+    /** Maximum number of messages kept in the history */
+    constexpr static std::size_t history_length = 1024;
+
+    /** Seconds between two updates of the metrics file */
+    constexpr static unsigned metrics_interval = 5;
+
+    /** Seconds before a lost link is connected again */
+    constexpr static unsigned link_retry_interval = 2;
+
+    /** Number of relayed messages remembered to drop copies */
+    constexpr static std::size_t relay_filter_capacity = 0x10000;
+
+    /** Largest packet a RemotePeer accepts, so larger messages are not
+    * relayed */
+    constexpr static std::size_t max_relayed_packetsize =
+        SegmentationLayerBase::max_packetsize;
 
     RemotePeer::connection_id_t current_conn_id;
 
@@ -82,13 +411,198 @@ private:
         socket_ptr peer_socket
     );
 
+    /** Dispatch an asynchronous accept request on a Unix domain socket.
+    * @param acceptor Either local_acceptor or shm_acceptor
+    */
+    void startLocalAccept(
+        boost::asio::local::stream_protocol::acceptor& acceptor
+    );
+
+    /** Callback function for completed accept requests on a Unix domain
+    * socket. Connections accepted by shm_acceptor are switched over to
+    * shared memory. */
+    void localAcceptHandler(
+        const boost::system::error_code& e,
+        local_socket_ptr peer_socket,
+        boost::asio::local::stream_protocol::acceptor* acceptor
+    );
+
+    /** Create a peer object for a newly accepted connection.
+    * @param pending Bytes in flight, if the connection was handed over
+    */
+    void addPeer(
+        Transport&& transport,
+        const RemotePeer::PendingBytes& pending = RemotePeer::PendingBytes{}
+    );
+
+#ifdef NUKE_MS_SOCKET_HANDOFF
+    /** Take the sockets of the server listening on handoff_path.
+    * @return The sockets, none if no server is listening
+    * @throws boost::system::system_error if the handoff fails
+    */
+    std::vector<HandoffRecord> takeOver();
+
+    /** Create a peer object for a connection taken over. */
+    void adoptPeer(const HandoffRecord& record);
+
+    /** Wait for a successor on handoff_acceptor */
+    void startHandoffAccept();
+
+    void handoffAcceptHandler(const boost::system::error_code& e);
+
+    /** Check the greeting of the successor and start the handoff. */
+    void handoffHelloHandler(const boost::system::error_code& e);
+
+    /** Release all sockets. Client connections are handed over when the
+    * handlers of their peers returned. */
+    void startHandoff();
+
+    /** Collect a released client connection. */
+    void peerHandedOff(RemotePeer::connection_id_t connection_id);
+
+    /** Send the sockets to the successor when all client connections are
+    * collected, and stop the server when all peers are gone. */
+    void continueHandoff();
+
+    /** Take back the sockets after the handoff failed, and set up again
+    * what was closed for the successor. */
+    void abortHandoff();
+#endif
+
+    /** Connect to one of link_endpoints */
+    void startLinkConnect(int endpoint_index);
+
+    void linkConnectHandler(
+        const boost::system::error_code& e,
+        socket_ptr link_socket,
+        int endpoint_index
+    );
+
+    /** Connect to one of link_endpoints after link_retry_interval */
+    void scheduleLinkConnect(int endpoint_index);
+
+    void linkTimerHandler(
+        const boost::system::error_code& e,
+        int endpoint_index
+    );
+
+    /** Create a link for a connection to another server and greet it. */
+    void addLink(Transport&& transport, int endpoint_index);
+
+    /** Turn a client that greeted with a NodeHello into a link. */
+    void adoptLink(
+        RemotePeer::connection_id_t connection_id,
+        const SerializedData& hello
+    );
+
+    /** Take note of the greeting of the server at the other end of a link.
+    * Links of a server to itself are closed for good. */
+    void linkGreeted(
+        RemotePeer::connection_id_t connection_id,
+        const SerializedData& hello
+    );
+
+    /** Handle the events of a link. */
+    void handleLinkEvent(const BasicServerEvent& evt);
+
+    /** Handle a message relayed by another server. */
+    void receiveRelayed(
+        RemotePeer::connection_id_t link_id,
+        std::shared_ptr<SegmentationLayer<SerializedData>> packet
+    );
+
+    /** Remember the user of a client, from a message it sent. */
+    void learnUser(
+        RemotePeer::connection_id_t connection_id,
+        const SerializedData& data
+    );
+
+    /** Forget the user of a client that is gone. */
+    void forgetUser(RemotePeer::connection_id_t connection_id);
+
+    /** Update the ring after a link was greeted or lost. */
+    void updateRing(const UniqueUserID& linked_node);
+
+    /** Decide where a relayed message goes next.
+    * @param inner The message as received from the client
+    * @param link Set to the link to the home server for ROUTE_LINK
+    */
+    route_t routeMessage(
+        const SerializedData& inner,
+        RemotePeer::connection_id_t& link
+    ) const;
+
+    /** Relay a message received by this server to the links. */
+    void relayNewMessage(const SegmentationLayer<SerializedData>& data);
+
+    /** Send a RelayedMessage packet on its route.
+    * @param packet The packet
+    * @param inner The message as received from the client
+    * @param from_link The link the message came from, or 0
+    */
+    void routeRelayed(
+        const SegmentationLayer<SerializedData>& packet,
+        const SerializedData& inner,
+        RemotePeer::connection_id_t from_link
+    );
+
+    /** Send a RelayedMessage packet over all links but one.
+    * @param packet The packet
+    * @param except_link The link the message came from, or 0
+    */
+    void relayMessage(
+        const SegmentationLayer<SerializedData>& packet,
+        RemotePeer::connection_id_t except_link
+    );
+
+    /** Handle a message published by another worker process. */
+    void busHandler(
+        std::shared_ptr<SegmentationLayer<SerializedData>> data
+    );
+
+    /** Distribute a packet received as a UDP datagram. */
+    void datagramHandler(
+        std::shared_ptr<SegmentationLayer<SerializedData>> data
+    );
+
+    /** Distribute a message received from a client to all clients,
+    * including those of the other worker processes and other servers. */
     void distributeMessage(
         RemotePeer::connection_id_t originating_id,
         std::shared_ptr<SegmentationLayer<SerializedData>> data
     );
 
+    /** Hand a message to the clients of this process and remember it. */
+    void deliverMessage(
+        std::shared_ptr<SegmentationLayer<SerializedData>> data
+    );
+
+    /** Replay the history to a reconnected client.
+    * The messages that were distributed after the one named in the request
+    * and before the client connected are sent to the client again. If that
+    * message is not in the history anymore, nothing is sent: the client
+    * missed more messages than the server remembers.
+    */
+    void resumeStream(
+        RemotePeer::connection_id_t connection_id,
+        const SerializedData& request
+    );
+
     RemotePeer::connection_id_t getNextConnectionId();
 
+    /** Schedule the next update of the metrics file. */
+    void startMetricsTimer();
+
+    /** Write the metrics file and schedule the next update. */
+    void metricsTimerHandler(const boost::system::error_code& e);
+
+    /** Stop the server, so that all pending logs and traces are written. */
+    void stopHandler(const boost::system::error_code& e, int signal_number);
+
+    /** Write the server statistics, the totals over all connections and the
+    * statistics of each connection. */
+    void writeMetrics(std::ostream& out);
+
 };
 
 } // namespace server
@@ -0,0 +1,235 @@
+// fanoutbus.cpp
+
+/*
+ *   nuke-ms - Nuclear Messaging System
+ *   Copyright (C) 2012  Alexander Korsunsky
+ *
+ *   This program is free software: you can redistribute it and/or modify
+ *   it under the terms of the GNU General Public License as published by
+ *   the Free Software Foundation, version 3 of the License.
+ *
+ *   This program is distributed in the hope that it will be useful,
+ *   but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *   MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ *   GNU General Public License for more details.
+ *
+ *   You should have received a copy of the GNU General Public License
+ *   along with this program.  If not, see <http://www.gnu.org/licenses/>.
+*/
+
+#include <deque>
+
+#include <boost/asio.hpp>
+#include <boost/bind.hpp>
+
+#include "fanoutbus.hpp"
+
+using namespace nuke_ms;
+using namespace server;
+
+
+struct TransportFanoutBus::Link
+{
+    explicit Link(Transport&& _transport)
+        : transport(std::move(_transport)), open(true)
+    {}
+
+    Transport transport;
+
+    /** A static buffer for the header */
+    byte_traits::byte_t header_buffer[SegmentationLayerBase::header_length];
+
+    /** Packets to write, the first one is being written. Only one write is
+    * pending at a time, so the packets are never interleaved on the link. */
+    std::deque<std::shared_ptr<byte_traits::byte_sequence>> write_queue;
+
+    /** False after the link failed */
+    bool open;
+};
+
+
+TransportFanoutBus::TransportFanoutBus(
+    std::vector<Transport>&& _links,
+    ServerLog& _log,
+    MetricsRegistry& registry
+)
+    : log(_log),
+    bus_messages_in(registry.counter("bus_messages_in")),
+    bus_messages_out(registry.counter("bus_messages_out")),
+    bus_links(registry.gauge("bus_links"))
+{
+    for (Transport& transport : _links)
+        links.emplace_back(new Link{std::move(transport)});
+
+    bus_links.set(links.size());
+}
+
+TransportFanoutBus::~TransportFanoutBus()
+{
+    boost::system::error_code dontcare;
+
+    for (const std::unique_ptr<Link>& link : links)
+        link->transport.close(dontcare);
+}
+
+void TransportFanoutBus::start(receive_callback_t callback)
+{
+    receive_callback = std::move(callback);
+
+    for (const std::unique_ptr<Link>& link : links)
+        startReceive(*link);
+}
+
+void TransportFanoutBus::publish(const SegmentationLayer<SerializedData>& msg)
+{
+    // the same bytes go to every link
+    std::shared_ptr<byte_traits::byte_sequence> data;
+
+    for (const std::unique_ptr<Link>& link : links)
+    {
+        if (!link->open)
+            continue;
+
+        if (!data)
+        {
+            data = std::make_shared<byte_traits::byte_sequence>(msg.size());
+            msg.fillSerialized(data->begin());
+        }
+
+        link->write_queue.push_back(data);
+
+        // otherwise the handler of the pending write starts it
+        if (link->write_queue.size() == 1)
+            startWrite(*link);
+
+        bus_messages_out.add();
+    }
+}
+
+void TransportFanoutBus::startWrite(Link& link)
+{
+    boost::asio::async_write(
+        link.transport,
+        boost::asio::buffer(*link.write_queue.front()),
+        boost::bind(
+            &TransportFanoutBus::sendHandler,
+            this,
+            boost::ref(link),
+            boost::asio::placeholders::error
+        )
+    );
+}
+
+void TransportFanoutBus::startReceive(Link& link)
+{
+    async_read(
+        link.transport,
+        boost::asio::buffer(
+            link.header_buffer, SegmentationLayerBase::header_length
+        ),
+        boost::bind(
+            &TransportFanoutBus::rcvHeaderHandler,
+            this,
+            boost::ref(link),
+            boost::asio::placeholders::error
+        )
+    );
+}
+
+void TransportFanoutBus::rcvHeaderHandler(
+    Link& link,
+    const boost::system::error_code& error
+)
+{
+    if (error)
+    {
+        failLink(link, error);
+        return;
+    }
+
+    SegmentationLayerBase::HeaderType header;
+    try {
+        header = SegmentationLayerBase::decodeHeader(link.header_buffer);
+    }
+    catch (const InvalidHeaderError&)
+    {
+        failLink(link, boost::asio::error::invalid_argument);
+        return;
+    }
+
+    auto body_data = std::make_shared<byte_traits::byte_sequence>(
+        header.packetsize - SegmentationLayerBase::header_length
+    );
+
+    async_read(
+        link.transport,
+        boost::asio::buffer(*body_data),
+        boost::bind(
+            &TransportFanoutBus::rcvBodyHandler,
+            this,
+            boost::ref(link),
+            boost::asio::placeholders::error,
+            body_data
+        )
+    );
+}
+
+void TransportFanoutBus::rcvBodyHandler(
+    Link& link,
+    const boost::system::error_code& error,
+    std::shared_ptr<byte_traits::byte_sequence> body_data
+)
+{
+    if (error)
+    {
+        failLink(link, error);
+        return;
+    }
+
+    bus_messages_in.add();
+
+    receive_callback(std::make_shared<SegmentationLayer<SerializedData>>(
+        SerializedData{body_data, body_data->begin(), body_data->size()}
+    ));
+
+    startReceive(link);
+}
+
+void TransportFanoutBus::sendHandler(
+    Link& link,
+    const boost::system::error_code& error
+)
+{
+    if (error)
+    {
+        link.write_queue.clear();
+        failLink(link, error);
+        return;
+    }
+
+    link.write_queue.pop_front();
+    if (!link.write_queue.empty())
+        startWrite(link);
+}
+
+void TransportFanoutBus::failLink(
+    Link& link,
+    const boost::system::error_code& reason
+)
+{
+    if (!link.open)
+        return;
+
+    // a worker that stops closes its links
+    if (reason == boost::asio::error::eof)
+        log.write(ServerLog::LEVEL_INFO, "bus_link_closed");
+    else
+        log.write(ServerLog::LEVEL_ERROR, "bus_link_failed", 0,
+            reason.message());
+
+    boost::system::error_code dontcare;
+    link.transport.close(dontcare);
+    link.open = false;
+
+    bus_links.sub();
+}
@@ -0,0 +1,135 @@
+// fanoutbus.hpp
+
+/*
+ *   nuke-ms - Nuclear Messaging System
+ *   Copyright (C) 2012  Alexander Korsunsky
+ *
+ *   This program is free software: you can redistribute it and/or modify
+ *   it under the terms of the GNU General Public License as published by
+ *   the Free Software Foundation, version 3 of the License.
+ *
+ *   This program is distributed in the hope that it will be useful,
+ *   but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *   MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ *   GNU General Public License for more details.
+ *
+ *   You should have received a copy of the GNU General Public License
+ *   along with this program.  If not, see <http://www.gnu.org/licenses/>.
+*/
+
+#ifndef FANOUTBUS_HPP
+#define FANOUTBUS_HPP
+
+#include <functional>
+#include <memory>
+#include <vector>
+
+#include "msglayer.hpp"
+#include "metrics.hpp"
+#include "transport.hpp"
+#include "serverlog.hpp"
+
+namespace nuke_ms
+{
+namespace server
+{
+
+/** Carries distributed messages between the worker processes of a server.
+*
+* Every worker accepts its own clients. A message received by one worker is
+* published on the bus, and every other worker hands it to its clients.
+* Messages received from the bus are never published again.
+*
+* Derive from this class to carry the messages in a different way.
+*/
+class FanoutBus
+{
+public:
+    /** Called for every message published by another worker */
+    typedef std::function<
+        void (std::shared_ptr<SegmentationLayer<SerializedData>>)
+    > receive_callback_t;
+
+    virtual ~FanoutBus()
+    {}
+
+    /** Start receiving the messages of the other workers.
+    * @param callback Called for every message, by the io_service of the bus
+    */
+    virtual void start(receive_callback_t callback) = 0;
+
+    /** Hand a message to all other workers. */
+    virtual void publish(const SegmentationLayer<SerializedData>& msg) = 0;
+};
+
+
+/** FanoutBus with one Transport to every other worker.
+*
+* The packets are framed like on a client connection. Any Transport will
+* do; the server uses pairs of connected Unix domain sockets, or shared
+* memory set up over them. A message is serialized once and the same bytes
+* are queued for every link; each link has one write pending at a time. A
+* link that fails is closed, the other links keep working.
+*/
+class TransportFanoutBus : public FanoutBus
+{
+public:
+    /** Constructor.
+    * @param links Connections to the other workers
+    * @param _log Log for errors
+    * @param registry Registry for the statistics
+    */
+    TransportFanoutBus(
+        std::vector<Transport>&& links,
+        ServerLog& _log,
+        MetricsRegistry& registry
+    );
+
+    ~TransportFanoutBus();
+
+    void start(receive_callback_t callback);
+
+    void publish(const SegmentationLayer<SerializedData>& msg);
+
+private:
+    struct Link;
+
+    /** The connections to the other workers */
+    std::vector<std::unique_ptr<Link>> links;
+
+    receive_callback_t receive_callback;
+
+    ServerLog& log;
+
+    /** Messages received from other workers */
+    Counter& bus_messages_in;
+
+    /** Messages published, once per link */
+    Counter& bus_messages_out;
+
+    /** Links that are still working */
+    Gauge& bus_links;
+
+    void startReceive(Link& link);
+
+    void rcvHeaderHandler(Link& link, const boost::system::error_code& error);
+
+    void rcvBodyHandler(
+        Link& link,
+        const boost::system::error_code& error,
+        std::shared_ptr<byte_traits::byte_sequence> body_data
+    );
+
+    /** Start writing the first packet in the write queue of a link. */
+    void startWrite(Link& link);
+
+    void sendHandler(Link& link, const boost::system::error_code& error);
+
+    /** Log the error and close the link, if it is still open */
+    void failLink(Link& link, const boost::system::error_code& reason);
+};
+
+} // namespace server
+} // namespace nuke_ms
+
+#endif // ifndef FANOUTBUS_HPP
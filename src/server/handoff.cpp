@@ -0,0 +1,305 @@
+// handoff.cpp
+
+/*
+ *   nuke-ms - Nuclear Messaging System
+ *   Copyright (C) 2012  Alexander Korsunsky
+ *
+ *   This program is free software: you can redistribute it and/or modify
+ *   it under the terms of the GNU General Public License as published by
+ *   the Free Software Foundation, version 3 of the License.
+ *
+ *   This program is distributed in the hope that it will be useful,
+ *   but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *   MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ *   GNU General Public License for more details.
+ *
+ *   You should have received a copy of the GNU General Public License
+ *   along with this program.  If not, see <http://www.gnu.org/licenses/>.
+*/
+
+#include <cerrno>
+#include <cstring>
+
+#include <boost/asio/error.hpp>
+#include <boost/system/system_error.hpp>
+
+#include <sys/socket.h>
+#include <unistd.h>
+
+#include "handoff.hpp"
+
+using namespace nuke_ms;
+using namespace server;
+
+
+namespace
+{
+
+/** Length of the head of a record: kind, length of inbound and outbound */
+const std::size_t record_head_length = 9;
+
+boost::system::system_error lastError(const char* what)
+{
+    return boost::system::system_error{
+        boost::system::error_code{
+            errno, boost::asio::error::get_system_category()
+        },
+        what
+    };
+}
+
+boost::system::system_error protocolError()
+{
+    return boost::system::system_error{
+        boost::system::errc::make_error_code(
+            boost::system::errc::protocol_error
+        ),
+        "handoff"
+    };
+}
+
+void sendAll(int socket, const byte_traits::byte_t* data, std::size_t size)
+{
+    while (size)
+    {
+        ssize_t sent = ::send(socket, data, size, MSG_NOSIGNAL);
+        if (sent < 0)
+        {
+            if (errno == EINTR)
+                continue;
+            throw lastError("handoff send");
+        }
+
+        data += sent;
+        size -= sent;
+    }
+}
+
+void receiveAll(int socket, byte_traits::byte_t* data, std::size_t size)
+{
+    while (size)
+    {
+        ssize_t received = ::recv(socket, data, size, 0);
+        if (received < 0)
+        {
+            if (errno == EINTR)
+                continue;
+            throw lastError("handoff receive");
+        }
+
+        if (received == 0)
+            throw boost::system::system_error{
+                boost::asio::error::eof, "handoff receive"
+            };
+
+        data += received;
+        size -= received;
+    }
+}
+
+/** Send the head of a record, with the socket if there is one */
+void sendHead(int socket, const HandoffRecord& record)
+{
+    byte_traits::byte_t head[record_head_length];
+    byte_traits::byte_t* it = head;
+
+    *it++ = static_cast<byte_traits::byte_t>(record.kind);
+    it = writebytes(it, to_netbo(
+        static_cast<byte_traits::uint4b_t>(record.inbound.size())
+    ));
+    writebytes(it, to_netbo(
+        static_cast<byte_traits::uint4b_t>(record.outbound.size())
+    ));
+
+    iovec iov{head, sizeof(head)};
+
+    union
+    {
+        char buf[CMSG_SPACE(sizeof(int))];
+        cmsghdr align;
+    } control;
+    std::memset(&control, 0, sizeof(control));
+
+    msghdr msg{};
+    msg.msg_iov = &iov;
+    msg.msg_iovlen = 1;
+
+    if (record.kind != HandoffRecord::KIND_END)
+    {
+        msg.msg_control = control.buf;
+        msg.msg_controllen = sizeof(control.buf);
+
+        cmsghdr* cmsg = CMSG_FIRSTHDR(&msg);
+        cmsg->cmsg_level = SOL_SOCKET;
+        cmsg->cmsg_type = SCM_RIGHTS;
+        cmsg->cmsg_len = CMSG_LEN(sizeof(int));
+        std::memcpy(CMSG_DATA(cmsg), &record.fd, sizeof(int));
+    }
+
+    ssize_t sent;
+    do
+        sent = ::sendmsg(socket, &msg, MSG_NOSIGNAL);
+    while (sent < 0 && errno == EINTR);
+
+    if (sent < 0)
+        throw lastError("handoff send");
+
+    // the head is tiny, the rest of it goes without the socket
+    sendAll(socket, head + sent, sizeof(head) - sent);
+}
+
+/** Receive the head of a record and its socket.
+* The socket arrives with the first byte of the head; the kernel does not
+* merge the head with the bytes of the record before it.
+*/
+HandoffRecord receiveHead(
+    int socket,
+    byte_traits::uint4b_t& inbound_size,
+    byte_traits::uint4b_t& outbound_size
+)
+{
+    byte_traits::byte_t head[record_head_length];
+    iovec iov{head, sizeof(head)};
+
+    union
+    {
+        char buf[CMSG_SPACE(sizeof(int))];
+        cmsghdr align;
+    } control;
+
+    msghdr msg{};
+    msg.msg_iov = &iov;
+    msg.msg_iovlen = 1;
+    msg.msg_control = control.buf;
+    msg.msg_controllen = sizeof(control.buf);
+
+    ssize_t received;
+    do
+        received = ::recvmsg(socket, &msg, MSG_CMSG_CLOEXEC);
+    while (received < 0 && errno == EINTR);
+
+    if (received < 0)
+        throw lastError("handoff receive");
+
+    HandoffRecord record{HandoffRecord::KIND_END, -1, {}, {}};
+
+    for (cmsghdr* cmsg = CMSG_FIRSTHDR(&msg); cmsg;
+        cmsg = CMSG_NXTHDR(&msg, cmsg))
+    {
+        if (cmsg->cmsg_level != SOL_SOCKET || cmsg->cmsg_type != SCM_RIGHTS)
+            continue;
+
+        int n = (cmsg->cmsg_len - CMSG_LEN(0)) / sizeof(int);
+        for (int i = 0; i < n; ++i)
+        {
+            int fd;
+            std::memcpy(&fd, CMSG_DATA(cmsg) + i * sizeof(int), sizeof(int));
+
+            if (record.fd < 0)
+                record.fd = fd;
+            else
+                ::close(fd);
+        }
+    }
+
+    try {
+        if (received == 0)
+            throw boost::system::system_error{
+                boost::asio::error::eof, "handoff receive"
+            };
+
+        receiveAll(socket, head + received, sizeof(head) - received);
+
+        if (head[0] > HandoffRecord::KIND_PEER ||
+            (head[0] != HandoffRecord::KIND_END) != (record.fd >= 0))
+            throw protocolError();
+    }
+    catch (...)
+    {
+        if (record.fd >= 0)
+            ::close(record.fd);
+        throw;
+    }
+
+    record.kind = static_cast<HandoffRecord::kind_t>(head[0]);
+
+    readbytes(&inbound_size, &head[1]);
+    inbound_size = to_hostbo(inbound_size);
+    readbytes(&outbound_size, &head[5]);
+    outbound_size = to_hostbo(outbound_size);
+
+    return record;
+}
+
+} // anonymous namespace
+
+
+bool nuke_ms::server::checkHandoffHello(const byte_traits::byte_t* hello)
+{
+    byte_traits::uint4b_t magic;
+    readbytes(&magic, hello);
+
+    return to_hostbo(magic) == handoff_magic && hello[4] == handoff_version;
+}
+
+void nuke_ms::server::sendHandoff(
+    int socket,
+    const std::vector<HandoffRecord>& records
+)
+{
+    for (const HandoffRecord& record : records)
+    {
+        sendHead(socket, record);
+        sendAll(socket, record.inbound.data(), record.inbound.size());
+        sendAll(socket, record.outbound.data(), record.outbound.size());
+    }
+
+    sendHead(socket, HandoffRecord{HandoffRecord::KIND_END, -1, {}, {}});
+
+    // the records may all fit into the socket buffer, only the
+    // acknowledgement tells that the successor has them
+    byte_traits::byte_t ack;
+    receiveAll(socket, &ack, 1);
+    if (ack != handoff_version)
+        throw protocolError();
+}
+
+std::vector<HandoffRecord> nuke_ms::server::receiveHandoff(int socket)
+{
+    byte_traits::byte_t hello[handoff_hello_length];
+    writebytes(hello, to_netbo(handoff_magic));
+    hello[4] = handoff_version;
+    sendAll(socket, hello, sizeof(hello));
+
+    std::vector<HandoffRecord> records;
+
+    try {
+        while (true)
+        {
+            byte_traits::uint4b_t inbound_size, outbound_size;
+            HandoffRecord record = receiveHead(socket, inbound_size,
+                outbound_size);
+
+            if (record.kind == HandoffRecord::KIND_END)
+                break;
+
+            records.push_back(std::move(record));
+
+            HandoffRecord& last = records.back();
+            last.inbound.resize(inbound_size);
+            receiveAll(socket, last.inbound.data(), inbound_size);
+            last.outbound.resize(outbound_size);
+            receiveAll(socket, last.outbound.data(), outbound_size);
+        }
+
+        sendAll(socket, &handoff_version, 1);
+    }
+    catch (...)
+    {
+        for (const HandoffRecord& record : records)
+            ::close(record.fd);
+        throw;
+    }
+
+    return records;
+}
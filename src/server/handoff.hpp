@@ -0,0 +1,97 @@
+// handoff.hpp
+
+/*
+ *   nuke-ms - Nuclear Messaging System
+ *   Copyright (C) 2012  Alexander Korsunsky
+ *
+ *   This program is free software: you can redistribute it and/or modify
+ *   it under the terms of the GNU General Public License as published by
+ *   the Free Software Foundation, version 3 of the License.
+ *
+ *   This program is distributed in the hope that it will be useful,
+ *   but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *   MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ *   GNU General Public License for more details.
+ *
+ *   You should have received a copy of the GNU General Public License
+ *   along with this program.  If not, see <http://www.gnu.org/licenses/>.
+*/
+
+#ifndef HANDOFF_HPP
+#define HANDOFF_HPP
+
+#include <vector>
+
+#include "bytes.hpp"
+
+namespace nuke_ms
+{
+namespace server
+{
+
+/** A socket handed from a server to its successor, with the bytes that
+* were in flight on it.
+*
+* A server hands its sockets over when a successor connects to its handoff
+* socket. The successor greets with handoff_magic and handoff_version; a
+* server that does not understand the greeting keeps its sockets. The
+* sockets are passed with SCM_RIGHTS, one per record. The successor
+* acknowledges the records with handoff_version; until then the server keeps
+* the sockets.
+*/
+struct HandoffRecord
+{
+    /** What the socket is used for */
+    enum kind_t
+    {
+        KIND_END = 0, /**< No socket, marks the end of the records */
+        KIND_ACCEPTOR = 1, /**< The TCP acceptor */
+        KIND_LOCAL_ACCEPTOR = 2, /**< The acceptor for the Unix domain socket */
+        KIND_PEER = 3 /**< A connection to a client */
+    };
+
+    kind_t kind;
+
+    /** The socket, owned by the record */
+    int fd;
+
+    /** The beginning of the packet being received, header first */
+    byte_traits::byte_sequence inbound;
+
+    /** Bytes that were not written to the socket yet, in order */
+    byte_traits::byte_sequence outbound;
+};
+
+/** Greeting of a successor */
+const byte_traits::uint4b_t handoff_magic = 0x4f484b4e;
+
+/** Version of the records, changed whenever their format changes */
+const byte_traits::byte_t handoff_version = 2;
+
+/** Length of the greeting of a successor */
+const std::size_t handoff_hello_length = 5;
+
+/** Check the greeting of a successor. */
+bool checkHandoffHello(const byte_traits::byte_t* hello);
+
+/** Send records to the successor and wait for its acknowledgement. A record
+* of kind KIND_END is sent after them. The sockets of the records stay open,
+* so the server can keep them if sending fails; close them when it
+* succeeded.
+* @param socket Blocking Unix domain socket connected to the successor
+* @throws boost::system::system_error if sending fails
+*/
+void sendHandoff(int socket, const std::vector<HandoffRecord>& records);
+
+/** Greet a running server and take its sockets.
+* @param socket Blocking Unix domain socket connected to the server
+* @return The records, up to but without the one of kind KIND_END
+* @throws boost::system::system_error if receiving fails or the server
+* closed the connection, e.g. because it did not understand the greeting
+*/
+std::vector<HandoffRecord> receiveHandoff(int socket);
+
+} // namespace server
+} // namespace nuke_ms
+
+#endif // ifndef HANDOFF_HPP
@@ -18,19 +18,413 @@
 */
 
 #include <iostream>
+#include <cstdlib>
+#include <random>
+#include <string>
+#include <vector>
 
 #include "dispatcher.hpp"
 
+#ifdef NUKE_MS_WORKER_PROCESSES
+#include <signal.h>
+#include <sys/socket.h>
+#include <sys/wait.h>
+#include <unistd.h>
+
+#ifdef NUKE_MS_SHM_TRANSPORT
+#include "shmtransport.hpp"
+#endif
+#endif
+
 using boost::asio::ip::tcp;
+using nuke_ms::server::DispatchingServer;
+using nuke_ms::server::ServerSettings;
+
+
+namespace
+{
+
+/** Settings taken from the environment */
+struct Settings
+{
+    /** Settings of the server, or of the first worker */
+    ServerSettings server;
+
+    unsigned workers;
+    bool shm_bus;
+    nuke_ms::UniqueUserID node_id;
+    bool node_id_given;
+    bool full_mesh;
+
+    /** Other servers as "host:port", separated by commas */
+    std::string links;
+};
+
+std::string getenvString(const char* name)
+{
+    const char* value = std::getenv(name);
+    return value ? value : "";
+}
+
+/** Connect a server to the servers in settings.links. Without links and
+* node id, the server does not take part in a federation.
+* @throws boost::system::system_error if a server can not be resolved
+*/
+void joinFederation(DispatchingServer& server, const Settings& settings)
+{
+    if (settings.links.empty() && !settings.node_id_given)
+        return;
+
+    tcp::resolver resolver(server.getIOService());
+    std::vector<tcp::endpoint> endpoints;
+
+    std::string::size_type begin = 0;
+    while (begin < settings.links.size())
+    {
+        std::string::size_type end = settings.links.find(',', begin);
+        if (end == std::string::npos)
+            end = settings.links.size();
+
+        std::string link = settings.links.substr(begin, end - begin);
+        std::string::size_type colon = link.rfind(':');
+        if (colon == std::string::npos)
+            throw boost::system::system_error{
+                boost::asio::error::invalid_argument, link
+            };
+
+        endpoints.push_back(
+            resolver.resolve(link.substr(0, colon), link.substr(colon + 1))
+                .begin()->endpoint()
+        );
+
+        begin = end + 1;
+    }
+
+    server.joinFederation(settings.node_id, endpoints, settings.full_mesh);
+}
+
+#ifdef NUKE_MS_WORKER_PROCESSES
+
+/** Connect the server of a worker to the other workers.
+* @param server The server of the worker
+* @param link_fds One end of a connected pair of Unix domain sockets to
+* every other worker, in the order of the workers
+* @param first_server_side Links from this index on set up the shared memory,
+* the links before it wait for it
+* @param shm_bus Whether to switch the links over to shared memory
+*/
+void joinBus(
+    DispatchingServer& server,
+    const std::vector<int>& link_fds,
+    std::size_t first_server_side,
+    bool shm_bus
+)
+{
+    using boost::asio::local::stream_protocol;
+
+    boost::asio::io_service& io_service = server.getIOService();
+    std::vector<nuke_ms::Transport> links;
+
+    for (std::size_t i = 0; i < link_fds.size(); ++i)
+    {
+        stream_protocol::socket socket(io_service, stream_protocol(),
+            link_fds[i]);
+
+        if (!shm_bus)
+        {
+            links.emplace_back(std::move(socket));
+            continue;
+        }
+
+#ifdef NUKE_MS_SHM_TRANSPORT
+        boost::system::error_code error;
+        std::unique_ptr<nuke_ms::TransportImpl> shm;
+
+        if (i >= first_server_side)
+            shm = nuke_ms::ShmTransport::createServerSide(
+                std::move(socket), error);
+        else
+        {
+            socket.wait(stream_protocol::socket::wait_read);
+            shm = nuke_ms::ShmTransport::createClientSide(
+                std::move(socket), error);
+        }
+
+        if (!shm)
+            throw boost::system::system_error{error, "shared memory bus"};
+
+        links.emplace_back(io_service, std::move(shm));
+#else
+        throw boost::system::system_error{
+            boost::asio::error::operation_not_supported, "shared memory bus"
+        };
+#endif
+    }
+
+    server.joinBus(std::unique_ptr<nuke_ms::server::FanoutBus>{
+        new nuke_ms::server::TransportFanoutBus{
+            std::move(links), server.getLog(), server.getMetrics()
+        }
+    });
+}
+
+/** Run one worker process.
+* Only the first worker accepts on the Unix domain sockets and UDP. The
+* workers do not join a federation, since links accepted by any of them
+* would need the same node identity.
+*/
+int runWorker(
+    const Settings& settings,
+    unsigned index,
+    const std::vector<int>& link_fds
+)
+{
+    std::string suffix = "." + std::to_string(index);
+
+    try {
+        ServerSettings worker_settings = settings.server;
+        if (!worker_settings.metrics_file.empty())
+            worker_settings.metrics_file += suffix;
+        if (!worker_settings.trace_file.empty())
+            worker_settings.trace_file += suffix;
+        if (index != 0)
+        {
+            worker_settings.local_path.clear();
+            worker_settings.shm_path.clear();
+            worker_settings.udp_port = 0;
+        }
+        worker_settings.reuse_port = true;
+        worker_settings.handoff_path.clear();
+
+        DispatchingServer server{worker_settings};
+
+        joinBus(server, link_fds, index, settings.shm_bus);
+
+        server.run();
+    }
+    catch (const std::exception& e)
+    {
+        std::cerr<<"Worker "<<index<<" failed: "<<e.what()<<'\n';
+        return 1;
+    }
+
+    return 0;
+}
+
+/** Start the worker processes and wait until all of them are gone.
+* Every two workers are connected by a pair of Unix domain sockets. SIGINT
+* and SIGTERM are passed on to the workers. A worker that exits or crashes
+* is not replaced; its clients have to reconnect, and the kernel hands their
+* connections to the other workers.
+*/
+int runWorkers(const Settings& settings)
+{
+    unsigned n = settings.workers;
+
+    // links[i][j] is the end of worker i of the link to worker j
+    std::vector<std::vector<int>> links(n, std::vector<int>(n, -1));
+    for (unsigned i = 0; i < n; ++i)
+    {
+        for (unsigned j = i + 1; j < n; ++j)
+        {
+            int fds[2];
+            if (::socketpair(AF_UNIX, SOCK_STREAM | SOCK_CLOEXEC, 0, fds))
+            {
+                std::perror("socketpair");
+                return 1;
+            }
+
+            links[i][j] = fds[0];
+            links[j][i] = fds[1];
+        }
+    }
+
+    // the signals are taken by sigwait() in this process
+    sigset_t signals, old_signals;
+    sigemptyset(&signals);
+    sigaddset(&signals, SIGINT);
+    sigaddset(&signals, SIGTERM);
+    sigaddset(&signals, SIGCHLD);
+    sigprocmask(SIG_BLOCK, &signals, &old_signals);
+
+    std::vector<pid_t> pids(n, -1);
+    for (unsigned i = 0; i < n; ++i)
+    {
+        pids[i] = ::fork();
+
+        if (pids[i] < 0)
+        {
+            std::perror("fork");
+            break;
+        }
+
+        if (pids[i] == 0)
+        {
+            sigprocmask(SIG_SETMASK, &old_signals, nullptr);
+
+            std::vector<int> own_links;
+            for (unsigned j = 0; j < n; ++j)
+            {
+                for (unsigned k = 0; k < n; ++k)
+                {
+                    if (j == i && k != i)
+                        own_links.push_back(links[j][k]);
+                    else if (j != i && links[j][k] >= 0)
+                        ::close(links[j][k]);
+                }
+            }
+
+            std::exit(runWorker(settings, i, own_links));
+        }
+    }
+
+    for (unsigned i = 0; i < n; ++i)
+        for (unsigned j = 0; j < n; ++j)
+            if (links[i][j] >= 0)
+                ::close(links[i][j]);
+
+    unsigned running = 0;
+    for (pid_t pid : pids)
+        running += pid > 0;
+
+    while (running)
+    {
+        int signal_number;
+        if (sigwait(&signals, &signal_number))
+            continue;
+
+        if (signal_number != SIGCHLD)
+        {
+            for (pid_t pid : pids)
+                if (pid > 0)
+                    ::kill(pid, signal_number);
+            continue;
+        }
+
+        int status;
+        pid_t pid;
+        while ((pid = ::waitpid(-1, &status, WNOHANG)) > 0)
+        {
+            for (unsigned i = 0; i < n; ++i)
+            {
+                if (pids[i] != pid)
+                    continue;
+
+                pids[i] = -1;
+                --running;
+
+                if (WIFSIGNALED(status))
+                    std::cerr<<"Worker "<<i<<" was killed by signal "
+                        <<WTERMSIG(status)<<'\n';
+                else if (WEXITSTATUS(status))
+                    std::cerr<<"Worker "<<i<<" exited with status "
+                        <<WEXITSTATUS(status)<<'\n';
+            }
+        }
+    }
+
+    return 0;
+}
+
+#endif // ifdef NUKE_MS_WORKER_PROCESSES
+
+} // anonymous namespace
 
 
 int main()
 {
-    nuke_ms::server::DispatchingServer server;
+    Settings settings;
+
+    // NUKE_MS_SERV_METRICS=<file> writes the statistics to a file
+    settings.server.metrics_file = getenvString("NUKE_MS_SERV_METRICS");
+
+    // NUKE_MS_SERV_TRACE=<file> enables tracing of every message
+    settings.server.trace_file = getenvString("NUKE_MS_SERV_TRACE");
+
+    // NUKE_MS_SERV_SOCKET=<path> accepts local clients on a Unix domain socket
+    settings.server.local_path = getenvString("NUKE_MS_SERV_SOCKET");
+
+    // NUKE_MS_SERV_SHM=<path> accepts local clients over shared memory
+    settings.server.shm_path = getenvString("NUKE_MS_SERV_SHM");
+
+    // NUKE_MS_SERV_UDP=<port> exchanges packets as UDP datagrams on a port
+    settings.server.udp_port = static_cast<unsigned short>(
+        std::atoi(getenvString("NUKE_MS_SERV_UDP").c_str())
+    );
+
+    // NUKE_MS_SERV_WORKERS=<n> runs n worker processes sharing the TCP port
+    int workers = std::atoi(getenvString("NUKE_MS_SERV_WORKERS").c_str());
+    settings.workers = workers > 1 ? workers : 1;
+
+    // NUKE_MS_SERV_BUS=shm connects the workers over shared memory
+    settings.shm_bus = getenvString("NUKE_MS_SERV_BUS") == "shm";
+
+    // NUKE_MS_SERV_PORT=<port> accepts clients and servers on another port
+    int port = std::atoi(getenvString("NUKE_MS_SERV_PORT").c_str());
+    if (port)
+        settings.server.port = static_cast<unsigned short>(port);
+
+    // NUKE_MS_SERV_LINKS=<host:port,...> relays messages to other servers
+    settings.links = getenvString("NUKE_MS_SERV_LINKS");
+
+    // NUKE_MS_SERV_NODE_ID=<n> identifies the server among them, random if
+    // not set. Servers without links need it to accept links.
+    std::string node_id = getenvString("NUKE_MS_SERV_NODE_ID");
+    settings.node_id_given = !node_id.empty();
+    if (settings.node_id_given)
+        settings.node_id = std::strtoull(node_id.c_str(), nullptr, 0);
+    else
+    {
+        std::random_device random;
+        settings.node_id =
+            (static_cast<unsigned long long>(random()) << 32) | random();
+    }
+
+    // NUKE_MS_SERV_FULL_MESH=1 tells that every server is linked with every
+    // other one, and relays messages for single users to their home only
+    settings.full_mesh = getenvString("NUKE_MS_SERV_FULL_MESH") == "1";
+
+    // NUKE_MS_SERV_HANDOFF=<path> takes over the clients of the server
+    // running with the same setting, and hands them to the next one
+    settings.server.handoff_path = getenvString("NUKE_MS_SERV_HANDOFF");
+
+    if (settings.workers > 1)
+    {
+        if (!settings.server.handoff_path.empty())
+            std::cerr<<"Worker processes can not hand over their clients.\n";
+
+#ifdef NUKE_MS_WORKER_PROCESSES
+        // every worker accepts links on the shared port, but only one
+        // server can answer for the node
+        if (!settings.links.empty() || settings.node_id_given)
+        {
+            std::cerr<<"Worker processes can not join a federation.\n";
+            return 1;
+        }
+
+        int status = runWorkers(settings);
+        std::cout<<"The server is terminating.\n";
+        return status;
+#else
+        std::cerr<<"Worker processes are not supported, "
+            "running a single process.\n";
+#endif
+    }
+
+    try {
+        DispatchingServer server{settings.server};
+
+        joinFederation(server, settings);
 
-    server.run();
+        server.run();
+    }
+    catch (const std::exception& e)
+    {
+        std::cerr<<"The server failed: "<<e.what()<<'\n';
+        return 1;
+    }
 
     std::cout<<"The server is terminating.\n";
 
     return 0;
-}
\ No newline at end of file
+}
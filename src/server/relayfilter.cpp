@@ -0,0 +1,44 @@
+// relayfilter.cpp
+
+/*
+ *   nuke-ms - Nuclear Messaging System
+ *   Copyright (C) 2012  Alexander Korsunsky
+ *
+ *   This program is free software: you can redistribute it and/or modify
+ *   it under the terms of the GNU General Public License as published by
+ *   the Free Software Foundation, version 3 of the License.
+ *
+ *   This program is distributed in the hope that it will be useful,
+ *   but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *   MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ *   GNU General Public License for more details.
+ *
+ *   You should have received a copy of the GNU General Public License
+ *   along with this program.  If not, see <http://www.gnu.org/licenses/>.
+*/
+
+#include "relayfilter.hpp"
+
+using namespace nuke_ms;
+using namespace server;
+
+
+bool RelayFilter::insert(
+    const UniqueUserID& origin,
+    RelayedMessage::relay_id_t relay_id
+)
+{
+    key_type key{origin.id, relay_id};
+
+    if (!known.insert(key).second)
+        return false;
+
+    order.push_back(key);
+    if (order.size() > capacity)
+    {
+        known.erase(order.front());
+        order.pop_front();
+    }
+
+    return true;
+}
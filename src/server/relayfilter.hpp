@@ -0,0 +1,72 @@
+// relayfilter.hpp
+
+/*
+ *   nuke-ms - Nuclear Messaging System
+ *   Copyright (C) 2012  Alexander Korsunsky
+ *
+ *   This program is free software: you can redistribute it and/or modify
+ *   it under the terms of the GNU General Public License as published by
+ *   the Free Software Foundation, version 3 of the License.
+ *
+ *   This program is distributed in the hope that it will be useful,
+ *   but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *   MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ *   GNU General Public License for more details.
+ *
+ *   You should have received a copy of the GNU General Public License
+ *   along with this program.  If not, see <http://www.gnu.org/licenses/>.
+*/
+
+#ifndef RELAYFILTER_HPP
+#define RELAYFILTER_HPP
+
+#include <deque>
+#include <set>
+#include <utility>
+
+#include "neartypes.hpp"
+
+namespace nuke_ms
+{
+namespace server
+{
+
+/** Remembers the most recently relayed messages of a federation.
+*
+* In a mesh of servers, a message arrives at a server once over every path
+* from its origin. Only the first copy is delivered and passed on; the
+* filter recognizes the others by the origin and relay identifier. The
+* oldest entries are forgotten when the filter is full; copies arrive
+* within a round trip of each other, long before that.
+*/
+class RelayFilter
+{
+public:
+    /** Constructor.
+    * @param _capacity Number of messages remembered
+    */
+    explicit RelayFilter(std::size_t _capacity)
+        : capacity(_capacity)
+    {}
+
+    /** Remember a message.
+    * @return true if the message is new, false if it was seen before
+    */
+    bool insert(const UniqueUserID& origin, RelayedMessage::relay_id_t relay_id);
+
+private:
+    typedef std::pair<unsigned long long, RelayedMessage::relay_id_t> key_type;
+
+    std::size_t capacity;
+
+    /** The remembered messages */
+    std::set<key_type> known;
+
+    /** The remembered messages, oldest first */
+    std::deque<key_type> order;
+};
+
+} // namespace server
+} // namespace nuke_ms
+
+#endif // ifndef RELAYFILTER_HPP
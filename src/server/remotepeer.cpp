@@ -19,6 +19,8 @@
 
 #include "remotepeer.hpp"
 
+#include <algorithm>
+
 #include <boost/bind.hpp>
 
 using namespace nuke_ms;
@@ -26,32 +28,108 @@ using namespace server;
 
 
 RemotePeer::RemotePeer(
-    socket_ptr _peer_socket,
+    Transport&& _transport,
     connection_id_t _connection_id,
-    event_callback_t _event_callback
+    event_callback_t _event_callback,
+    MetricsRegistry& registry,
+    TraceRecorder& _tracer,
+    const PendingBytes& pending
 )
     : ReferenceCounter<RemotePeer>(boost::bind(&RemotePeer::canDelete, this)),
-    peer_socket(_peer_socket), connection_id(_connection_id),
-    event_callback(_event_callback), error_happened(false)
+    transport(std::move(_transport)), connection_id(_connection_id),
+    event_callback(_event_callback), error_happened(false),
+    read_handler_memory(std::make_shared<HandlerMemory>()),
+    write_handler_memory(std::make_shared<HandlerMemory>()),
+    read_latency(registry.histogram("read_latency_ns")),
+    dispatch_latency(registry.histogram("dispatch_latency_ns")),
+    write_latency(registry.histogram("write_latency_ns")),
+    tracer(_tracer), released(false)
 {
-    startReceive();
+    if (!pending.outbound.empty())
+        write(
+            std::make_shared<byte_traits::byte_sequence>(pending.outbound), 0
+        );
+
+    std::size_t header_part = std::min(
+        pending.inbound.size(), SegmentationLayerBase::header_length
+    );
+    std::copy(pending.inbound.begin(), pending.inbound.begin() + header_part,
+        header_buffer);
+
+    if (header_part < SegmentationLayerBase::header_length)
+        startReceive(header_part);
+    else
+        startReceiveBody(
+            byte_traits::byte_sequence(
+                pending.inbound.begin() + header_part, pending.inbound.end()
+            ),
+            clock_type::time_point{}
+        );
 }
 
-void RemotePeer::startReceive()
+void RemotePeer::startReceive(std::size_t offset)
 {
     // start an asynchrous read
     async_read(
-        *peer_socket,
-        boost::asio::buffer(header_buffer, SegmentationLayerBase::header_length),
-        boost::bind(
+        transport,
+        boost::asio::buffer(
+            header_buffer + offset,
+            SegmentationLayerBase::header_length - offset
+        ),
+        makeAllocHandler(read_handler_memory, boost::bind(
             &RemotePeer::rcvHeaderHandler,
             boost::asio::placeholders::error,
             boost::asio::placeholders::bytes_transferred,
-            ReferenceCounter<RemotePeer>::CountedReference(*this)
-        )
+            ReferenceCounter<RemotePeer>::CountedReference(*this),
+            offset
+        ))
     );
 }
 
+void RemotePeer::startReceiveBody(
+    const byte_traits::byte_sequence& received,
+    clock_type::time_point read_time
+)
+{
+    try {
+        // validate header and get packet size
+        SegmentationLayerBase::HeaderType header(
+            SegmentationLayerBase::decodeHeader(header_buffer)
+        );
+
+        if (header.packetsize > SegmentationLayerBase::max_packetsize ||
+            received.size() >
+                header.packetsize - SegmentationLayerBase::header_length)
+            throw InvalidHeaderError();
+
+        auto body_data = std::make_shared<byte_traits::byte_sequence>(
+            header.packetsize-SegmentationLayerBase::header_length
+        );
+        std::copy(received.begin(), received.end(), body_data->begin());
+
+        // start a receive for the packet body_data
+        async_read(
+            transport,
+            boost::asio::buffer(*body_data) + received.size(),
+            makeAllocHandler(read_handler_memory, boost::bind(
+                &RemotePeer::rcvBodyHandler,
+                boost::asio::placeholders::error,
+                boost::asio::placeholders::bytes_transferred,
+                ReferenceCounter<RemotePeer>::CountedReference(*this),
+                body_data,
+                received.size(),
+                read_time,
+                clock_type::now()
+            ))
+        );
+    }
+    catch(const InvalidHeaderError& e)
+    {
+        ++conn_metrics.dropped_frames;
+        postError(e.what());
+    }
+}
+
 
 void RemotePeer::canDelete()
 {
@@ -63,6 +141,10 @@ void RemotePeer::canDelete()
 
 void RemotePeer::postError(const byte_traits::native_string& errmsg)
 {
+    // the connection lives on in another process
+    if (released)
+        return;
+
     if (!error_happened)
     {
         event_callback(
@@ -77,81 +159,96 @@ void RemotePeer::postError(const byte_traits::native_string& errmsg)
 void RemotePeer::sendHandler(
     const boost::system::error_code& error,
     std::size_t bytes_transferred,
-    ReferenceCounter<RemotePeer>::CountedReference peer_reference,
-    std::shared_ptr<byte_traits::byte_sequence> sendbuf
+    ReferenceCounter<RemotePeer>::CountedReference peer_reference
 )
 {
     // import reference for convenience
     RemotePeer& remotepeer = peer_reference;
 
-    // nothing to do if everything went fine
+    remotepeer.conn_metrics.bytes_out += bytes_transferred;
+
+    // nothing else to do if everything went fine
     if (!error)
+    {
+        QueuedWrite& sent = remotepeer.write_queue.front();
+        clock_type::time_point end_time = clock_type::now();
+
+        --remotepeer.conn_metrics.pending_writes;
+        ++remotepeer.conn_metrics.messages_out;
+        remotepeer.write_latency.record(
+            std::chrono::duration_cast<std::chrono::nanoseconds>(
+                end_time - sent.start_time
+            ).count()
+        );
+
+        if (sent.trace_id)
+            remotepeer.tracer.span("write", remotepeer.connection_id,
+                sent.start_time, end_time, sent.trace_id);
+
+        remotepeer.write_queue.pop_front();
+        if (!remotepeer.write_queue.empty())
+            remotepeer.startWrite();
+
         return;
+    }
 
-    // otherwise report error
+    // the rest goes to the process the connection was handed to
+    if (remotepeer.released)
+    {
+        for (const QueuedWrite& queued : remotepeer.write_queue)
+        {
+            remotepeer.unsent.insert(remotepeer.unsent.end(),
+                queued.data->begin() + bytes_transferred, queued.data->end());
+            bytes_transferred = 0;
+        }
+    }
+
+    // the queued packets are not written anymore
+    remotepeer.conn_metrics.pending_writes -= remotepeer.write_queue.size();
+    remotepeer.write_queue.clear();
+
+    // report the error, unless the connection was released
     remotepeer.postError(error.message());
 }
 
 void RemotePeer::rcvHeaderHandler(
     const boost::system::error_code& error,
     std::size_t bytes_transferred,
-    ReferenceCounter<RemotePeer>::CountedReference peer_reference
+    ReferenceCounter<RemotePeer>::CountedReference peer_reference,
+    std::size_t offset
 )
 {
     // import reference for convenience
     RemotePeer& remotepeer = peer_reference;
 
+    // only needed for tracing
+    clock_type::time_point read_time;
+    if (remotepeer.tracer.enabled())
+        read_time = clock_type::now();
+
     if (error)
     {
+        if (remotepeer.released)
+            remotepeer.unreceived.assign(
+                remotepeer.header_buffer,
+                remotepeer.header_buffer + offset + bytes_transferred
+            );
+
         // report error
         remotepeer.postError(error.message());
     }
     else
-    {
-        try {
-            // validate header and get packet size
-            SegmentationLayerBase::HeaderType header(
-                SegmentationLayerBase::decodeHeader(remotepeer.header_buffer)
-            );
-
-
-
-/// FIXME Magic number, set to something proper or make configurable
-const byte_traits::uint2b_t MAX_PACKETSIZE = 0x8FFF;
-
-            if (header.packetsize > MAX_PACKETSIZE)
-                throw InvalidHeaderError();
-
-            auto body_data = std::make_shared<byte_traits::byte_sequence>(
-                header.packetsize-SegmentationLayerBase::header_length
-            );
-
-            // start a receive for the packet body_data
-            async_read(
-                *remotepeer.peer_socket,
-                boost::asio::buffer(*body_data),
-                boost::bind(
-                    &RemotePeer::rcvBodyHandler,
-                    boost::asio::placeholders::error,
-                    boost::asio::placeholders::bytes_transferred,
-                    peer_reference,
-                    body_data
-                )
-            );
-        }
-        catch(const InvalidHeaderError& e)
-        {
-            remotepeer.postError(e.what());
-        }
-
-    }
+        remotepeer.startReceiveBody(byte_traits::byte_sequence{}, read_time);
 }
 
 void RemotePeer::rcvBodyHandler(
     const boost::system::error_code& error,
     std::size_t bytes_transferred,
     ReferenceCounter<RemotePeer>::CountedReference peer_reference,
-    std::shared_ptr<byte_traits::byte_sequence> body_data
+    std::shared_ptr<byte_traits::byte_sequence> body_data,
+    std::size_t offset,
+    clock_type::time_point read_time,
+    clock_type::time_point header_time
 )
 {
     RemotePeer& remotepeer = peer_reference;
@@ -160,19 +257,68 @@ void RemotePeer::rcvBodyHandler(
     // counter.
     if (error)
     {
+        if (remotepeer.released)
+        {
+            remotepeer.unreceived.assign(
+                remotepeer.header_buffer,
+                remotepeer.header_buffer + SegmentationLayerBase::header_length
+            );
+            remotepeer.unreceived.insert(remotepeer.unreceived.end(),
+                body_data->begin(),
+                body_data->begin() + offset + bytes_transferred
+            );
+        }
+
         remotepeer.postError(error.message());
     }
     else
     {
+        clock_type::time_point body_time = clock_type::now();
+        remotepeer.read_latency.record(
+            std::chrono::duration_cast<std::chrono::nanoseconds>(
+                body_time - header_time
+            ).count()
+        );
+
+        ++remotepeer.conn_metrics.messages_in;
+        remotepeer.conn_metrics.bytes_in +=
+            SegmentationLayerBase::header_length + bytes_transferred;
+
         auto segmlayer = std::make_shared<SegmentationLayer<SerializedData>>(
             SerializedData{body_data, body_data->begin(), body_data->size()}
         );
 
+        // writes started by the dispatcher belong to this message
+        std::uint64_t trace_id = 0;
+        if (remotepeer.tracer.enabled())
+        {
+            trace_id = remotepeer.tracer.nextMessageId();
+            remotepeer.tracer.span("decode_header", remotepeer.connection_id,
+                read_time, header_time, trace_id);
+            remotepeer.tracer.span("read_body", remotepeer.connection_id,
+                header_time, body_time, trace_id);
+            remotepeer.tracer.setCurrentMessage(trace_id);
+        }
+
         // if the receive was ok, post the passage back to the enclosing entity
         remotepeer.event_callback(
             ReceivedMessageEvent(remotepeer.connection_id, segmlayer)
         );
 
+        clock_type::time_point dispatch_time = clock_type::now();
+        remotepeer.dispatch_latency.record(
+            std::chrono::duration_cast<std::chrono::nanoseconds>(
+                dispatch_time - body_time
+            ).count()
+        );
+
+        if (trace_id)
+        {
+            remotepeer.tracer.span("dispatch", remotepeer.connection_id,
+                body_time, dispatch_time, trace_id);
+            remotepeer.tracer.setCurrentMessage(0);
+        }
+
         // renew receive Call
         remotepeer.startReceive();
     }
@@ -185,17 +331,35 @@ void RemotePeer::sendMessage(const SegmentationLayer<SerializedData>& msg)
 
     msg.fillSerialized(data->begin());
 
+    write(data, tracer.currentMessage());
+}
+
+void RemotePeer::write(
+    std::shared_ptr<byte_traits::byte_sequence> data,
+    std::uint64_t trace_id
+)
+{
+    ++conn_metrics.pending_writes;
+
+    write_queue.push_back(QueuedWrite{data, clock_type::now(), trace_id});
+
+    // otherwise the handler of the pending write starts it
+    if (write_queue.size() == 1)
+        startWrite();
+}
+
+void RemotePeer::startWrite()
+{
     // write the Message onto the line
     boost::asio::async_write(
-        *peer_socket,
-        boost::asio::buffer(*data),
-        boost::bind(
+        transport,
+        boost::asio::buffer(*write_queue.front().data),
+        makeAllocHandler(write_handler_memory, boost::bind(
             &RemotePeer::sendHandler,
             boost::asio::placeholders::error,
             boost::asio::placeholders::bytes_transferred,
-            ReferenceCounter<RemotePeer>::CountedReference(*this),
-            data
-        )
+            ReferenceCounter<RemotePeer>::CountedReference(*this)
+        ))
     );
 }
 
@@ -203,7 +367,22 @@ void RemotePeer::shutdownConnection()
 {
     boost::system::error_code dontcare;
 
-    peer_socket->shutdown(boost::asio::ip::tcp::socket::shutdown_both,dontcare);
-    peer_socket->close(dontcare);
+    transport.shutdown(dontcare);
+    transport.close(dontcare);
 }
 
+TransportImpl::native_handle_type RemotePeer::release(
+    boost::system::error_code& error
+)
+{
+    TransportImpl::native_handle_type handle = transport.release(error);
+    if (!error)
+        released = true;
+
+    return handle;
+}
+
+RemotePeer::PendingBytes RemotePeer::pendingBytes() const
+{
+    return PendingBytes{unreceived, unsent};
+}
@@ -20,11 +20,18 @@
 #ifndef REMOTEPEER_HPP
 #define REMOTEPEER_HPP
 
+#include <chrono>
+#include <deque>
+
 #include <boost/asio.hpp>
 
 #include "msglayer.hpp"
+#include "handleralloc.hpp"
 #include "refcounter.hpp"
+#include "metrics.hpp"
+#include "tracing.hpp"
 #include "servevent.hpp"
+#include "transport.hpp"
 
 namespace nuke_ms
 {
@@ -33,9 +40,6 @@ namespace server
 
 class RemotePeer : public ReferenceCounter<RemotePeer>
 {
-    /** Typedef for pointer to a socket */
-    typedef boost::shared_ptr<boost::asio::ip::tcp::socket> socket_ptr;
-
 public:
 
     /** Type that identifies the connection to which this event happened. */
@@ -45,10 +49,29 @@ public:
     typedef boost::shared_ptr<RemotePeer> ptr_t;
 
 
+    /** Bytes in flight on a connection, carried over when the connection
+    * is handed to another process */
+    struct PendingBytes
+    {
+        /** The beginning of the packet being received, header first */
+        byte_traits::byte_sequence inbound;
+
+        /** Bytes that were not written yet, in order */
+        byte_traits::byte_sequence outbound;
+    };
+
+    /** Constructor.
+    * @param pending Bytes in flight when the connection was handed over by
+    * another process. The outbound bytes are written first, and receiving
+    * continues in the middle of the packet.
+    */
     RemotePeer(
-        socket_ptr _peer_socket,
+        Transport&& _transport,
         connection_id_t _connection_id,
-        event_callback_t _event_callback
+        event_callback_t _event_callback,
+        MetricsRegistry& registry,
+        TraceRecorder& _tracer,
+        const PendingBytes& pending = PendingBytes{}
     );
 
 
@@ -56,7 +79,7 @@ public:
 
 
     /** Shutdown the connection to the remote peer.
-    * This function closes the connected socket.
+    * This function closes the connection.
     * However, deletion of this object is invalid until all handlers have
     * returned.
     * When this has happened, an event with eventtype ID_CAN_DELETE
@@ -64,9 +87,25 @@ public:
     */
     void shutdownConnection();
 
+    /** Give up the connection without closing it, to hand it to another
+    * process. Pending operations are aborted and no errors are reported
+    * anymore. When all handlers have returned, an event with eventtype
+    * ID_CAN_DELETE is sent, and pendingBytes() tells what was in flight.
+    * @return The native handle of the socket, owned by the caller
+    */
+    TransportImpl::native_handle_type release(boost::system::error_code& error);
+
+    /** Get the bytes in flight after release() */
+    PendingBytes pendingBytes() const;
+
+    /** Get the statistics of this connection. */
+    const ConnectionMetrics& metrics() const
+    { return conn_metrics; }
+
 private:
+    typedef std::chrono::steady_clock clock_type;
 
-    socket_ptr peer_socket; /**< The socket this Peer is associated with */
+    Transport transport; /**< The connection to the peer */
 
     /**< An ID to identify the Peer at the server */
     const connection_id_t connection_id;
@@ -81,9 +120,76 @@ private:
     * Only the first error will be reported. */
     bool error_happened;
 
-    /**
+    /** Statistics of this connection */
+    ConnectionMetrics conn_metrics;
+
+    /** Recycled memory for the handlers of the read operations */
+    std::shared_ptr<HandlerMemory> read_handler_memory;
+
+    /** Recycled memory for the handlers of the write operations */
+    std::shared_ptr<HandlerMemory> write_handler_memory;
+
+    /** Time from a complete header to a complete body */
+    LatencyHistogram& read_latency;
+
+    /** Time the server needs to handle a received packet */
+    LatencyHistogram& dispatch_latency;
+
+    /** Time from sendMessage() to the completion of the write */
+    LatencyHistogram& write_latency;
+
+    /** Recorder for the stages of each message */
+    TraceRecorder& tracer;
+
+    /** True after release() */
+    bool released;
+
+    /** A packet waiting to be written */
+    struct QueuedWrite
+    {
+        std::shared_ptr<byte_traits::byte_sequence> data;
+
+        /** When sendMessage() was called */
+        clock_type::time_point start_time;
+
+        /** Message traced with the write, or 0 */
+        std::uint64_t trace_id;
+    };
+
+    /** Packets to write, the first one is being written. Only one write is
+    * pending at a time, so the packets are never interleaved on the
+    * connection. */
+    std::deque<QueuedWrite> write_queue;
+
+    /** The beginning of the packet being received when the connection was
+    * released */
+    byte_traits::byte_sequence unreceived;
+
+    /** Bytes not written when the connection was released */
+    byte_traits::byte_sequence unsent;
+
+    /** Start reading a header.
+    * @param offset Bytes of the header already in header_buffer
+    */
+    void startReceive(std::size_t offset = 0);
+
+    /** Decode the header in header_buffer and start reading the body.
+    * @param received Bytes of the body received before
+    * @param read_time When the header was complete, only for tracing
     */
-    void startReceive();
+    void startReceiveBody(
+        const byte_traits::byte_sequence& received,
+        clock_type::time_point read_time
+    );
+
+    /** Queue bytes for writing to the connection. */
+    void write(
+        std::shared_ptr<byte_traits::byte_sequence> data,
+        std::uint64_t trace_id
+    );
+
+    /** Start writing the first packet of write_queue. */
+    void startWrite();
 
     /** Called when all handlers with a this pointer returned.
     * This function should only be called when all handlers that contain a
@@ -98,21 +204,24 @@ private:
     static void sendHandler(
         const boost::system::error_code& e,
         std::size_t bytes_transferred,
-        ReferenceCounter<RemotePeer>::CountedReference peer_reference,
-        std::shared_ptr<byte_traits::byte_sequence> sendbuf
+        ReferenceCounter<RemotePeer>::CountedReference peer_reference
     );
 
     static void rcvHeaderHandler(
         const boost::system::error_code& error,
         std::size_t bytes_transferred,
-        ReferenceCounter<RemotePeer>::CountedReference peer_reference
+        ReferenceCounter<RemotePeer>::CountedReference peer_reference,
+        std::size_t offset
     );
 
     static void rcvBodyHandler(
         const boost::system::error_code& error,
         std::size_t bytes_transferred,
         ReferenceCounter<RemotePeer>::CountedReference peer_reference,
-        std::shared_ptr<byte_traits::byte_sequence> body_data
+        std::shared_ptr<byte_traits::byte_sequence> body_data,
+        std::size_t offset,
+        clock_type::time_point read_time,
+        clock_type::time_point header_time
     );
 
     // no copy construction allowed.
@@ -0,0 +1,244 @@
+// serverlog.cpp
+
+/*
+ *   nuke-ms - Nuclear Messaging System
+ *   Copyright (C) 2012  Alexander Korsunsky
+ *
+ *   This program is free software: you can redistribute it and/or modify
+ *   it under the terms of the GNU General Public License as published by
+ *   the Free Software Foundation, either version 3 of the License.
+ *
+ *   This program is distributed in the hope that it will be useful,
+ *   but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *   MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ *   GNU General Public License for more details.
+ *
+ *   You should have received a copy of the GNU General Public License
+ *   along with this program.  If not, see <http://www.gnu.org/licenses/>.
+*/
+
+#include <algorithm>
+#include <chrono>
+#include <cstring>
+
+#include <boost/date_time/posix_time/posix_time_types.hpp>
+
+#include "serverlog.hpp"
+
+using namespace nuke_ms;
+using namespace server;
+
+
+constexpr std::int64_t ServerLog::no_value;
+
+/** Current time in microseconds since the epoch */
+static std::int64_t now_us()
+{
+    return std::chrono::duration_cast<std::chrono::microseconds>(
+        std::chrono::system_clock::now().time_since_epoch()
+    ).count();
+}
+
+/** Write a string as JSON string literal, including the quotes */
+static void writeJsonString(std::ostream& out, const char* str, std::size_t len)
+{
+    static const char hexdigits[] = "0123456789abcdef";
+
+    out<<'"';
+    for (std::size_t i = 0; i < len; ++i)
+    {
+        unsigned char c = static_cast<unsigned char>(str[i]);
+        switch (c)
+        {
+            case '"': out<<"\\\""; break;
+            case '\\': out<<"\\\\"; break;
+            case '\n': out<<"\\n"; break;
+            case '\r': out<<"\\r"; break;
+            case '\t': out<<"\\t"; break;
+            default:
+                if (c < 0x20)
+                    out<<"\\u00"<<hexdigits[c >> 4]<<hexdigits[c & 0xF];
+                else
+                    out<<str[i];
+        }
+    }
+    out<<'"';
+}
+
+/** Length of a text cut to at most max_length bytes. The cut does not split
+* a UTF-8 sequence, so the output stays valid UTF-8. */
+static std::size_t truncatedLength(const std::string& text,
+    std::size_t max_length)
+{
+    if (text.size() <= max_length)
+        return text.size();
+
+    // back off over the continuation bytes of the sequence being cut
+    std::size_t length = max_length;
+    while (length > 0 &&
+        (static_cast<unsigned char>(text[length]) & 0xC0) == 0x80)
+        --length;
+
+    return length;
+}
+
+static const char* levelName(ServerLog::level_t level)
+{
+    switch (level)
+    {
+        case ServerLog::LEVEL_DEBUG: return "debug";
+        case ServerLog::LEVEL_INFO: return "info";
+        case ServerLog::LEVEL_WARNING: return "warning";
+        default: return "error";
+    }
+}
+
+
+ServerLog::ServerLog(
+    std::ostream& _out,
+    level_t _threshold,
+    unsigned rate,
+    unsigned burst
+)
+    : out(_out), threshold(_threshold),
+    emission_interval{rate ? 1000000 / std::int64_t{rate} : 0},
+    burst_tolerance{emission_interval * burst},
+    theoretical_arrival{0},
+    ring{new Record[ring_size]},
+    write_pos{0}, read_pos{0}, dropped{0}, stop{false}
+{
+    for (std::uint64_t i = 0; i < ring_size; ++i)
+        ring[i].sequence.store(i, std::memory_order_relaxed);
+
+    drain_thread = boost::thread{&ServerLog::run, this};
+}
+
+ServerLog::~ServerLog()
+{
+    stop.store(true, std::memory_order_release);
+    drain_thread.join();
+}
+
+bool ServerLog::admit(std::int64_t now)
+{
+    std::int64_t tat = theoretical_arrival.load(std::memory_order_relaxed);
+
+    while (true)
+    {
+        std::int64_t base = std::max(tat, now);
+
+        if (base - now > burst_tolerance)
+            return false;
+
+        if (theoretical_arrival.compare_exchange_weak(
+                tat, base + emission_interval, std::memory_order_relaxed))
+            return true;
+    }
+}
+
+void ServerLog::push(
+    level_t level,
+    const char* event,
+    std::int64_t conn,
+    const std::string& text,
+    std::int64_t value
+)
+{
+    std::int64_t now = now_us();
+
+    if (level < LEVEL_ERROR && !admit(now))
+    {
+        dropped.fetch_add(1, std::memory_order_relaxed);
+        return;
+    }
+
+    // claim a free slot, or give up if the ring is full
+    std::uint64_t pos = write_pos.load(std::memory_order_relaxed);
+    Record* rec;
+    while (true)
+    {
+        rec = &ring[pos & (ring_size - 1)];
+        std::uint64_t seq = rec->sequence.load(std::memory_order_acquire);
+
+        if (seq == pos)
+        {
+            if (write_pos.compare_exchange_weak(
+                    pos, pos + 1, std::memory_order_relaxed))
+                break;
+        }
+        else if (seq < pos)
+        {
+            dropped.fetch_add(1, std::memory_order_relaxed);
+            return;
+        }
+        else
+            pos = write_pos.load(std::memory_order_relaxed);
+    }
+
+    rec->timestamp = now;
+    rec->level = level;
+    rec->event = event;
+    rec->conn = conn;
+    rec->value = value;
+    rec->text_length = truncatedLength(text, max_text_length);
+    std::memcpy(rec->text, text.data(), rec->text_length);
+
+    // hand the slot to the drain thread
+    rec->sequence.store(pos + 1, std::memory_order_release);
+}
+
+bool ServerLog::drain()
+{
+    bool written = false;
+
+    while (true)
+    {
+        Record& rec = ring[read_pos & (ring_size - 1)];
+        if (rec.sequence.load(std::memory_order_acquire) != read_pos + 1)
+            break;
+
+        out<<"{\"ts\":"<<rec.timestamp<<",\"level\":\""<<
+            levelName(rec.level)<<"\",\"event\":\""<<rec.event<<'"';
+        if (rec.conn)
+            out<<",\"conn\":"<<rec.conn;
+        if (rec.value != no_value)
+            out<<",\"value\":"<<rec.value;
+        if (rec.text_length)
+        {
+            out<<",\"msg\":";
+            writeJsonString(out, rec.text, rec.text_length);
+        }
+        out<<"}\n";
+
+        // give the slot back to the producers
+        rec.sequence.store(read_pos + ring_size, std::memory_order_release);
+        ++read_pos;
+        written = true;
+    }
+
+    std::uint64_t num_dropped = dropped.exchange(0, std::memory_order_relaxed);
+    if (num_dropped)
+    {
+        out<<"{\"ts\":"<<now_us()<<
+            ",\"level\":\"warning\",\"event\":\"log_dropped\",\"value\":"<<
+            num_dropped<<"}\n";
+        written = true;
+    }
+
+    if (written)
+        out.flush();
+
+    return written;
+}
+
+void ServerLog::run()
+{
+    while (!stop.load(std::memory_order_acquire))
+    {
+        if (!drain())
+            boost::this_thread::sleep(boost::posix_time::milliseconds(10));
+    }
+
+    // write what was logged before the destructor was called
+    drain();
+}
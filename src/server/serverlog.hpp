@@ -0,0 +1,197 @@
+// serverlog.hpp
+
+/*
+ *   nuke-ms - Nuclear Messaging System
+ *   Copyright (C) 2012  Alexander Korsunsky
+ *
+ *   This program is free software: you can redistribute it and/or modify
+ *   it under the terms of the GNU General Public License as published by
+ *   the Free Software Foundation, version 3 of the License.
+ *
+ *   This program is distributed in the hope that it will be useful,
+ *   but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *   MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ *   GNU General Public License for more details.
+ *
+ *   You should have received a copy of the GNU General Public License
+ *   along with this program.  If not, see <http://www.gnu.org/licenses/>.
+*/
+
+#ifndef SERVERLOG_HPP
+#define SERVERLOG_HPP
+
+#include <atomic>
+#include <cstdint>
+#include <memory>
+#include <ostream>
+#include <string>
+
+#include <boost/thread/thread.hpp>
+
+namespace nuke_ms
+{
+namespace server
+{
+
+/** Asynchronous structured logger for the server.
+*
+* Log records are put into a fixed-size ring buffer without taking a lock or
+* allocating memory. A dedicated thread takes them out again and writes them
+* as JSON lines, one object per record:
+*
+* @code
+* {"ts":1349120431123456,"level":"info","event":"client_connected","conn":3}
+* @endcode
+*
+* "ts" is the time in microseconds since the epoch, "conn", "value" and
+* "msg" are only present if they were given.
+*
+* Records below the threshold are discarded with a single comparison.
+* Records below LEVEL_ERROR are rate limited, and if the ring buffer is full
+* records are dropped instead of blocking the caller. The number of dropped
+* records is reported by the drain thread in a "log_dropped" record.
+*/
+class ServerLog
+{
+public:
+    /** Severity of a record */
+    enum level_t {
+        LEVEL_DEBUG,
+        LEVEL_INFO,
+        LEVEL_WARNING,
+        LEVEL_ERROR
+    };
+
+    /** Number of records in the ring buffer. Must be a power of two. */
+    enum { ring_size = 4096 };
+
+    /** Maximum length of the message text of a record in bytes. Longer
+    * texts are truncated, but not within a UTF-8 sequence. */
+    enum { max_text_length = 160 };
+
+    /** Marks a record without a value */
+    constexpr static std::int64_t no_value = INT64_MIN;
+
+    /** Constructor. Starts the drain thread.
+    *
+    * @param _out Where the records are written to
+    * @param _threshold Records below this level are discarded
+    * @param rate Maximum sustained number of records per second below
+    * LEVEL_ERROR
+    * @param burst Number of records that may exceed the rate at once
+    */
+    ServerLog(
+        std::ostream& _out,
+        level_t _threshold = LEVEL_INFO,
+        unsigned rate = 1000,
+        unsigned burst = 100
+    );
+
+    /** Destructor. Writes the remaining records and stops the drain thread. */
+    ~ServerLog();
+
+    ServerLog(const ServerLog&) = delete;
+    ServerLog& operator= (const ServerLog&) = delete;
+
+    /** Check if records of a level are written. */
+    bool enabled(level_t level) const
+    { return level >= threshold; }
+
+    /** Write a record.
+    * This function can be called by any thread. It does not block.
+    *
+    * @param level Severity of the record
+    * @param event Name of the event. Must be a string literal.
+    * @param conn Connection the record is about, 0 for none
+    * @param text Message text
+    * @param value A number describing the event, no_value for none
+    */
+    void write(
+        level_t level,
+        const char* event,
+        std::int64_t conn = 0,
+        const std::string& text = std::string{},
+        std::int64_t value = no_value
+    )
+    {
+        if (enabled(level))
+            push(level, event, conn, text, value);
+    }
+
+private:
+    /** A record in the ring buffer */
+    struct Record
+    {
+        /** Position in the ring this slot is ready for.
+        * Equal to the position if the slot is free for a producer, position+1
+        * if it holds a record for the drain thread. */
+        std::atomic<std::uint64_t> sequence;
+
+        std::int64_t timestamp;
+        level_t level;
+        const char* event;
+        std::int64_t conn;
+        std::int64_t value;
+        std::size_t text_length;
+        char text[max_text_length];
+    };
+
+    /** Where the records are written to */
+    std::ostream& out;
+
+    /** Records below this level are discarded */
+    const level_t threshold;
+
+    /** Minimum time between two records in microseconds */
+    const std::int64_t emission_interval;
+
+    /** How far records may run ahead of the rate in microseconds */
+    const std::int64_t burst_tolerance;
+
+    /** Earliest time the next record conforms to the rate, in microseconds.
+    * (Generic cell rate algorithm) */
+    std::atomic<std::int64_t> theoretical_arrival;
+
+    /** The ring buffer */
+    std::unique_ptr<Record[]> ring;
+
+    /** Next position to be written by a producer */
+    std::atomic<std::uint64_t> write_pos;
+
+    /** Next position to be read by the drain thread */
+    std::uint64_t read_pos;
+
+    /** Number of records dropped since the last "log_dropped" record */
+    std::atomic<std::uint64_t> dropped;
+
+    /** Set by the destructor to end the drain thread */
+    std::atomic<bool> stop;
+
+    /** The thread writing the records */
+    boost::thread drain_thread;
+
+    /** Check the rate limit and put a record into the ring. */
+    void push(
+        level_t level,
+        const char* event,
+        std::int64_t conn,
+        const std::string& text,
+        std::int64_t value
+    );
+
+    /** Take a record from the rate limit. Lock-free.
+    * @return true if the record may be written */
+    bool admit(std::int64_t now);
+
+    /** Write all records in the ring to the output.
+    * @return true if anything was written */
+    bool drain();
+
+    /** Thread function: drain the ring until stopped. */
+    void run();
+};
+
+} // namespace server
+} // namespace nuke_ms
+
+#endif // ifndef SERVERLOG_HPP
@@ -41,6 +41,9 @@ struct SendHandler
     std::weak_ptr<ConnectedClient> parent;
     std::shared_ptr<byte_traits::byte_sequence> buffer;
 
+    /** Called with the outcome, may be empty */
+    ConnectedClient::SendCompletion completion;
+
     void operator() (
         const boost::system::error_code& error,
         std::size_t bytes_transferred
@@ -86,23 +89,33 @@ struct ReceiveBodyHandler
 
 ConnectedClient::ConnectedClient(
         connection_id_t connection_id_,
-        boost::asio::ip::tcp::socket&& socket_,
+        Transport&& transport_,
         const Signals::ReceivedMessage& rcvd_callback,
         const Signals::Disconnected& disconnected_callback
-) : connection_id{connection_id_}, socket{std::move(socket_)},
+) : signals{rcvd_callback, disconnected_callback},
+    connection_id{connection_id_}, transport{std::move(transport_)},
     header_buffer{std::make_shared<
         std::array<byte_traits::byte_t,SegmentationLayerBase::header_length>
     >()},
-    signals{rcvd_callback, disconnected_callback}
+    read_handler_memory{std::make_shared<HandlerMemory>()},
+    write_handler_memory{std::make_shared<HandlerMemory>()},
+    keep_received{false}
 { }
 
 void ConnectedClient::async_write(
-    const std::shared_ptr<byte_traits::byte_sequence>& data)
+    const std::shared_ptr<byte_traits::byte_sequence>& data,
+    const SendCompletion& completion
+)
 {
+    ++conn_metrics.pending_writes;
+
     boost::asio::async_write(
-        socket,
+        transport,
         boost::asio::buffer(*data),
-        SendHandler{shared_from_this(), data}
+        makeAllocHandler(
+            write_handler_memory,
+            SendHandler{shared_from_this(), data, completion}
+        )
     );
 }
 
@@ -114,15 +127,44 @@ std::shared_ptr<ConnectedClient> ConnectedClient::makeInstance(
     const Signals::ReceivedMessage& rcvd_callback,
     const Signals::Disconnected& disconnected_callback
 )
+{
+    return makeInstance(
+        connection_id,
+        Transport{std::move(socket)},
+        rcvd_callback,
+        disconnected_callback
+    );
+}
+
+std::shared_ptr<ConnectedClient> ConnectedClient::makeInstance(
+    connection_id_t connection_id,
+    Transport&& transport,
+    const Signals::ReceivedMessage& rcvd_callback,
+    const Signals::Disconnected& disconnected_callback
+)
 {
     std::shared_ptr<ConnectedClient> client{new ConnectedClient{
-        connection_id, std::move(socket), rcvd_callback, disconnected_callback
+        connection_id, std::move(transport), rcvd_callback,
+        disconnected_callback
     }};
     client->startReceive();
 
     return client;
 }
 
+std::shared_ptr<ConnectedClient> ConnectedClient::makeInstance(
+    connection_id_t connection_id,
+    Transport&& transport
+)
+{
+    return makeInstance(
+        connection_id,
+        std::move(transport),
+        [](connection_id_t, const std::shared_ptr<SerializedData>&) {},
+        [](connection_id_t) {}
+    );
+}
+
 
 ConnectedClient::~ConnectedClient()
 {
@@ -133,10 +175,13 @@ void ConnectedClient::startReceive()
 {
     ReceiveHeaderHandler handler{shared_from_this()};
 
+    // create the buffer before the handler is moved away
+    auto buffer = boost::asio::buffer(*handler.buffer);
+
     async_read(
-        socket,
-        boost::asio::buffer(*handler.buffer),
-        std::move(handler)
+        transport,
+        buffer,
+        makeAllocHandler(read_handler_memory, std::move(handler))
     );
 }
 
@@ -144,7 +189,68 @@ void ConnectedClient::shutdown()
 {
     // initiate socket shutdown
     boost::system::error_code dontcare;
-    socket.shutdown(tcp::socket::shutdown_both, dontcare);
+    transport.shutdown(dontcare);
+}
+
+void ConnectedClient::receivePacket(ReceiveCompletion&& completion)
+{
+    keep_received = true;
+
+    // like a socket, only one receive may be pending
+    if (receive_completion)
+    {
+        completion(boost::asio::error::already_started,
+            std::shared_ptr<SerializedData>{});
+        return;
+    }
+
+    if (!received_packets.empty())
+    {
+        std::shared_ptr<SerializedData> data{
+            std::move(received_packets.front())
+        };
+        received_packets.pop_front();
+
+        completion(boost::system::error_code{}, std::move(data));
+        return;
+    }
+
+    if (disconnect_reason)
+    {
+        completion(disconnect_reason, std::shared_ptr<SerializedData>{});
+        return;
+    }
+
+    receive_completion = std::move(completion);
+}
+
+void ConnectedClient::deliverPacket(const std::shared_ptr<SerializedData>& data)
+{
+    if (receive_completion)
+    {
+        ReceiveCompletion completion;
+        completion.swap(receive_completion);
+
+        completion(boost::system::error_code{}, data);
+    }
+    else if (keep_received)
+        received_packets.push_back(data);
+}
+
+void ConnectedClient::handleDisconnect(const boost::system::error_code& reason)
+{
+    shutdown();
+
+    if (!disconnect_reason)
+        disconnect_reason = reason;
+
+    signals.disconnected(connection_id);
+
+    ReceiveCompletion completion;
+    completion.swap(receive_completion);
+
+    if (completion)
+        completion(disconnect_reason, std::shared_ptr<SerializedData>{});
 }
 
 void SendHandler::operator() (
@@ -153,15 +259,34 @@ void SendHandler::operator() (
 )
 {
     auto parent = this->parent.lock();
-    if (!parent) return; // Mommy is dead? Ok, then nevermind :-(
+    if (!parent) // Mommy is dead? Ok, then nevermind :-(
+    {
+        if (completion)
+            completion(boost::asio::error::operation_aborted);
+        return;
+    }
+
+    --parent->conn_metrics.pending_writes;
+    parent->conn_metrics.bytes_out += bytes_transferred;
 
     // on error, disconnect parent
     if (error || bytes_transferred != buffer->size())
     {
-        parent->shutdown();
-        parent->signals.disconnected(parent->connection_id);
+        parent->handleDisconnect(
+            error ? error : boost::asio::error::make_error_code(
+                boost::asio::error::connection_aborted
+            )
+        );
+
+        if (completion)
+            completion(parent->disconnect_reason);
         return;
     }
+
+    ++parent->conn_metrics.messages_out;
+
+    if (completion)
+        completion(boost::system::error_code{});
 }
 
 void ReceiveHeaderHandler::operator() (
@@ -175,8 +300,7 @@ void ReceiveHeaderHandler::operator() (
     // if we had an error reading, shutdown and send disconnected event
     if (error)
     {
-        parent->shutdown();
-        parent->signals.disconnected(parent->connection_id);
+        parent->handleDisconnect(error);
         return;
     }
 
@@ -186,10 +310,7 @@ void ReceiveHeaderHandler::operator() (
         SegmentationLayerBase::HeaderType header_data
             = SegmentationLayerBase::decodeHeader(buffer->begin());
 
-/// @todo FIXME Magic number, set to something proper or make configurable
-constexpr byte_traits::uint2b_t MAX_PACKETSIZE = 0x8FFF;
-
-        if (header_data.packetsize > MAX_PACKETSIZE)
+        if (header_data.packetsize > SegmentationLayerBase::max_packetsize)
             throw MsgLayerError("Oversized packet.");
 
         auto body_buf = std::make_shared<byte_traits::byte_sequence>(
@@ -198,16 +319,21 @@ constexpr byte_traits::uint2b_t MAX_PACKETSIZE = 0x8FFF;
 
         // start an asynchronous receive for the body
         async_read(
-            parent->socket,
+            parent->transport,
             boost::asio::buffer(*body_buf),
-            ReceiveBodyHandler{parent, body_buf}
+            makeAllocHandler(
+                parent->read_handler_memory,
+                ReceiveBodyHandler{parent, body_buf}
+            )
         );
     }
     // on failure, shutdown and send disconnected event
     catch (const MsgLayerError& e)
     {
-        parent->shutdown();
-        parent->signals.disconnected(parent->connection_id);
+        ++parent->conn_metrics.dropped_frames;
+        parent->handleDisconnect(boost::asio::error::make_error_code(
+            boost::asio::error::invalid_argument
+        ));
     }
 }
 
@@ -222,16 +348,20 @@ void ReceiveBodyHandler::operator() (
     // if we had an error reading, shutdown and send disconnected event
     if (error)
     {
-        parent->shutdown();
-        parent->signals.disconnected(parent->connection_id);
+        parent->handleDisconnect(error);
         return;
     }
 
+    ++parent->conn_metrics.messages_in;
+    parent->conn_metrics.bytes_in +=
+        SegmentationLayerBase::header_length + bytes_transferred;
+
     // otherwise, construct message and send signal
-    parent->signals.receivedMessage(
-        parent->connection_id,
-        std::make_shared<SerializedData>(buffer, buffer->begin(),buffer->size())
+    auto data = std::make_shared<SerializedData>(
+        buffer, buffer->begin(), buffer->size()
     );
+    parent->signals.receivedMessage(parent->connection_id, data);
+    parent->deliverPacket(data);
 
     // restart receive operation
     parent->startReceive();
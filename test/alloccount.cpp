@@ -0,0 +1,147 @@
+// alloccount.cpp
+
+/*
+ *   nuke-ms - Nuclear Messaging System
+ *   Copyright (C) 2012  Alexander Korsunsky
+ *
+ *   This program is free software: you can redistribute it and/or modify
+ *   it under the terms of the GNU General Public License as published by
+ *   the Free Software Foundation, either version 3 of the License, or
+ *   (at your option) any later version.
+ *
+ *   This program is distributed in the hope that it will be useful,
+ *   but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *   MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ *   GNU General Public License for more details.
+ *
+ *   You should have received a copy of the GNU General Public License
+ *   along with this program.  If not, see <http://www.gnu.org/licenses/>.
+*/
+
+#include <atomic>
+#include <cerrno>
+#include <cstdlib>
+#include <new>
+
+#include "alloccount.hpp"
+
+/** Allocations so far. Constant initialized, so it can be used before any
+ * constructor of the program has run. */
+static std::atomic<std::uint64_t> allocations{0};
+
+static inline void countAllocation()
+{
+    allocations.fetch_add(1, std::memory_order_relaxed);
+}
+
+std::uint64_t allocationCount()
+{
+    return allocations.load(std::memory_order_relaxed);
+}
+
+
+#ifdef __GLIBC__
+
+// Replace the malloc family. Everything else, including operator new and
+// the aligned allocations of Boost.Asio, ends up here.
+
+extern "C"
+{
+
+void* __libc_malloc(std::size_t size);
+void* __libc_calloc(std::size_t num, std::size_t size);
+void* __libc_realloc(void* ptr, std::size_t size);
+void* __libc_memalign(std::size_t alignment, std::size_t size);
+void* __libc_valloc(std::size_t size);
+void* __libc_pvalloc(std::size_t size);
+void __libc_free(void* ptr);
+
+void* malloc(std::size_t size)
+{
+    countAllocation();
+    return __libc_malloc(size);
+}
+
+void* calloc(std::size_t num, std::size_t size)
+{
+    countAllocation();
+    return __libc_calloc(num, size);
+}
+
+void* realloc(void* ptr, std::size_t size)
+{
+    countAllocation();
+    return __libc_realloc(ptr, size);
+}
+
+void* memalign(std::size_t alignment, std::size_t size)
+{
+    countAllocation();
+    return __libc_memalign(alignment, size);
+}
+
+void* aligned_alloc(std::size_t alignment, std::size_t size)
+{
+    countAllocation();
+    return __libc_memalign(alignment, size);
+}
+
+int posix_memalign(void** ptr, std::size_t alignment, std::size_t size)
+{
+    if (alignment % sizeof(void*) || (alignment & (alignment - 1)))
+        return EINVAL;
+
+    countAllocation();
+    void* mem = __libc_memalign(alignment, size);
+    if (!mem)
+        return ENOMEM;
+
+    *ptr = mem;
+    return 0;
+}
+
+void* valloc(std::size_t size)
+{
+    countAllocation();
+    return __libc_valloc(size);
+}
+
+void* pvalloc(std::size_t size)
+{
+    countAllocation();
+    return __libc_pvalloc(size);
+}
+
+void free(void* ptr)
+{
+    __libc_free(ptr);
+}
+
+} // extern "C"
+
+#else // ifdef __GLIBC__
+
+// Without glibc, only the C++ allocation functions can be replaced. The
+// array and nothrow versions call these by default.
+
+void* operator new(std::size_t size)
+{
+    countAllocation();
+
+    if (void* ptr = std::malloc(size ? size : 1))
+        return ptr;
+
+    throw std::bad_alloc{};
+}
+
+void operator delete(void* ptr) noexcept
+{
+    std::free(ptr);
+}
+
+void operator delete(void* ptr, std::size_t) noexcept
+{
+    std::free(ptr);
+}
+
+#endif // ifdef __GLIBC__
@@ -0,0 +1,73 @@
+// alloccount.hpp
+
+/*
+ *   nuke-ms - Nuclear Messaging System
+ *   Copyright (C) 2012  Alexander Korsunsky
+ *
+ *   This program is free software: you can redistribute it and/or modify
+ *   it under the terms of the GNU General Public License as published by
+ *   the Free Software Foundation, either version 3 of the License, or
+ *   (at your option) any later version.
+ *
+ *   This program is distributed in the hope that it will be useful,
+ *   but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *   MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ *   GNU General Public License for more details.
+ *
+ *   You should have received a copy of the GNU General Public License
+ *   along with this program.  If not, see <http://www.gnu.org/licenses/>.
+*/
+
+/* Counting of heap allocations for tests.
+ *
+ * Link alloccount.cpp into a test to replace the global allocator by one that
+ * counts every allocation of the process, on any thread. With glibc, malloc
+ * and its relatives are replaced, so allocations that bypass operator new
+ * are counted as well. Elsewhere, only operator new is replaced.
+ *
+ * Tests use the counter to check that a code path does not allocate more
+ * than it does today, so allocations that were removed can't come back
+ * unnoticed:
+ *
+ *     warmUp();
+ *     AllocationCounter counter;
+ *     for (int i = 0; i < 1000; ++i)
+ *         doSomething();
+ *     TEST_ASSERT(counter.perOperation(1000) <= 2.0);
+*/
+
+#ifndef ALLOCCOUNT_HPP
+#define ALLOCCOUNT_HPP
+
+#include <cstdint>
+
+/** Number of allocations in this process since it was started */
+std::uint64_t allocationCount();
+
+/** Counts the allocations made after its construction */
+class AllocationCounter
+{
+    std::uint64_t start;
+
+public:
+    AllocationCounter()
+        : start{allocationCount()}
+    {}
+
+    /** Start counting again */
+    void reset()
+    { start = allocationCount(); }
+
+    /** Number of allocations since construction or the last reset() */
+    std::uint64_t count() const
+    { return allocationCount() - start; }
+
+    /** Average number of allocations per operation.
+     * @param operations Number of operations performed since counting began
+    */
+    double perOperation(std::uint64_t operations) const
+    { return operations ? double(count()) / operations : 0.0; }
+};
+
+
+#endif // ifndef ALLOCCOUNT_HPP
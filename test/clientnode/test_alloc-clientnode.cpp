@@ -0,0 +1,119 @@
+// test_alloc-clientnode.cpp
+
+/*
+ *   nuke-ms - Nuclear Messaging System
+ *   Copyright (C) 2012  Alexander Korsunsky
+ *
+ *   This program is free software: you can redistribute it and/or modify
+ *   it under the terms of the GNU General Public License as published by
+ *   the Free Software Foundation, either version 3 of the License.
+ *
+ *   This program is distributed in the hope that it will be useful,
+ *   but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *   MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ *   GNU General Public License for more details.
+ *
+ *   You should have received a copy of the GNU General Public License
+ *   along with this program.  If not, see <http://www.gnu.org/licenses/>.
+*/
+
+#include <atomic>
+#include <chrono>
+#include <iostream>
+#include <thread>
+#include <boost/asio.hpp>
+
+#include "neartypes.hpp"
+#include "clientnode/clientnode.hpp"
+
+#include "alloccount.hpp"
+#include "testutils.hpp"
+
+
+using namespace nuke_ms;
+using namespace boost::asio::ip;
+
+DECLARE_TEST("allocations of StateConnected")
+
+
+// Allowed allocations for receiving a message in StateConnected and handing
+// it to the application. Lower this when an allocation is removed.
+static const double max_allocs_receive = 2.0;
+
+static const int warmup_iterations = 100;
+static const int iterations = 2000;
+
+
+/** Wait until the client received a number of messages */
+static bool waitFor(const std::atomic<int>& received, int count)
+{
+    std::chrono::steady_clock::time_point deadline =
+        std::chrono::steady_clock::now() + std::chrono::seconds{5};
+
+    while (received.load() < count)
+    {
+        if (std::chrono::steady_clock::now() > deadline)
+            return false;
+
+        std::this_thread::sleep_for(std::chrono::milliseconds{1});
+    }
+
+    return true;
+}
+
+int main()
+{
+    boost::asio::io_service io_service;
+    // a port chosen by the system, so tests can run in parallel
+    tcp::acceptor acceptor{io_service,
+        tcp::endpoint{address_v4::loopback(), 0}};
+    std::string port = std::to_string(acceptor.local_endpoint().port());
+
+    std::atomic<int> received{0};
+    std::atomic<bool> intact{true};
+    const std::string text(100, 'x');
+
+    clientnode::ClientNode client;
+    client.connectRcvMessage(
+        [&](std::shared_ptr<NearUserMessage> msg)
+        {
+            if (msg->_stringwrap._message_string != text)
+                intact = false;
+            ++received;
+        }
+    );
+    client.connectTo({"127.0.0.1 " + port});
+
+    tcp::socket server_socket{io_service};
+    acceptor.accept(server_socket);
+    server_socket.set_option(tcp::no_delay{true});
+
+    // the server side only uses a buffer allocated up front
+    SegmentationLayer<NearUserMessage> packet{NearUserMessage{
+        StringwrapLayer{text}, UniqueUserID{}, UniqueUserID{1ull}
+    }};
+    byte_traits::byte_sequence out(packet.size());
+    packet.fillSerialized(out.begin());
+
+    for (int i = 0; i < warmup_iterations; ++i)
+        boost::asio::write(server_socket, boost::asio::buffer(out));
+
+    TEST_ASSERT(waitFor(received, warmup_iterations));
+
+    AllocationCounter counter;
+    for (int i = 0; i < iterations; ++i)
+        boost::asio::write(server_socket, boost::asio::buffer(out));
+
+    bool all_received = waitFor(received, warmup_iterations + iterations);
+    double allocs = counter.perOperation(iterations);
+
+    TEST_ASSERT(all_received);
+    TEST_ASSERT(intact);
+
+    std::cout<<"receive: "<<allocs<<" allocations per message\n";
+    TEST_ASSERT(allocs <= max_allocs_receive);
+
+    client.disconnect();
+
+    return CONCLUDE_TEST();
+}
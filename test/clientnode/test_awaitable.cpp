@@ -0,0 +1,279 @@
+// test_awaitable.cpp
+
+/*
+ *   nuke-ms - Nuclear Messaging System
+ *   Copyright (C) 2012  Alexander Korsunsky
+ *
+ *   This program is free software: you can redistribute it and/or modify
+ *   it under the terms of the GNU General Public License as published by
+ *   the Free Software Foundation, version 3 of the License.
+ *
+ *   This program is distributed in the hope that it will be useful,
+ *   but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *   MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ *   GNU General Public License for more details.
+ *
+ *   You should have received a copy of the GNU General Public License
+ *   along with this program.  If not, see <http://www.gnu.org/licenses/>.
+*/
+
+#include <string>
+#include <utility>
+#include <vector>
+
+#include <boost/asio.hpp>
+#include <boost/asio/awaitable.hpp>
+#include <boost/asio/co_spawn.hpp>
+#include <boost/asio/detached.hpp>
+#include <boost/asio/use_awaitable.hpp>
+
+#include "clientnode/asyncclient.hpp"
+#include "clientnode/clientnode.hpp"
+#include "servnode/connected-client.hpp"
+
+#include "testutils.hpp"
+
+DECLARE_TEST("co_await on ClientNode, ConnectedClient and AsyncClient")
+
+using namespace nuke_ms;
+using namespace nuke_ms::clientnode;
+using namespace nuke_ms::servnode;
+using boost::asio::awaitable;
+using boost::asio::use_awaitable;
+using boost::asio::ip::tcp;
+
+
+/** What the coroutines found out */
+struct Outcome
+{
+    bool clientnode_done = false;
+    bool asyncclient_done = false;
+    bool oversize_refused = false;
+    int eof_seen = 0;
+};
+
+/** Send every packet back to the client, until it disconnects */
+static awaitable<void> echo(std::shared_ptr<ConnectedClient> client,
+    Outcome& outcome)
+{
+    try {
+        while (true)
+        {
+            std::shared_ptr<SerializedData> data =
+                co_await client->asyncReceive(use_awaitable);
+
+            SerializedData copy{*data};
+            co_await client->asyncSend(
+                SegmentationLayer<SerializedData>{std::move(copy)},
+                use_awaitable
+            );
+        }
+    }
+    catch (const boost::system::system_error& e)
+    {
+        if (e.code() == boost::asio::error::eof)
+            ++outcome.eof_seen;
+    }
+}
+
+/** Accept a number of clients and echo their packets */
+static awaitable<void> serve(tcp::acceptor& acceptor, int clients,
+    Outcome& outcome)
+{
+    for (int i = 0; i < clients; ++i)
+    {
+        tcp::socket socket = co_await acceptor.async_accept(use_awaitable);
+
+        boost::asio::co_spawn(acceptor.get_executor(),
+            echo(ConnectedClient::makeInstance(i, Transport{std::move(socket)}),
+                outcome),
+            boost::asio::detached
+        );
+    }
+}
+
+/** Accept one client and send it a header announcing a huge packet */
+static awaitable<void> serveOversize(tcp::acceptor& acceptor)
+{
+    tcp::socket socket = co_await acceptor.async_accept(use_awaitable);
+
+    const byte_traits::byte_t header[] = {0x80, 0x00, 0x90, 0x00};
+    co_await boost::asio::async_write(socket, boost::asio::buffer(header),
+        use_awaitable);
+
+    // keep the socket open until the client gave up
+    byte_traits::byte_t dontcare;
+    try {
+        co_await socket.async_read_some(boost::asio::buffer(&dontcare, 1),
+            use_awaitable);
+    }
+    catch (const boost::system::system_error&)
+    {}
+}
+
+/** Get the error code of an awaited operation that is expected to fail */
+template <typename Operation>
+static awaitable<boost::system::error_code> failure(Operation operation)
+{
+    try {
+        co_await operation();
+    }
+    catch (const boost::system::system_error& e)
+    {
+        co_return e.code();
+    }
+
+    co_return boost::system::error_code{};
+}
+
+static awaitable<void> useClientNode(ClientNode& client,
+    const std::string& port, Outcome& outcome)
+{
+    // temporaries in co_await expressions trip up some compilers
+    const ServerLocation server{"127.0.0.1 " + port};
+    const ServerLocation nonsense{"nonsense"};
+
+    co_await client.asyncConnect(server, use_awaitable);
+
+    // the server sends every message back
+    NearUserMessage::msg_id_t msg_id =
+        co_await client.asyncSend("Hello", use_awaitable);
+
+    std::shared_ptr<NearUserMessage> msg =
+        co_await client.asyncReceive(use_awaitable);
+    TEST_ASSERT(msg->_msg_id == msg_id);
+    TEST_ASSERT(msg->_stringwrap._message_string == "Hello");
+
+    // messages arriving between two receives are kept
+    std::vector<NearUserMessage::msg_id_t> msg_ids;
+    for (int i = 0; i < 3; ++i)
+        msg_ids.push_back(co_await client.asyncSend(
+            std::to_string(i), UniqueUserID{}, use_awaitable
+        ));
+
+    bool in_order = true;
+    for (int i = 0; i < 3; ++i)
+    {
+        msg = co_await client.asyncReceive(use_awaitable);
+        in_order = in_order && msg->_msg_id == msg_ids[i] &&
+            msg->_stringwrap._message_string == std::to_string(i);
+    }
+    TEST_ASSERT(in_order);
+
+    boost::system::error_code error = co_await failure(
+        [&]() -> awaitable<void> {
+            co_await client.asyncConnect(server, use_awaitable);
+        }
+    );
+    TEST_ASSERT(error == boost::asio::error::already_connected);
+
+    client.disconnect();
+
+    error = co_await failure([&]() -> awaitable<void> {
+        co_await client.asyncReceive(use_awaitable);
+    });
+    TEST_ASSERT(error == boost::asio::error::not_connected);
+
+    error = co_await failure([&]() -> awaitable<void> {
+        co_await client.asyncSend("Nobody there", use_awaitable);
+    });
+    TEST_ASSERT(error == boost::asio::error::not_connected);
+
+    error = co_await failure([&]() -> awaitable<void> {
+        co_await client.asyncConnect(nonsense, use_awaitable);
+    });
+    TEST_ASSERT(error == boost::asio::error::invalid_argument);
+
+    outcome.clientnode_done = true;
+}
+
+static awaitable<void> useAsyncClient(AsyncClient& client,
+    const std::string& port, Outcome& outcome)
+{
+    co_await client.asyncConnect("127.0.0.1", port, use_awaitable);
+    co_await client.asyncSend(NearUserMessage{StringwrapLayer{"Hi"}},
+        use_awaitable);
+
+    for (int i = 0; i < 3; ++i)
+    {
+        co_await client.asyncSend(
+            NearUserMessage{StringwrapLayer{std::to_string(i)}}, use_awaitable
+        );
+    }
+
+    std::shared_ptr<NearUserMessage> msg =
+        co_await client.asyncReceive(use_awaitable);
+    TEST_ASSERT(msg->_stringwrap._message_string == "Hi");
+
+    bool in_order = true;
+    for (int i = 0; i < 3; ++i)
+    {
+        msg = co_await client.asyncReceive(use_awaitable);
+        in_order = in_order &&
+            msg->_stringwrap._message_string == std::to_string(i);
+    }
+    TEST_ASSERT(in_order);
+
+    client.close();
+    outcome.asyncclient_done = true;
+}
+
+static awaitable<void> receiveOversize(AsyncClient& client,
+    const std::string& port, Outcome& outcome)
+{
+    co_await client.asyncConnect("127.0.0.1", port, use_awaitable);
+
+    boost::system::error_code error = co_await failure(
+        [&]() -> awaitable<void> {
+            co_await client.asyncReceive(use_awaitable);
+        }
+    );
+    outcome.oversize_refused = error == boost::asio::error::invalid_argument;
+
+    client.close();
+}
+
+
+int main()
+{
+    boost::asio::io_context io_context;
+    Outcome outcome;
+
+    tcp::acceptor acceptor{io_context,
+        tcp::endpoint{boost::asio::ip::address_v4::loopback(), 0}};
+    std::string port = std::to_string(acceptor.local_endpoint().port());
+
+    tcp::acceptor oversize_acceptor{io_context,
+        tcp::endpoint{boost::asio::ip::address_v4::loopback(), 0}};
+    std::string oversize_port =
+        std::to_string(oversize_acceptor.local_endpoint().port());
+
+    ClientNode clientnode;
+    AsyncClient asyncclient{io_context};
+    AsyncClient oversize_client{io_context};
+
+    boost::asio::co_spawn(io_context, serve(acceptor, 2, outcome),
+        boost::asio::detached);
+    boost::asio::co_spawn(io_context, serveOversize(oversize_acceptor),
+        boost::asio::detached);
+
+    boost::asio::co_spawn(io_context,
+        useClientNode(clientnode, port, outcome), boost::asio::detached);
+    boost::asio::co_spawn(io_context,
+        useAsyncClient(asyncclient, port, outcome), boost::asio::detached);
+    boost::asio::co_spawn(io_context,
+        receiveOversize(oversize_client, oversize_port, outcome),
+        boost::asio::detached);
+
+    // returns when all coroutines are finished
+    io_context.run();
+
+    TEST_ASSERT(outcome.clientnode_done);
+    TEST_ASSERT(outcome.asyncclient_done);
+    TEST_ASSERT(outcome.oversize_refused);
+
+    // both echo coroutines saw their client go away
+    TEST_ASSERT(outcome.eof_seen == 2);
+
+    return CONCLUDE_TEST();
+}
@@ -0,0 +1,152 @@
+// test_logstreams.cpp
+
+/*
+ *   nuke-ms - Nuclear Messaging System
+ *   Copyright (C) 2012  Alexander Korsunsky
+ *
+ *   This program is free software: you can redistribute it and/or modify
+ *   it under the terms of the GNU General Public License as published by
+ *   the Free Software Foundation, version 3 of the License.
+ *
+ *   This program is distributed in the hope that it will be useful,
+ *   but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *   MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ *   GNU General Public License for more details.
+ *
+ *   You should have received a copy of the GNU General Public License
+ *   along with this program.  If not, see <http://www.gnu.org/licenses/>.
+*/
+
+#include <sstream>
+#include <string>
+#include <thread>
+#include <vector>
+
+#include "clientnode/logstreams.hpp"
+
+#include "testutils.hpp"
+
+
+using namespace nuke_ms::clientnode;
+
+DECLARE_TEST("LoggingStreams and LogWriter")
+
+
+/** Counts how often it is formatted */
+struct Formatted
+{
+    int& count;
+};
+
+static std::ostream& operator<< (std::ostream& out, const Formatted& formatted)
+{
+    ++formatted.count;
+    return out<<"formatted";
+}
+
+/** Split the lines of a stream */
+static std::vector<std::string> lines(const std::ostringstream& stream)
+{
+    std::vector<std::string> result;
+    std::istringstream in{stream.str()};
+    for (std::string line; std::getline(in, line);)
+        result.push_back(line);
+    return result;
+}
+
+/** Log one message of every level */
+static void logAll(const LoggingStreams& logstreams, int& formatted)
+{
+    NUKE_MS_LOG(logstreams, LOGLEVEL_INFO, "info " << Formatted{formatted});
+    NUKE_MS_LOG(logstreams, LOGLEVEL_WARNING,
+        "warning " << Formatted{formatted});
+    NUKE_MS_LOG(logstreams, LOGLEVEL_ERROR, "error " << Formatted{formatted});
+}
+
+int main()
+{
+    // the default threshold drops info messages
+    {
+        std::ostringstream info, warn, error;
+        LoggingStreams logstreams{info, warn, error};
+        logstreams.threshold = LoggingStreams{}.threshold;
+
+        int formatted = 0;
+        logAll(logstreams, formatted);
+
+        TEST_ASSERT(info.str().empty());
+        TEST_ASSERT(warn.str() == "warning formatted\n");
+        TEST_ASSERT(error.str() == "error formatted\n");
+
+        // messages below the threshold are not even formatted
+        TEST_ASSERT(formatted == 2);
+    }
+
+    // every threshold lets the messages of its level and above through
+    const log_level_t levels[] = {
+        LOGLEVEL_INFO, LOGLEVEL_WARNING, LOGLEVEL_ERROR, LOGLEVEL_NONE
+    };
+    for (log_level_t threshold : levels)
+    {
+        std::ostringstream info, warn, error;
+        LoggingStreams logstreams{info, warn, error, threshold};
+
+        int formatted = 0;
+        logAll(logstreams, formatted);
+
+        TEST_ASSERT(info.str().empty() == (threshold > LOGLEVEL_INFO));
+        TEST_ASSERT(warn.str().empty() == (threshold > LOGLEVEL_WARNING));
+        TEST_ASSERT(error.str().empty() == (threshold > LOGLEVEL_ERROR));
+        TEST_ASSERT(formatted == LOGLEVEL_NONE - threshold);
+    }
+
+    // The writer filters the same way. It writes the messages of every
+    // thread in order, and all of them before it is destroyed.
+    {
+        std::ostringstream info, warn, error;
+        const int threads = 4, messages = 1000;
+
+        {
+            LoggingStreams logstreams{info, warn, error, LOGLEVEL_WARNING,
+                std::make_shared<LogWriter>()};
+
+            std::vector<std::thread> loggers;
+            for (int t = 0; t < threads; ++t)
+            {
+                loggers.emplace_back([&logstreams, t]()
+                {
+                    for (int i = 0; i < messages; ++i)
+                    {
+                        NUKE_MS_LOG(logstreams, LOGLEVEL_INFO, t<<' '<<i);
+                        NUKE_MS_LOG(logstreams, LOGLEVEL_WARNING, t<<' '<<i);
+                    }
+                });
+            }
+
+            for (std::thread& logger : loggers)
+                logger.join();
+        }
+
+        TEST_ASSERT(info.str().empty());
+        TEST_ASSERT(error.str().empty());
+
+        std::vector<std::string> written = lines(warn);
+        TEST_ASSERT(written.size() == std::size_t(threads * messages));
+
+        std::vector<int> next(threads, 0);
+        bool in_order = true;
+        for (const std::string& line : written)
+        {
+            std::istringstream in{line};
+            int t = -1, i = -1;
+            in>>t>>i;
+
+            in_order = in_order && t >= 0 && t < threads && i == next[t];
+            if (t >= 0 && t < threads)
+                ++next[t];
+        }
+        TEST_ASSERT(in_order);
+    }
+
+    return CONCLUDE_TEST();
+}
@@ -0,0 +1,112 @@
+// test_loopback-clientnode.cpp
+
+/*
+ *   nuke-ms - Nuclear Messaging System
+ *   Copyright (C) 2012  Alexander Korsunsky
+ *
+ *   This program is free software: you can redistribute it and/or modify
+ *   it under the terms of the GNU General Public License as published by
+ *   the Free Software Foundation, either version 3 of the License.
+ *
+ *   This program is distributed in the hope that it will be useful,
+ *   but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *   MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ *   GNU General Public License for more details.
+ *
+ *   You should have received a copy of the GNU General Public License
+ *   along with this program.  If not, see <http://www.gnu.org/licenses/>.
+*/
+
+#include <iostream>
+#include <thread>
+#include <boost/asio.hpp>
+
+#include "neartypes.hpp"
+#include "loopback.hpp"
+#include "clientnode/clientnode.hpp"
+#include "servnode/connected-client.hpp"
+
+#include "testutils.hpp"
+#include "signalrecorder.hpp"
+
+
+using namespace nuke_ms;
+using namespace nuke_ms::clientnode;
+
+DECLARE_TEST("ClientNode over a LoopbackTransport")
+
+
+int main()
+{
+    SignalRecorder<ConnectionStatusReport> status;
+    SignalRecorder<byte_traits::msg_string> messages;
+
+    ClientNode client;
+    client.connectConnectionStatusReport(
+        [&](std::shared_ptr<const ConnectionStatusReport> rprt)
+        { status.record(*rprt); }
+    );
+    client.connectRcvMessage(
+        [&](std::shared_ptr<NearUserMessage> msg)
+        { messages.record(msg->_stringwrap._message_string); }
+    );
+
+    // nobody listens yet
+    client.connectTo({"inproc:test-server"});
+    TEST_ASSERT(status.waitFor(1));
+    TEST_ASSERT(status[0].newstate ==
+        ConnectionStatusReport::CNST_DISCONNECTED);
+    TEST_ASSERT(status[0].statechange_reason ==
+        ConnectionStatusReport::STCHR_CONNECT_FAILED);
+
+    // a server that echoes every packet, run by its own thread
+    boost::asio::io_service io_service;
+    std::shared_ptr<servnode::ConnectedClient> connection;
+
+    LoopbackListener listener{io_service, "test-server",
+        [&](Transport&& transport)
+        {
+            connection = servnode::ConnectedClient::makeInstance(
+                0,
+                std::move(transport),
+                [&connection](
+                    servnode::connection_id_t,
+                    const std::shared_ptr<SerializedData>& data
+                )
+                {
+                    connection->sendPacket(
+                        SegmentationLayer<SerializedData>{std::move(*data)}
+                    );
+                },
+                [](servnode::connection_id_t) {}
+            );
+        }
+    };
+
+    boost::asio::io_service::work work{io_service};
+    std::thread server_thread{[&]() { io_service.run(); }};
+
+    client.connectTo({"inproc:test-server"});
+    TEST_ASSERT(status.waitFor(2));
+    TEST_ASSERT(status[1].newstate ==
+        ConnectionStatusReport::CNST_CONNECTED);
+
+    const int count = 100;
+    for (int i = 0; i < count; ++i)
+        client.sendUserMessage("message " + std::to_string(i));
+
+    TEST_ASSERT(messages.waitFor(count));
+
+    bool in_order = true;
+    for (int i = 0; i < count; ++i)
+        in_order = in_order && messages[i] == "message " + std::to_string(i);
+    TEST_ASSERT(in_order);
+
+    client.disconnect();
+    TEST_ASSERT(status.waitFor(3));
+
+    io_service.stop();
+    server_thread.join();
+
+    return CONCLUDE_TEST();
+}
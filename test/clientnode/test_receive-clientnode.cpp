@@ -0,0 +1,134 @@
+// test_receive-clientnode.cpp
+
+/*
+ *   nuke-ms - Nuclear Messaging System
+ *   Copyright (C) 2012  Alexander Korsunsky
+ *
+ *   This program is free software: you can redistribute it and/or modify
+ *   it under the terms of the GNU General Public License as published by
+ *   the Free Software Foundation, version 3 of the License.
+ *
+ *   This program is distributed in the hope that it will be useful,
+ *   but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *   MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ *   GNU General Public License for more details.
+ *
+ *   You should have received a copy of the GNU General Public License
+ *   along with this program.  If not, see <http://www.gnu.org/licenses/>.
+*/
+
+#include <chrono>
+#include <thread>
+#include <boost/asio.hpp>
+
+#include "neartypes.hpp"
+#include "clientnode/clientnode.hpp"
+
+#include "testutils.hpp"
+#include "signalrecorder.hpp"
+
+
+using namespace nuke_ms;
+using namespace nuke_ms::clientnode;
+using namespace boost::asio::ip;
+
+DECLARE_TEST("receiving with ClientNode")
+
+
+/** Text of the i-th message, of a length that varies with i */
+static byte_traits::msg_string messageText(int i)
+{
+    return std::to_string(i) + byte_traits::msg_string(i * 997 % 20000, 'x');
+}
+
+/** Append the packet of the i-th message */
+static void appendMessage(byte_traits::byte_sequence& stream, int i)
+{
+    SegmentationLayer<NearUserMessage> packet{NearUserMessage{
+        StringwrapLayer{messageText(i)}, UniqueUserID{}, UniqueUserID{1ull},
+        static_cast<NearUserMessage::msg_id_t>(i)
+    }};
+
+    std::size_t pos = stream.size();
+    stream.resize(pos + packet.size());
+    packet.fillSerialized(stream.begin() + pos);
+}
+
+int main()
+{
+    SignalRecorder<ConnectionStatusReport> status;
+    SignalRecorder<std::shared_ptr<NearUserMessage>> received;
+
+    ClientNode client;
+    client.connectConnectionStatusReport(
+        [&](std::shared_ptr<const ConnectionStatusReport> rprt)
+        { status.record(*rprt); }
+    );
+    client.connectRcvMessage(
+        [&](std::shared_ptr<NearUserMessage> msg) { received.record(msg); }
+    );
+
+    boost::asio::io_service io_service;
+    tcp::acceptor acceptor{io_service, tcp::endpoint{address_v4::loopback(), 0}};
+    std::string port = std::to_string(acceptor.local_endpoint().port());
+
+    client.connectTo({"127.0.0.1 " + port});
+
+    tcp::socket server_socket{io_service};
+    acceptor.accept(server_socket);
+    server_socket.set_option(tcp::no_delay{true});
+
+    TEST_ASSERT(status.waitFor(1));
+
+    // Many packets in a single write. They are far more than fit into the
+    // receive buffer, so packets are split between reads and the buffer is
+    // reused many times.
+    const int count = 100;
+    byte_traits::byte_sequence stream;
+    for (int i = 0; i < count; ++i)
+        appendMessage(stream, i);
+
+    boost::asio::write(server_socket, boost::asio::buffer(stream));
+
+    // a packet trickling in byte by byte
+    stream.clear();
+    appendMessage(stream, count);
+    for (byte_traits::byte_t byte : stream)
+    {
+        boost::asio::write(server_socket, boost::asio::buffer(&byte, 1));
+        std::this_thread::sleep_for(std::chrono::microseconds{100});
+    }
+
+    // a packet that is not a user message is skipped
+    const byte_traits::byte_t unknown[] = {0x80, 0x06, 0x00, 0x00, 0x7f, 0x00};
+    boost::asio::write(server_socket, boost::asio::buffer(unknown));
+
+    stream.clear();
+    appendMessage(stream, count + 1);
+    boost::asio::write(server_socket, boost::asio::buffer(stream));
+
+    TEST_ASSERT(received.waitFor(count + 2));
+
+    // The messages were kept while the receive buffer was overwritten, so
+    // they must not refer to it
+    bool intact = true;
+    for (int i = 0; i < count + 2; ++i)
+    {
+        intact = intact && received[i]->_msg_id ==
+            static_cast<NearUserMessage::msg_id_t>(i) &&
+            received[i]->_stringwrap._message_string == messageText(i);
+    }
+    TEST_ASSERT(intact);
+
+    // a packet larger than allowed ends the connection
+    const byte_traits::byte_t oversized[] = {0x80, 0x00, 0x90, 0x00};
+    boost::asio::write(server_socket, boost::asio::buffer(oversized));
+
+    TEST_ASSERT(status.waitFor(2));
+    TEST_ASSERT(status[1].newstate ==
+        ConnectionStatusReport::CNST_DISCONNECTED);
+    TEST_ASSERT(status[1].statechange_reason ==
+        ConnectionStatusReport::STCHR_SOCKET_CLOSED);
+
+    return CONCLUDE_TEST();
+}
@@ -0,0 +1,75 @@
+// test_reconnect.cpp
+
+/*
+ *   nuke-ms - Nuclear Messaging System
+ *   Copyright (C) 2012  Alexander Korsunsky
+ *
+ *   This program is free software: you can redistribute it and/or modify
+ *   it under the terms of the GNU General Public License as published by
+ *   the Free Software Foundation, either version 3 of the License.
+ *
+ *   This program is distributed in the hope that it will be useful,
+ *   but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *   MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ *   GNU General Public License for more details.
+ *
+ *   You should have received a copy of the GNU General Public License
+ *   along with this program.  If not, see <http://www.gnu.org/licenses/>.
+*/
+
+#include <algorithm>
+#include <random>
+
+#include "clientnode/reconnect.hpp"
+
+#include "testutils.hpp"
+
+
+using namespace nuke_ms::clientnode;
+
+DECLARE_TEST("struct ReconnectPolicy")
+
+
+int main()
+{
+    // disabled by default
+    TEST_ASSERT(!ReconnectPolicy{}.mayRetry(0));
+
+    // the number of attempts is limited if asked for
+    ReconnectPolicy limited{true, 100, 1000, 3};
+    TEST_ASSERT(limited.mayRetry(0));
+    TEST_ASSERT(limited.mayRetry(2));
+    TEST_ASSERT(!limited.mayRetry(3));
+
+    ReconnectPolicy unlimited{true, 100, 1000};
+    TEST_ASSERT(unlimited.mayRetry(1000000));
+
+    // the ceiling of the delay doubles with each attempt up to the maximum,
+    // and the delays spread out below it
+    std::mt19937 rng{42};
+    const unsigned ceilings[] = {100, 200, 400, 800, 1000, 1000, 1000};
+
+    for (unsigned attempt = 0; attempt < 7; ++attempt)
+    {
+        unsigned lowest = ceilings[attempt], highest = 0;
+        for (int i = 0; i < 1000; ++i)
+        {
+            unsigned delay = unlimited.getDelay(attempt, rng);
+            lowest = std::min(lowest, delay);
+            highest = std::max(highest, delay);
+        }
+
+        TEST_ASSERT(highest <= ceilings[attempt]);
+        TEST_ASSERT(highest >= ceilings[attempt] * 9 / 10);
+        TEST_ASSERT(lowest <= ceilings[attempt] / 10);
+    }
+
+    // many attempts with a long initial delay do not overflow
+    ReconnectPolicy slow{true, 0xffffffffu, 30000};
+    bool capped = true;
+    for (unsigned attempt = 0; attempt < 100; ++attempt)
+        capped = capped && slow.getDelay(attempt, rng) <= 30000;
+    TEST_ASSERT(capped);
+
+    return CONCLUDE_TEST();
+}
@@ -0,0 +1,248 @@
+// test_send-clientnode.cpp
+
+/*
+ *   nuke-ms - Nuclear Messaging System
+ *   Copyright (C) 2012  Alexander Korsunsky
+ *
+ *   This program is free software: you can redistribute it and/or modify
+ *   it under the terms of the GNU General Public License as published by
+ *   the Free Software Foundation, either version 3 of the License.
+ *
+ *   This program is distributed in the hope that it will be useful,
+ *   but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *   MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ *   GNU General Public License for more details.
+ *
+ *   You should have received a copy of the GNU General Public License
+ *   along with this program.  If not, see <http://www.gnu.org/licenses/>.
+*/
+
+#include <chrono>
+#include <future>
+#include <thread>
+#include <boost/asio.hpp>
+
+#include "neartypes.hpp"
+#include "clientnode/clientnode.hpp"
+
+#include "testutils.hpp"
+#include "signalrecorder.hpp"
+
+
+using namespace nuke_ms;
+using namespace nuke_ms::clientnode;
+using namespace boost::asio::ip;
+
+DECLARE_TEST("sending with ClientNode")
+
+
+/** Read one packet from the socket and parse it */
+static NearUserMessage readMessage(tcp::socket& socket)
+{
+    byte_traits::byte_t header[SegmentationLayerBase::header_length];
+    boost::asio::read(socket, boost::asio::buffer(header));
+
+    SegmentationLayerBase::HeaderType header_data =
+        SegmentationLayerBase::decodeHeader(header);
+
+    auto body = std::make_shared<byte_traits::byte_sequence>(
+        header_data.packetsize - SegmentationLayerBase::header_length
+    );
+    boost::asio::read(socket, boost::asio::buffer(*body));
+
+    return NearUserMessage{SerializedData{body, body->begin(), body->size()}};
+}
+
+/** Get the reason a future gives for not sending.
+* @return SendReport::SR_SEND_OK if the message was sent, or the future did
+* not become ready
+*/
+template <typename T>
+static SendReport::send_rprt_reason_t failureReason(std::future<T>& future)
+{
+    if (future.wait_for(std::chrono::seconds{5}) != std::future_status::ready)
+        return SendReport::SR_SEND_OK;
+
+    try {
+        future.get();
+    }
+    catch (const SendError& e)
+    {
+        return e.report.reason;
+    }
+
+    return SendReport::SR_SEND_OK;
+}
+
+int main()
+{
+    SignalRecorder<ConnectionStatusReport> status;
+    SignalRecorder<SendReport> sent;
+
+    ClientNode client;
+    client.connectConnectionStatusReport(
+        [&](std::shared_ptr<const ConnectionStatusReport> rprt)
+        { status.record(*rprt); }
+    );
+    client.connectSendReport(
+        [&](std::shared_ptr<const SendReport> rprt) { sent.record(*rprt); }
+    );
+
+    // the server is a plain socket, on a port chosen by the system
+    boost::asio::io_service io_service;
+    tcp::acceptor acceptor{io_service, tcp::endpoint{address_v4::loopback(), 0}};
+    std::string port = std::to_string(acceptor.local_endpoint().port());
+
+    client.connectTo({"127.0.0.1 " + port});
+
+    tcp::socket server_socket{io_service};
+    acceptor.accept(server_socket);
+
+    TEST_ASSERT(status.waitFor(1));
+    TEST_ASSERT(status[0].newstate ==
+        ConnectionStatusReport::CNST_CONNECTED);
+
+    // Far more than fits into the socket buffers while the server does not
+    // read. The packets must still arrive one after the other.
+    const int count = 200;
+    std::vector<NearUserMessage::msg_id_t> msg_ids;
+    for (int i = 0; i < count; ++i)
+        msg_ids.push_back(client.sendUserMessage(
+            std::to_string(i) + std::string(20000, 'x')
+        ));
+
+    std::this_thread::sleep_for(std::chrono::milliseconds{100});
+
+    bool intact = true;
+    for (int i = 0; i < count; ++i)
+    {
+        NearUserMessage msg = readMessage(server_socket);
+        intact = intact && msg._msg_id == msg_ids[i] &&
+            msg._stringwrap._message_string ==
+                std::to_string(i) + std::string(20000, 'x');
+    }
+    TEST_ASSERT(intact);
+
+    TEST_ASSERT(sent.waitFor(count));
+
+    bool reported = true;
+    for (int i = 0; i < count; ++i)
+        reported = reported && sent[i].send_state &&
+            sent[i].message_id == msg_ids[i];
+    TEST_ASSERT(reported);
+
+    // a batch arrives as one packet after the other, with consecutive
+    // identifiers and one report for each message
+    const int batch_size = 5;
+    std::vector<NearUserMessage> batch;
+    for (int i = 0; i < batch_size; ++i)
+        batch.emplace_back(StringwrapLayer{"batch " + std::to_string(i)});
+
+    NearUserMessage::msg_id_t first_id =
+        client.sendUserMessages(std::move(batch));
+
+    bool batch_intact = true;
+    for (int i = 0; i < batch_size; ++i)
+    {
+        NearUserMessage msg = readMessage(server_socket);
+        batch_intact = batch_intact && msg._msg_id == first_id + i &&
+            msg._stringwrap._message_string == "batch " + std::to_string(i);
+    }
+    TEST_ASSERT(batch_intact);
+
+    TEST_ASSERT(sent.waitFor(count + batch_size));
+
+    bool batch_reported = true;
+    for (int i = 0; i < batch_size; ++i)
+        batch_reported = batch_reported && sent[count + i].send_state &&
+            sent[count + i].message_id == first_id + i;
+    TEST_ASSERT(batch_reported);
+
+    // An empty batch takes no identifier and issues no report, so the next
+    // message is not mistaken for it
+    TEST_ASSERT(client.sendUserMessages(std::vector<NearUserMessage>{}) ==
+        NearUserMessage::msg_id_none);
+
+    NearUserMessage::msg_id_t next_id = client.sendUserMessage("next");
+    TEST_ASSERT(next_id == first_id + batch_size);
+    TEST_ASSERT(readMessage(server_socket)._msg_id == next_id);
+
+    const std::size_t connected_reports = count + batch_size + 1;
+    TEST_ASSERT(sent.waitFor(connected_reports));
+    TEST_ASSERT(sent.back().message_id == next_id);
+
+    // the futures become ready when the messages were written
+    std::future<NearUserMessage::msg_id_t> single =
+        client.sendUserMessageAsync("single");
+
+    std::vector<NearUserMessage> async_batch;
+    for (int i = 0; i < 3; ++i)
+        async_batch.emplace_back(StringwrapLayer{"async"});
+
+    std::future<std::vector<NearUserMessage::msg_id_t>> async_batch_ids =
+        client.sendUserMessagesAsync(std::move(async_batch));
+
+    NearUserMessage::msg_id_t single_id = readMessage(server_socket)._msg_id;
+
+    std::vector<NearUserMessage::msg_id_t> arrived_ids;
+    for (int i = 0; i < 3; ++i)
+        arrived_ids.push_back(readMessage(server_socket)._msg_id);
+
+    TEST_ASSERT(single.wait_for(std::chrono::seconds{5}) ==
+        std::future_status::ready);
+    TEST_ASSERT(single.get() == single_id);
+
+    // the future of a batch holds the identifiers of all of its messages
+    TEST_ASSERT(async_batch_ids.wait_for(std::chrono::seconds{5}) ==
+        std::future_status::ready);
+    TEST_ASSERT(async_batch_ids.get() == arrived_ids);
+
+    std::future<std::vector<NearUserMessage::msg_id_t>> empty_batch_ids =
+        client.sendUserMessagesAsync(std::vector<NearUserMessage>{});
+    TEST_ASSERT(empty_batch_ids.wait_for(std::chrono::seconds{0}) ==
+        std::future_status::ready);
+    TEST_ASSERT(empty_batch_ids.get().empty());
+    TEST_ASSERT(sent.size() == connected_reports);
+
+    client.disconnect();
+    TEST_ASSERT(status.waitFor(2));
+
+    // without a connection, every message of a batch is reported as not sent
+    std::vector<NearUserMessage> unsent;
+    for (int i = 0; i < 3; ++i)
+        unsent.emplace_back(StringwrapLayer{"unsent"});
+
+    first_id = client.sendUserMessages(unsent.begin(), unsent.end());
+
+    TEST_ASSERT(sent.waitFor(connected_reports + 3));
+
+    bool unsent_reported = true;
+    for (int i = 0; i < 3; ++i)
+    {
+        SendReport rprt = sent[connected_reports + i];
+        unsent_reported = unsent_reported && !rprt.send_state &&
+            rprt.reason == SendReport::SR_SERVER_NOT_CONNECTED &&
+            rprt.message_id == first_id + i;
+    }
+    TEST_ASSERT(unsent_reported);
+
+    // without a connection, the futures hold a SendError
+    std::future<NearUserMessage::msg_id_t> refused =
+        client.sendUserMessageAsync("refused");
+    TEST_ASSERT(failureReason(refused) == SendReport::SR_SERVER_NOT_CONNECTED);
+
+    std::vector<NearUserMessage> refused_batch;
+    refused_batch.emplace_back(StringwrapLayer{"refused"});
+    refused_batch.emplace_back(StringwrapLayer{"refused"});
+
+    std::future<std::vector<NearUserMessage::msg_id_t>> refused_batch_ids =
+        client.sendUserMessagesAsync(std::move(refused_batch));
+    TEST_ASSERT(failureReason(refused_batch_ids) ==
+        SendReport::SR_SERVER_NOT_CONNECTED);
+
+    // no reports were issued for the messages with futures
+    std::this_thread::sleep_for(std::chrono::milliseconds{100});
+    TEST_ASSERT(sent.size() == connected_reports + 3);
+
+    return CONCLUDE_TEST();
+}
@@ -0,0 +1,215 @@
+// test_statemachine.cpp
+
+/*
+ *   nuke-ms - Nuclear Messaging System
+ *   Copyright (C) 2012  Alexander Korsunsky
+ *
+ *   This program is free software: you can redistribute it and/or modify
+ *   it under the terms of the GNU General Public License as published by
+ *   the Free Software Foundation, version 3 of the License.
+ *
+ *   This program is distributed in the hope that it will be useful,
+ *   but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *   MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ *   GNU General Public License for more details.
+ *
+ *   You should have received a copy of the GNU General Public License
+ *   along with this program.  If not, see <http://www.gnu.org/licenses/>.
+*/
+
+#include <future>
+#include <boost/asio.hpp>
+
+#include "clientnode/statemachine.hpp"
+
+#include "testutils.hpp"
+#include "signalrecorder.hpp"
+
+
+using namespace nuke_ms;
+using namespace nuke_ms::clientnode;
+using namespace boost::asio::ip;
+
+DECLARE_TEST("class ClientnodeMachine")
+
+
+/** Run a function on the I/O thread of the machine.
+* @return The state of the machine afterwards
+*/
+static state_id_t inMachine(
+    ClientnodeMachine& machine,
+    const std::function<void (ClientnodeMachine&)>& function =
+        std::function<void (ClientnodeMachine&)>{}
+)
+{
+    auto state = std::make_shared<std::promise<state_id_t>>();
+
+    machine.postCommand(std::unique_ptr<MachineCommand>{new FunctionCommand{
+        [function, state](ClientnodeMachine& cm)
+        {
+            if (function)
+                function(cm);
+            state->set_value(cm.state());
+        }
+    }});
+
+    return state->get_future().get();
+}
+
+/** Dispatch an event on the I/O thread of the machine.
+* @return The state of the machine afterwards
+*/
+template <typename Event>
+static state_id_t dispatchEvent(ClientnodeMachine& machine, Event evt)
+{
+    auto shared_evt = std::make_shared<Event>(std::move(evt));
+
+    return inMachine(machine, [shared_evt](ClientnodeMachine& cm)
+        { cm.process_event(*shared_evt); });
+}
+
+static EvtConnectRequest connectRequest(const std::string& port)
+{
+    return EvtConnectRequest{"127.0.0.1", port};
+}
+
+int main()
+{
+    ClientNodeSignals signals;
+    SignalRecorder<ConnectionStatusReport> reports;
+
+    signals.connectStatReport.connect(
+        [&](std::shared_ptr<const ConnectionStatusReport> rprt)
+        { reports.record(*rprt); }
+    );
+
+    boost::asio::io_service io_service;
+    tcp::acceptor acceptor{io_service, tcp::endpoint{address_v4::loopback(), 0}};
+    std::string port = std::to_string(acceptor.local_endpoint().port());
+
+    // accepts the abandoned attempt, so it does not get in the way
+    tcp::acceptor unused{io_service, tcp::endpoint{address_v4::loopback(), 0}};
+    std::string unused_port = std::to_string(unused.local_endpoint().port());
+
+    // a port nobody listens on
+    std::string closed_port;
+    {
+        tcp::acceptor closed{io_service,
+            tcp::endpoint{address_v4::loopback(), 0}};
+        closed_port = std::to_string(closed.local_endpoint().port());
+    }
+
+    ClientnodeMachine machine{signals, LoggingStreams{}};
+
+    // the machine starts waiting, and only a connect request gets it going
+    TEST_ASSERT(inMachine(machine) == STATE_WAITING);
+    TEST_ASSERT(dispatchEvent(machine, EvtConnectReport{true, ""}) ==
+        STATE_WAITING);
+    TEST_ASSERT(dispatchEvent(machine, EvtReconnect{}) == STATE_WAITING);
+    TEST_ASSERT(dispatchEvent(machine, EvtDisconnectRequest{}) ==
+        STATE_WAITING);
+    TEST_ASSERT(dispatchEvent(machine, EvtDisconnected{""}) == STATE_WAITING);
+    TEST_ASSERT(reports.size() == 0);
+
+    // Negotiating until the outcome of the attempt is known, which may be
+    // right away. So the events are dispatched in one go.
+    state_id_t requested = STATE_TERMINATED, busy = STATE_TERMINATED;
+    TEST_ASSERT(inMachine(machine, [&](ClientnodeMachine& cm)
+    {
+        cm.process_event(connectRequest(unused_port));
+        requested = cm.state();
+
+        cm.process_event(connectRequest(unused_port));
+        cm.process_event(EvtDisconnected{""});
+        busy = cm.state();
+
+        // the attempt can be given up
+        cm.process_event(EvtDisconnectRequest{});
+    }) == STATE_WAITING);
+    TEST_ASSERT(requested == STATE_NEGOTIATING);
+    TEST_ASSERT(busy == STATE_NEGOTIATING);
+
+    TEST_ASSERT(reports.waitFor(2));
+    TEST_ASSERT(reports[0].statechange_reason ==
+        ConnectionStatusReport::STCHR_BUSY);
+    TEST_ASSERT(reports.back().statechange_reason ==
+        ConnectionStatusReport::STCHR_USER_REQUESTED);
+
+    // a failed attempt goes back to waiting
+    TEST_ASSERT(dispatchEvent(machine, connectRequest(closed_port)) ==
+        STATE_NEGOTIATING);
+    TEST_ASSERT(reports.waitFor(3));
+    TEST_ASSERT(reports.back().statechange_reason ==
+        ConnectionStatusReport::STCHR_CONNECT_FAILED);
+    TEST_ASSERT(inMachine(machine) == STATE_WAITING);
+
+    // a successful one ends up connected
+    TEST_ASSERT(dispatchEvent(machine, connectRequest(port)) ==
+        STATE_NEGOTIATING);
+
+    tcp::socket server_socket{io_service};
+    acceptor.accept(server_socket);
+
+    TEST_ASSERT(reports.waitFor(4));
+    TEST_ASSERT(inMachine(machine) == STATE_CONNECTED);
+
+    // connected until the connection is lost
+    TEST_ASSERT(dispatchEvent(machine, connectRequest(port)) ==
+        STATE_CONNECTED);
+    TEST_ASSERT(dispatchEvent(machine, EvtConnectReport{false, ""}) ==
+        STATE_CONNECTED);
+    TEST_ASSERT(dispatchEvent(machine, EvtReconnect{}) == STATE_CONNECTED);
+    TEST_ASSERT(reports.waitFor(5));
+    TEST_ASSERT(reports.back().statechange_reason == ConnectionStatusReport::STCHR_BUSY);
+
+    server_socket.close();
+    TEST_ASSERT(reports.waitFor(6));
+    TEST_ASSERT(reports.back().statechange_reason ==
+        ConnectionStatusReport::STCHR_SOCKET_CLOSED);
+    TEST_ASSERT(inMachine(machine) == STATE_WAITING);
+
+    // with automatic reconnects, a lost connection goes back to negotiating
+    inMachine(machine, [](ClientnodeMachine& cm)
+        { cm.reconnect_policy = ReconnectPolicy{true, 10000, 10000}; });
+
+    TEST_ASSERT(dispatchEvent(machine, connectRequest(port)) ==
+        STATE_NEGOTIATING);
+    server_socket = tcp::socket{io_service};
+    acceptor.accept(server_socket);
+    TEST_ASSERT(reports.waitFor(7));
+    TEST_ASSERT(inMachine(machine) == STATE_CONNECTED);
+
+    // the attempts to reconnect fail, and the machine keeps trying
+    acceptor.close();
+    server_socket.close();
+    TEST_ASSERT(reports.waitFor(8));
+    TEST_ASSERT(reports.back().statechange_reason ==
+        ConnectionStatusReport::STCHR_RECONNECTING);
+    TEST_ASSERT(inMachine(machine) == STATE_NEGOTIATING);
+
+    // Shutting down terminates the machine while the reconnect is pending.
+    // From then on, every event is discarded.
+    machine.shutdown();
+    TEST_ASSERT(machine.state() == STATE_TERMINATED);
+
+    std::size_t report_count = reports.size();
+
+    bool completed = false;
+    machine.process_event(EvtConnectRequest{"127.0.0.1", port,
+        CONNECTION_TCP,
+        [&](const boost::system::error_code&) { completed = true; }
+    });
+    machine.process_event(EvtConnectReport{true, ""});
+    machine.process_event(EvtReconnect{});
+    machine.process_event(EvtDisconnectRequest{});
+    machine.process_event(EvtDisconnected{""});
+    machine.process_event(EvtSendMsg<NearUserMessage>{
+        NearUserMessage{StringwrapLayer{"Hello"}}
+    });
+
+    TEST_ASSERT(machine.state() == STATE_TERMINATED);
+    TEST_ASSERT(!completed);
+    TEST_ASSERT(reports.size() == report_count);
+
+    return CONCLUDE_TEST();
+}
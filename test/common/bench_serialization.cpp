@@ -0,0 +1,231 @@
+// bench_serialization.cpp
+
+/*
+ *   nuke-ms - Nuclear Messaging System
+ *   Copyright (C) 2012  Alexander Korsunsky
+ *
+ *   This program is free software: you can redistribute it and/or modify
+ *   it under the terms of the GNU General Public License as published by
+ *   the Free Software Foundation, either version 3 of the License.
+ *
+ *   This program is distributed in the hope that it will be useful,
+ *   but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *   MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ *   GNU General Public License for more details.
+ *
+ *   You should have received a copy of the GNU General Public License
+ *   along with this program.  If not, see <http://www.gnu.org/licenses/>.
+*/
+
+/* Microbenchmark for the serialization of the message layers.
+ *
+ * For every operation and message size, the number of nanoseconds per
+ * operation and the bytes processed per second are written as CSV to the
+ * standard output. The optional argument is the minimum time in
+ * milliseconds each measurement runs (default 200).
+ *
+ * The program exits with a nonzero status if a round trip does not give
+ * back the original data, so a short run doubles as a test.
+*/
+
+#include <algorithm>
+#include <chrono>
+#include <cstdlib>
+#include <iostream>
+#include <vector>
+
+#include "bytes.hpp"
+#include "msglayer.hpp"
+#include "neartypes.hpp"
+
+using namespace nuke_ms;
+
+typedef std::chrono::steady_clock clock_type;
+
+/** Results are added up here, so the compiler can't drop the work */
+static volatile std::size_t sink;
+
+/** Set if a round trip failed */
+static bool roundtrip_failed = false;
+
+/** Minimum duration of a measurement */
+static clock_type::duration min_time = std::chrono::milliseconds{200};
+
+/** Number of repetitions of a measurement, the fastest one is reported */
+static const int repetitions = 5;
+
+
+/** Measure an operation and print the result.
+* @param name Name of the benchmark
+* @param size Message size the operation works on
+* @param op The operation. Returns a value that is added to the sink.
+*/
+template <typename Operation>
+void measure(const char* name, std::size_t size, Operation op)
+{
+    // find an iteration count that takes long enough
+    unsigned long iterations = 1;
+    while (true)
+    {
+        clock_type::time_point start = clock_type::now();
+        for (unsigned long i = 0; i < iterations; ++i)
+            sink = sink + op();
+        if (clock_type::now() - start >= min_time / 10 || iterations >= 1ul<<30)
+            break;
+        iterations *= 2;
+    }
+    iterations *= 10;
+
+    double best_ns = 0;
+    for (int r = 0; r < repetitions; ++r)
+    {
+        clock_type::time_point start = clock_type::now();
+        for (unsigned long i = 0; i < iterations; ++i)
+            sink = sink + op();
+        double ns = std::chrono::duration<double, std::nano>(
+            clock_type::now() - start
+        ).count() / iterations;
+
+        if (r == 0 || ns < best_ns)
+            best_ns = ns;
+    }
+
+    std::cout<<name<<','<<size<<','<<iterations<<','<<best_ns<<','<<
+        (best_ns > 0 ? size * 1e9 / best_ns : 0.0)<<'\n';
+}
+
+static void check(bool ok, const char* name)
+{
+    if (!ok)
+    {
+        std::cerr<<"Round trip failed: "<<name<<'\n';
+        roundtrip_failed = true;
+    }
+}
+
+
+int main(int argc, char* argv[])
+{
+    if (argc > 1)
+        min_time = std::chrono::milliseconds{std::atol(argv[1])};
+
+    std::cout<<"benchmark,size,iterations,ns_per_op,bytes_per_s\n";
+
+    const std::size_t sizes[] = {16, 64, 256, 1024, 4096, 16384, 32768};
+
+    for (std::size_t size : sizes)
+    {
+        const byte_traits::msg_string text(size, 'x');
+
+        // ---- SegmentationLayer<StringwrapLayer> ----
+        SegmentationLayer<StringwrapLayer> segm_sw{StringwrapLayer{text}};
+        byte_traits::byte_sequence buf(segm_sw.size());
+
+        measure("stringwrap_serialize", size, [&]()
+        {
+            SegmentationLayer<StringwrapLayer> msg{StringwrapLayer{text}};
+            msg.fillSerialized(buf.begin());
+            return buf[buf.size() - 1];
+        });
+
+        auto sw_roundtrip = [&]()
+        {
+            SegmentationLayer<StringwrapLayer> msg{StringwrapLayer{text}};
+            msg.fillSerialized(buf.begin());
+
+            SegmentationLayerBase::HeaderType header =
+                SegmentationLayerBase::decodeHeader(buf.begin());
+            StringwrapLayer up{SerializedData{
+                {}, buf.begin() + SegmentationLayerBase::header_length,
+                header.packetsize - SegmentationLayerBase::header_length
+            }};
+            return up._message_string.size();
+        };
+        check(sw_roundtrip() == size, "stringwrap");
+        measure("stringwrap_roundtrip", size, sw_roundtrip);
+
+        // ---- SegmentationLayer<NearUserMessage> ----
+        SegmentationLayer<NearUserMessage> segm_num{NearUserMessage{text}};
+        byte_traits::byte_sequence num_buf(segm_num.size());
+
+        measure("nearuser_serialize", size, [&]()
+        {
+            SegmentationLayer<NearUserMessage> msg{
+                NearUserMessage{text, UniqueUserID{1ull}, UniqueUserID{2ull}, 3}
+            };
+            msg.fillSerialized(num_buf.begin());
+            return num_buf[num_buf.size() - 1];
+        });
+
+        auto num_roundtrip = [&]()
+        {
+            SegmentationLayer<NearUserMessage> msg{
+                NearUserMessage{text, UniqueUserID{1ull}, UniqueUserID{2ull}, 3}
+            };
+            msg.fillSerialized(num_buf.begin());
+
+            SegmentationLayerBase::HeaderType header =
+                SegmentationLayerBase::decodeHeader(num_buf.begin());
+            NearUserMessage up{SerializedData{
+                {}, num_buf.begin() + SegmentationLayerBase::header_length,
+                header.packetsize - SegmentationLayerBase::header_length
+            }};
+            return up._stringwrap._message_string.size() + up._msg_id;
+        };
+        check(num_roundtrip() == size + 3, "nearuser");
+        measure("nearuser_roundtrip", size, num_roundtrip);
+
+        // ---- SegmentationLayer<SerializedData> ----
+        auto payload = std::make_shared<byte_traits::byte_sequence>(size, 0x55);
+        byte_traits::byte_sequence sd_buf(
+            size + SegmentationLayerBase::header_length
+        );
+
+        auto sd_roundtrip = [&]()
+        {
+            SegmentationLayer<SerializedData> msg{
+                SerializedData{payload, payload->begin(), payload->size()}
+            };
+            msg.fillSerialized(sd_buf.begin());
+
+            SegmentationLayerBase::HeaderType header =
+                SegmentationLayerBase::decodeHeader(sd_buf.begin());
+            SegmentationLayer<SerializedData> up{SerializedData{
+                {}, sd_buf.begin() + SegmentationLayerBase::header_length,
+                header.packetsize - SegmentationLayerBase::header_length
+            }};
+            return up._inner_layer.size();
+        };
+        check(sd_roundtrip() == size, "serializeddata");
+        measure("serializeddata_roundtrip", size, sd_roundtrip);
+
+        // ---- reversebytes ----
+        std::vector<byte_traits::uint4b_t> words(
+            size / sizeof(byte_traits::uint4b_t)
+        );
+        for (std::size_t i = 0; i < words.size(); ++i)
+            words[i] = static_cast<byte_traits::uint4b_t>(i * 0x01020304u);
+
+        measure("reversebytes_uint4b", size, [&]()
+        {
+            for (byte_traits::uint4b_t& w : words)
+                w = reversebytes(w);
+            return words[0];
+        });
+    }
+
+    // ---- decodeHeader, independent of the message size ----
+    SegmentationLayer<StringwrapLayer> header_msg{StringwrapLayer{"hello"}};
+    byte_traits::byte_sequence header_buf(header_msg.size());
+    header_msg.fillSerialized(header_buf.begin());
+
+    check(SegmentationLayerBase::decodeHeader(header_buf.begin()).packetsize ==
+        header_buf.size(), "decodeHeader");
+    measure("decode_header", SegmentationLayerBase::header_length, [&]()
+    {
+        return SegmentationLayerBase::decodeHeader(
+            header_buf.begin()).packetsize;
+    });
+
+    return roundtrip_failed ? 1 : 0;
+}
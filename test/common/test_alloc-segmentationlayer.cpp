@@ -0,0 +1,119 @@
+// test_alloc-segmentationlayer.cpp
+
+/*
+ *   nuke-ms - Nuclear Messaging System
+ *   Copyright (C) 2012  Alexander Korsunsky
+ *
+ *   This program is free software: you can redistribute it and/or modify
+ *   it under the terms of the GNU General Public License as published by
+ *   the Free Software Foundation, either version 3 of the License.
+ *
+ *   This program is distributed in the hope that it will be useful,
+ *   but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *   MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ *   GNU General Public License for more details.
+ *
+ *   You should have received a copy of the GNU General Public License
+ *   along with this program.  If not, see <http://www.gnu.org/licenses/>.
+*/
+
+#include <iostream>
+#include <memory>
+#include <string>
+
+#include "neartypes.hpp"
+#include "msglayer.hpp"
+
+#include "alloccount.hpp"
+#include "testutils.hpp"
+
+DECLARE_TEST("allocations of SegmentationLayer")
+
+using namespace nuke_ms;
+
+// Allowed allocations per message. Lower these when an allocation is removed.
+
+/** Serializing a finished packet into an existing buffer */
+static const double max_allocs_fill = 0.0;
+
+/** Creating a packet from a message text and serializing it */
+static const double max_allocs_serialize = 1.0;
+
+/** Decoding a received packet into a NearUserMessage */
+static const double max_allocs_deserialize = 1.0;
+
+
+static const int warmup_iterations = 100;
+static const int iterations = 10000;
+
+int main()
+{
+    // long enough to not fit into the small string buffer
+    const std::string text(100, 'x');
+    const UniqueUserID sender{1ull};
+
+    SegmentationLayer<NearUserMessage> packet{
+        NearUserMessage{StringwrapLayer{text}, UniqueUserID{}, sender, 1}
+    };
+    byte_traits::byte_sequence buffer(packet.size());
+
+    // serialize a packet over and over
+    for (int i = 0; i < warmup_iterations; ++i)
+        packet.fillSerialized(buffer.begin());
+
+    AllocationCounter counter;
+    for (int i = 0; i < iterations; ++i)
+        packet.fillSerialized(buffer.begin());
+
+    double fill = counter.perOperation(iterations);
+    std::cout<<"fillSerialized: "<<fill<<" allocations per packet\n";
+    TEST_ASSERT(fill <= max_allocs_fill);
+
+    // build the packet from the text every time, like a sender does
+    counter.reset();
+    for (int i = 0; i < iterations; ++i)
+    {
+        SegmentationLayer<NearUserMessage> p{
+            NearUserMessage{StringwrapLayer{text}, UniqueUserID{}, sender,
+                NearUserMessage::msg_id_t(i)}
+        };
+        p.fillSerialized(buffer.begin());
+    }
+
+    double serialize = counter.perOperation(iterations);
+    std::cout<<"serialize: "<<serialize<<" allocations per packet\n";
+    TEST_ASSERT(serialize <= max_allocs_serialize);
+
+    // decode the packet from a shared receive buffer, like a receiver does
+    auto rcvbuf = std::make_shared<byte_traits::byte_sequence>(buffer);
+    std::size_t received = 0;
+
+    auto decode = [&]()
+    {
+        SegmentationLayerBase::HeaderType header =
+            SegmentationLayerBase::decodeHeader(rcvbuf->begin());
+
+        SegmentationLayer<SerializedData> segmlayer{SerializedData{
+            rcvbuf,
+            rcvbuf->begin() + SegmentationLayerBase::header_length,
+            header.packetsize - SegmentationLayerBase::header_length
+        }};
+
+        NearUserMessage msg{segmlayer._inner_layer};
+        received += msg._stringwrap._message_string.size();
+    };
+
+    for (int i = 0; i < warmup_iterations; ++i)
+        decode();
+
+    counter.reset();
+    for (int i = 0; i < iterations; ++i)
+        decode();
+
+    double deserialize = counter.perOperation(iterations);
+    std::cout<<"deserialize: "<<deserialize<<" allocations per packet\n";
+    TEST_ASSERT(deserialize <= max_allocs_deserialize);
+    TEST_ASSERT(received == (warmup_iterations + iterations) * text.size());
+
+    return CONCLUDE_TEST();
+}
@@ -0,0 +1,141 @@
+// test_datagram.cpp
+
+/*
+ *   nuke-ms - Nuclear Messaging System
+ *   Copyright (C) 2012  Alexander Korsunsky
+ *
+ *   This program is free software: you can redistribute it and/or modify
+ *   it under the terms of the GNU General Public License as published by
+ *   the Free Software Foundation, either version 3 of the License.
+ *
+ *   This program is distributed in the hope that it will be useful,
+ *   but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *   MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ *   GNU General Public License for more details.
+ *
+ *   You should have received a copy of the GNU General Public License
+ *   along with this program.  If not, see <http://www.gnu.org/licenses/>.
+*/
+
+#include <iostream>
+#include <string>
+#include <vector>
+
+#include <boost/asio/io_service.hpp>
+
+#include "datagram.hpp"
+
+#include "testutils.hpp"
+
+DECLARE_TEST("class DatagramSocket")
+
+using namespace nuke_ms;
+using boost::asio::ip::udp;
+
+
+/** Open a socket on a free port of the loopback interface */
+static DatagramSocket makeSocket(boost::asio::io_service& io_service)
+{
+    return DatagramSocket{udp::socket{
+        io_service, udp::endpoint{boost::asio::ip::address_v4::loopback(), 0}
+    }};
+}
+
+/** Wait until a datagram is waiting */
+static void waitReadable(DatagramSocket& socket)
+{
+    socket.getSocket().wait(udp::socket::wait_read);
+}
+
+static std::string toString(const boost::asio::const_buffer& buffer)
+{
+    return std::string(static_cast<const char*>(buffer.data()), buffer.size());
+}
+
+int main()
+{
+    boost::asio::io_service io_service;
+
+    DatagramSocket sender = makeSocket(io_service);
+
+    // nothing is waiting
+    {
+        DatagramSocket receiver = makeSocket(io_service);
+        boost::system::error_code error;
+        TEST_ASSERT(receiver.receive(error) == 0);
+        TEST_ASSERT(error == boost::asio::error::would_block);
+    }
+
+    // one datagram to many receivers
+    {
+        std::vector<DatagramSocket> receivers;
+        std::vector<udp::endpoint> endpoints;
+        for (int i = 0; i < 3; ++i)
+        {
+            receivers.push_back(makeSocket(io_service));
+            endpoints.push_back(receivers.back().getSocket().local_endpoint());
+        }
+
+        const std::string text = "to everyone";
+        boost::system::error_code error;
+        TEST_ASSERT(sender.sendToAll(boost::asio::buffer(text),
+            endpoints.data(), endpoints.size(), error) == endpoints.size());
+        TEST_ASSERT(!error);
+
+        for (DatagramSocket& receiver : receivers)
+        {
+            waitReadable(receiver);
+            TEST_ASSERT(receiver.receive(error) == 1);
+            TEST_ASSERT(!error);
+            TEST_ASSERT(toString(receiver.datagram(0)) == text);
+            TEST_ASSERT(!receiver.truncated(0));
+            TEST_ASSERT(receiver.sender(0) ==
+                sender.getSocket().local_endpoint());
+        }
+    }
+
+    // many datagrams to one receiver, fetched in batches in order
+    {
+        DatagramSocket receiver = makeSocket(io_service);
+        udp::endpoint endpoint = receiver.getSocket().local_endpoint();
+
+        const int count = DatagramSocket::batch_size + 10;
+        boost::system::error_code error;
+        for (int i = 0; i < count; ++i)
+        {
+            std::string text = "datagram " + std::to_string(i);
+            sender.sendToAll(boost::asio::buffer(text), &endpoint, 1, error);
+            TEST_ASSERT(!error);
+        }
+
+        std::vector<std::string> received;
+        while (received.size() < std::size_t(count))
+        {
+            waitReadable(receiver);
+
+            std::size_t n = receiver.receive(error);
+            TEST_ASSERT(!error && n <= DatagramSocket::batch_size);
+
+            for (std::size_t i = 0; i < n; ++i)
+                received.push_back(toString(receiver.datagram(i)));
+        }
+
+        bool in_order = true;
+        for (int i = 0; i < count; ++i)
+            in_order = in_order && received[i] == "datagram " + std::to_string(i);
+        TEST_ASSERT(in_order);
+
+        // a datagram that is too long is cut off and marked
+        std::string big(DatagramSocket::max_datagram_size + 100, 'x');
+        sender.sendToAll(boost::asio::buffer(big), &endpoint, 1, error);
+        TEST_ASSERT(!error);
+
+        waitReadable(receiver);
+        TEST_ASSERT(receiver.receive(error) == 1);
+        TEST_ASSERT(receiver.truncated(0));
+        TEST_ASSERT(receiver.datagram(0).size() ==
+            DatagramSocket::max_datagram_size);
+    }
+
+    return CONCLUDE_TEST();
+}
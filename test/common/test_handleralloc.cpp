@@ -0,0 +1,92 @@
+// test_handleralloc.cpp
+
+/*
+ *   nuke-ms - Nuclear Messaging System
+ *   Copyright (C) 2012  Alexander Korsunsky
+ *
+ *   This program is free software: you can redistribute it and/or modify
+ *   it under the terms of the GNU General Public License as published by
+ *   the Free Software Foundation, either version 3 of the License.
+ *
+ *   This program is distributed in the hope that it will be useful,
+ *   but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *   MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ *   GNU General Public License for more details.
+ *
+ *   You should have received a copy of the GNU General Public License
+ *   along with this program.  If not, see <http://www.gnu.org/licenses/>.
+*/
+
+#include <boost/asio.hpp>
+
+#include "handleralloc.hpp"
+
+#include "testutils.hpp"
+
+DECLARE_TEST("class HandlerMemory")
+
+using namespace nuke_ms;
+
+struct ChainHandler
+{
+    boost::asio::io_service& io_service;
+    std::shared_ptr<HandlerMemory> memory;
+    unsigned& remaining;
+    bool& always_recycled;
+
+    void operator() ()
+    {
+        // the memory of this handler was given back before it was invoked
+        if (memory->inUse())
+            always_recycled = false;
+
+        if (--remaining > 0)
+            io_service.post(makeAllocHandler(memory, *this));
+    }
+};
+
+int main()
+{
+    auto memory = std::make_shared<HandlerMemory>();
+    HandlerAllocator<char> alloc{*memory};
+
+    // the block is handed out once, then the free store is used
+    char* first = alloc.allocate(16);
+    TEST_ASSERT(memory->inUse());
+
+    char* second = alloc.allocate(16);
+    TEST_ASSERT(second != first);
+
+    alloc.deallocate(second, 16);
+    TEST_ASSERT(memory->inUse());
+
+    alloc.deallocate(first, 16);
+    TEST_ASSERT(!memory->inUse());
+
+    // after returning it, the block is handed out again
+    TEST_ASSERT(alloc.allocate(16) == first);
+    alloc.deallocate(first, 16);
+
+    // oversized requests never get the block
+    char* big = alloc.allocate(HandlerMemory::block_size + 1);
+    TEST_ASSERT(!memory->inUse());
+    alloc.deallocate(big, HandlerMemory::block_size + 1);
+
+    // a chain of asynchronous operations recycles the same block
+    boost::asio::io_service io_service;
+    unsigned remaining = 1000;
+    bool always_recycled = true;
+
+    io_service.post(makeAllocHandler(
+        memory, ChainHandler{io_service, memory, remaining, always_recycled}
+    ));
+    TEST_ASSERT(memory->inUse());
+
+    io_service.run();
+
+    TEST_ASSERT(remaining == 0);
+    TEST_ASSERT(always_recycled);
+    TEST_ASSERT(!memory->inUse());
+
+    return CONCLUDE_TEST();
+}
@@ -0,0 +1,105 @@
+// test_hashring.cpp
+
+/*
+ *   nuke-ms - Nuclear Messaging System
+ *   Copyright (C) 2012  Alexander Korsunsky
+ *
+ *   This program is free software: you can redistribute it and/or modify
+ *   it under the terms of the GNU General Public License as published by
+ *   the Free Software Foundation, version 3 of the License.
+ *
+ *   This program is distributed in the hope that it will be useful,
+ *   but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *   MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ *   GNU General Public License for more details.
+ *
+ *   You should have received a copy of the GNU General Public License
+ *   along with this program.  If not, see <http://www.gnu.org/licenses/>.
+*/
+
+#include <map>
+#include <vector>
+
+#include "hashring.hpp"
+
+#include "testutils.hpp"
+
+DECLARE_TEST("class HashRing")
+
+using namespace nuke_ms;
+
+int main()
+{
+    const unsigned users = 20000;
+
+    HashRing ring;
+
+    // nobody has a home without servers
+    TEST_ASSERT(ring.empty());
+    TEST_ASSERT(ring.nodeFor(UniqueUserID{42ull}) == UniqueUserID::user_id_none);
+
+    ring.addNode(UniqueUserID{1ull});
+    ring.addNode(UniqueUserID{1ull});
+    TEST_ASSERT(ring.size() == 1);
+    TEST_ASSERT(ring.nodeFor(UniqueUserID{42ull}) == UniqueUserID{1ull});
+
+    for (unsigned long long node = 2; node <= 4; ++node)
+        ring.addNode(UniqueUserID{node});
+    TEST_ASSERT(ring.size() == 4 && ring.contains(UniqueUserID{3ull}));
+
+    // every server gets a fair share of the users
+    std::vector<UniqueUserID> homes;
+    std::map<unsigned long long, unsigned> shares;
+    for (unsigned i = 0; i < users; ++i)
+    {
+        homes.push_back(ring.nodeFor(UniqueUserID{i * 7919ull + 13}));
+        ++shares[homes.back().id];
+    }
+
+    TEST_ASSERT(shares.size() == 4);
+    for (const auto& share : shares)
+    {
+        std::cout<<"Server "<<share.first<<": "<<share.second<<" users\n";
+        TEST_ASSERT(share.second > users / 4 * 7 / 10);
+        TEST_ASSERT(share.second < users / 4 * 13 / 10);
+    }
+
+    // a fifth server takes about a fifth of the users, all from the others
+    ring.addNode(UniqueUserID{5ull});
+
+    unsigned moved = 0;
+    for (unsigned i = 0; i < users; ++i)
+    {
+        UniqueUserID home = ring.nodeFor(UniqueUserID{i * 7919ull + 13});
+        if (home == homes[i])
+            continue;
+
+        TEST_ASSERT(home == UniqueUserID{5ull});
+        ++moved;
+    }
+
+    std::cout<<"Users moved to the new server: "<<moved<<'\n';
+    TEST_ASSERT(moved > users / 5 * 7 / 10);
+    TEST_ASSERT(moved < users / 5 * 13 / 10);
+
+    // removing it again moves exactly those users back
+    ring.removeNode(UniqueUserID{5ull});
+    TEST_ASSERT(ring.size() == 4 && !ring.contains(UniqueUserID{5ull}));
+
+    bool all_back = true;
+    for (unsigned i = 0; i < users; ++i)
+        all_back &= ring.nodeFor(UniqueUserID{i * 7919ull + 13}) == homes[i];
+    TEST_ASSERT(all_back);
+
+    // the order the servers were added in does not matter
+    HashRing other;
+    for (unsigned long long node = 4; node >= 1; --node)
+        other.addNode(UniqueUserID{node});
+
+    bool same_homes = true;
+    for (unsigned i = 0; i < users; ++i)
+        same_homes &= other.nodeFor(UniqueUserID{i * 7919ull + 13}) == homes[i];
+    TEST_ASSERT(same_homes);
+
+    return CONCLUDE_TEST();
+}
@@ -0,0 +1,279 @@
+// test_loopback.cpp
+
+/*
+ *   nuke-ms - Nuclear Messaging System
+ *   Copyright (C) 2012  Alexander Korsunsky
+ *
+ *   This program is free software: you can redistribute it and/or modify
+ *   it under the terms of the GNU General Public License as published by
+ *   the Free Software Foundation, either version 3 of the License.
+ *
+ *   This program is distributed in the hope that it will be useful,
+ *   but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *   MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ *   GNU General Public License for more details.
+ *
+ *   You should have received a copy of the GNU General Public License
+ *   along with this program.  If not, see <http://www.gnu.org/licenses/>.
+*/
+
+#include <iostream>
+#include <thread>
+#include <vector>
+
+#include <boost/asio/read.hpp>
+#include <boost/asio/write.hpp>
+
+#include "loopback.hpp"
+
+#include "testutils.hpp"
+
+DECLARE_TEST("class LoopbackTransport")
+
+using namespace nuke_ms;
+
+
+/** Bytes that differ from position to position */
+static std::vector<unsigned char> pattern(std::size_t size, unsigned seed)
+{
+    std::vector<unsigned char> v(size);
+    for (std::size_t i = 0; i < size; ++i)
+        v[i] = static_cast<unsigned char>((i * 7 + seed) ^ (i >> 9));
+    return v;
+}
+
+int main()
+{
+    // two io_services run by two threads, with more data in flight than
+    // fits into the buffers
+    {
+        boost::asio::io_service io_service1, io_service2;
+        auto ends = LoopbackTransport::createPair(io_service1, io_service2);
+        Transport t1{io_service1, std::move(ends.first)};
+        Transport t2{io_service2, std::move(ends.second)};
+        TEST_ASSERT(t1.isOpen() && t2.isOpen());
+
+        const std::size_t chunk = 50000;
+        const int writes = 3 * LoopbackTransport::buffer_size / chunk;
+
+        std::vector<std::vector<unsigned char>> to_t2, to_t1;
+        for (int i = 0; i < writes; ++i)
+        {
+            to_t2.push_back(pattern(chunk, i));
+            to_t1.push_back(pattern(chunk, i + 100));
+        }
+
+        int written1 = 0, written2 = 0;
+        for (int i = 0; i < writes; ++i)
+        {
+            boost::asio::async_write(t1, boost::asio::buffer(to_t2[i]),
+                [&](const boost::system::error_code& e, std::size_t n)
+                {
+                    TEST_ASSERT(!e && n == chunk);
+                    ++written1;
+                }
+            );
+            boost::asio::async_write(t2, boost::asio::buffer(to_t1[i]),
+                [&](const boost::system::error_code& e, std::size_t n)
+                {
+                    TEST_ASSERT(!e && n == chunk);
+                    ++written2;
+                }
+            );
+        }
+
+        std::vector<unsigned char> in1(chunk * writes), in2(chunk * writes);
+        std::size_t read1 = 0, read2 = 0;
+
+        boost::asio::async_read(t1, boost::asio::buffer(in1),
+            [&](const boost::system::error_code& e, std::size_t n)
+            {
+                TEST_ASSERT(!e);
+                read1 = n;
+            }
+        );
+        boost::asio::async_read(t2, boost::asio::buffer(in2),
+            [&](const boost::system::error_code& e, std::size_t n)
+            {
+                TEST_ASSERT(!e);
+                read2 = n;
+            }
+        );
+
+        // each io_service runs out of work when its reads and writes are done
+        std::thread thread2{[&]() { io_service2.run(); }};
+        io_service1.run();
+        thread2.join();
+
+        TEST_ASSERT(written1 == writes && written2 == writes);
+        TEST_ASSERT(read1 == in1.size() && read2 == in2.size());
+
+        bool intact = true;
+        for (int i = 0; i < writes; ++i)
+        {
+            intact = intact &&
+                std::equal(to_t2[i].begin(), to_t2[i].end(),
+                    in2.begin() + i * chunk) &&
+                std::equal(to_t1[i].begin(), to_t1[i].end(),
+                    in1.begin() + i * chunk);
+        }
+        TEST_ASSERT(intact);
+    }
+
+    boost::asio::io_service io_service;
+
+    // bytes written before closing are still delivered, then the stream
+    // ends, and writing to the closed connection fails
+    {
+        auto ends = LoopbackTransport::createPair(io_service, io_service);
+        Transport t1{io_service, std::move(ends.first)};
+        Transport t2{io_service, std::move(ends.second)};
+
+        const std::vector<unsigned char> last = pattern(100, 42);
+        boost::asio::async_write(t1, boost::asio::buffer(last),
+            [](const boost::system::error_code& e, std::size_t)
+            { TEST_ASSERT(!e); }
+        );
+
+        io_service.run();
+        io_service.reset();
+
+        boost::system::error_code error;
+        t1.close(error);
+        TEST_ASSERT(!error && !t1.isOpen());
+
+        std::vector<unsigned char> rest(200);
+        std::size_t rest_read = 0;
+        boost::system::error_code rest_error;
+        boost::asio::async_read(t2, boost::asio::buffer(rest),
+            [&](const boost::system::error_code& e, std::size_t n)
+            {
+                rest_error = e;
+                rest_read = n;
+            }
+        );
+
+        boost::system::error_code write_error;
+        boost::asio::async_write(t2, boost::asio::buffer(last),
+            [&](const boost::system::error_code& e, std::size_t)
+            { write_error = e; }
+        );
+
+        io_service.run();
+        io_service.reset();
+
+        TEST_ASSERT(rest_error == boost::asio::error::eof);
+        TEST_ASSERT(rest_read == last.size());
+        TEST_ASSERT(std::equal(last.begin(), last.end(), rest.begin()));
+        TEST_ASSERT(write_error == boost::asio::error::broken_pipe);
+    }
+
+    // closing aborts a pending read
+    {
+        auto ends = LoopbackTransport::createPair(io_service, io_service);
+        Transport t1{io_service, std::move(ends.first)};
+        Transport t2{io_service, std::move(ends.second)};
+
+        char buffer[4];
+        boost::system::error_code read_error;
+        bool read_done = false;
+        t1.async_read_some(boost::asio::buffer(buffer),
+            [&](const boost::system::error_code& e, std::size_t)
+            {
+                read_error = e;
+                read_done = true;
+            }
+        );
+
+        io_service.poll();
+        io_service.reset();
+        TEST_ASSERT(!read_done);
+
+        boost::system::error_code error;
+        t1.close(error);
+
+        io_service.run();
+        io_service.reset();
+
+        TEST_ASSERT(read_done);
+        TEST_ASSERT(read_error == boost::asio::error::operation_aborted);
+    }
+
+    // connecting through a listener
+    {
+        boost::system::error_code error;
+        TEST_ASSERT(!LoopbackListener::connect(io_service, "test", error));
+        TEST_ASSERT(error == boost::asio::error::connection_refused);
+
+        std::vector<Transport> accepted;
+        std::unique_ptr<LoopbackListener> listener{new LoopbackListener{
+            io_service, "test",
+            [&](Transport&& transport)
+            { accepted.push_back(std::move(transport)); }
+        }};
+
+        // a name is only registered once
+        bool thrown = false;
+        try {
+            LoopbackListener second{io_service, "test",
+                [](Transport&&) {}};
+        }
+        catch (const boost::system::system_error& e)
+        {
+            thrown = e.code() == boost::asio::error::address_in_use;
+        }
+        TEST_ASSERT(thrown);
+
+        Transport client{io_service,
+            LoopbackListener::connect(io_service, "test", error)};
+        TEST_ASSERT(!error && client.isOpen());
+
+        // the client end can be written before the server end is accepted
+        const std::string hello = "hello";
+        boost::asio::async_write(client, boost::asio::buffer(hello),
+            [](const boost::system::error_code& e, std::size_t)
+            { TEST_ASSERT(!e); }
+        );
+
+        io_service.run();
+        io_service.reset();
+
+        TEST_ASSERT(accepted.size() == 1);
+
+        std::string in(hello.size(), '\0');
+        boost::asio::async_read(accepted[0], boost::asio::buffer(&in[0], in.size()),
+            [](const boost::system::error_code& e, std::size_t)
+            { TEST_ASSERT(!e); }
+        );
+
+        io_service.run();
+        io_service.reset();
+
+        TEST_ASSERT(in == hello);
+
+        // connections not yet accepted when the listener goes away are closed
+        Transport late{io_service,
+            LoopbackListener::connect(io_service, "test", error)};
+        TEST_ASSERT(!error);
+        listener.reset();
+
+        char c;
+        boost::system::error_code late_error;
+        late.async_read_some(boost::asio::buffer(&c, 1),
+            [&](const boost::system::error_code& e, std::size_t)
+            { late_error = e; }
+        );
+
+        io_service.run();
+        io_service.reset();
+
+        TEST_ASSERT(accepted.size() == 1);
+        TEST_ASSERT(late_error == boost::asio::error::eof);
+
+        // the name is free again
+        TEST_ASSERT(!LoopbackListener::connect(io_service, "test", error));
+        TEST_ASSERT(error == boost::asio::error::connection_refused);
+    }
+
+    return CONCLUDE_TEST();
+}
@@ -0,0 +1,90 @@
+// test_metrics.cpp
+
+/*
+ *   nuke-ms - Nuclear Messaging System
+ *   Copyright (C) 2012  Alexander Korsunsky
+ *
+ *   This program is free software: you can redistribute it and/or modify
+ *   it under the terms of the GNU General Public License as published by
+ *   the Free Software Foundation, either version 3 of the License.
+ *
+ *   This program is distributed in the hope that it will be useful,
+ *   but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *   MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ *   GNU General Public License for more details.
+ *
+ *   You should have received a copy of the GNU General Public License
+ *   along with this program.  If not, see <http://www.gnu.org/licenses/>.
+*/
+
+#include <sstream>
+#include <boost/thread.hpp>
+
+#include "metrics.hpp"
+
+#include "testutils.hpp"
+
+DECLARE_TEST("Metrics")
+
+using namespace nuke_ms;
+
+static const unsigned num_threads = 4;
+static const unsigned increments_per_thread = 100000;
+
+void increment(Counter& counter)
+{
+    for (unsigned i = 0; i < increments_per_thread; ++i)
+        counter.add();
+}
+
+int main()
+{
+    // counters add up all threads
+    Counter counter;
+    boost::thread_group threads;
+    for (unsigned t = 0; t < num_threads; ++t)
+        threads.create_thread(boost::bind(increment, boost::ref(counter)));
+    threads.join_all();
+
+    TEST_ASSERT(counter.value() == num_threads * increments_per_thread);
+
+    // an empty histogram has no percentiles
+    LatencyHistogram hist;
+    TEST_ASSERT(hist.percentile(0.5) == 0);
+
+    // small values are exact
+    for (std::uint64_t v = 1; v <= 4; ++v)
+        hist.record(v);
+    TEST_ASSERT(hist.count() == 4);
+    TEST_ASSERT(hist.sum() == 10);
+    TEST_ASSERT(hist.percentile(0.5) == 2);
+    TEST_ASSERT(hist.percentile(1.0) == 4);
+
+    // larger values are within 1/sub_buckets
+    LatencyHistogram hist2;
+    for (std::uint64_t v = 1; v <= 1000; ++v)
+        hist2.record(v * 1000);
+
+    std::uint64_t p99 = hist2.percentile(0.99);
+    TEST_ASSERT(p99 >= 990000);
+    TEST_ASSERT(p99 <= 990000 + 990000 / LatencyHistogram::sub_buckets);
+
+    // huge values don't overflow the buckets
+    hist2.record(~std::uint64_t{0});
+    TEST_ASSERT(hist2.percentile(1.0) > p99);
+
+    // the registry hands out the same metric for the same name
+    MetricsRegistry registry;
+    TEST_ASSERT(&registry.counter("a") == &registry.counter("a"));
+    TEST_ASSERT(&registry.counter("a") != &registry.counter("b"));
+
+    registry.counter("a").add(3);
+    registry.gauge("g").set(-2);
+
+    std::ostringstream out;
+    registry.write(out);
+    TEST_ASSERT(out.str().find("a 3\n") != std::string::npos);
+    TEST_ASSERT(out.str().find("g -2\n") != std::string::npos);
+
+    return CONCLUDE_TEST();
+}
@@ -0,0 +1,94 @@
+// test_mpscqueue.cpp
+
+/*
+ *   nuke-ms - Nuclear Messaging System
+ *   Copyright (C) 2012  Alexander Korsunsky
+ *
+ *   This program is free software: you can redistribute it and/or modify
+ *   it under the terms of the GNU General Public License as published by
+ *   the Free Software Foundation, either version 3 of the License.
+ *
+ *   This program is distributed in the hope that it will be useful,
+ *   but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *   MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ *   GNU General Public License for more details.
+ *
+ *   You should have received a copy of the GNU General Public License
+ *   along with this program.  If not, see <http://www.gnu.org/licenses/>.
+*/
+
+#include <vector>
+#include <boost/thread.hpp>
+
+#include "mpscqueue.hpp"
+
+#include "testutils.hpp"
+
+DECLARE_TEST("class MPSCQueue")
+
+using namespace nuke_ms;
+
+struct Item : public MPSCQueueNode
+{
+    unsigned producer;
+    unsigned sequence;
+
+    Item(unsigned p, unsigned s) : producer{p}, sequence{s} {}
+};
+
+static const unsigned num_producers = 4;
+static const unsigned items_per_producer = 100000;
+
+void produce(MPSCQueue<Item>& queue, unsigned producer)
+{
+    for (unsigned i = 0; i < items_per_producer; ++i)
+        queue.push(std::unique_ptr<Item>{new Item{producer, i}});
+}
+
+int main()
+{
+    MPSCQueue<Item> queue;
+
+    // an empty queue gives nothing
+    TEST_ASSERT(!queue.pop());
+
+    // single threaded: first in, first out
+    queue.push(std::unique_ptr<Item>{new Item{0, 1}});
+    queue.push(std::unique_ptr<Item>{new Item{0, 2}});
+    TEST_ASSERT(queue.pop()->sequence == 1);
+    queue.push(std::unique_ptr<Item>{new Item{0, 3}});
+    TEST_ASSERT(queue.pop()->sequence == 2);
+    TEST_ASSERT(queue.pop()->sequence == 3);
+    TEST_ASSERT(!queue.pop());
+
+    // multiple producers: every item arrives, in order per producer
+    boost::thread_group producers;
+    for (unsigned p = 0; p < num_producers; ++p)
+        producers.create_thread(boost::bind(produce, boost::ref(queue), p));
+
+    std::vector<unsigned> next_sequence(num_producers, 0);
+    unsigned long received = 0;
+    bool in_order = true;
+
+    while (received < num_producers * items_per_producer)
+    {
+        std::unique_ptr<Item> item = queue.pop();
+        if (!item)
+            continue;
+
+        if (item->sequence != next_sequence[item->producer]++)
+            in_order = false;
+
+        ++received;
+    }
+
+    producers.join_all();
+
+    TEST_ASSERT(in_order);
+    TEST_ASSERT(!queue.pop());
+
+    // elements left in the queue are destroyed with it
+    queue.push(std::unique_ptr<Item>{new Item{0, 0}});
+
+    return CONCLUDE_TEST();
+}
@@ -88,5 +88,100 @@ int main()
         TEST_ASSERT(no_exception_thrown);
     }
 
+    // resume requests must survive the round trip as well
+    NearResumeRequest resume_down{NearUserMessage::msg_id_t{0xBEEF}, sender};
+
+    std::vector<byte_traits::byte_t> resume_bytes(resume_down.size());
+    resume_down.fillSerialized(resume_bytes.begin());
+
+    TEST_ASSERT(resume_bytes[0] == NearResumeRequest::LAYER_ID);
+
+    try
+    {
+        NearResumeRequest resume_up{
+            SerializedData{{}, resume_bytes.begin(), resume_bytes.size()}
+        };
+
+        TEST_ASSERT(resume_up._last_msg_id == NearUserMessage::msg_id_t{0xBEEF});
+        TEST_ASSERT(resume_up._last_sender == sender);
+    }
+    catch(const std::exception& e)
+    {
+        std::cerr<<"Caught exception "<<e.what()<<'\n';
+        TEST_ASSERT(false && "Exception occured");
+    }
+
+    // a user message is not a resume request
+    bool threw_invalid_header = false;
+    try
+    {
+        NearResumeRequest{SerializedData{{}, bytes.begin(), bytes.size()}};
+    }
+    catch(const InvalidHeaderError&)
+    {
+        threw_invalid_header = true;
+    }
+    TEST_ASSERT(threw_invalid_header);
+
+    // greetings between servers
+    NodeHello hello_down{recipient};
+
+    std::vector<byte_traits::byte_t> hello_bytes(hello_down.size());
+    hello_down.fillSerialized(hello_bytes.begin());
+
+    TEST_ASSERT(hello_bytes[0] == NodeHello::LAYER_ID);
+    NodeHello hello_up{
+        SerializedData{{}, hello_bytes.begin(), hello_bytes.size()}
+    };
+    TEST_ASSERT(hello_up._node_id == recipient);
+
+    // a relayed message carries the user message unchanged
+    RelayedMessage relay_down{
+        sender,
+        RelayedMessage::relay_id_t{0x12345678},
+        SerializedData{{}, bytes.begin(), bytes.size()}
+    };
+
+    TEST_ASSERT(relay_down.size() == RelayedMessage::header_length + bytes.size());
+
+    auto relay_bytes = std::make_shared<byte_traits::byte_sequence>(
+        relay_down.size()
+    );
+    relay_down.fillSerialized(relay_bytes->begin());
+
+    try
+    {
+        RelayedMessage relay_up{
+            SerializedData{relay_bytes, relay_bytes->begin(), relay_bytes->size()}
+        };
+
+        TEST_ASSERT(relay_up._origin == sender);
+        TEST_ASSERT(relay_up._relay_id == RelayedMessage::relay_id_t{0x12345678});
+        TEST_ASSERT(relay_up._inner_layer.getOwnership() == relay_bytes);
+
+        NearUserMessage inner_up{relay_up._inner_layer};
+        TEST_ASSERT(inner_up._stringwrap._message_string == message_string);
+        TEST_ASSERT(inner_up._msg_id == NearUserMessage::msg_id_t{0xF0});
+    }
+    catch(const std::exception& e)
+    {
+        std::cerr<<"Caught exception "<<e.what()<<'\n';
+        TEST_ASSERT(false && "Exception occured");
+    }
+
+    // a greeting is too short to be a relayed message
+    bool threw_undersized = false;
+    try
+    {
+        RelayedMessage{
+            SerializedData{{}, hello_bytes.begin(), hello_bytes.size()}
+        };
+    }
+    catch(const UndersizedPacketError&)
+    {
+        threw_undersized = true;
+    }
+    TEST_ASSERT(threw_undersized);
+
     return CONCLUDE_TEST();
 }
@@ -69,6 +69,13 @@ int main()
 
         std::cout<<"Data received: "<<hexprint(serdat_up.begin(),
                 serdat_up.begin() + serdat_up.size())<<std::endl;
+
+        // a copy has its own buffer with the same content
+        SerializedData serdat_copy{serdat_up};
+        TEST_ASSERT(serdat_copy.size() == serdat_up.size());
+        TEST_ASSERT(serdat_copy.begin() != serdat_up.begin());
+        TEST_ASSERT(std::equal(serdat_copy.begin(),
+            serdat_copy.begin() + serdat_copy.size(), serdat_up.begin()));
     }
     catch(const InvalidHeaderError&)
     {
@@ -0,0 +1,218 @@
+// test_shmtransport.cpp
+
+/*
+ *   nuke-ms - Nuclear Messaging System
+ *   Copyright (C) 2012  Alexander Korsunsky
+ *
+ *   This program is free software: you can redistribute it and/or modify
+ *   it under the terms of the GNU General Public License as published by
+ *   the Free Software Foundation, either version 3 of the License.
+ *
+ *   This program is distributed in the hope that it will be useful,
+ *   but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *   MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ *   GNU General Public License for more details.
+ *
+ *   You should have received a copy of the GNU General Public License
+ *   along with this program.  If not, see <http://www.gnu.org/licenses/>.
+*/
+
+#include <iostream>
+#include <vector>
+
+#include <boost/asio/read.hpp>
+#include <boost/asio/write.hpp>
+#include <boost/asio/local/connect_pair.hpp>
+
+#include "shmtransport.hpp"
+
+#include "testutils.hpp"
+
+DECLARE_TEST("class ShmTransport")
+
+using namespace nuke_ms;
+
+
+/** Bytes that differ from position to position */
+static std::vector<unsigned char> pattern(std::size_t size, unsigned seed)
+{
+    std::vector<unsigned char> v(size);
+    for (std::size_t i = 0; i < size; ++i)
+        v[i] = static_cast<unsigned char>((i * 7 + seed) ^ (i >> 9));
+    return v;
+}
+
+/** Run handlers until a condition is met. An open ShmTransport always
+* waits for the other side, so io_service::run() would never return. */
+template <typename Condition>
+static void runUntil(boost::asio::io_service& io_service, Condition done)
+{
+    io_service.reset();
+    while (!done() && io_service.run_one())
+    {}
+}
+
+int main()
+{
+    boost::asio::io_service io_service;
+
+    boost::asio::local::stream_protocol::socket s1{io_service}, s2{io_service};
+    boost::asio::local::connect_pair(s1, s2);
+
+    boost::system::error_code error;
+    std::unique_ptr<TransportImpl> server_impl =
+        ShmTransport::createServerSide(std::move(s1), error);
+    TEST_ASSERT(server_impl && !error);
+
+    // the server has sent everything, so the client does not have to wait
+    std::unique_ptr<TransportImpl> client_impl =
+        ShmTransport::createClientSide(std::move(s2), error);
+    TEST_ASSERT(client_impl && !error);
+
+    Transport server{io_service, std::move(server_impl)};
+    Transport client{io_service, std::move(client_impl)};
+    TEST_ASSERT(server.isOpen() && client.isOpen());
+
+    // many overlapping writes, together larger than a ring, in both
+    // directions. They must arrive in order and without interleaving. Like
+    // packets, each write is smaller than what boost::asio::async_write()
+    // passes to a single async_write_some().
+    const std::size_t chunk = 60000;
+    const int writes = 3 * ShmTransport::ring_size / chunk;
+
+    std::vector<std::vector<unsigned char>> to_server, to_client;
+    for (int i = 0; i < writes; ++i)
+    {
+        to_server.push_back(pattern(chunk, i));
+        to_client.push_back(pattern(chunk, i + 100));
+    }
+
+    int written = 0;
+    for (int i = 0; i < writes; ++i)
+    {
+        auto count = [&](const boost::system::error_code& e, std::size_t n)
+        {
+            TEST_ASSERT(!e && n == chunk);
+            ++written;
+        };
+
+        boost::asio::async_write(client, boost::asio::buffer(to_server[i]), count);
+        boost::asio::async_write(server, boost::asio::buffer(to_client[i]), count);
+    }
+
+    std::vector<unsigned char> server_in(chunk * writes), client_in(chunk * writes);
+    std::size_t server_read = 0, client_read = 0;
+    int reads_done = 0;
+
+    boost::asio::async_read(server, boost::asio::buffer(server_in),
+        [&](const boost::system::error_code& e, std::size_t n)
+        {
+            TEST_ASSERT(!e);
+            server_read = n;
+            ++reads_done;
+        }
+    );
+    boost::asio::async_read(client, boost::asio::buffer(client_in),
+        [&](const boost::system::error_code& e, std::size_t n)
+        {
+            TEST_ASSERT(!e);
+            client_read = n;
+            ++reads_done;
+        }
+    );
+
+    runUntil(io_service,
+        [&]() { return written == 2 * writes && reads_done == 2; });
+
+    TEST_ASSERT(written == 2 * writes);
+    TEST_ASSERT(server_read == server_in.size());
+    TEST_ASSERT(client_read == client_in.size());
+
+    bool intact = true;
+    for (int i = 0; i < writes; ++i)
+    {
+        intact = intact &&
+            std::equal(to_server[i].begin(), to_server[i].end(),
+                server_in.begin() + i * chunk) &&
+            std::equal(to_client[i].begin(), to_client[i].end(),
+                client_in.begin() + i * chunk);
+    }
+    TEST_ASSERT(intact);
+
+    // bytes written before closing are still delivered, then the stream ends
+    const std::vector<unsigned char> last = pattern(100, 42);
+    bool last_written = false;
+    boost::asio::async_write(client, boost::asio::buffer(last),
+        [&](const boost::system::error_code& e, std::size_t)
+        {
+            TEST_ASSERT(!e);
+            last_written = true;
+        }
+    );
+
+    runUntil(io_service, [&]() { return last_written; });
+
+    client.close(error);
+    TEST_ASSERT(!client.isOpen());
+
+    std::vector<unsigned char> rest(200);
+    std::size_t rest_read = 0;
+    boost::system::error_code rest_error;
+    bool rest_done = false;
+    boost::asio::async_read(server, boost::asio::buffer(rest),
+        [&](const boost::system::error_code& e, std::size_t n)
+        {
+            rest_error = e;
+            rest_read = n;
+            rest_done = true;
+        }
+    );
+
+    runUntil(io_service, [&]() { return rest_done; });
+
+    TEST_ASSERT(rest_error == boost::asio::error::eof);
+    TEST_ASSERT(rest_read == last.size());
+    TEST_ASSERT(std::equal(last.begin(), last.end(), rest.begin()));
+
+    // writing to a closed connection fails
+    boost::system::error_code write_error;
+    bool write_done = false;
+    boost::asio::async_write(server, boost::asio::buffer(last),
+        [&](const boost::system::error_code& e, std::size_t)
+        {
+            write_error = e;
+            write_done = true;
+        }
+    );
+
+    runUntil(io_service, [&]() { return write_done; });
+
+    TEST_ASSERT(write_error == boost::asio::error::broken_pipe);
+
+    // closing aborts a pending read
+    boost::asio::local::stream_protocol::socket s3{io_service}, s4{io_service};
+    boost::asio::local::connect_pair(s3, s4);
+
+    Transport a{io_service, ShmTransport::createServerSide(std::move(s3), error)};
+    Transport b{io_service, ShmTransport::createClientSide(std::move(s4), error)};
+
+    boost::system::error_code read_error;
+    bool read_done = false;
+    boost::asio::async_read(a, boost::asio::buffer(rest),
+        [&](const boost::system::error_code& e, std::size_t)
+        {
+            read_error = e;
+            read_done = true;
+        }
+    );
+
+    io_service.poll();
+    TEST_ASSERT(!read_done);
+    a.close(error);
+
+    runUntil(io_service, [&]() { return read_done; });
+
+    TEST_ASSERT(read_error == boost::asio::error::operation_aborted);
+
+    return CONCLUDE_TEST();
+}
@@ -0,0 +1,185 @@
+// test_tracing.cpp
+
+/*
+ *   nuke-ms - Nuclear Messaging System
+ *   Copyright (C) 2012  Alexander Korsunsky
+ *
+ *   This program is free software: you can redistribute it and/or modify
+ *   it under the terms of the GNU General Public License as published by
+ *   the Free Software Foundation, version 3 of the License.
+ *
+ *   This program is distributed in the hope that it will be useful,
+ *   but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *   MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ *   GNU General Public License for more details.
+ *
+ *   You should have received a copy of the GNU General Public License
+ *   along with this program.  If not, see <http://www.gnu.org/licenses/>.
+*/
+
+#include <cmath>
+#include <cstdio>
+#include <cstdlib>
+#include <fstream>
+#include <regex>
+#include <sstream>
+#include <string>
+#include <vector>
+
+#include "tracing.hpp"
+
+#include "testutils.hpp"
+
+DECLARE_TEST("class TraceRecorder")
+
+using namespace nuke_ms;
+
+typedef TraceRecorder::clock_type clock_type;
+
+
+/** A span as read back from the trace file */
+struct ReadSpan
+{
+    std::string name;
+    double ts;
+    double dur;
+    long long tid;
+    unsigned long long msg;
+};
+
+/** Read the whole trace file */
+static std::string readFile(const std::string& filename)
+{
+    std::ifstream in{filename.c_str()};
+    std::ostringstream contents;
+    contents<<in.rdbuf();
+    return contents.str();
+}
+
+/** Parse the spans of a trace, one per line.
+* @return false if a line is not a span in the expected format
+*/
+static bool parseSpans(const std::string& trace, std::vector<ReadSpan>& spans)
+{
+    static const std::regex span_format{
+        "\\{\"name\":\"(\\w+)\",\"cat\":\"msg\",\"ph\":\"X\","
+        "\"ts\":(\\d+\\.\\d{3}),\"dur\":(\\d+\\.\\d{3}),"
+        "\"pid\":1,\"tid\":(-?\\d+),\"args\":\\{\"msg\":(\\d+)\\}\\},?"
+    };
+
+    spans.clear();
+    std::istringstream in{trace};
+    for (std::string line; std::getline(in, line);)
+    {
+        if (line == "[" || line == "]" || line.empty())
+            continue;
+
+        std::smatch match;
+        if (!std::regex_match(line, match, span_format))
+            return false;
+
+        spans.push_back(ReadSpan{
+            match[1], std::atof(match[2].str().c_str()),
+            std::atof(match[3].str().c_str()),
+            std::atoll(match[4].str().c_str()),
+            std::strtoull(match[5].str().c_str(), nullptr, 10)
+        });
+    }
+
+    return true;
+}
+
+
+int main()
+{
+    // without a file nothing is recorded, but there are still message ids
+    {
+        TraceRecorder disabled;
+        TEST_ASSERT(!disabled.enabled());
+        TEST_ASSERT(disabled.nextMessageId() == 1);
+        TEST_ASSERT(disabled.nextMessageId() == 2);
+
+        clock_type::time_point now = clock_type::now();
+        disabled.span("ignored", 1, now, now, 1);
+        disabled.flush();
+    }
+
+    const std::string filename = "test_tracing.json";
+    std::vector<ReadSpan> spans;
+
+    {
+        TraceRecorder recorder{filename};
+        TEST_ASSERT(recorder.enabled());
+
+        TEST_ASSERT(recorder.currentMessage() == 0);
+        std::uint64_t first = recorder.nextMessageId();
+        std::uint64_t second = recorder.nextMessageId();
+        TEST_ASSERT(first == 1);
+        TEST_ASSERT(second == 2);
+
+        recorder.setCurrentMessage(second);
+        TEST_ASSERT(recorder.currentMessage() == second);
+
+        clock_type::time_point start = clock_type::now();
+        recorder.span("decode_header", 3, start,
+            start + std::chrono::microseconds{1500}, first);
+        recorder.span("write", -1, start + std::chrono::milliseconds{2},
+            start + std::chrono::milliseconds{2}, second);
+
+        // spans are buffered until flushed
+        TEST_ASSERT(parseSpans(readFile(filename), spans));
+        TEST_ASSERT(spans.empty());
+
+        // The file is a JSON array of complete events, one per line. It
+        // can be loaded before the closing bracket is written.
+        recorder.flush();
+        std::string trace = readFile(filename);
+        TEST_ASSERT(trace.compare(0, 2, "[\n") == 0);
+        TEST_ASSERT(trace.back() == '}');
+        TEST_ASSERT(parseSpans(trace, spans));
+        TEST_ASSERT(spans.size() == 2);
+
+        if (spans.size() == 2)
+        {
+            TEST_ASSERT(spans[0].name == "decode_header");
+            TEST_ASSERT(spans[0].dur == 1500.0);
+            TEST_ASSERT(spans[0].tid == 3);
+            TEST_ASSERT(spans[0].msg == first);
+
+            TEST_ASSERT(spans[1].name == "write");
+            TEST_ASSERT(spans[1].dur == 0.0);
+            TEST_ASSERT(spans[1].tid == -1);
+            TEST_ASSERT(spans[1].msg == second);
+
+            // time stamps are relative to the creation of the recorder
+            TEST_ASSERT(spans[0].ts < 1000000.0);
+            TEST_ASSERT(std::abs(spans[1].ts - spans[0].ts - 2000.0) < 0.01);
+        }
+
+        // a full buffer is written without being asked
+        for (int i = 0; i < TraceRecorder::buffer_size; ++i)
+            recorder.span("dispatch", i, start, start, i);
+
+        TEST_ASSERT(parseSpans(readFile(filename), spans));
+        TEST_ASSERT(spans.size() == 2 + TraceRecorder::buffer_size);
+
+        recorder.span("dispatch", 0, start, start, 0);
+    }
+
+    // the destructor writes the rest and closes the array
+    std::string trace = readFile(filename);
+    TEST_ASSERT(trace.size() >= 4 &&
+        trace.compare(trace.size() - 4, 4, "}\n]\n") == 0);
+    TEST_ASSERT(parseSpans(trace, spans));
+    TEST_ASSERT(spans.size() == 3 + TraceRecorder::buffer_size);
+
+    // the spans are in the order they were recorded
+    bool in_order = true;
+    for (int i = 0; i < TraceRecorder::buffer_size; ++i)
+        in_order = in_order && spans[2 + i].tid == i;
+    TEST_ASSERT(in_order);
+
+    std::remove(filename.c_str());
+
+    return CONCLUDE_TEST();
+}
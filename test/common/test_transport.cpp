@@ -0,0 +1,241 @@
+// test_transport.cpp
+
+/*
+ *   nuke-ms - Nuclear Messaging System
+ *   Copyright (C) 2012  Alexander Korsunsky
+ *
+ *   This program is free software: you can redistribute it and/or modify
+ *   it under the terms of the GNU General Public License as published by
+ *   the Free Software Foundation, either version 3 of the License.
+ *
+ *   This program is distributed in the hope that it will be useful,
+ *   but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *   MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ *   GNU General Public License for more details.
+ *
+ *   You should have received a copy of the GNU General Public License
+ *   along with this program.  If not, see <http://www.gnu.org/licenses/>.
+*/
+
+#include <iostream>
+#include <string>
+
+#include <boost/asio/read.hpp>
+#include <boost/asio/write.hpp>
+#include <boost/asio/post.hpp>
+#include <boost/asio/local/connect_pair.hpp>
+#include <boost/asio/local/stream_protocol.hpp>
+
+#include "transport.hpp"
+#include "handleralloc.hpp"
+
+#include "testutils.hpp"
+
+DECLARE_TEST("class Transport")
+
+using namespace nuke_ms;
+
+
+/** Transport implementation that answers every read with the same text */
+class RepeatingTransport : public TransportImpl
+{
+    boost::asio::io_service& io_service;
+    std::string text;
+    bool open;
+
+public:
+    RepeatingTransport(boost::asio::io_service& _io_service, std::string _text)
+        : io_service(_io_service), text{std::move(_text)}, open{true}
+    {}
+
+    void asyncReadSome(const boost::asio::mutable_buffer& buffer, TransportOp* op)
+    {
+        std::size_t n = boost::asio::buffer_copy(
+            buffer, boost::asio::buffer(text)
+        );
+
+        boost::asio::post(io_service, std::bind(
+            TransportCompletion{op}, boost::system::error_code{}, n
+        ));
+    }
+
+    void asyncWriteSome(const boost::asio::const_buffer& buffer, TransportOp* op)
+    {
+        boost::asio::post(io_service, std::bind(
+            TransportCompletion{op}, boost::system::error_code{}, buffer.size()
+        ));
+    }
+
+    void shutdown(boost::system::error_code&) {}
+
+    void close(boost::system::error_code&)
+    { open = false; }
+
+    bool isOpen() const
+    { return open; }
+};
+
+
+int main()
+{
+    boost::asio::io_service io_service;
+
+    // without a connection, operations fail
+    {
+        Transport transport{io_service};
+        TEST_ASSERT(!transport.isOpen());
+
+        char buffer[4];
+        boost::system::error_code read_error;
+        bool called = false;
+
+        transport.async_read_some(boost::asio::buffer(buffer),
+            [&](const boost::system::error_code& error, std::size_t)
+            {
+                read_error = error;
+                called = true;
+            }
+        );
+
+        // never called from within the initiating function
+        TEST_ASSERT(!called);
+
+        io_service.run();
+        io_service.reset();
+
+        TEST_ASSERT(called);
+        TEST_ASSERT(read_error == boost::asio::error::bad_descriptor);
+    }
+
+    // a stream socket pair, used with the composed operations
+    {
+        boost::asio::local::stream_protocol::socket s1{io_service}, s2{io_service};
+        boost::asio::local::connect_pair(s1, s2);
+
+        Transport t1{std::move(s1)};
+        Transport t2{std::move(s2)};
+        TEST_ASSERT(t1.isOpen() && t2.isOpen());
+
+        const std::string out = "Hello through a transport";
+        std::string in(out.size(), '\0');
+        std::size_t written = 0, read = 0;
+
+        auto memory = std::make_shared<HandlerMemory>();
+
+        boost::asio::async_write(t1, boost::asio::buffer(out),
+            [&](const boost::system::error_code& error, std::size_t n)
+            {
+                TEST_ASSERT(!error);
+                written = n;
+            }
+        );
+
+        boost::asio::async_read(t2, boost::asio::buffer(&in[0], in.size()),
+            makeAllocHandler(memory,
+                [&](const boost::system::error_code& error, std::size_t n)
+                {
+                    TEST_ASSERT(!error);
+                    read = n;
+
+                    // the memory is given back before the handler runs
+                    TEST_ASSERT(!memory->inUse());
+                }
+            )
+        );
+
+        io_service.run();
+        io_service.reset();
+
+        TEST_ASSERT(written == out.size());
+        TEST_ASSERT(read == out.size());
+        TEST_ASSERT(in == out);
+
+        // closing aborts pending operations
+        boost::system::error_code read_error;
+        boost::asio::async_read(t2, boost::asio::buffer(&in[0], in.size()),
+            [&](const boost::system::error_code& error, std::size_t)
+            {
+                read_error = error;
+            }
+        );
+
+        boost::system::error_code close_error;
+        t2.close(close_error);
+        TEST_ASSERT(!t2.isOpen());
+
+        io_service.run();
+        io_service.reset();
+
+        TEST_ASSERT(read_error == boost::asio::error::operation_aborted);
+    }
+
+    // releasing a socket aborts the read, but keeps the socket open
+    {
+        boost::asio::local::stream_protocol::socket s1{io_service}, s2{io_service};
+        boost::asio::local::connect_pair(s1, s2);
+
+        Transport t1{std::move(s1)};
+
+        boost::system::error_code read_error;
+        std::string in(4, '\0');
+        boost::asio::async_read(t1, boost::asio::buffer(&in[0], in.size()),
+            [&](const boost::system::error_code& error, std::size_t)
+            {
+                read_error = error;
+            }
+        );
+
+        boost::system::error_code release_error;
+        boost::asio::local::stream_protocol::socket released(io_service,
+            boost::asio::local::stream_protocol(),
+            t1.release(release_error));
+        TEST_ASSERT(!release_error && !t1.isOpen());
+
+        io_service.run();
+        io_service.reset();
+
+        TEST_ASSERT(read_error == boost::asio::error::operation_aborted);
+
+        boost::asio::write(s2, boost::asio::buffer("ping", 4));
+        boost::asio::read(released, boost::asio::buffer(&in[0], in.size()));
+        TEST_ASSERT(in == "ping");
+    }
+
+    // other implementations can not be released
+    {
+        Transport transport{
+            io_service,
+            std::unique_ptr<TransportImpl>{
+                new RepeatingTransport{io_service, "abc"}
+            }
+        };
+
+        boost::system::error_code release_error;
+        transport.release(release_error);
+        TEST_ASSERT(release_error == boost::asio::error::operation_not_supported);
+        TEST_ASSERT(transport.isOpen());
+    }
+
+    // an own implementation
+    {
+        Transport transport{
+            io_service,
+            std::unique_ptr<TransportImpl>{
+                new RepeatingTransport{io_service, "abc"}
+            }
+        };
+
+        std::string in(7, '\0');
+        boost::asio::async_read(transport, boost::asio::buffer(&in[0], in.size()),
+            [](const boost::system::error_code& error, std::size_t)
+            { TEST_ASSERT(!error); }
+        );
+
+        io_service.run();
+        io_service.reset();
+
+        TEST_ASSERT(in == "abcabca");
+    }
+
+    return CONCLUDE_TEST();
+}
@@ -0,0 +1,160 @@
+// test_datagrampeers.cpp
+
+/*
+ *   nuke-ms - Nuclear Messaging System
+ *   Copyright (C) 2012  Alexander Korsunsky
+ *
+ *   This program is free software: you can redistribute it and/or modify
+ *   it under the terms of the GNU General Public License as published by
+ *   the Free Software Foundation, version 3 of the License.
+ *
+ *   This program is distributed in the hope that it will be useful,
+ *   but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *   MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ *   GNU General Public License for more details.
+ *
+ *   You should have received a copy of the GNU General Public License
+ *   along with this program.  If not, see <http://www.gnu.org/licenses/>.
+*/
+
+#include <algorithm>
+#include <chrono>
+#include <memory>
+#include <sstream>
+#include <thread>
+#include <vector>
+
+#include "datagrampeers.hpp"
+
+#include "testutils.hpp"
+
+DECLARE_TEST("class DatagramPeers")
+
+using namespace nuke_ms;
+using namespace nuke_ms::server;
+using boost::asio::ip::udp;
+
+typedef std::shared_ptr<SegmentationLayer<SerializedData>> message_ptr;
+
+
+/** A packet with a payload of a certain size */
+static byte_traits::byte_sequence makePacket(
+    std::size_t size,
+    byte_traits::byte_t first,
+    byte_traits::byte_t fill = 'x'
+)
+{
+    auto data = std::make_shared<byte_traits::byte_sequence>(size, fill);
+    (*data)[0] = first;
+
+    SegmentationLayer<SerializedData> msg{
+        SerializedData{data, data->begin(), data->size()}
+    };
+
+    byte_traits::byte_sequence packet(msg.size());
+    msg.fillSerialized(packet.begin());
+    return packet;
+}
+
+/** Send a datagram and let the server handle it */
+static void sendTo(
+    boost::asio::io_service& io_service,
+    udp::socket& client,
+    const byte_traits::byte_sequence& packet,
+    const udp::endpoint& server
+)
+{
+    client.send_to(boost::asio::buffer(packet), server);
+    io_service.run_one();
+}
+
+/** Receive a datagram, if one arrives soon */
+static byte_traits::byte_sequence receive(udp::socket& client)
+{
+    for (int i = 0; i < 100 && !client.available(); ++i)
+        std::this_thread::sleep_for(std::chrono::milliseconds{1});
+
+    byte_traits::byte_sequence datagram(client.available());
+    if (!datagram.empty())
+        client.receive(boost::asio::buffer(datagram));
+
+    return datagram;
+}
+
+
+int main()
+{
+    std::ostringstream logstream;
+    ServerLog log{logstream};
+
+    boost::asio::io_service io_service;
+    MetricsRegistry registry;
+    std::vector<message_ptr> received;
+
+    DatagramPeers peers{io_service, 0,
+        [&](message_ptr msg) { received.push_back(msg); }, log, registry};
+
+    udp::endpoint server{
+        boost::asio::ip::address_v4::loopback(), peers.localEndpoint().port()
+    };
+
+    udp::socket client{io_service, udp::endpoint{udp::v4(), 0}};
+    udp::socket other{io_service, udp::endpoint{udp::v4(), 0}};
+
+    Gauge& known = registry.gauge("datagram_peers");
+    Counter& unverified = registry.counter("datagrams_unverified");
+
+    const byte_traits::byte_sequence message = makePacket(20, 0x41);
+    auto payload = std::make_shared<byte_traits::byte_sequence>(10, 0x41);
+    const SegmentationLayer<SerializedData> outgoing{
+        SerializedData{payload, payload->begin(), payload->size()}
+    };
+
+    // packets of unknown clients are dropped and not answered
+    sendTo(io_service, client, message, server);
+    TEST_ASSERT(received.empty());
+    TEST_ASSERT(unverified.value() == 1);
+
+    peers.sendMessage(outgoing);
+    TEST_ASSERT(receive(client).empty());
+
+    // asking for a cookie does not make a client known
+    const byte_traits::byte_sequence cookie_request = makePacket(
+        1 + DatagramPeers::cookie_length, DatagramPeers::cookie_layer_id, 0
+    );
+    TEST_ASSERT(cookie_request.size() == DatagramPeers::cookie_packet_length);
+
+    sendTo(io_service, client, cookie_request, server);
+    TEST_ASSERT(known.value() == 0);
+
+    // the answer is a cookie packet of the same length
+    byte_traits::byte_sequence cookie = receive(client);
+    TEST_ASSERT(cookie.size() == cookie_request.size());
+    TEST_ASSERT(std::equal(cookie.begin(), cookie.begin() + 5,
+        cookie_request.begin()));
+    TEST_ASSERT(cookie != cookie_request);
+
+    // a made up cookie, or the cookie of another address, is refused
+    byte_traits::byte_sequence forged = cookie;
+    forged.back() ^= 1;
+    sendTo(io_service, client, forged, server);
+    sendTo(io_service, other, cookie, server);
+    TEST_ASSERT(known.value() == 0);
+    TEST_ASSERT(unverified.value() == 4);
+    TEST_ASSERT(receive(other).empty());
+
+    // sending the cookie back makes the client known
+    sendTo(io_service, client, cookie, server);
+    TEST_ASSERT(known.value() == 1);
+
+    sendTo(io_service, client, message, server);
+    TEST_ASSERT(received.size() == 1);
+    TEST_ASSERT(received[0]->size() == message.size());
+
+    // only the known client gets the packets
+    peers.sendMessage(outgoing);
+    TEST_ASSERT(receive(client).size() == 14);
+    TEST_ASSERT(receive(other).empty());
+
+    return CONCLUDE_TEST();
+}
@@ -0,0 +1,180 @@
+// test_fanoutbus.cpp
+
+/*
+ *   nuke-ms - Nuclear Messaging System
+ *   Copyright (C) 2012  Alexander Korsunsky
+ *
+ *   This program is free software: you can redistribute it and/or modify
+ *   it under the terms of the GNU General Public License as published by
+ *   the Free Software Foundation, version 3 of the License.
+ *
+ *   This program is distributed in the hope that it will be useful,
+ *   but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *   MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ *   GNU General Public License for more details.
+ *
+ *   You should have received a copy of the GNU General Public License
+ *   along with this program.  If not, see <http://www.gnu.org/licenses/>.
+*/
+
+#include <algorithm>
+#include <memory>
+#include <sstream>
+#include <vector>
+
+#include <boost/asio/read.hpp>
+#include <boost/asio/local/connect_pair.hpp>
+#include <boost/asio/local/stream_protocol.hpp>
+
+#include "fanoutbus.hpp"
+
+#include "testutils.hpp"
+
+DECLARE_TEST("class TransportFanoutBus")
+
+using namespace nuke_ms;
+using namespace nuke_ms::server;
+
+typedef std::shared_ptr<SegmentationLayer<SerializedData>> message_ptr;
+
+/** A message of a certain size, every byte is the number of the message */
+static SegmentationLayer<SerializedData> makeMessage(
+    std::size_t size,
+    byte_traits::byte_t number
+)
+{
+    auto data = std::make_shared<byte_traits::byte_sequence>(size, number);
+    return SegmentationLayer<SerializedData>{
+        SerializedData{data, data->begin(), data->size()}
+    };
+}
+
+/** Check that a message was made by makeMessage */
+static bool checkMessage(
+    const message_ptr& msg,
+    std::size_t size,
+    byte_traits::byte_t number
+)
+{
+    const SerializedData& data = msg->_inner_layer;
+
+    return data.size() == size && std::all_of(data.begin(), data.begin() + size,
+        [number](byte_traits::byte_t b) { return b == number; });
+}
+
+/** Connect two transports with a Unix domain socket pair */
+static void connectPair(
+    boost::asio::io_service& io_service,
+    std::vector<Transport>& first,
+    std::vector<Transport>& second
+)
+{
+    boost::asio::local::stream_protocol::socket s1{io_service}, s2{io_service};
+    boost::asio::local::connect_pair(s1, s2);
+
+    first.emplace_back(std::move(s1));
+    second.emplace_back(std::move(s2));
+}
+
+
+int main()
+{
+    std::ostringstream logstream;
+    ServerLog log{logstream};
+
+    // many large messages are not interleaved when the socket buffer is full
+    {
+        boost::asio::io_service io_service;
+        MetricsRegistry registry_a, registry_b;
+
+        std::vector<Transport> links_a, links_b;
+        connectPair(io_service, links_a, links_b);
+
+        TransportFanoutBus bus_a{std::move(links_a), log, registry_a};
+        TransportFanoutBus bus_b{std::move(links_b), log, registry_b};
+
+        const std::size_t num_messages = 64, message_size = 40000;
+        std::vector<message_ptr> received;
+
+        bus_a.start([](message_ptr) { TEST_ASSERT(false); });
+        bus_b.start([&](message_ptr msg)
+        {
+            received.push_back(msg);
+            if (received.size() == num_messages)
+                io_service.stop();
+        });
+
+        // all written before the io_service runs, far more than fits into
+        // the socket buffer
+        for (std::size_t i = 0; i < num_messages; ++i)
+            bus_a.publish(makeMessage(message_size, i));
+
+        io_service.run();
+
+        TEST_ASSERT(received.size() == num_messages);
+        for (std::size_t i = 0; i < received.size(); ++i)
+            TEST_ASSERT(checkMessage(received[i], message_size, i));
+
+        TEST_ASSERT(registry_a.counter("bus_messages_out").value() ==
+            num_messages);
+        TEST_ASSERT(registry_b.counter("bus_messages_in").value() ==
+            num_messages);
+        TEST_ASSERT(registry_a.gauge("bus_links").value() == 1);
+    }
+
+    // a message goes to every link, a failed link does not stop the others
+    {
+        boost::asio::io_service io_service;
+        MetricsRegistry registry_a, registry_b;
+
+        std::vector<Transport> links_a, links_b;
+        connectPair(io_service, links_a, links_b);
+
+        // the other worker is a plain socket
+        boost::asio::local::stream_protocol::socket s1{io_service}, worker_c{
+            io_service
+        };
+        boost::asio::local::connect_pair(s1, worker_c);
+        links_a.emplace_back(std::move(s1));
+
+        TransportFanoutBus bus_a{std::move(links_a), log, registry_a};
+        TransportFanoutBus bus_b{std::move(links_b), log, registry_b};
+
+        TEST_ASSERT(registry_a.gauge("bus_links").value() == 2);
+
+        std::vector<message_ptr> received;
+
+        bus_a.start([](message_ptr) { TEST_ASSERT(false); });
+        bus_b.start([&](message_ptr msg)
+        {
+            received.push_back(msg);
+            io_service.stop();
+        });
+
+        bus_a.publish(makeMessage(10, 1));
+
+        io_service.run();
+        io_service.reset();
+
+        TEST_ASSERT(received.size() == 1);
+        TEST_ASSERT(checkMessage(received[0], 10, 1));
+
+        byte_traits::byte_sequence packet(14);
+        boost::asio::read(worker_c, boost::asio::buffer(packet));
+        TEST_ASSERT(packet[0] == 0x80 && packet[1] == 14 && packet[4] == 1);
+
+        // the worker at the end of the second link is gone
+        worker_c.close();
+        while (registry_a.gauge("bus_links").value() != 1)
+            io_service.run_one();
+
+        bus_a.publish(makeMessage(20, 2));
+        io_service.run();
+
+        TEST_ASSERT(received.size() == 2);
+        TEST_ASSERT(checkMessage(received[1], 20, 2));
+        TEST_ASSERT(registry_a.counter("bus_messages_out").value() == 3);
+    }
+
+    return CONCLUDE_TEST();
+}
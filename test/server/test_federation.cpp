@@ -0,0 +1,189 @@
+// test_federation.cpp
+
+/*
+ *   nuke-ms - Nuclear Messaging System
+ *   Copyright (C) 2012  Alexander Korsunsky
+ *
+ *   This program is free software: you can redistribute it and/or modify
+ *   it under the terms of the GNU General Public License as published by
+ *   the Free Software Foundation, version 3 of the License.
+ *
+ *   This program is distributed in the hope that it will be useful,
+ *   but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *   MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ *   GNU General Public License for more details.
+ *
+ *   You should have received a copy of the GNU General Public License
+ *   along with this program.  If not, see <http://www.gnu.org/licenses/>.
+*/
+
+#include <chrono>
+#include <memory>
+#include <string>
+#include <thread>
+#include <vector>
+
+#include "dispatcher.hpp"
+
+#include "testutils.hpp"
+
+DECLARE_TEST("relaying in a federation with a loop")
+
+using namespace nuke_ms;
+using namespace nuke_ms::server;
+using boost::asio::ip::tcp;
+
+typedef std::vector<std::unique_ptr<DispatchingServer>> servers_type;
+
+
+/** Run the handlers of all servers until a condition holds, at most a few
+* seconds */
+template <typename Condition>
+static bool pumpUntil(servers_type& servers, Condition condition)
+{
+    auto deadline = std::chrono::steady_clock::now() + std::chrono::seconds{5};
+
+    while (!condition())
+    {
+        if (std::chrono::steady_clock::now() > deadline)
+            return false;
+
+        for (std::unique_ptr<DispatchingServer>& server : servers)
+            server->getIOService().poll();
+        std::this_thread::sleep_for(std::chrono::milliseconds{1});
+    }
+
+    return true;
+}
+
+/** Run the handlers of all servers for a while */
+static void pumpFor(servers_type& servers, std::chrono::milliseconds duration)
+{
+    auto start = std::chrono::steady_clock::now();
+    pumpUntil(servers, [&]()
+        { return std::chrono::steady_clock::now() - start > duration; });
+}
+
+/** Send a message to everybody */
+static void sendMessage(tcp::socket& socket, NearUserMessage::msg_id_t msg_id)
+{
+    SegmentationLayer<NearUserMessage> packet{NearUserMessage{
+        StringwrapLayer{std::to_string(msg_id)}, UniqueUserID{},
+        UniqueUserID{0x5e0de5ull}, msg_id
+    }};
+    byte_traits::byte_sequence data(packet.size());
+    packet.fillSerialized(data.begin());
+
+    boost::asio::write(socket, boost::asio::buffer(data));
+}
+
+/** Receive the next user message, 0 if none arrives */
+static NearUserMessage::msg_id_t receiveMessage(
+    servers_type& servers,
+    tcp::socket& socket
+)
+{
+    if (!pumpUntil(servers, [&]()
+        { return socket.available() >= SegmentationLayerBase::header_length; }))
+        return 0;
+
+    byte_traits::byte_t header[SegmentationLayerBase::header_length];
+    boost::asio::read(socket, boost::asio::buffer(header));
+
+    std::size_t body_size = SegmentationLayerBase::decodeHeader(header)
+        .packetsize - SegmentationLayerBase::header_length;
+
+    if (!pumpUntil(servers, [&]() { return socket.available() >= body_size; }))
+        return 0;
+
+    auto body = std::make_shared<byte_traits::byte_sequence>(body_size);
+    boost::asio::read(socket, boost::asio::buffer(*body));
+
+    return NearUserMessage{
+        SerializedData{body, body->begin(), body->size()}
+    }._msg_id;
+}
+
+/** Sum of a counter over all servers */
+static std::uint64_t total(servers_type& servers, const char* name)
+{
+    std::uint64_t sum = 0;
+    for (std::unique_ptr<DispatchingServer>& server : servers)
+        sum += server->getMetrics().counter(name).value();
+    return sum;
+}
+
+
+int main()
+{
+    const std::size_t count = 3;
+
+    // on ports chosen by the system
+    ServerSettings settings;
+    settings.port = 0;
+
+    servers_type servers;
+    std::vector<tcp::endpoint> endpoints;
+    for (std::size_t i = 0; i < count; ++i)
+    {
+        servers.emplace_back(new DispatchingServer{settings});
+        endpoints.emplace_back(
+            boost::asio::ip::address_v4::loopback(),
+            servers[i]->localEndpoint().port()
+        );
+    }
+
+    // every server links to the next one, the last one to the first: the
+    // messages go around in circles unless the servers drop the copies
+    for (std::size_t i = 0; i < count; ++i)
+    {
+        servers[i]->joinFederation(
+            UniqueUserID{i + 1ull},
+            std::vector<tcp::endpoint>{endpoints[(i + 1) % count]}
+        );
+    }
+
+    TEST_ASSERT(pumpUntil(servers, [&]()
+    {
+        for (std::unique_ptr<DispatchingServer>& server : servers)
+            if (server->getMetrics().gauge("node_links").value() != 2)
+                return false;
+        return true;
+    }));
+
+    // one client on every server; every server accepted a link before
+    boost::asio::io_service io_service;
+    std::vector<std::unique_ptr<tcp::socket>> clients;
+    for (std::size_t i = 0; i < count; ++i)
+    {
+        clients.emplace_back(new tcp::socket{io_service});
+        clients[i]->connect(endpoints[i]);
+
+        Counter& accepted =
+            servers[i]->getMetrics().counter("connections_accepted");
+        TEST_ASSERT(pumpUntil(servers, [&]() { return accepted.value() == 2; }));
+    }
+
+    // every client gets every message once, wherever it was sent
+    for (std::size_t sender = 0; sender < count; ++sender)
+    {
+        NearUserMessage::msg_id_t msg_id = sender + 1;
+        sendMessage(*clients[sender], msg_id);
+
+        for (std::unique_ptr<tcp::socket>& client : clients)
+            TEST_ASSERT(receiveMessage(servers, *client) == msg_id);
+    }
+
+    pumpFor(servers, std::chrono::milliseconds{200});
+
+    for (std::unique_ptr<tcp::socket>& client : clients)
+        TEST_ASSERT(client->available() == 0);
+
+    // Every message reached the two other servers once over each of their
+    // links. The second copy was dropped and not passed on again.
+    TEST_ASSERT(total(servers, "relayed_in") == count * 2);
+    TEST_ASSERT(total(servers, "relay_duplicates") == count * 2);
+
+    // the servers close their links and clients when they are destroyed
+    return CONCLUDE_TEST();
+}
@@ -0,0 +1,190 @@
+// test_handoff.cpp
+
+/*
+ *   nuke-ms - Nuclear Messaging System
+ *   Copyright (C) 2012  Alexander Korsunsky
+ *
+ *   This program is free software: you can redistribute it and/or modify
+ *   it under the terms of the GNU General Public License as published by
+ *   the Free Software Foundation, version 3 of the License.
+ *
+ *   This program is distributed in the hope that it will be useful,
+ *   but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *   MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ *   GNU General Public License for more details.
+ *
+ *   You should have received a copy of the GNU General Public License
+ *   along with this program.  If not, see <http://www.gnu.org/licenses/>.
+*/
+
+#include <string>
+#include <thread>
+#include <vector>
+
+#include <boost/system/system_error.hpp>
+
+#include <fcntl.h>
+#include <sys/socket.h>
+#include <unistd.h>
+
+#include "handoff.hpp"
+
+#include "testutils.hpp"
+
+DECLARE_TEST("socket handoff")
+
+using namespace nuke_ms;
+using namespace nuke_ms::server;
+
+
+/** Read exactly size bytes, or less if the socket is closed */
+static std::string readString(int socket, std::size_t size)
+{
+    std::string str(size, '\0');
+    std::size_t done = 0;
+
+    while (done < size)
+    {
+        ssize_t received = ::recv(socket, &str[done], size - done, 0);
+        if (received <= 0)
+            break;
+        done += received;
+    }
+
+    str.resize(done);
+    return str;
+}
+
+static byte_traits::byte_sequence toBytes(const std::string& str)
+{
+    return byte_traits::byte_sequence(str.begin(), str.end());
+}
+
+/** Write a string through one socket and read it at the other one */
+static bool connected(int first, int second)
+{
+    const std::string str = "ping";
+    return ::send(first, str.data(), str.size(), 0) == ssize_t(str.size()) &&
+        readString(second, str.size()) == str;
+}
+
+
+int main()
+{
+    // a server hands an acceptor and a connection to its successor
+    {
+        int link[2], acceptor[2], peer[2];
+        TEST_ASSERT(::socketpair(AF_UNIX, SOCK_STREAM, 0, link) == 0);
+        TEST_ASSERT(::socketpair(AF_UNIX, SOCK_STREAM, 0, acceptor) == 0);
+        TEST_ASSERT(::socketpair(AF_UNIX, SOCK_STREAM, 0, peer) == 0);
+
+        // more than fits into the socket buffer at once
+        const std::string outbound(100000, 'o');
+
+        std::vector<HandoffRecord> received;
+        std::thread successor{[&]() { received = receiveHandoff(link[1]); }};
+
+        byte_traits::byte_t hello[handoff_hello_length];
+        TEST_ASSERT(::recv(link[0], hello, sizeof(hello), MSG_WAITALL) ==
+            ssize_t(sizeof(hello)));
+        TEST_ASSERT(checkHandoffHello(hello));
+
+        const std::vector<HandoffRecord> records{
+            HandoffRecord{HandoffRecord::KIND_ACCEPTOR, acceptor[0], {}, {}},
+            HandoffRecord{HandoffRecord::KIND_PEER, peer[0],
+                toBytes("abc"), toBytes(outbound)}
+        };
+        sendHandoff(link[0], records);
+        successor.join();
+
+        // the record of kind KIND_END is not returned
+        TEST_ASSERT(received.size() == 2);
+        TEST_ASSERT(received[0].kind == HandoffRecord::KIND_ACCEPTOR);
+        TEST_ASSERT(received[0].inbound.empty());
+        TEST_ASSERT(received[0].outbound.empty());
+        TEST_ASSERT(received[1].kind == HandoffRecord::KIND_PEER);
+        TEST_ASSERT(received[1].inbound == toBytes("abc"));
+        TEST_ASSERT(received[1].outbound == toBytes(outbound));
+
+        // the successor got new descriptors for the same sockets
+        TEST_ASSERT(received[0].fd >= 0 && received[0].fd != acceptor[0]);
+        TEST_ASSERT(connected(received[0].fd, acceptor[1]));
+        TEST_ASSERT(connected(peer[1], received[1].fd));
+
+        // the sender still owns its descriptors
+        TEST_ASSERT(::fcntl(acceptor[0], F_GETFD) != -1);
+        TEST_ASSERT(connected(peer[0], peer[1]));
+
+        for (int fd : {link[0], link[1], acceptor[0], acceptor[1], peer[0],
+            peer[1], received[0].fd, received[1].fd})
+            ::close(fd);
+    }
+
+    // a server that does not understand the greeting closes the connection
+    {
+        byte_traits::byte_t hello[handoff_hello_length];
+        writebytes(hello, to_netbo(handoff_magic + 1));
+        hello[4] = handoff_version;
+        TEST_ASSERT(!checkHandoffHello(hello));
+
+        writebytes(hello, to_netbo(handoff_magic));
+        hello[4] = handoff_version + 1;
+        TEST_ASSERT(!checkHandoffHello(hello));
+
+        int link[2];
+        TEST_ASSERT(::socketpair(AF_UNIX, SOCK_STREAM, 0, link) == 0);
+
+        std::thread server{[&]()
+        {
+            readString(link[0], handoff_hello_length);
+            ::close(link[0]);
+        }};
+
+        bool failed = false;
+        try {
+            receiveHandoff(link[1]);
+        }
+        catch (const boost::system::system_error&)
+        {
+            failed = true;
+        }
+        server.join();
+        TEST_ASSERT(failed);
+
+        ::close(link[1]);
+    }
+
+    // a successor that goes away before the acknowledgement fails the
+    // handoff, the sockets stay open
+    {
+        int link[2], peer[2];
+        TEST_ASSERT(::socketpair(AF_UNIX, SOCK_STREAM, 0, link) == 0);
+        TEST_ASSERT(::socketpair(AF_UNIX, SOCK_STREAM, 0, peer) == 0);
+
+        // both heads, the one of the peer and the one of kind KIND_END
+        std::thread successor{[&]()
+        {
+            readString(link[1], 18);
+            ::close(link[1]);
+        }};
+
+        bool failed = false;
+        try {
+            sendHandoff(link[0], {
+                HandoffRecord{HandoffRecord::KIND_PEER, peer[0], {}, {}}
+            });
+        }
+        catch (const boost::system::system_error&)
+        {
+            failed = true;
+        }
+        successor.join();
+        TEST_ASSERT(failed);
+        TEST_ASSERT(connected(peer[0], peer[1]));
+
+        for (int fd : {link[0], peer[0], peer[1]})
+            ::close(fd);
+    }
+
+    return CONCLUDE_TEST();
+}
@@ -0,0 +1,172 @@
+// test_localsocket.cpp
+
+/*
+ *   nuke-ms - Nuclear Messaging System
+ *   Copyright (C) 2012  Alexander Korsunsky
+ *
+ *   This program is free software: you can redistribute it and/or modify
+ *   it under the terms of the GNU General Public License as published by
+ *   the Free Software Foundation, version 3 of the License.
+ *
+ *   This program is distributed in the hope that it will be useful,
+ *   but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *   MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ *   GNU General Public License for more details.
+ *
+ *   You should have received a copy of the GNU General Public License
+ *   along with this program.  If not, see <http://www.gnu.org/licenses/>.
+*/
+
+#include <chrono>
+#include <fstream>
+#include <string>
+#include <thread>
+#include <sys/stat.h>
+#include <unistd.h>
+
+#include "dispatcher.hpp"
+#include "clientnode/clientnode.hpp"
+
+#include "testutils.hpp"
+#include "signalrecorder.hpp"
+
+DECLARE_TEST("Unix domain sockets of the DispatchingServer")
+
+using namespace nuke_ms;
+using namespace nuke_ms::server;
+using namespace nuke_ms::clientnode;
+using boost::asio::local::stream_protocol;
+
+
+/** Run the handlers of the server until a condition holds, at most a few
+* seconds */
+template <typename Condition>
+static bool pumpUntil(DispatchingServer& server, Condition condition)
+{
+    auto deadline = std::chrono::steady_clock::now() + std::chrono::seconds{5};
+
+    while (!condition())
+    {
+        if (std::chrono::steady_clock::now() > deadline)
+            return false;
+
+        server.getIOService().poll();
+        std::this_thread::sleep_for(std::chrono::milliseconds{1});
+    }
+
+    return true;
+}
+
+/** Connect a ClientNode to the server and let it send a message.
+* @return true if the message came back from the server
+*/
+static bool roundTrip(DispatchingServer& server, const std::string& where)
+{
+    SignalRecorder<ConnectionStatusReport> status;
+    SignalRecorder<byte_traits::msg_string> messages;
+
+    ClientNode client;
+    client.connectConnectionStatusReport(
+        [&](std::shared_ptr<const ConnectionStatusReport> rprt)
+        { status.record(*rprt); }
+    );
+    client.connectRcvMessage(
+        [&](std::shared_ptr<NearUserMessage> msg)
+        { messages.record(msg->_stringwrap._message_string); }
+    );
+
+    client.connectTo({where});
+    if (!pumpUntil(server, [&]() { return status.size() > 0; }) ||
+        status[0].newstate != ConnectionStatusReport::CNST_CONNECTED)
+        return false;
+
+    client.sendUserMessage(byte_traits::msg_string{"Hello " + where});
+    if (!pumpUntil(server, [&]() { return messages.size() > 0; }))
+        return false;
+
+    return messages[0] == "Hello " + where;
+}
+
+/** Whether there is a Unix domain socket file at the path */
+static bool isSocket(const std::string& path)
+{
+    struct stat st;
+    return ::lstat(path.c_str(), &st) == 0 && S_ISSOCK(st.st_mode);
+}
+
+int main()
+{
+    const std::string path = "/tmp/nuke-ms-test-localsocket-" +
+        std::to_string(::getpid());
+    ::unlink(path.c_str());
+
+    // a socket file left behind by a server that was not shut down cleanly
+    {
+        boost::asio::io_service io_service;
+        stream_protocol::acceptor stale{io_service};
+        stale.open();
+        stale.bind(stream_protocol::endpoint{path});
+        stale.listen();
+    }
+    TEST_ASSERT(isSocket(path));
+
+    // on a port chosen by the system
+    ServerSettings settings;
+    settings.port = 0;
+    settings.local_path = path;
+
+    {
+        DispatchingServer server{settings};
+
+        // the stale file is replaced, and clients get through
+        TEST_ASSERT(roundTrip(server, "unix:" + path));
+
+        // a server that is still listening keeps its path
+        bool in_use = false;
+        try {
+            DispatchingServer second{settings};
+        }
+        catch (const boost::system::system_error& e)
+        {
+            in_use = e.code() == boost::asio::error::address_in_use;
+        }
+        TEST_ASSERT(in_use);
+
+        // and is not disturbed by the attempt
+        TEST_ASSERT(roundTrip(server, "unix:" + path));
+    }
+
+    // the socket file is removed on shutdown
+    TEST_ASSERT(!isSocket(path));
+
+    // anything that is not a socket is never deleted
+    std::ofstream{path} << "precious";
+    bool refused = false;
+    try {
+        DispatchingServer server{settings};
+    }
+    catch (const boost::system::system_error&)
+    {
+        refused = true;
+    }
+    TEST_ASSERT(refused);
+
+    std::string content;
+    std::ifstream{path} >> content;
+    TEST_ASSERT(content == "precious");
+    ::unlink(path.c_str());
+
+#ifdef NUKE_MS_SHM_TRANSPORT
+    // clients on the same host can also exchange messages over shared memory
+    settings.local_path.clear();
+    settings.shm_path = path;
+
+    {
+        DispatchingServer server{settings};
+        TEST_ASSERT(roundTrip(server, "shm:" + path));
+    }
+    TEST_ASSERT(!isSocket(path));
+#endif
+
+    return CONCLUDE_TEST();
+}
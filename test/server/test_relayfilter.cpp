@@ -0,0 +1,65 @@
+// test_relayfilter.cpp
+
+/*
+ *   nuke-ms - Nuclear Messaging System
+ *   Copyright (C) 2012  Alexander Korsunsky
+ *
+ *   This program is free software: you can redistribute it and/or modify
+ *   it under the terms of the GNU General Public License as published by
+ *   the Free Software Foundation, version 3 of the License.
+ *
+ *   This program is distributed in the hope that it will be useful,
+ *   but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *   MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ *   GNU General Public License for more details.
+ *
+ *   You should have received a copy of the GNU General Public License
+ *   along with this program.  If not, see <http://www.gnu.org/licenses/>.
+*/
+
+#include "relayfilter.hpp"
+
+#include "testutils.hpp"
+
+DECLARE_TEST("class RelayFilter")
+
+using namespace nuke_ms;
+using namespace nuke_ms::server;
+
+
+int main()
+{
+    const UniqueUserID alpha{0xa1ull};
+    const UniqueUserID beta{0xb2ull};
+
+    RelayFilter filter{3};
+
+    // the first copy is new, later ones are not
+    TEST_ASSERT(filter.insert(alpha, 1));
+    TEST_ASSERT(!filter.insert(alpha, 1));
+
+    // the same relay identifier from another origin is another message
+    TEST_ASSERT(filter.insert(beta, 1));
+    TEST_ASSERT(filter.insert(alpha, 2));
+    TEST_ASSERT(!filter.insert(beta, 1));
+    TEST_ASSERT(!filter.insert(alpha, 2));
+
+    // the filter is full, the oldest message is forgotten
+    TEST_ASSERT(filter.insert(alpha, 3));
+    TEST_ASSERT(filter.insert(alpha, 1));
+
+    // that pushed out (beta, 1), the others are still known
+    TEST_ASSERT(!filter.insert(alpha, 2));
+    TEST_ASSERT(!filter.insert(alpha, 3));
+    TEST_ASSERT(!filter.insert(alpha, 1));
+    TEST_ASSERT(filter.insert(beta, 1));
+
+    // seeing a message again does not make it newer, so (alpha, 3) is the
+    // oldest and forgotten next
+    TEST_ASSERT(filter.insert(beta, 2));
+    TEST_ASSERT(!filter.insert(alpha, 1));
+    TEST_ASSERT(!filter.insert(beta, 1));
+    TEST_ASSERT(filter.insert(alpha, 3));
+
+    return CONCLUDE_TEST();
+}
@@ -0,0 +1,180 @@
+// test_resume.cpp
+
+/*
+ *   nuke-ms - Nuclear Messaging System
+ *   Copyright (C) 2012  Alexander Korsunsky
+ *
+ *   This program is free software: you can redistribute it and/or modify
+ *   it under the terms of the GNU General Public License as published by
+ *   the Free Software Foundation, version 3 of the License.
+ *
+ *   This program is distributed in the hope that it will be useful,
+ *   but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *   MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ *   GNU General Public License for more details.
+ *
+ *   You should have received a copy of the GNU General Public License
+ *   along with this program.  If not, see <http://www.gnu.org/licenses/>.
+*/
+
+#include <chrono>
+#include <memory>
+#include <string>
+#include <thread>
+
+#include "dispatcher.hpp"
+
+#include "testutils.hpp"
+
+DECLARE_TEST("resuming the message stream")
+
+using namespace nuke_ms;
+using namespace nuke_ms::server;
+using boost::asio::ip::tcp;
+
+
+/** Run the handlers of the server until a condition holds, at most a few
+* seconds */
+template <typename Condition>
+static bool pumpUntil(DispatchingServer& server, Condition condition)
+{
+    auto deadline = std::chrono::steady_clock::now() + std::chrono::seconds{5};
+
+    while (!condition())
+    {
+        if (std::chrono::steady_clock::now() > deadline)
+            return false;
+
+        server.getIOService().poll();
+        std::this_thread::sleep_for(std::chrono::milliseconds{1});
+    }
+
+    return true;
+}
+
+/** Send a packet to the server */
+template <typename Message>
+static void sendPacket(tcp::socket& socket, Message msg)
+{
+    SegmentationLayer<Message> packet{std::move(msg)};
+    byte_traits::byte_sequence data(packet.size());
+    packet.fillSerialized(data.begin());
+
+    boost::asio::write(socket, boost::asio::buffer(data));
+}
+
+/** Send a user message with an identifier */
+static void sendMessage(
+    tcp::socket& socket,
+    NearUserMessage::msg_id_t msg_id,
+    const UniqueUserID& sender
+)
+{
+    sendPacket(socket, NearUserMessage{
+        StringwrapLayer{std::to_string(msg_id)}, UniqueUserID{}, sender, msg_id
+    });
+}
+
+/** Receive the next user message, 0 if none arrives */
+static NearUserMessage::msg_id_t receiveMessage(
+    DispatchingServer& server,
+    tcp::socket& socket
+)
+{
+    if (!pumpUntil(server, [&]()
+        { return socket.available() >= SegmentationLayerBase::header_length; }))
+        return 0;
+
+    byte_traits::byte_t header[SegmentationLayerBase::header_length];
+    boost::asio::read(socket, boost::asio::buffer(header));
+
+    std::size_t body_size = SegmentationLayerBase::decodeHeader(header)
+        .packetsize - SegmentationLayerBase::header_length;
+
+    if (!pumpUntil(server, [&]() { return socket.available() >= body_size; }))
+        return 0;
+
+    auto body = std::make_shared<byte_traits::byte_sequence>(body_size);
+    boost::asio::read(socket, boost::asio::buffer(*body));
+
+    return NearUserMessage{
+        SerializedData{body, body->begin(), body->size()}
+    }._msg_id;
+}
+
+
+int main()
+{
+    // on a port chosen by the system
+    ServerSettings settings;
+    settings.port = 0;
+
+    DispatchingServer server{settings};
+    Counter& accepted = server.getMetrics().counter("connections_accepted");
+    Counter& gaps = server.getMetrics().counter("resume_gaps");
+
+    tcp::endpoint endpoint{
+        boost::asio::ip::address_v4::loopback(), server.localEndpoint().port()
+    };
+
+    boost::asio::io_service io_service;
+    const UniqueUserID sender{0x5e0de5ull};
+
+    tcp::socket talker{io_service};
+    talker.connect(endpoint);
+    TEST_ASSERT(pumpUntil(server, [&]() { return accepted.value() == 1; }));
+
+    for (NearUserMessage::msg_id_t i = 1; i <= 5; ++i)
+    {
+        sendMessage(talker, i, sender);
+        TEST_ASSERT(receiveMessage(server, talker) == i);
+    }
+
+    // a client that lost its connection after message 3 comes back, and
+    // gets messages 6 and 7 as they are distributed
+    tcp::socket resumer{io_service};
+    resumer.connect(endpoint);
+    TEST_ASSERT(pumpUntil(server, [&]() { return accepted.value() == 2; }));
+
+    for (NearUserMessage::msg_id_t i = 6; i <= 7; ++i)
+    {
+        sendMessage(talker, i, sender);
+        TEST_ASSERT(receiveMessage(server, talker) == i);
+        TEST_ASSERT(receiveMessage(server, resumer) == i);
+    }
+
+    // only the messages it missed are sent again, 6 and 7 not twice
+    sendPacket(resumer, NearResumeRequest{3, sender});
+    TEST_ASSERT(receiveMessage(server, resumer) == 4);
+    TEST_ASSERT(receiveMessage(server, resumer) == 5);
+
+    sendMessage(talker, 8, sender);
+    TEST_ASSERT(receiveMessage(server, talker) == 8);
+    TEST_ASSERT(receiveMessage(server, resumer) == 8);
+
+    // the message was sent by somebody else, the history does not have it
+    tcp::socket lost{io_service};
+    lost.connect(endpoint);
+    TEST_ASSERT(pumpUntil(server, [&]() { return accepted.value() == 3; }));
+
+    sendPacket(lost, NearResumeRequest{3, UniqueUserID{0xa11ce5ull}});
+    TEST_ASSERT(pumpUntil(server, [&]() { return gaps.value() == 1; }));
+
+    sendMessage(talker, 9, sender);
+    TEST_ASSERT(receiveMessage(server, talker) == 9);
+    TEST_ASSERT(receiveMessage(server, resumer) == 9);
+    TEST_ASSERT(receiveMessage(server, lost) == 9);
+
+    // let the server delete the peers before it is destroyed
+    talker.close();
+    resumer.close();
+    lost.close();
+    auto closed = std::chrono::steady_clock::now();
+    pumpUntil(server, [&]()
+    {
+        return std::chrono::steady_clock::now() - closed >
+            std::chrono::milliseconds{200};
+    });
+
+    return CONCLUDE_TEST();
+}
@@ -0,0 +1,187 @@
+// test_serverlog.cpp
+
+/*
+ *   nuke-ms - Nuclear Messaging System
+ *   Copyright (C) 2012  Alexander Korsunsky
+ *
+ *   This program is free software: you can redistribute it and/or modify
+ *   it under the terms of the GNU General Public License as published by
+ *   the Free Software Foundation, version 3 of the License.
+ *
+ *   This program is distributed in the hope that it will be useful,
+ *   but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *   MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ *   GNU General Public License for more details.
+ *
+ *   You should have received a copy of the GNU General Public License
+ *   along with this program.  If not, see <http://www.gnu.org/licenses/>.
+*/
+
+#include <chrono>
+#include <cstdlib>
+#include <sstream>
+#include <string>
+#include <thread>
+#include <vector>
+
+#include "serverlog.hpp"
+
+#include "testutils.hpp"
+
+DECLARE_TEST("class ServerLog")
+
+using namespace nuke_ms::server;
+
+
+/** Split the lines of a stream */
+static std::vector<std::string> lines(const std::ostringstream& stream)
+{
+    std::vector<std::string> result;
+    std::istringstream in{stream.str()};
+    for (std::string line; std::getline(in, line);)
+        result.push_back(line);
+    return result;
+}
+
+/** The line without its timestamp, which is always the first field */
+static std::string withoutTimestamp(const std::string& line)
+{
+    if (line.compare(0, 6, "{\"ts\":") != 0)
+        return line;
+
+    return "{" + line.substr(line.find(',') + 1);
+}
+
+/** The message text of a record written with text, as it appears in the
+* output */
+static std::string loggedText(const std::string& text)
+{
+    std::ostringstream out;
+    {
+        ServerLog log{out};
+        log.write(ServerLog::LEVEL_INFO, "text", 0, text);
+    }
+
+    std::string line = lines(out).at(0);
+    std::size_t begin = line.find(",\"msg\":\"") + 8;
+    return line.substr(begin, line.size() - begin - 2);
+}
+
+/** Count the records of an event and the records dropped in total */
+static void countRecords(
+    const std::ostringstream& out,
+    const std::string& event,
+    std::size_t& written,
+    std::size_t& dropped
+)
+{
+    written = dropped = 0;
+    for (const std::string& line : lines(out))
+    {
+        if (line.find("\"event\":\"" + event + "\"") != std::string::npos)
+            ++written;
+        else if (line.find("\"event\":\"log_dropped\"") != std::string::npos)
+            dropped += std::strtoull(
+                line.c_str() + line.find("\"value\":") + 8, nullptr, 10);
+    }
+}
+
+
+int main()
+{
+    // one JSON object per record, optional fields only if given
+    {
+        std::ostringstream out;
+        {
+            ServerLog log{out};
+            log.write(ServerLog::LEVEL_DEBUG, "hidden", 1);
+            log.write(ServerLog::LEVEL_INFO, "started");
+            log.write(ServerLog::LEVEL_WARNING, "client_error", 3,
+                "End of file", 42);
+            log.write(ServerLog::LEVEL_ERROR, "negative", 0, "", -1);
+        }
+
+        std::vector<std::string> written = lines(out);
+        TEST_ASSERT(written.size() == 3);
+        TEST_ASSERT(withoutTimestamp(written.at(0)) ==
+            "{\"level\":\"info\",\"event\":\"started\"}");
+        TEST_ASSERT(withoutTimestamp(written.at(1)) ==
+            "{\"level\":\"warning\",\"event\":\"client_error\",\"conn\":3,"
+            "\"value\":42,\"msg\":\"End of file\"}");
+        TEST_ASSERT(withoutTimestamp(written.at(2)) ==
+            "{\"level\":\"error\",\"event\":\"negative\",\"value\":-1}");
+    }
+
+    // control characters, quotes and backslashes are escaped
+    TEST_ASSERT(loggedText("a\"b\\c\nd\re\tf") ==
+        "a\\\"b\\\\c\\nd\\re\\tf");
+    TEST_ASSERT(loggedText(std::string{"\x01\x1f\x7f", 3}) ==
+        "\\u0001\\u001f\x7f");
+    TEST_ASSERT(loggedText("gr\xc3\xbc\xc3\x9f") == "gr\xc3\xbc\xc3\x9f");
+
+    // long texts are truncated, but not within a UTF-8 sequence
+    const std::size_t max = ServerLog::max_text_length;
+    const std::string ascii(max, 'a');
+
+    TEST_ASSERT(loggedText(ascii + "b") == ascii);
+    TEST_ASSERT(loggedText(ascii.substr(1) + "\xc3\xbc") ==
+        ascii.substr(1));
+    TEST_ASSERT(loggedText(ascii.substr(2) + "\xc3\xbc") ==
+        ascii.substr(2) + "\xc3\xbc");
+    TEST_ASSERT(loggedText(ascii.substr(2) + "\xe2\x82\xac") ==
+        ascii.substr(2));
+    TEST_ASSERT(loggedText(ascii.substr(1) + "\xf0\x9f\x98\x80") ==
+        ascii.substr(1));
+    TEST_ASSERT(loggedText(ascii.substr(3) + "\xf0\x9f\x98\x80") ==
+        ascii.substr(3));
+
+    // Records below LEVEL_ERROR are limited to the rate, after a burst.
+    // The dropped ones are counted.
+    {
+        std::ostringstream out;
+        std::size_t written, dropped;
+        {
+            // one record every 100 ms, up to 5 ahead of that
+            ServerLog log{out, ServerLog::LEVEL_INFO, 10, 5};
+
+            for (int i = 0; i < 100; ++i)
+                log.write(ServerLog::LEVEL_WARNING, "burst");
+
+            for (int i = 0; i < 10; ++i)
+                log.write(ServerLog::LEVEL_ERROR, "failure");
+
+            // the rate allows more records later
+            std::this_thread::sleep_for(std::chrono::milliseconds{250});
+            log.write(ServerLog::LEVEL_INFO, "later");
+        }
+
+        countRecords(out, "burst", written, dropped);
+        TEST_ASSERT(written == 6);
+        TEST_ASSERT(dropped == 94);
+
+        countRecords(out, "failure", written, dropped);
+        TEST_ASSERT(written == 10);
+
+        countRecords(out, "later", written, dropped);
+        TEST_ASSERT(written == 1);
+    }
+
+    // if the ring is full, records are dropped instead of waiting
+    {
+        std::ostringstream out;
+        const std::size_t count = 4 * ServerLog::ring_size;
+        std::size_t written, dropped;
+        {
+            ServerLog log{out, ServerLog::LEVEL_INFO, 0};
+            for (std::size_t i = 0; i < count; ++i)
+                log.write(ServerLog::LEVEL_INFO, "flood", 0,
+                    "some text to slow the drain down");
+        }
+
+        countRecords(out, "flood", written, dropped);
+        TEST_ASSERT(written + dropped == count);
+        TEST_ASSERT(written >= ServerLog::ring_size);
+    }
+
+    return CONCLUDE_TEST();
+}
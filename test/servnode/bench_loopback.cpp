@@ -0,0 +1,166 @@
+// bench_loopback.cpp
+
+/*
+ *   nuke-ms - Nuclear Messaging System
+ *   Copyright (C) 2012  Alexander Korsunsky
+ *
+ *   This program is free software: you can redistribute it and/or modify
+ *   it under the terms of the GNU General Public License as published by
+ *   the Free Software Foundation, either version 3 of the License.
+ *
+ *   This program is distributed in the hope that it will be useful,
+ *   but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *   MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ *   GNU General Public License for more details.
+ *
+ *   You should have received a copy of the GNU General Public License
+ *   along with this program.  If not, see <http://www.gnu.org/licenses/>.
+*/
+
+/* Benchmark of the protocol and dispatch cost of ConnectedClient.
+ *
+ * A client sends batches of packets to a ConnectedClient that echoes them
+ * back. Both ends share one io_service and are connected by a
+ * LoopbackTransport, so no system calls are involved and the results do not
+ * depend on the network stack.
+ *
+ * For every packet size, the number of nanoseconds per echoed packet and the
+ * packets per second are written as CSV to the standard output. The optional
+ * argument is the minimum time in milliseconds each measurement runs
+ * (default 200).
+ *
+ * The program exits with a nonzero status if an echo does not give back the
+ * original data, so a short run doubles as a test.
+*/
+
+#include <chrono>
+#include <cstdlib>
+#include <iostream>
+#include <boost/asio.hpp>
+
+#include "neartypes.hpp"
+#include "loopback.hpp"
+#include "servnode/connected-client.hpp"
+
+using namespace nuke_ms;
+
+typedef std::chrono::steady_clock clock_type;
+
+/** Minimum duration of a measurement */
+static clock_type::duration min_time = std::chrono::milliseconds{200};
+
+/** Number of packets sent before waiting for the echo */
+static const int batch_size = 32;
+
+
+/** Run handlers until a condition is met. The ConnectedClient always has a
+* read pending, so io_service::run() would never return. */
+template <typename Condition>
+static void runUntil(boost::asio::io_service& io_service, Condition done)
+{
+    io_service.reset();
+    while (!done() && io_service.run_one())
+    {}
+}
+
+
+int main(int argc, char* argv[])
+{
+    if (argc > 1)
+        min_time = std::chrono::milliseconds{std::atol(argv[1])};
+
+    boost::asio::io_service io_service;
+
+    auto ends = LoopbackTransport::createPair(io_service, io_service);
+    Transport client{io_service, std::move(ends.first)};
+
+    // echo every packet back to the client
+    std::shared_ptr<servnode::ConnectedClient> connection;
+    connection = servnode::ConnectedClient::makeInstance(
+        0,
+        Transport{io_service, std::move(ends.second)},
+        [&connection](
+            servnode::connection_id_t,
+            const std::shared_ptr<SerializedData>& data
+        )
+        {
+            connection->sendPacket(
+                SegmentationLayer<SerializedData>{std::move(*data)}
+            );
+        },
+        [](servnode::connection_id_t) {}
+    );
+
+    bool echo_failed = false;
+
+    std::cout<<"benchmark,size,packets,ns_per_packet,packets_per_s\n";
+
+    const std::size_t sizes[] = {16, 256, 4096};
+
+    for (std::size_t size : sizes)
+    {
+        SegmentationLayer<NearUserMessage> packet{NearUserMessage{
+            StringwrapLayer{std::string(size, 'x')},
+            UniqueUserID{}, UniqueUserID{1ull}
+        }};
+
+        // a batch of packets, sent with a single write
+        byte_traits::byte_sequence out(packet.size() * batch_size);
+        for (int i = 0; i < batch_size; ++i)
+            packet.fillSerialized(out.begin() + i * packet.size());
+        byte_traits::byte_sequence in(out.size());
+
+        auto echo = [&]() -> bool
+        {
+            bool written = false, read = false;
+            boost::system::error_code write_error, read_error;
+
+            boost::asio::async_write(client, boost::asio::buffer(out),
+                [&](const boost::system::error_code& e, std::size_t)
+                {
+                    write_error = e;
+                    written = true;
+                }
+            );
+            boost::asio::async_read(client, boost::asio::buffer(in),
+                [&](const boost::system::error_code& e, std::size_t)
+                {
+                    read_error = e;
+                    read = true;
+                }
+            );
+
+            runUntil(io_service, [&]() { return written && read; });
+
+            return !write_error && !read_error && in == out;
+        };
+
+        if (!echo())
+        {
+            std::cerr<<"Echo failed for size "<<size<<'\n';
+            echo_failed = true;
+            continue;
+        }
+
+        unsigned long batches = 0;
+        clock_type::time_point start = clock_type::now();
+        clock_type::duration elapsed;
+        do
+        {
+            echo_failed = !echo() || echo_failed;
+            ++batches;
+            elapsed = clock_type::now() - start;
+        } while (elapsed < min_time);
+
+        unsigned long packets = batches * batch_size;
+        double ns = std::chrono::duration<double, std::nano>(elapsed).count()
+            / packets;
+
+        std::cout<<"connected_client_echo,"<<size<<','<<packets<<','<<ns<<','
+            <<(ns > 0 ? 1e9 / ns : 0.0)<<'\n';
+    }
+
+    connection->shutdown();
+
+    return echo_failed ? 1 : 0;
+}
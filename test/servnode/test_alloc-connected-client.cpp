@@ -0,0 +1,117 @@
+// test_alloc-connected-client.cpp
+
+/*
+ *   nuke-ms - Nuclear Messaging System
+ *   Copyright (C) 2012  Alexander Korsunsky
+ *
+ *   This program is free software: you can redistribute it and/or modify
+ *   it under the terms of the GNU General Public License as published by
+ *   the Free Software Foundation, either version 3 of the License.
+ *
+ *   This program is distributed in the hope that it will be useful,
+ *   but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *   MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ *   GNU General Public License for more details.
+ *
+ *   You should have received a copy of the GNU General Public License
+ *   along with this program.  If not, see <http://www.gnu.org/licenses/>.
+*/
+
+#include <iostream>
+#include <boost/asio.hpp>
+#include <boost/thread.hpp>
+
+#include "neartypes.hpp"
+#include "servnode/connected-client.hpp"
+
+#include "alloccount.hpp"
+#include "testutils.hpp"
+
+
+using namespace nuke_ms;
+using namespace boost::asio::ip;
+
+DECLARE_TEST("allocations of ConnectedClient")
+
+
+// Allowed allocations for receiving a packet and sending it back. Lower this
+// when an allocation is removed.
+static const double max_allocs_roundtrip = 5.0;
+
+static const int warmup_iterations = 100;
+static const int iterations = 2000;
+
+
+int main()
+{
+    boost::asio::io_service io_service;
+    // a port chosen by the system, so tests can run in parallel
+    tcp::acceptor acceptor{io_service,
+        tcp::endpoint{address_v4::loopback(), 0}};
+
+    tcp::socket client_socket{io_service};
+    client_socket.connect(acceptor.local_endpoint());
+    client_socket.set_option(tcp::no_delay{true});
+
+    tcp::socket server_socket{io_service};
+    acceptor.accept(server_socket);
+    server_socket.set_option(tcp::no_delay{true});
+
+    // echo every packet back to the client
+    std::shared_ptr<servnode::ConnectedClient> connection;
+    connection = servnode::ConnectedClient::makeInstance(
+        0,
+        std::move(server_socket),
+        [&connection](
+            servnode::connection_id_t,
+            const std::shared_ptr<SerializedData>& data
+        )
+        {
+            connection->sendPacket(
+                SegmentationLayer<SerializedData>{std::move(*data)}
+            );
+        },
+        [](servnode::connection_id_t) {}
+    );
+
+    boost::thread server_thread{[&io_service]() { io_service.run(); }};
+
+    // the client only uses buffers allocated up front
+    SegmentationLayer<NearUserMessage> packet{NearUserMessage{
+        StringwrapLayer{std::string(100, 'x')}, UniqueUserID{}, UniqueUserID{1ull}
+    }};
+    byte_traits::byte_sequence out(packet.size());
+    packet.fillSerialized(out.begin());
+    byte_traits::byte_sequence in(out.size());
+
+    auto roundtrip = [&]() -> bool
+    {
+        boost::system::error_code error;
+        boost::asio::write(client_socket, boost::asio::buffer(out), error);
+        if (!error)
+            boost::asio::read(client_socket, boost::asio::buffer(in), error);
+
+        return !error && in == out;
+    };
+
+    bool ok = true;
+    for (int i = 0; i < warmup_iterations; ++i)
+        ok = ok && roundtrip();
+
+    AllocationCounter counter;
+    for (int i = 0; i < iterations; ++i)
+        ok = ok && roundtrip();
+
+    double allocs = counter.perOperation(iterations);
+
+    TEST_ASSERT(ok);
+
+    std::cout<<"receive and send: "<<allocs<<" allocations per packet\n";
+    TEST_ASSERT(allocs <= max_allocs_roundtrip);
+
+    connection->shutdown();
+    client_socket.close();
+    server_thread.join();
+
+    return CONCLUDE_TEST();
+}
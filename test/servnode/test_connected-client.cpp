@@ -19,16 +19,15 @@
 
 #include <iostream>
 #include <boost/asio.hpp>
-#include <boost/thread.hpp>
 
 #include "neartypes.hpp"
+#include "loopback.hpp"
 #include "servnode/connected-client.hpp"
 
 #include "testutils.hpp"
 
 
 using namespace nuke_ms;
-using namespace boost::asio::ip;
 
 DECLARE_TEST("class ConnectedClient")
 
@@ -37,7 +36,6 @@ static const char* OUTSTRING = "Wazzzuuppp???";
 static const char* INSTRING = "Wazzzuuppp!!!";
 
 static std::string data_out_received;
-static std::string data_in_received;
 
 class MockServer;
 
@@ -53,40 +51,20 @@ void disconnectCallback(
 );
 
 
+/** Server with a single client, connected through a LoopbackTransport.
+* Client and server share one io_service, so the test runs in one thread. */
 struct MockServer {
-    boost::asio::io_service io_service;
-
-    MockServer()
-    : acceptor_v4(io_service, tcp::endpoint{tcp::v4(), 34443})
-    { }
-
-    void run()
+    MockServer(Transport&& transport)
     {
-        tcp::socket socket{io_service};
-
-        // start accept, bind socket to the handler
-        boost::system::error_code accept_error;
-        acceptor_v4.accept(socket, accept_error);
-
-        if (!accept_error)
-        {
-            std::cout<<"server: Someone connected!\n";
-            this->client_container = servnode::ConnectedClient::makeInstance(
-                0,
-                std::move(socket),
-                std::bind(receiveCallback,
-                    std::placeholders::_1, std::placeholders::_2,
-                    std::ref(*this)
-                ),
-                disconnectCallback
-            );
-        }
-        else
-            std::cout<<"server: Accept failed with: "<<accept_error.message()<<'\n';
-
-        TEST_ASSERT(!accept_error);
-
-        io_service.run();
+        this->client_container = servnode::ConnectedClient::makeInstance(
+            0,
+            std::move(transport),
+            std::bind(receiveCallback,
+                std::placeholders::_1, std::placeholders::_2,
+                std::ref(*this)
+            ),
+            disconnectCallback
+        );
     }
 
     void shutdown()
@@ -101,7 +79,6 @@ struct MockServer {
     }
 
     std::shared_ptr<servnode::ConnectedClient> client_container;
-    tcp::acceptor acceptor_v4;
 };
 
 
@@ -129,8 +106,22 @@ void disconnectCallback(
 { std::cout<<"server: Client "<<client_id<<" disconnected.\n"; }
 
 
+/** Run handlers until a condition is met. The ConnectedClient always has a
+* read pending, so io_service::run() would never return. */
+template <typename Condition>
+static void runUntil(boost::asio::io_service& io_service, Condition done)
+{
+    io_service.reset();
+    while (!done() && io_service.run_one())
+    {}
+}
+
 
-void sendMessage(tcp::socket& sock, const std::string& data)
+void sendMessage(
+    boost::asio::io_service& io_service,
+    Transport& transport,
+    const std::string& data
+)
 {
     SegmentationLayer<NearUserMessage> msg{NearUserMessage(data)};
     auto seq = std::make_shared<byte_traits::byte_sequence>(msg.size());
@@ -139,55 +130,74 @@ void sendMessage(tcp::socket& sock, const std::string& data)
     std::cout<<"client: Sending Message...\n";
 
     boost::system::error_code send_error;
-    std::size_t bytes_transferred =
-        boost::asio::write(sock, boost::asio::buffer(*seq), send_error);
+    std::size_t bytes_transferred = 0;
+    bool done = false;
+
+    boost::asio::async_write(transport, boost::asio::buffer(*seq),
+        [&](const boost::system::error_code& error, std::size_t n)
+        {
+            send_error = error;
+            bytes_transferred = n;
+            done = true;
+        }
+    );
+
+    runUntil(io_service, [&]() { return done; });
 
     std::cout<<(!send_error ? "client: Message sent.\n" : "send failed\n");
     TEST_ASSERT(!send_error && bytes_transferred == seq->size());
 }
 
+/** Read exactly as many bytes as fit into the buffer */
+boost::system::error_code receive(
+    boost::asio::io_service& io_service,
+    Transport& transport,
+    const boost::asio::mutable_buffer& buffer
+)
+{
+    boost::system::error_code receive_error;
+    bool done = false;
+
+    boost::asio::async_read(transport, boost::asio::mutable_buffers_1{buffer},
+        [&](const boost::system::error_code& error, std::size_t)
+        {
+            receive_error = error;
+            done = true;
+        }
+    );
+
+    runUntil(io_service, [&]() { return done; });
+
+    return receive_error;
+}
+
 
 
 int main()
 {
+    boost::asio::io_service io_service;
+
+    auto ends = LoopbackTransport::createPair(io_service, io_service);
+
     // -------- SERVER CODE ---------
     std::cout<<"Initializing server\n";
 
-    MockServer server;
-
-    // Start server with ConnectedClient code
-    boost::thread server_thread{boost::bind(&MockServer::run, &server)};
+    MockServer server{Transport{io_service, std::move(ends.second)}};
 
 
     // -------- CLIENT CODE ---------
     std::cout<<"Initializing client\n";
 
-    boost::asio::io_service client_io_service;
-    tcp::socket con_socket{client_io_service};
-
-    // connect to the local socket
-    boost::system::error_code connect_error;
-    con_socket.connect(
-        tcp::endpoint{boost::asio::ip::address::from_string("127.0.0.1"),34443},
-        connect_error
-    );
-
-    TEST_ASSERT(!connect_error);
-    if (connect_error)
-        return 1;
-
-    std::cout<<"client: Connection succeeded.\n";
-    con_socket.set_option(boost::asio::socket_base::linger(true, 2000));
+    Transport client{io_service, std::move(ends.first)};
 
     // send message to the "server"
-    sendMessage(con_socket, OUTSTRING);
+    sendMessage(io_service, client, OUTSTRING);
 
     // read reply header
     byte_traits::byte_t headerbuf[SegmentationLayerBase::header_length];
-    boost::asio::read(
-        con_socket,
+    TEST_ASSERT(!receive(io_service, client,
         boost::asio::buffer(headerbuf, SegmentationLayerBase::header_length)
-    );
+    ));
 
 	byte_traits::uint2b_t packetsize;
 	readbytes(&packetsize, headerbuf+1);
@@ -201,7 +211,7 @@ int main()
     auto bodybuf = std::make_shared<byte_traits::byte_sequence>(
         packetsize-SegmentationLayerBase::header_length
     );
-    boost::asio::read(con_socket, boost::asio::buffer(*bodybuf));
+    TEST_ASSERT(!receive(io_service, client, boost::asio::buffer(*bodybuf)));
 
     StringwrapLayer in_data(
         SerializedData{bodybuf, bodybuf->begin(), bodybuf->size()}
@@ -209,13 +219,22 @@ int main()
 
     std::cout<<"Reply received: \""<<in_data._message_string<<"\".\n";
 
-    // shut down servers
-    server.shutdown();
-    server_thread.join();
+    // the server shut down the connection after the reply
+    byte_traits::byte_t rest;
+    TEST_ASSERT(receive(io_service, client, boost::asio::buffer(&rest, 1)) ==
+        boost::asio::error::eof);
 
     // verify data integrity
     TEST_ASSERT(in_data._message_string == INSTRING);
     TEST_ASSERT(data_out_received == OUTSTRING);
 
+    // one packet each way, no write left over
+    const ConnectionMetrics& metrics = server.client_container->metrics();
+    TEST_ASSERT(metrics.messages_in == 1);
+    TEST_ASSERT(metrics.messages_out == 1);
+    TEST_ASSERT(metrics.bytes_out == packetsize);
+    TEST_ASSERT(metrics.pending_writes == 0);
+    TEST_ASSERT(metrics.dropped_frames == 0);
+
     return CONCLUDE_TEST();
 }
@@ -0,0 +1,88 @@
+// signalrecorder.hpp
+
+/*
+ *   nuke-ms - Nuclear Messaging System
+ *   Copyright (C) 2012  Alexander Korsunsky
+ *
+ *   This program is free software: you can redistribute it and/or modify
+ *   it under the terms of the GNU General Public License as published by
+ *   the Free Software Foundation, version 3 of the License.
+ *
+ *   This program is distributed in the hope that it will be useful,
+ *   but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *   MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ *   GNU General Public License for more details.
+ *
+ *   You should have received a copy of the GNU General Public License
+ *   along with this program.  If not, see <http://www.gnu.org/licenses/>.
+*/
+
+#ifndef SIGNALRECORDER_HPP
+#define SIGNALRECORDER_HPP
+
+#include <chrono>
+#include <condition_variable>
+#include <cstddef>
+#include <mutex>
+#include <vector>
+
+
+/** Records the values a signal passes on another thread, so a test can wait
+* for them.
+*
+* The values are returned as copies, so they can be looked at while the
+* signal is still issued.
+*
+* @tparam T Type of the recorded values
+*/
+template <typename T>
+class SignalRecorder
+{
+    mutable std::mutex mutex; /**< Protects values */
+    std::condition_variable changed; /**< Notified for each new value */
+    std::vector<T> values; /**< The values, in the order they were recorded */
+
+public:
+
+    /** Append a value. To be called from the slot of the signal. */
+    void record(T value)
+    {
+        std::lock_guard<std::mutex> lock{mutex};
+        values.push_back(std::move(value));
+        changed.notify_all();
+    }
+
+    /** Number of values recorded so far */
+    std::size_t size() const
+    {
+        std::lock_guard<std::mutex> lock{mutex};
+        return values.size();
+    }
+
+    /** The value recorded as the i-th one */
+    T operator[](std::size_t i) const
+    {
+        std::lock_guard<std::mutex> lock{mutex};
+        return values.at(i);
+    }
+
+    /** The value recorded last */
+    T back() const
+    {
+        std::lock_guard<std::mutex> lock{mutex};
+        return values.back();
+    }
+
+    /** Wait until a number of values were recorded, at most a few seconds.
+    * @return true if there are at least count values
+    */
+    bool waitFor(std::size_t count)
+    {
+        std::unique_lock<std::mutex> lock{mutex};
+        return changed.wait_for(lock, std::chrono::seconds{5},
+            [&]() { return values.size() >= count; });
+    }
+};
+
+
+#endif // ifndef SIGNALRECORDER_HPP